@@ -3,6 +3,7 @@
 #include <string>
 #include <regex>
 #include <cmath>
+#include <cstring>
 
 #include "TextEditor.h"
 
@@ -23,21 +24,238 @@
 // TODO
 // - multiline comments vs single-line: latter is blocking start of a ML
 
-template<class InputIt1, class InputIt2, class BinaryPredicate>
-bool equals(InputIt1 first1, InputIt1 last1,
-	InputIt2 first2, InputIt2 last2, BinaryPredicate p)
+void TextEditor::LineBuffer::clear()
 {
-	for (; first1 != last1 && first2 != last2; ++first1, ++first2)
+	mChunks.clear();
+	mChunkStart.clear();
+	mSize = 0;
+	mLastChunk = 0;
+}
+
+size_t TextEditor::LineBuffer::FindChunk(size_t aIndex) const
+{
+	assert(aIndex < mSize);
+	mLastChunk = (size_t)(std::upper_bound(mChunkStart.begin(), mChunkStart.end(), aIndex) - mChunkStart.begin()) - 1;
+	return mLastChunk;
+}
+
+void TextEditor::LineBuffer::UpdateChunkStarts(size_t aFromChunk)
+{
+	mChunkStart.resize(mChunks.size());
+	size_t start = aFromChunk == 0 ? 0 : mChunkStart[aFromChunk - 1] + mChunks[aFromChunk - 1].size();
+	for (size_t i = aFromChunk; i < mChunks.size(); ++i)
 	{
-		if (!p(*first1, *first2))
-			return false;
+		mChunkStart[i] = start;
+		start += mChunks[i].size();
+	}
+}
+
+void TextEditor::LineBuffer::SplitChunk(size_t aChunk)
+{
+	auto& chunk = mChunks[aChunk];
+	std::vector<Line> tail;
+	tail.reserve(2 * kChunkSize);
+	tail.insert(tail.end(), std::make_move_iterator(chunk.begin() + kChunkSize), std::make_move_iterator(chunk.end()));
+	chunk.erase(chunk.begin() + kChunkSize, chunk.end());
+	mChunks.insert(mChunks.begin() + aChunk + 1, std::move(tail));
+	mChunkStart.insert(mChunkStart.begin() + aChunk + 1, mChunkStart[aChunk] + kChunkSize);
+}
+
+TextEditor::Line& TextEditor::LineBuffer::push_back(Line&& aLine)
+{
+	if (mChunks.empty() || mChunks.back().size() >= kChunkSize)
+	{
+		mChunks.emplace_back();
+		mChunks.back().reserve(2 * kChunkSize);
+		mChunkStart.push_back(mSize);
+	}
+
+	++mSize;
+	mChunks.back().push_back(std::move(aLine));
+	return mChunks.back().back();
+}
+
+TextEditor::Line& TextEditor::LineBuffer::insert(size_t aIndex, Line&& aLine)
+{
+	assert(aIndex <= mSize);
+
+	if (aIndex == mSize)
+		return push_back(std::move(aLine));
+
+	size_t offset;
+	auto chunk = Locate(aIndex, offset);
+	auto& lines = mChunks[chunk];
+	lines.insert(lines.begin() + offset, std::move(aLine));
+	++mSize;
+	for (size_t i = chunk + 1; i < mChunkStart.size(); ++i)
+		++mChunkStart[i];
+
+	if (lines.size() >= 2 * kChunkSize)
+	{
+		SplitChunk(chunk);
+		if (offset >= kChunkSize)
+		{
+			++chunk;
+			offset -= kChunkSize;
+		}
+	}
+
+	mLastChunk = chunk;
+	return mChunks[chunk][offset];
+}
+
+void TextEditor::LineBuffer::insert(size_t aIndex, std::vector<Line>&& aLines)
+{
+	assert(aIndex <= mSize);
+
+	if (aLines.empty())
+		return;
+
+	// The lines after aIndex in its chunk are moved out, to follow the new ones. The chunk is
+	// topped up to kChunkSize lines, and the rest go into new chunks of that size.
+	auto chunk = mChunks.empty() ? 0 : mChunks.size() - 1;
+	std::vector<Line> tail;
+	if (aIndex < mSize)
+	{
+		size_t offset;
+		chunk = Locate(aIndex, offset);
+		auto& lines = mChunks[chunk];
+		tail.assign(std::make_move_iterator(lines.begin() + offset), std::make_move_iterator(lines.end()));
+		lines.erase(lines.begin() + offset, lines.end());
+	}
+
+	auto count = aLines.size() + tail.size();
+	size_t next = 0;
+	auto take = [&]() -> Line&& { auto i = next++; return std::move(i < aLines.size() ? aLines[i] : tail[i - aLines.size()]); };
+
+	if (!mChunks.empty())
+	{
+		auto& lines = mChunks[chunk];
+		while (next < count && lines.size() < kChunkSize)
+			lines.push_back(take());
+	}
+
+	std::vector<std::vector<Line>> chunks;
+	while (next < count)
+	{
+		chunks.emplace_back();
+		auto& lines = chunks.back();
+		lines.reserve(2 * kChunkSize);
+		while (next < count && lines.size() < kChunkSize)
+			lines.push_back(take());
+	}
+	auto at = mChunks.empty() ? mChunks.begin() : mChunks.begin() + chunk + 1;
+	mChunks.insert(at, std::make_move_iterator(chunks.begin()), std::make_move_iterator(chunks.end()));
+
+	mSize += aLines.size();
+	UpdateChunkStarts(chunk);
+	mLastChunk = 0;
+}
+
+void TextEditor::LineBuffer::erase(size_t aFirst, size_t aLast)
+{
+	assert(aFirst <= aLast && aLast <= mSize);
+
+	if (aFirst == aLast)
+		return;
+
+	size_t firstOffset, lastOffset;
+	auto firstChunk = Locate(aFirst, firstOffset);
+	auto lastChunk = Locate(aLast - 1, lastOffset);
+
+	if (firstChunk == lastChunk)
+	{
+		auto& lines = mChunks[firstChunk];
+		lines.erase(lines.begin() + firstOffset, lines.begin() + lastOffset + 1);
+	}
+	else
+	{
+		auto& head = mChunks[firstChunk];
+		auto& tail = mChunks[lastChunk];
+		head.erase(head.begin() + firstOffset, head.end());
+		tail.erase(tail.begin(), tail.begin() + lastOffset + 1);
+		mChunks.erase(mChunks.begin() + firstChunk + 1, mChunks.begin() + lastChunk);
+	}
+	mSize -= aLast - aFirst;
+
+	// Drop emptied chunks and fold small neighbours together so the table stays compact
+	auto lastTouched = std::min(firstChunk + 1, mChunks.size() - 1);
+	for (auto i = lastTouched + 1; i-- > firstChunk;)
+	{
+		if (mChunks[i].empty())
+			mChunks.erase(mChunks.begin() + i);
+		else if (i + 1 < mChunks.size() && mChunks[i].size() + mChunks[i + 1].size() <= kChunkSize)
+		{
+			auto& next = mChunks[i + 1];
+			mChunks[i].insert(mChunks[i].end(), std::make_move_iterator(next.begin()), std::make_move_iterator(next.end()));
+			mChunks.erase(mChunks.begin() + i + 1);
+		}
+	}
+
+	UpdateChunkStarts(std::min(firstChunk, mChunks.size()));
+	mLastChunk = 0;
+}
+
+size_t TextEditor::LineBuffer::MemoryUsage() const
+{
+	auto result = sizeof(LineBuffer) + mChunks.capacity() * sizeof(mChunks[0]) + mChunkStart.capacity() * sizeof(size_t);
+	for (auto& chunk : mChunks)
+	{
+		result += (chunk.capacity() - chunk.size()) * sizeof(Line);
+		for (auto& line : chunk)
+			result += line.MemoryUsage();
 	}
-	return first1 == last1 && first2 == last2;
+	return result;
+}
+
+void TextEditor::Line::insert(size_t aIndex, const char* aText, size_t aLength)
+{
+	mText.insert(aIndex, aText, aLength);
+	mAttributes.insert(mAttributes.begin() + aIndex, aLength, (Attribute)PaletteIndex::Default);
+	mCacheId = 0;
+}
+
+void TextEditor::Line::append(const Line& aOther, size_t aFrom)
+{
+	mText.append(aOther.mText, aFrom, std::string::npos);
+	mAttributes.insert(mAttributes.end(), aOther.mAttributes.begin() + aFrom, aOther.mAttributes.end());
+	mCacheId = 0;
+}
+
+void TextEditor::Line::erase(size_t aFirst, size_t aLast)
+{
+	mText.erase(aFirst, aLast - aFirst);
+	mAttributes.erase(mAttributes.begin() + aFirst, mAttributes.begin() + aLast);
+	mCacheId = 0;
+}
+
+void TextEditor::Line::assign(const char* aText, size_t aLength)
+{
+	mText.assign(aText, aLength);
+	mAttributes.assign(aLength, (Attribute)PaletteIndex::Default);
+	mCacheId = 0;
+}
+
+static size_t StringHeapBytes(const std::string& aString)
+{
+	// Short strings live inside the string object itself (small string optimization)
+	auto text = aString.data();
+	auto object = (const char*)&aString;
+	return text >= object && text < object + sizeof(std::string) ? 0 : aString.capacity() + 1;
+}
+
+size_t TextEditor::Line::MemoryUsage() const
+{
+	return sizeof(Line) + StringHeapBytes(mText) + mAttributes.capacity() * sizeof(Attribute);
 }
 
 TextEditor::TextEditor()
 	: mLineSpacing(1.0f)
 	, mUndoIndex(0)
+	, mUndoMemoryUsage(0)
+	, mUndoMemoryBudget(32 * 1024 * 1024)
+	, mUndoMergeable(false)
+	, mUndoMergeTime(0)
 	, mTabSize(4)
 	, mOverwrite(false)
 	, mReadOnly(false)
@@ -52,8 +270,52 @@ TextEditor::TextEditor()
 	, mColorRangeMin(0)
 	, mColorRangeMax(0)
 	, mSelectionMode(SelectionMode::Normal)
+	, mPaletteAlpha(-1.0f)
+	, mEditGeneration(0)
+	, mColorizeInFlight(false)
+	, mColorizerQuit(false)
 	, mCheckComments(true)
+	, mCommentRangeMin(0)
+	, mCommentRangeMax(std::numeric_limits<int>::max())
+	, mFindRegex(false)
+	, mFindCaseSensitive(true)
+	, mFindQueryId(0)
+	, mFindRangeMin(std::numeric_limits<int>::max())
+	, mFindRangeMax(0)
+	, mFindShiftLine(0)
+	, mFindShift(0)
+	, mFindInFlight(false)
+	, mFindQuit(false)
+	, mSymbolRangeMin(std::numeric_limits<int>::max())
+	, mSymbolRangeMax(0)
+	, mSymbolShiftLine(0)
+	, mSymbolShift(0)
+	, mCompletionEnabled(true)
+	, mCompletionRequested(false)
+	, mCompletionOpen(false)
+	, mCompletionIndex(0)
+	, mCompletionTop(0)
+	, mShowMinimap(false)
+	, mMinimapFrameTop(0.0f)
+	, mMinimapFrameBottom(0.0f)
+	, mMinimapTrack(0.0f)
+	, mMinimapDragging(false)
+	, mMinimapGrab(0.0f)
+	, mWordWrap(false)
+	, mWrapColumns(80)
+	, mWrapRangeMin(std::numeric_limits<int>::max())
+	, mWrapRangeMax(0)
+	, mRowTreeStaleFrom(0)
+	, mRowTreeLines(0)
+	, mChangeRangeMin(std::numeric_limits<int>::max())
+	, mChangeRangeMax(0)
+	, mChangeLineCount(0)
+	, mBreakpointsChanged(false)
 	, mDebugCurrentLine(-1)
+	, mLastCacheId(0)
+	, mDrawRunsFrame(0)
+	, mDrawRunsFont(nullptr)
+	, mDrawRunsFontSize(0.0f)
 	, mLastClick(-1.0f)
 	, mHandleKeyboardInputs(true)
 	, mHandleMouseInputs(true)
@@ -64,26 +326,46 @@ TextEditor::TextEditor()
 	SetPalette(GetDarkPalette());
 	SetLanguageDefinition(LanguageDefinition::HLSL());
 	mLines.push_back(Line());
+	DiscardTextChange();
 }
 
 TextEditor::~TextEditor()
 {
+	StopColorizer();
+	StopFindThread();
 }
 
 void TextEditor::SetLanguageDefinition(const LanguageDefinition & aLanguageDef)
 {
+	AddLanguageCompletionWords(mLanguageDefinition, false);
+	AddLanguageCompletionWords(aLanguageDef, true);
+	CloseCompletion();
+
 	mLanguageDefinition = aLanguageDef;
-	mRegexList.clear();
 
-	for (auto& r : mLanguageDefinition.mTokenRegexStrings)
-		mRegexList.push_back(std::make_pair(std::regex(r.first, std::regex_constants::optimize), r.second));
+	// A job in flight keeps the previous context alive; its result is dropped by Colorize() below
+	auto context = std::make_shared<ColorizerContext>();
+	context->mLanguageDefinition = aLanguageDef;
+	for (auto& r : aLanguageDef.mTokenRegexStrings)
+		context->mRegexList.push_back(std::make_pair(std::regex(r.first, std::regex_constants::optimize), r.second));
+	mColorizerContext = std::move(context);
+
+	// The comment pass that sets these flags is skipped for such languages
+	if (aLanguageDef.mTokenizeLine != nullptr)
+	{
+		for (auto& line : mLines)
+			for (size_t i = 0; i < line.size(); ++i)
+				line.SetFlag(i, (AttributeFlags)(Attribute_Comment | Attribute_MultiLineComment | Attribute_Preprocessor), false);
+	}
 
 	Colorize();
+	ResetSymbols();
 }
 
 void TextEditor::SetPalette(const Palette & aValue)
 {
 	mPaletteBase = aValue;
+	mPaletteAlpha = -1.0f;
 }
 
 std::string TextEditor::GetText(const Coordinates & aStart, const Coordinates & aEnd) const
@@ -101,23 +383,17 @@ std::string TextEditor::GetText(const Coordinates & aStart, const Coordinates &
 
 	result.reserve(s + s / 8);
 
-	while (istart < iend || lstart < lend)
+	for (; lstart <= lend && lstart < (int)mLines.size(); ++lstart, istart = 0)
 	{
-		if (lstart >= (int)mLines.size())
-			break;
-
 		auto& line = mLines[lstart];
-		if (istart < (int)line.size())
+		auto from = std::min(istart, (int)line.size());
+		if (lstart < lend)
 		{
-			result += line[istart].mChar;
-			istart++;
-		}
-		else
-		{
-			istart = 0;
-			++lstart;
+			result.append(line.mText, from, std::string::npos);
 			result += '\n';
 		}
+		else
+			result.append(line.mText, from, std::max(0, iend - from));
 	}
 
 	return result;
@@ -217,7 +493,7 @@ void TextEditor::Advance(Coordinates & aCoordinates) const
 
 		if (cindex + 1 < (int)line.size())
 		{
-			auto delta = UTF8CharLength(line[cindex].mChar);
+			auto delta = UTF8CharLength(line[cindex]);
 			cindex = std::min(cindex + delta, (int)line.size() - 1);
 		}
 		else
@@ -247,78 +523,102 @@ void TextEditor::DeleteRange(const Coordinates & aStart, const Coordinates & aEn
 		auto& line = mLines[aStart.mLine];
 		auto n = GetLineMaxColumn(aStart.mLine);
 		if (aEnd.mColumn >= n)
-			line.erase(line.begin() + start, line.end());
+			line.erase(start, line.size());
 		else
-			line.erase(line.begin() + start, line.begin() + end);
+			line.erase(start, end);
 	}
 	else
 	{
 		auto& firstLine = mLines[aStart.mLine];
 		auto& lastLine = mLines[aEnd.mLine];
 
-		firstLine.erase(firstLine.begin() + start, firstLine.end());
-		lastLine.erase(lastLine.begin(), lastLine.begin() + end);
+		firstLine.erase(start, firstLine.size());
+		lastLine.erase(0, end);
 
 		if (aStart.mLine < aEnd.mLine)
-			firstLine.insert(firstLine.end(), lastLine.begin(), lastLine.end());
+			firstLine.append(lastLine);
 
 		if (aStart.mLine < aEnd.mLine)
+		{
+			JoinErrorMarker(aStart.mLine, aEnd.mLine);
 			RemoveLine(aStart.mLine + 1, aEnd.mLine + 1);
+		}
 	}
 
 	mTextChanged = true;
 }
 
+// Appends [aBegin, aEnd) to aText, without carriage returns
+static void AppendWithoutCR(std::string& aText, const char* aBegin, const char* aEnd)
+{
+	while (aBegin != aEnd)
+	{
+		auto cr = (const char*)memchr(aBegin, '\r', aEnd - aBegin);
+		aText.append(aBegin, cr != nullptr ? cr : aEnd);
+		aBegin = cr != nullptr ? cr + 1 : aEnd;
+	}
+}
+
 int TextEditor::InsertTextAt(Coordinates& /* inout */ aWhere, const char * aValue)
 {
 	assert(!mReadOnly);
+	assert(!mLines.empty());
+
+	if (*aValue == '\0')
+		return 0;
+
+	// The text is split at its line breaks up front. Its first line goes into the line at
+	// aWhere, and the others are built aside, the last one taking the rest of that line, then
+	// inserted all at once.
+	auto end = aValue + strlen(aValue);
+	auto lineEnd = [end](const char* aFrom) { auto found = (const char*)memchr(aFrom, '\n', end - aFrom); return found != nullptr ? found : end; };
+
+	auto cindex = GetCharacterIndex(aWhere);
+	std::string first;
+	auto firstEnd = lineEnd(aValue);
+	AppendWithoutCR(first, aValue, firstEnd);
 
-	int cindex = GetCharacterIndex(aWhere);
 	int totalLines = 0;
-	while (*aValue != '\0')
+	if (firstEnd == end)
 	{
-		assert(!mLines.empty());
-
-		if (*aValue == '\r')
-		{
-			// skip
-			++aValue;
-		}
-		else if (*aValue == '\n')
-		{
-			if (cindex < (int)mLines[aWhere.mLine].size())
-			{
-				auto& newLine = InsertLine(aWhere.mLine + 1);
-				auto& line = mLines[aWhere.mLine];
-				newLine.insert(newLine.begin(), line.begin() + cindex, line.end());
-				line.erase(line.begin() + cindex, line.end());
-			}
-			else
-			{
-				InsertLine(aWhere.mLine + 1);
-			}
-			++aWhere.mLine;
-			aWhere.mColumn = 0;
-			cindex = 0;
-			++totalLines;
-			++aValue;
-		}
-		else
+		mLines[aWhere.mLine].insert(cindex, first.data(), first.size());
+		cindex += (int)first.size();
+	}
+	else
+	{
+		std::vector<Line> lines;
+		lines.reserve(std::count(firstEnd, end, '\n'));
+		for (auto from = firstEnd + 1;;)
 		{
-			auto& line = mLines[aWhere.mLine];
-			auto d = UTF8CharLength(*aValue);
-			while (d-- > 0 && *aValue != '\0')
-				line.insert(line.begin() + cindex++, Glyph(*aValue++, PaletteIndex::Default));
-			++aWhere.mColumn;
+			auto to = lineEnd(from);
+			lines.emplace_back();
+			auto& newLine = lines.back();
+			AppendWithoutCR(newLine.mText, from, to);
+			newLine.mAttributes.assign(newLine.mText.size(), (Attribute)PaletteIndex::Default);
+			if (to == end)
+				break;
+			from = to + 1;
 		}
 
-		mTextChanged = true;
+		auto& line = mLines[aWhere.mLine];
+		auto& last = lines.back();
+		auto lastSize = (int)last.size();
+		last.append(line, cindex);
+		line.erase(cindex, line.size());
+		line.insert(cindex, first.data(), first.size());
+		cindex = lastSize;
+
+		totalLines = (int)lines.size();
+		InsertLines(aWhere.mLine + 1, std::move(lines));
+		aWhere.mLine += totalLines;
 	}
+	aWhere.mColumn = GetCharacterColumn(aWhere.mLine, cindex);
 
+	mTextChanged = true;
 	return totalLines;
 }
 
-void TextEditor::AddUndo(UndoRecord& aValue)
+void TextEditor::AddUndo(UndoRecord& aValue, bool aMergeable)
 {
 	assert(!mReadOnly);
 	//printf("AddUndo: (@%d.%d) +\'%s' [%d.%d .. %d.%d], -\'%s', [%d.%d .. %d.%d] (@%d.%d)\n",
@@ -328,9 +628,95 @@ void TextEditor::AddUndo(UndoRecord& aValue)
 	//	aValue.mAfter.mCursorPosition.mLine, aValue.mAfter.mCursorPosition.mColumn
 	//	);
 
-	mUndoBuffer.resize((size_t)(mUndoIndex + 1));
-	mUndoBuffer.back() = aValue;
-	++mUndoIndex;
+	auto now = (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	bool merged = aMergeable && mUndoMergeable && now - mUndoMergeTime < 1000 && MergeUndo(aValue);
+
+	if (!merged)
+	{
+		while ((int)mUndoBuffer.size() > mUndoIndex)
+		{
+			mUndoMemoryUsage -= mUndoBuffer.back().MemoryUsage();
+			mUndoBuffer.pop_back();
+		}
+
+		mUndoBuffer.push_back(std::move(aValue));
+		mUndoMemoryUsage += mUndoBuffer.back().MemoryUsage();
+		++mUndoIndex;
+	}
+
+	mUndoMergeable = aMergeable;
+	mUndoMergeTime = now;
+	TrimUndo();
+}
+
+static bool IsWordCharacter(char c)
+{
+	// Bytes of multibyte UTF-8 sequences count as word characters
+	return isalnum((unsigned char)c) || c == '_' || (unsigned char)c >= 0x80;
+}
+
+bool TextEditor::MergeUndo(const UndoRecord& aValue)
+{
+	if (mUndoIndex == 0 || mUndoIndex != (int)mUndoBuffer.size())
+		return false;
+
+	auto& last = mUndoBuffer.back();
+	if (last.mAfter.mCursorPosition != aValue.mBefore.mCursorPosition)
+		return false;
+
+	// A group ends at a line break or where a new word starts, so "foo bar" undoes as "bar" then "foo "
+	auto singleCharacter = [](const std::string& aText) {
+		return !aText.empty() && aText[0] != '\n' && UTF8CharLength(aText[0]) == (int)aText.size();
+	};
+
+	if (aValue.mRemoved.empty() && singleCharacter(aValue.mAdded))
+	{
+		// Typing
+		if (last.mAdded.empty() || last.mAdded.back() == '\n' || last.mAddedEnd != aValue.mAddedStart)
+			return false;
+		if (!IsWordCharacter(last.mAdded.back()) && IsWordCharacter(aValue.mAdded[0]))
+			return false;
+
+		mUndoMemoryUsage -= last.MemoryUsage();
+		last.mAdded += aValue.mAdded;
+		last.mAddedEnd = aValue.mAddedEnd;
+	}
+	else if (aValue.mAdded.empty() && singleCharacter(aValue.mRemoved))
+	{
+		// Backspace
+		if (!last.mAdded.empty() || last.mRemoved.empty() || last.mRemoved[0] == '\n' || last.mRemovedStart != aValue.mRemovedEnd)
+			return false;
+		if (!IsWordCharacter(aValue.mRemoved.back()) && IsWordCharacter(last.mRemoved[0]))
+			return false;
+
+		mUndoMemoryUsage -= last.MemoryUsage();
+		last.mRemoved.insert(0, aValue.mRemoved);
+		last.mRemovedStart = aValue.mRemovedStart;
+	}
+	else
+		return false;
+
+	last.mAfter = aValue.mAfter;
+	mUndoMemoryUsage += last.MemoryUsage();
+	return true;
+}
+
+void TextEditor::ClearUndo()
+{
+	mUndoBuffer.clear();
+	mUndoIndex = 0;
+	mUndoMemoryUsage = 0;
+	mUndoMergeable = false;
+}
+
+void TextEditor::TrimUndo()
+{
+	while (mUndoMemoryUsage > mUndoMemoryBudget && mUndoIndex > 1)
+	{
+		mUndoMemoryUsage -= mUndoBuffer.front().MemoryUsage();
+		mUndoBuffer.pop_front();
+		--mUndoIndex;
+	}
 }
 
 TextEditor::Coordinates TextEditor::ScreenPosToCoordinates(const ImVec2& aPosition) const
@@ -338,10 +724,25 @@ TextEditor::Coordinates TextEditor::ScreenPosToCoordinates(const ImVec2& aPositi
 	ImVec2 origin = ImGui::GetCursorScreenPos();
 	ImVec2 local(aPosition.x - origin.x, aPosition.y - origin.y);
 
-	int lineNo = std::max(0, (int)floor(local.y / mCharAdvance.y));
+	auto row = std::max(0, (int)floor(local.y / mCharAdvance.y));
+	int lineNo = RowToLine(row);
 
 	int columnCoord = 0;
 
+	// On a wrapped row, aPosition is as far along the line as the row starts, and stays
+	// within the row
+	auto rowColumn = 0;
+	auto nextRowColumn = std::numeric_limits<int>::max();
+	if (mWordWrap && lineNo < (int)mLines.size() && GetLineRows(lineNo) > 1)
+	{
+		auto& points = GetWrapPoints(lineNo);
+		auto index = std::max(0, std::min(row - LineToRow(lineNo), (int)points.size() - 1));
+		rowColumn = points[index].mColumn;
+		if (index + 1 < (int)points.size())
+			nextRowColumn = points[index + 1].mColumn;
+		local.x = std::max(local.x, mTextStart) + TextDistanceToLineStart(Coordinates(lineNo, rowColumn));
+	}
+
 	if (lineNo >= 0 && lineNo < (int)mLines.size())
 	{
 		auto& line = mLines.at(lineNo);
@@ -349,11 +750,27 @@ TextEditor::Coordinates TextEditor::ScreenPosToCoordinates(const ImVec2& aPositi
 		int columnIndex = 0;
 		float columnX = 0.0f;
 
+		if (line.size() >= kLongLine)
+		{
+			// Start at the draw run under aPosition instead of at the start of the line
+			float spaceSize = ImGui::GetFont()->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX, -1.0f, " ").x;
+			auto& runs = GetDrawRuns(line, spaceSize);
+			auto run = std::upper_bound(runs.begin(), runs.end(), local.x - mTextStart,
+				[](float aX, const DrawRun& aRun) { return aX < aRun.mX; });
+			if (run != runs.begin())
+			{
+				--run;
+				columnIndex = (int)run->mBegin;
+				columnX = run->mX;
+				columnCoord = GetCharacterColumn(lineNo, columnIndex);
+			}
+		}
+
 		while ((size_t)columnIndex < line.size())
 		{
 			float columnWidth = 0.0f;
 
-			if (line[columnIndex].mChar == '\t')
+			if (line[columnIndex] == '\t')
 			{
 				float spaceSize = ImGui::GetFont()->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX, -1.0f, " ").x;
 				float oldX = columnX;
@@ -368,10 +785,10 @@ TextEditor::Coordinates TextEditor::ScreenPosToCoordinates(const ImVec2& aPositi
 			else
 			{
 				char buf[7];
-				auto d = UTF8CharLength(line[columnIndex].mChar);
+				auto d = UTF8CharLength(line[columnIndex]);
 				int i = 0;
 				while (i < 6 && d-- > 0)
-					buf[i++] = line[columnIndex++].mChar;
+					buf[i++] = line[columnIndex++];
 				buf[i] = '\0';
 				columnWidth = ImGui::GetFont()->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX, -1.0f, buf).x;
 				if (mTextStart + columnX + columnWidth * 0.5f > local.x)
@@ -382,6 +799,7 @@ TextEditor::Coordinates TextEditor::ScreenPosToCoordinates(const ImVec2& aPositi
 		}
 	}
 
+	columnCoord = std::max(rowColumn, std::min(columnCoord, nextRowColumn - 1));
 	return SanitizeCoordinates(Coordinates(lineNo, columnCoord));
 }
 
@@ -397,13 +815,13 @@ TextEditor::Coordinates TextEditor::FindWordStart(const Coordinates & aFrom) con
 	if (cindex >= (int)line.size())
 		return at;
 
-	while (cindex > 0 && isspace(line[cindex].mChar))
+	while (cindex > 0 && isspace(line[cindex]))
 		--cindex;
 
-	auto cstart = (PaletteIndex)line[cindex].mColorIndex;
+	auto cstart = line.GetColor(cindex);
 	while (cindex > 0)
 	{
-		auto c = line[cindex].mChar;
+		auto c = line[cindex];
 		if ((c & 0xC0) != 0x80)	// not UTF code sequence 10xxxxxx
 		{
 			if (c <= 32 && isspace(c))
@@ -411,7 +829,7 @@ TextEditor::Coordinates TextEditor::FindWordStart(const Coordinates & aFrom) con
 				cindex++;
 				break;
 			}
-			if (cstart != (PaletteIndex)line[size_t(cindex - 1)].mColorIndex)
+			if (cstart != line.GetColor(size_t(cindex - 1)))
 				break;
 		}
 		--cindex;
@@ -431,19 +849,19 @@ TextEditor::Coordinates TextEditor::FindWordEnd(const Coordinates & aFrom) const
 	if (cindex >= (int)line.size())
 		return at;
 
-	bool prevspace = (bool)isspace(line[cindex].mChar);
-	auto cstart = (PaletteIndex)line[cindex].mColorIndex;
+	bool prevspace = (bool)isspace(line[cindex]);
+	auto cstart = line.GetColor(cindex);
 	while (cindex < (int)line.size())
 	{
-		auto c = line[cindex].mChar;
+		auto c = line[cindex];
 		auto d = UTF8CharLength(c);
-		if (cstart != (PaletteIndex)line[cindex].mColorIndex)
+		if (cstart != line.GetColor(cindex))
 			break;
 
 		if (prevspace != !!isspace(c))
 		{
 			if (isspace(c))
-				while (cindex < (int)line.size() && isspace(line[cindex].mChar))
+				while (cindex < (int)line.size() && isspace(line[cindex]))
 					++cindex;
 			break;
 		}
@@ -465,7 +883,7 @@ TextEditor::Coordinates TextEditor::FindNextWord(const Coordinates & aFrom) cons
 	if (cindex < (int)mLines[at.mLine].size())
 	{
 		auto& line = mLines[at.mLine];
-		isword = isalnum(line[cindex].mChar);
+		isword = isalnum(line[cindex]);
 		skip = isword;
 	}
 
@@ -480,7 +898,7 @@ TextEditor::Coordinates TextEditor::FindNextWord(const Coordinates & aFrom) cons
 		auto& line = mLines[at.mLine];
 		if (cindex < (int)line.size())
 		{
-			isword = isalnum(line[cindex].mChar);
+			isword = isalnum(line[cindex]);
 
 			if (isword && !skip)
 				return Coordinates(at.mLine, GetCharacterColumn(at.mLine, cindex));
@@ -509,13 +927,25 @@ int TextEditor::GetCharacterIndex(const Coordinates& aCoordinates) const
 	auto& line = mLines[aCoordinates.mLine];
 	int c = 0;
 	int i = 0;
+	if (auto index = GetColumnIndex(line))
+	{
+		auto& checkpoints = index->mCheckpoints;
+		auto it = std::upper_bound(checkpoints.begin(), checkpoints.end(), aCoordinates.mColumn,
+			[](int aColumn, const ColumnCheckpoint& aCheckpoint) { return aColumn < aCheckpoint.mColumn; });
+		if (it != checkpoints.begin())
+		{
+			--it;
+			i = it->mIndex;
+			c = it->mColumn;
+		}
+	}
 	for (; i < line.size() && c < aCoordinates.mColumn;)
 	{
-		if (line[i].mChar == '\t')
+		if (line[i] == '\t')
 			c = (c / mTabSize) * mTabSize + mTabSize;
 		else
 			++c;
-		i += UTF8CharLength(line[i].mChar);
+		i += UTF8CharLength(line[i]);
 	}
 	return i;
 }
@@ -527,9 +957,21 @@ int TextEditor::GetCharacterColumn(int aLine, int aIndex) const
 	auto& line = mLines[aLine];
 	int col = 0;
 	int i = 0;
+	if (auto index = GetColumnIndex(line))
+	{
+		auto& checkpoints = index->mCheckpoints;
+		auto it = std::upper_bound(checkpoints.begin(), checkpoints.end(), aIndex,
+			[](int aIndex, const ColumnCheckpoint& aCheckpoint) { return aIndex < aCheckpoint.mIndex; });
+		if (it != checkpoints.begin())
+		{
+			--it;
+			i = it->mIndex;
+			col = it->mColumn;
+		}
+	}
 	while (i < aIndex && i < (int)line.size())
 	{
-		auto c = line[i].mChar;
+		auto c = line[i];
 		i += UTF8CharLength(c);
 		if (c == '\t')
 			col = (col / mTabSize) * mTabSize + mTabSize;
@@ -546,7 +988,7 @@ int TextEditor::GetLineCharacterCount(int aLine) const
 	auto& line = mLines[aLine];
 	int c = 0;
 	for (unsigned i = 0; i < line.size(); c++)
-		i += UTF8CharLength(line[i].mChar);
+		i += UTF8CharLength(line[i]);
 	return c;
 }
 
@@ -555,10 +997,12 @@ int TextEditor::GetLineMaxColumn(int aLine) const
 	if (aLine >= mLines.size())
 		return 0;
 	auto& line = mLines[aLine];
+	if (auto index = GetColumnIndex(line))
+		return index->mMaxColumn;
 	int col = 0;
 	for (unsigned i = 0; i < line.size(); )
 	{
-		auto c = line[i].mChar;
+		auto c = line[i];
 		if (c == '\t')
 			col = (col / mTabSize) * mTabSize + mTabSize;
 		else
@@ -579,9 +1023,9 @@ bool TextEditor::IsOnWordBoundary(const Coordinates & aAt) const
 		return true;
 
 	if (mColorizerEnabled)
-		return line[cindex].mColorIndex != line[size_t(cindex - 1)].mColorIndex;
+		return line.GetColor(cindex) != line.GetColor(size_t(cindex - 1));
 
-	return isspace(line[cindex].mChar) != isspace(line[cindex - 1].mChar);
+	return isspace(line[cindex]) != isspace(line[cindex - 1]);
 }
 
 void TextEditor::RemoveLine(int aStart, int aEnd)
@@ -590,26 +1034,16 @@ void TextEditor::RemoveLine(int aStart, int aEnd)
 	assert(aEnd >= aStart);
 	assert(mLines.size() > (size_t)(aEnd - aStart));
 
-	ErrorMarkers etmp;
-	for (auto& i : mErrorMarkers)
-	{
-		ErrorMarkers::value_type e(i.first >= aStart ? i.first - 1 : i.first, i.second);
-		if (e.first >= aStart && e.first <= aEnd)
-			continue;
-		etmp.insert(e);
-	}
-	mErrorMarkers = std::move(etmp);
-
-	Breakpoints btmp;
-	for (auto i : mBreakpoints)
-	{
-		if (i >= aStart && i <= aEnd)
-			continue;
-		btmp.insert(i >= aStart ? i - 1 : i);
-	}
-	mBreakpoints = std::move(btmp);
+	ShiftErrorMarkers(aEnd, aStart - aEnd);
+	ShiftBreakpoints(aEnd, aStart - aEnd);
 
-	mLines.erase(mLines.begin() + aStart, mLines.begin() + aEnd);
+	mLines.erase(aStart, aEnd);
+	ShiftColorRanges(aStart, aStart - aEnd);
+	ShiftFindMatches(aStart, aStart - aEnd);
+	ShiftSymbols(aStart, aStart - aEnd);
+	ShiftFolds(aStart, aStart - aEnd);
+	ShiftWrap(aStart, aStart - aEnd);
+	ShiftTextChange(aStart, aStart - aEnd);
 	assert(!mLines.empty());
 
 	mTextChanged = true;
@@ -620,26 +1054,16 @@ void TextEditor::RemoveLine(int aIndex)
 	assert(!mReadOnly);
 	assert(mLines.size() > 1);
 
-	ErrorMarkers etmp;
-	for (auto& i : mErrorMarkers)
-	{
-		ErrorMarkers::value_type e(i.first > aIndex ? i.first - 1 : i.first, i.second);
-		if (e.first - 1 == aIndex)
-			continue;
-		etmp.insert(e);
-	}
-	mErrorMarkers = std::move(etmp);
-
-	Breakpoints btmp;
-	for (auto i : mBreakpoints)
-	{
-		if (i == aIndex)
-			continue;
-		btmp.insert(i >= aIndex ? i - 1 : i);
-	}
-	mBreakpoints = std::move(btmp);
+	ShiftErrorMarkers(aIndex + 1, -1);
+	ShiftBreakpoints(aIndex + 1, -1);
 
-	mLines.erase(mLines.begin() + aIndex);
+	mLines.erase(aIndex);
+	ShiftColorRanges(aIndex, -1);
+	ShiftFindMatches(aIndex, -1);
+	ShiftSymbols(aIndex, -1);
+	ShiftFolds(aIndex, -1);
+	ShiftWrap(aIndex, -1);
+	ShiftTextChange(aIndex, -1);
 	assert(!mLines.empty());
 
 	mTextChanged = true;
@@ -649,19 +1073,45 @@ TextEditor::Line& TextEditor::InsertLine(int aIndex)
 {
 	assert(!mReadOnly);
 
-	auto& result = *mLines.insert(mLines.begin() + aIndex, Line());
+	// the new line starts where the line it pushes down started, so it inherits its lexer state
+	Line line;
+	if (aIndex < (int)mLines.size())
+		line.mLexState = mLines[aIndex].mLexState;
+	auto& result = mLines.insert(aIndex, std::move(line));
+	ShiftColorRanges(aIndex, 1);
+	ShiftFindMatches(aIndex, 1);
+	ShiftSymbols(aIndex, 1);
+	ShiftFolds(aIndex, 1);
+	ShiftWrap(aIndex, 1);
+	ShiftTextChange(aIndex, 1);
+
+	ShiftErrorMarkers(aIndex, 1);
+	ShiftBreakpoints(aIndex, 1);
 
-	ErrorMarkers etmp;
-	for (auto& i : mErrorMarkers)
-		etmp.insert(ErrorMarkers::value_type(i.first >= aIndex ? i.first + 1 : i.first, i.second));
-	mErrorMarkers = std::move(etmp);
+	return result;
+}
 
-	Breakpoints btmp;
-	for (auto i : mBreakpoints)
-		btmp.insert(i >= aIndex ? i + 1 : i);
-	mBreakpoints = std::move(btmp);
+void TextEditor::InsertLines(int aIndex, std::vector<Line>&& aLines)
+{
+	assert(!mReadOnly);
 
-	return result;
+	// the new lines start where the line they push down started, so they inherit its lexer state
+	auto count = (int)aLines.size();
+	if (aIndex < (int)mLines.size())
+	{
+		for (auto& line : aLines)
+			line.mLexState = mLines[aIndex].mLexState;
+	}
+	mLines.insert(aIndex, std::move(aLines));
+	ShiftColorRanges(aIndex, count);
+	ShiftFindMatches(aIndex, count);
+	ShiftSymbols(aIndex, count);
+	ShiftFolds(aIndex, count);
+	ShiftWrap(aIndex, count);
+	ShiftTextChange(aIndex, count);
+
+	ShiftErrorMarkers(aIndex, count);
+	ShiftBreakpoints(aIndex, count);
 }
 
 std::string TextEditor::GetWordUnderCursor() const
@@ -681,21 +1131,21 @@ std::string TextEditor::GetWordAt(const Coordinates & aCoords) const
 	auto iend = GetCharacterIndex(end);
 
 	for (auto it = istart; it < iend; ++it)
-		r.push_back(mLines[aCoords.mLine][it].mChar);
+		r.push_back(mLines[aCoords.mLine][it]);
 
 	return r;
 }
 
-ImU32 TextEditor::GetGlyphColor(const Glyph & aGlyph) const
+ImU32 TextEditor::GetGlyphColor(Attribute aAttribute) const
 {
 	if (!mColorizerEnabled)
 		return mPalette[(int)PaletteIndex::Default];
-	if (aGlyph.mComment)
+	if (aAttribute & Attribute_Comment)
 		return mPalette[(int)PaletteIndex::Comment];
-	if (aGlyph.mMultiLineComment)
+	if (aAttribute & Attribute_MultiLineComment)
 		return mPalette[(int)PaletteIndex::MultiLineComment];
-	auto const color = mPalette[(int)aGlyph.mColorIndex];
-	if (aGlyph.mPreprocessor)
+	auto const color = mPalette[aAttribute & Attribute_ColorMask];
+	if (aAttribute & Attribute_Preprocessor)
 	{
 		const auto ppcolor = mPalette[(int)PaletteIndex::Preprocessor];
 		const int c0 = ((ppcolor & 0xff) + (color & 0xff)) / 2;
@@ -707,50 +1157,244 @@ ImU32 TextEditor::GetGlyphColor(const Glyph & aGlyph) const
 	return color;
 }
 
-void TextEditor::HandleKeyboardInputs()
+template<class TCache>
+static void PruneLineCache(TCache& aCache, int aFrame)
 {
-	ImGuiIO& io = ImGui::GetIO();
-	auto shift = io.KeyShift;
-	auto ctrl = io.ConfigMacOSXBehaviors ? io.KeySuper : io.KeyCtrl;
-	auto alt = io.ConfigMacOSXBehaviors ? io.KeyCtrl : io.KeyAlt;
+	for (auto it = aCache.begin(); it != aCache.end();)
+	{
+		if (it->second.mFrame != aFrame)
+			it = aCache.erase(it);
+		else
+			++it;
+	}
+}
 
-	if (ImGui::IsWindowFocused())
+// Attributes that GetGlyphColor maps to the same color map to the same value
+static TextEditor::Attribute DrawColor(TextEditor::Attribute aAttribute)
+{
+	if (aAttribute & TextEditor::Attribute_Comment)
+		return (TextEditor::Attribute)TextEditor::PaletteIndex::Comment;
+	if (aAttribute & TextEditor::Attribute_MultiLineComment)
+		return (TextEditor::Attribute)TextEditor::PaletteIndex::MultiLineComment;
+	return aAttribute & (TextEditor::Attribute_ColorMask | TextEditor::Attribute_Preprocessor);
+}
+
+uint32_t TextEditor::GetCacheId(const Line& aLine) const
+{
+	if (aLine.mCacheId == 0)
 	{
-		if (ImGui::IsWindowHovered())
-			ImGui::SetMouseCursor(ImGuiMouseCursor_TextInput);
-		//ImGui::CaptureKeyboardFromApp(true);
+		if (++mLastCacheId == 0)
+			++mLastCacheId;
+		aLine.mCacheId = mLastCacheId;
+	}
+	return aLine.mCacheId;
+}
 
-		io.WantCaptureKeyboard = true;
-		io.WantTextInput = true;
+const std::vector<TextEditor::DrawRun>& TextEditor::GetDrawRuns(const Line& aLine, float aSpaceSize) const
+{
+	auto& entry = mDrawRuns[GetCacheId(aLine)];
+	auto& runs = entry.mRuns;
+	entry.mFrame = mDrawRunsFrame;
+	if (!runs.empty() || aLine.empty())
+		return runs;
+
+	auto font = ImGui::GetFont();
+	auto fontSize = ImGui::GetFontSize();
+	auto tabSize = float(mTabSize) * aSpaceSize;
+	auto text = aLine.mText.data();
+	auto size = aLine.size();
+	auto x = 0.0f;
+
+	for (size_t i = 0; i < size;)
+	{
+		DrawRun run;
+		run.mX = x;
+		run.mBegin = (uint32_t)i;
+		run.mColor = DrawColor(aLine.mAttributes[i]);
 
-	if (!IsReadOnly() && ctrl && !shift && !alt && ImGui::IsKeyPressed(ImGui_GetKeyIndex(ImGuiKey_Z)))
-		Undo();
-	else if (!IsReadOnly() && !ctrl && !shift && alt && ImGui::IsKeyPressed(ImGui_GetKeyIndex(ImGuiKey_Backspace)))
-		Undo();
-	else if (!IsReadOnly() && ctrl && !shift && !alt && ImGui::IsKeyPressed(ImGui_GetKeyIndex(ImGuiKey_Y)))
-		Redo();
-	else if (!ctrl && !alt && ImGui::IsKeyPressed(ImGui_GetKeyIndex(ImGuiKey_UpArrow)))
-		MoveUp(1, shift);
-	else if (!ctrl && !alt && ImGui::IsKeyPressed(ImGui_GetKeyIndex(ImGuiKey_DownArrow)))
-		MoveDown(1, shift);
-	else if (!alt && ImGui::IsKeyPressed(ImGui_GetKeyIndex(ImGuiKey_LeftArrow)))
-		MoveLeft(1, shift, ctrl);
-	else if (!alt && ImGui::IsKeyPressed(ImGui_GetKeyIndex(ImGuiKey_RightArrow)))
-		MoveRight(1, shift, ctrl);
-	else if (!alt && ImGui::IsKeyPressed(ImGui_GetKeyIndex(ImGuiKey_PageUp)))
-		MoveUp(GetPageSize() - 4, shift);
-	else if (!alt && ImGui::IsKeyPressed(ImGui_GetKeyIndex(ImGuiKey_PageDown)))
-		MoveDown(GetPageSize() - 4, shift);
-	else if (!alt && ctrl && ImGui::IsKeyPressed(ImGui_GetKeyIndex(ImGuiKey_Home)))
-		MoveTop(shift);
-	else if (ctrl && !alt && ImGui::IsKeyPressed(ImGui_GetKeyIndex(ImGuiKey_End)))
-		MoveBottom(shift);
-	else if (!ctrl && !alt && ImGui::IsKeyPressed(ImGui_GetKeyIndex(ImGuiKey_Home)))
-		MoveHome(shift);
-	else if (!ctrl && !alt && ImGui::IsKeyPressed(ImGui_GetKeyIndex(ImGuiKey_End)))
-		MoveEnd(shift);
-	else if (!IsReadOnly() && !ctrl && !shift && !alt && ImGui::IsKeyPressed(ImGui_GetKeyIndex(ImGuiKey_Delete)))
-		Delete();
+		if (text[i] == '\t')
+		{
+			run.mKind = DrawRun::Tab;
+			x = (1.0f + std::floor((1.0f + x) / tabSize)) * tabSize;
+			++i;
+		}
+		else if (text[i] == ' ')
+		{
+			run.mKind = DrawRun::Spaces;
+			for (; i < size && text[i] == ' ' && i - run.mBegin < kDrawRunBytes; ++i)
+				x += aSpaceSize;
+		}
+		else
+		{
+			run.mKind = DrawRun::Text;
+			while (i < size && text[i] != '\t' && text[i] != ' ' && DrawColor(aLine.mAttributes[i]) == run.mColor && i - run.mBegin < kDrawRunBytes)
+				i = std::min(size, i + UTF8CharLength(text[i]));
+			x += font->CalcTextSizeA(fontSize, FLT_MAX, -1.0f, text + run.mBegin, text + i, nullptr).x;
+		}
+
+		run.mEnd = (uint32_t)i;
+		run.mWidth = x - run.mX;
+		runs.push_back(run);
+	}
+
+	return runs;
+}
+
+const TextEditor::ColumnIndex* TextEditor::GetColumnIndex(const Line& aLine) const
+{
+	if (aLine.size() < kLongLine)
+		return nullptr;
+
+	auto& index = mColumnIndexes[GetCacheId(aLine)];
+	index.mFrame = mDrawRunsFrame;
+	if (!index.mCheckpoints.empty())
+		return &index;
+
+	auto text = aLine.mText.data();
+	auto size = aLine.size();
+	auto column = 0;
+	size_t next = 0;
+	index.mCheckpoints.reserve(size / kColumnCheckpointBytes + 1);
+	for (size_t i = 0; i < size;)
+	{
+		if (i >= next)
+		{
+			index.mCheckpoints.push_back({ (int)i, column });
+			next = i + kColumnCheckpointBytes;
+		}
+
+		// Runs of plain ASCII up to the next checkpoint take one column a byte
+		auto stop = std::min(next, size);
+		while (i < stop && (Char)text[i] < 0x80 && text[i] != '\t')
+		{
+			++i;
+			++column;
+		}
+		if (i == stop)
+			continue;
+
+		auto c = (Char)text[i];
+		if (c == '\t')
+			column = (column / mTabSize) * mTabSize + mTabSize;
+		else
+			++column;
+		i += UTF8CharLength(c);
+	}
+	index.mMaxColumn = column;
+	return &index;
+}
+
+// Recoloring a line gives it a new cache id, but leaves what was cached of its text alone:
+// the entries kept under aOldCacheId move to the new id
+void TextEditor::KeepTextCaches(const Line& aLine, uint32_t aOldCacheId) const
+{
+	if (aOldCacheId == 0 || aLine.mCacheId == aOldCacheId)
+		return;
+
+	auto index = mColumnIndexes.find(aOldCacheId);
+	if (index != mColumnIndexes.end())
+	{
+		mColumnIndexes[GetCacheId(aLine)] = std::move(index->second);
+		mColumnIndexes.erase(aOldCacheId);
+	}
+	auto points = mWrapPoints.find(aOldCacheId);
+	if (points != mWrapPoints.end())
+	{
+		mWrapPoints[GetCacheId(aLine)] = std::move(points->second);
+		mWrapPoints.erase(aOldCacheId);
+	}
+}
+
+const TextEditor::MinimapLine& TextEditor::GetMinimapLine(const Line& aLine) const
+{
+	auto inserted = mMinimapLines.try_emplace(GetCacheId(aLine));
+	auto& summary = inserted.first->second;
+	summary.mFrame = mDrawRunsFrame;
+	if (!inserted.second)
+		return summary;
+
+	// Characters per color, the comment and preprocessor flags folded in the way they are drawn
+	int counts[256] = {};
+	auto begin = -1;
+	auto column = 0;
+	auto end = 0;
+	auto size = aLine.size();
+	for (size_t i = 0; i < size;)
+	{
+		auto c = aLine[i];
+		if (c == '\t')
+			column = (column / mTabSize) * mTabSize + mTabSize;
+		else if (c == ' ')
+			++column;
+		else
+		{
+			if (begin < 0)
+				begin = column;
+			end = ++column;
+			++counts[DrawColor(aLine.mAttributes[i])];
+		}
+		i += UTF8CharLength(c);
+	}
+
+	summary.mBegin = std::max(begin, 0);
+	summary.mEnd = end;
+	summary.mColor = 0;
+	for (int i = 1; i < 256; ++i)
+	{
+		if (counts[i] > counts[summary.mColor])
+			summary.mColor = (Attribute)i;
+	}
+	return summary;
+}
+
+void TextEditor::HandleKeyboardInputs()
+{
+	ImGuiIO& io = ImGui::GetIO();
+	auto shift = io.KeyShift;
+	auto ctrl = io.ConfigMacOSXBehaviors ? io.KeySuper : io.KeyCtrl;
+	auto alt = io.ConfigMacOSXBehaviors ? io.KeyCtrl : io.KeyAlt;
+
+	if (ImGui::IsWindowFocused())
+	{
+		if (ImGui::IsWindowHovered())
+			ImGui::SetMouseCursor(ImGuiMouseCursor_TextInput);
+		//ImGui::CaptureKeyboardFromApp(true);
+
+		io.WantCaptureKeyboard = true;
+		io.WantTextInput = true;
+
+	if (mCompletionOpen && HandleCompletionKeys())
+	{
+		// Taken by the completion list
+	}
+	else if (!IsReadOnly() && ctrl && !shift && !alt && ImGui::IsKeyPressed(ImGui_GetKeyIndex(ImGuiKey_Z)))
+		Undo();
+	else if (!IsReadOnly() && !ctrl && !shift && alt && ImGui::IsKeyPressed(ImGui_GetKeyIndex(ImGuiKey_Backspace)))
+		Undo();
+	else if (!IsReadOnly() && ctrl && !shift && !alt && ImGui::IsKeyPressed(ImGui_GetKeyIndex(ImGuiKey_Y)))
+		Redo();
+	else if (!ctrl && !alt && ImGui::IsKeyPressed(ImGui_GetKeyIndex(ImGuiKey_UpArrow)))
+		MoveUp(1, shift);
+	else if (!ctrl && !alt && ImGui::IsKeyPressed(ImGui_GetKeyIndex(ImGuiKey_DownArrow)))
+		MoveDown(1, shift);
+	else if (!alt && ImGui::IsKeyPressed(ImGui_GetKeyIndex(ImGuiKey_LeftArrow)))
+		MoveLeft(1, shift, ctrl);
+	else if (!alt && ImGui::IsKeyPressed(ImGui_GetKeyIndex(ImGuiKey_RightArrow)))
+		MoveRight(1, shift, ctrl);
+	else if (!alt && ImGui::IsKeyPressed(ImGui_GetKeyIndex(ImGuiKey_PageUp)))
+		MoveUp(GetPageSize() - 4, shift);
+	else if (!alt && ImGui::IsKeyPressed(ImGui_GetKeyIndex(ImGuiKey_PageDown)))
+		MoveDown(GetPageSize() - 4, shift);
+	else if (!alt && ctrl && ImGui::IsKeyPressed(ImGui_GetKeyIndex(ImGuiKey_Home)))
+		MoveTop(shift);
+	else if (ctrl && !alt && ImGui::IsKeyPressed(ImGui_GetKeyIndex(ImGuiKey_End)))
+		MoveBottom(shift);
+	else if (!ctrl && !alt && ImGui::IsKeyPressed(ImGui_GetKeyIndex(ImGuiKey_Home)))
+		MoveHome(shift);
+	else if (!ctrl && !alt && ImGui::IsKeyPressed(ImGui_GetKeyIndex(ImGuiKey_End)))
+		MoveEnd(shift);
+	else if (!IsReadOnly() && !ctrl && !shift && !alt && ImGui::IsKeyPressed(ImGui_GetKeyIndex(ImGuiKey_Delete)))
+		Delete();
 	else if (!IsReadOnly() && !ctrl && !shift && !alt && ImGui::IsKeyPressed(ImGui_GetKeyIndex(ImGuiKey_Backspace)))
 		Backspace();
 	else if (!ctrl && !shift && !alt && ImGui::IsKeyPressed(ImGui_GetKeyIndex(ImGuiKey_Insert)))
@@ -773,6 +1417,10 @@ void TextEditor::HandleKeyboardInputs()
 		EnterCharacter('\n', false);
 	else if (!IsReadOnly() && !ctrl && !alt && ImGui::IsKeyPressed(ImGui_GetKeyIndex(ImGuiKey_Tab)))
 		EnterCharacter('\t', shift);
+	else if (ctrl && shift && !alt && ImGui::IsKeyPressed(ImGui_GetKeyIndex(ImGuiKey_LeftBracket)))
+		Fold(FindFoldRegion(mState.mCursorPosition.mLine));
+	else if (ctrl && shift && !alt && ImGui::IsKeyPressed(ImGui_GetKeyIndex(ImGuiKey_RightBracket)))
+		Unfold(mState.mCursorPosition.mLine);
 
 		if (!IsReadOnly() && !io.InputQueueCharacters.empty())
 		{
@@ -780,7 +1428,15 @@ void TextEditor::HandleKeyboardInputs()
 			{
 				auto c = io.InputQueueCharacters[i];
 				if (c != 0 && (c == '\n' || c >= 32))
+				{
 					EnterCharacter(c, shift);
+
+					// Names, and members after a '.', are completed as they are typed
+					if (c == '.' || c >= 0x80 || IsWordCharacter((char)c))
+						mCompletionRequested = true;
+					else
+						CloseCompletion();
+				}
 			}
 			io.InputQueueCharacters.resize(0);
 		}
@@ -794,6 +1450,22 @@ void TextEditor::HandleMouseInputs()
 	auto ctrl = io.ConfigMacOSXBehaviors ? io.KeySuper : io.KeyCtrl;
 	auto alt = io.ConfigMacOSXBehaviors ? io.KeyCtrl : io.KeyAlt;
 
+	// The completion list is drawn over the text (and maybe past the window): clicks on it are its own
+	if (mCompletionOpen && ImGui::IsMouseHoveringRect(mCompletionRectMin, mCompletionRectMax, false))
+	{
+		if (ImGui::IsMouseClicked(0))
+		{
+			auto row = (int)((ImGui::GetMousePos().y - mCompletionRectMin.y) / mCharAdvance.y);
+			mCompletionIndex = std::min(mCompletionTop + row, (int)mCompletions.size() - 1);
+			AcceptCompletion();
+			mScrollToCursor = true;
+		}
+		return;
+	}
+
+	if (mShowMinimap && HandleMinimapMouse())
+		return;
+
 	if (ImGui::IsWindowHovered())
 	{
 		if (!shift && !alt)
@@ -841,6 +1513,10 @@ void TextEditor::HandleMouseInputs()
 			/*
 			Left mouse button click
 			*/
+			else if (click && FoldMarkerAt(ImGui::GetMousePos()) >= 0)
+			{
+				ToggleFold(FoldMarkerAt(ImGui::GetMousePos()));
+			}
 			else if (click)
 			{
 				mState.mCursorPosition = mInteractiveStart = mInteractiveEnd = ScreenPosToCoordinates(ImGui::GetMousePos());
@@ -870,14 +1546,25 @@ void TextEditor::Render()
 	mCharAdvance = ImVec2(fontSize, ImGui::GetTextLineHeightWithSpacing() * mLineSpacing);
 
 	/* Update palette with the current alpha from style */
-	for (int i = 0; i < (int)PaletteIndex::Max; ++i)
+	if (mPaletteAlpha != ImGui::GetStyle().Alpha)
 	{
-		auto color = ImGui::ColorConvertU32ToFloat4(mPaletteBase[i]);
-		color.w *= ImGui::GetStyle().Alpha;
-		mPalette[i] = ImGui::ColorConvertFloat4ToU32(color);
+		mPaletteAlpha = ImGui::GetStyle().Alpha;
+		for (int i = 0; i < (int)PaletteIndex::Max; ++i)
+		{
+			auto color = ImGui::ColorConvertU32ToFloat4(mPaletteBase[i]);
+			color.w *= mPaletteAlpha;
+			mPalette[i] = ImGui::ColorConvertFloat4ToU32(color);
+		}
 	}
 
-	assert(mLineBuffer.empty());
+	/* Draw runs measured with another font are useless */
+	if (mDrawRunsFont != ImGui::GetFont() || mDrawRunsFontSize != ImGui::GetFontSize())
+	{
+		mDrawRuns.clear();
+		mDrawRunsFont = ImGui::GetFont();
+		mDrawRunsFontSize = ImGui::GetFontSize();
+	}
+	++mDrawRunsFrame;
 
 	auto contentSize = ImGui::GetWindowContentRegionMax();
 	auto drawList = ImGui::GetWindowDrawList();
@@ -890,30 +1577,92 @@ void TextEditor::Render()
 	}
 
 	ImVec2 cursorScreenPos = ImGui::GetCursorScreenPos();
+	auto windowPos = ImGui::GetWindowPos();
+	auto windowWidth = ImGui::GetWindowWidth();
 	auto scrollX = ImGui::GetScrollX();
 	auto scrollY = ImGui::GetScrollY();
 
-	auto lineNo = (int)floor(scrollY / mCharAdvance.y);
 	auto globalLineMax = (int)mLines.size();
-	auto lineMax = std::max(0, std::min((int)mLines.size() - 1, lineNo + (int)floor((scrollY + contentSize.y) / mCharAdvance.y)));
 
 	// Deduce mTextStart by evaluating mLines size (global lineMax) plus two spaces as text width
 	char buf[16];
 	snprintf(buf, 16, " %d ", globalLineMax);
 	mTextStart = ImGui::GetFont()->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX, -1.0f, buf, nullptr, nullptr).x + mLeftMargin;
 
+	// Wrapped rows fit the width left of the minimap. When it changes, the line at the top
+	// stays there.
+	if (mWordWrap)
+	{
+		auto width = windowPos.x + contentSize.x - cursorScreenPos.x - mTextStart - GetMinimapWidth();
+		auto columns = std::max((int)kMinWrapColumns, (int)std::floor(width / mCharAdvance.x));
+		if (columns != mWrapColumns)
+		{
+			auto topLine = RowToLine((int)floor(scrollY / mCharAdvance.y));
+			SetWrapColumns(columns);
+			scrollY = LineToRow(topLine) * mCharAdvance.y;
+			ImGui::SetScrollY(scrollY);
+		}
+	}
+
+	// Rows, and the lines shown on them: lines folded away are skipped over, and a wrapped
+	// line may start above the first row in view
+	auto rowCount = GetRowCount();
+	auto row = std::min((int)floor(scrollY / mCharAdvance.y), rowCount - 1);
+	auto firstRow = row;
+	auto rowMax = std::max(0, std::min(rowCount - 1, row + (int)floor((scrollY + contentSize.y) / mCharAdvance.y)));
+	auto lineNo = RowToLine(row);
+	auto lineMax = RowToLine(rowMax);
+	row = LineToRow(lineNo);
+	auto fold = std::partition_point(mFolds.begin(), mFolds.end(), [lineNo](const FoldedRegion& aFold) { return aFold.mLine < lineNo; });
+
 	if (!mLines.empty())
 	{
 		float spaceSize = ImGui::GetFont()->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX, -1.0f, " ", nullptr, nullptr).x;
 
+		// Find matches are shaded with half the alpha of the selection
+		auto matchColor = mPalette[(int)PaletteIndex::Selection];
+		matchColor = (matchColor & ~IM_COL32_A_MASK) | ((((matchColor & IM_COL32_A_MASK) >> IM_COL32_A_SHIFT) / 2) << IM_COL32_A_SHIFT);
+		FindMatch firstMatch = { lineNo, 0, 0 };
+		auto match = std::lower_bound(mFindMatches.begin(), mFindMatches.end(), firstMatch, FindMatchLess);
+
+		static const std::vector<WrapPoint> unwrapped(1, WrapPoint{ 0, 0 });
+		std::vector<float> wrapX;
+
 		while (lineNo <= lineMax)
 		{
-			ImVec2 lineStartScreenPos = ImVec2(cursorScreenPos.x, cursorScreenPos.y + lineNo * mCharAdvance.y);
+			ImVec2 lineStartScreenPos = ImVec2(cursorScreenPos.x, cursorScreenPos.y + row * mCharAdvance.y);
 			ImVec2 textScreenPos = ImVec2(lineStartScreenPos.x + mTextStart, lineStartScreenPos.y);
 
 			auto& line = mLines[lineNo];
-			longest = std::max(mTextStart + TextDistanceToLineStart(Coordinates(lineNo, GetLineMaxColumn(lineNo))), longest);
-			auto columnNo = 0;
+			auto& runs = GetDrawRuns(line, spaceSize);
+			if (!runs.empty())
+				longest = std::max(mTextStart + runs.back().mX + runs.back().mWidth, longest);
+
+			// Row k of the line starts at wrapX[k] along it. Positions and spans along the line
+			// are drawn on the rows they fall on.
+			auto& wraps = mWordWrap ? GetWrapPoints(lineNo) : unwrapped;
+			auto lineRows = (int)wraps.size();
+			auto lineHeight = lineRows * mCharAdvance.y;
+			wrapX.assign(lineRows, 0.0f);
+			for (int k = 1; k < lineRows; ++k)
+				wrapX[k] = TextDistanceToLineStart(Coordinates(lineNo, wraps[k].mColumn));
+			auto rowOf = [&](float aX) {
+				return (int)(std::upper_bound(wrapX.begin() + 1, wrapX.end(), aX) - wrapX.begin()) - 1;
+			};
+			auto textPos = [&](float aX) {
+				auto k = rowOf(aX);
+				return ImVec2(textScreenPos.x + aX - wrapX[k], textScreenPos.y + k * mCharAdvance.y);
+			};
+			auto fillSpan = [&](float aStart, float aEnd, ImU32 aColor) {
+				for (auto k = rowOf(aStart); aStart < aEnd; ++k)
+				{
+					auto rowEnd = k + 1 < lineRows ? std::min(aEnd, wrapX[k + 1]) : aEnd;
+					ImVec2 spanStart(textScreenPos.x + aStart - wrapX[k], textScreenPos.y + k * mCharAdvance.y);
+					drawList->AddRectFilled(spanStart, ImVec2(spanStart.x + rowEnd - aStart, spanStart.y + mCharAdvance.y), aColor);
+					aStart = rowEnd;
+				}
+			};
+
 			Coordinates lineStartCoord(lineNo, 0);
 			Coordinates lineEndCoord(lineNo, GetLineMaxColumn(lineNo));
 
@@ -931,19 +1680,39 @@ void TextEditor::Render()
 				ssend += mCharAdvance.x;
 
 			if (sstart != -1 && ssend != -1 && sstart < ssend)
+				fillSpan(sstart, ssend, mPalette[(int)PaletteIndex::Selection]);
+
+			// Draw find matches. Matches still found on lines edited since they were searched
+			// may reach past the end of the line.
+			auto lineMatchesEnd = match;
+			while (lineMatchesEnd != mFindMatches.end() && lineMatchesEnd->mLine == lineNo)
+				++lineMatchesEnd;
+			if (match != lineMatchesEnd)
 			{
-				ImVec2 vstart(lineStartScreenPos.x + mTextStart + sstart, lineStartScreenPos.y);
-				ImVec2 vend(lineStartScreenPos.x + mTextStart + ssend, lineStartScreenPos.y + mCharAdvance.y);
-				drawList->AddRectFilled(vstart, vend, mPalette[(int)PaletteIndex::Selection]);
+				auto left = mWordWrap ? 0.0f : scrollX - mTextStart;
+				auto right = mWordWrap ? FLT_MAX : left + windowWidth;
+				auto distance = [&](int aIndex) {
+					aIndex = std::min(aIndex, (int)line.size());
+					return TextDistanceToLineStart(Coordinates(lineNo, GetCharacterColumn(lineNo, aIndex)));
+				};
+				match = std::partition_point(match, lineMatchesEnd, [&](const FindMatch& m) { return distance(m.mEnd) < left; });
+				for (; match != lineMatchesEnd; ++match)
+				{
+					auto mstart = distance(match->mBegin);
+					if (mstart > right)
+						break;
+					fillSpan(mstart, distance(match->mEnd), matchColor);
+				}
 			}
+			match = lineMatchesEnd;
 
 			// Draw breakpoints
 			auto start = ImVec2(lineStartScreenPos.x + scrollX, lineStartScreenPos.y);
 
-			if (mBreakpoints.count(lineNo + 1) != 0)
+			if (HasBreakpoint(lineNo + 1))
 			{
 				// Draw background
-				auto end = ImVec2(lineStartScreenPos.x + contentSize.x + 2.0f * scrollX, lineStartScreenPos.y + mCharAdvance.y);
+				auto end = ImVec2(lineStartScreenPos.x + contentSize.x + 2.0f * scrollX, lineStartScreenPos.y + lineHeight);
 				drawList->AddRectFilled(start, end, mPalette[(int)PaletteIndex::Breakpoint]);
 				
 				// Draw red circle marker on the left margin
@@ -961,7 +1730,7 @@ void TextEditor::Render()
 			if (mDebugCurrentLine == lineNo + 1)
 			{
 				// Draw bright yellow background for current debug line
-				auto end = ImVec2(lineStartScreenPos.x + contentSize.x + 2.0f * scrollX, lineStartScreenPos.y + mCharAdvance.y);
+				auto end = ImVec2(lineStartScreenPos.x + contentSize.x + 2.0f * scrollX, lineStartScreenPos.y + lineHeight);
 				drawList->AddRectFilled(start, end, mPalette[(int)PaletteIndex::DebugCurrentLine]);
 				
 				// Draw yellow arrow marker on the left margin
@@ -983,7 +1752,7 @@ void TextEditor::Render()
 			auto errorIt = mErrorMarkers.find(lineNo + 1);
 			if (errorIt != mErrorMarkers.end())
 			{
-				auto end = ImVec2(lineStartScreenPos.x + contentSize.x + 2.0f * scrollX, lineStartScreenPos.y + mCharAdvance.y);
+				auto end = ImVec2(lineStartScreenPos.x + contentSize.x + 2.0f * scrollX, lineStartScreenPos.y + lineHeight);
 				drawList->AddRectFilled(start, end, mPalette[(int)PaletteIndex::ErrorMarker]);
 
 				if (ImGui::IsMouseHoveringRect(lineStartScreenPos, end))
@@ -1005,10 +1774,23 @@ void TextEditor::Render()
 
 			auto lineNoWidth = ImGui::GetFont()->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX, -1.0f, buf, nullptr, nullptr).x;
 			drawList->AddText(ImVec2(lineStartScreenPos.x + mTextStart - lineNoWidth, lineStartScreenPos.y), mPalette[(int)PaletteIndex::LineNumber], buf);
-			
+
+			// Draw the fold marker in the two spaces after the line number: pointing right on a
+			// folded line, down on a line that can be folded
+			auto folded = fold != mFolds.end() && fold->mLine == lineNo;
+			if (folded || IsFoldable(lineNo))
+			{
+				auto size = mCharAdvance.x * 0.4f;
+				ImVec2 center(lineStartScreenPos.x + mTextStart - mCharAdvance.x, lineStartScreenPos.y + mCharAdvance.y * 0.5f);
+				if (folded)
+					drawList->AddTriangleFilled(ImVec2(center.x - size * 0.5f, center.y - size), ImVec2(center.x - size * 0.5f, center.y + size), ImVec2(center.x + size * 0.5f, center.y), mPalette[(int)PaletteIndex::LineNumber]);
+				else
+					drawList->AddTriangle(ImVec2(center.x - size, center.y - size * 0.5f), ImVec2(center.x + size, center.y - size * 0.5f), ImVec2(center.x, center.y + size * 0.5f), mPalette[(int)PaletteIndex::LineNumber]);
+			}
+
 			// Handle double-click on line number to toggle breakpoint
 			ImVec2 lineNoStart = ImVec2(lineStartScreenPos.x + scrollX, lineStartScreenPos.y);
-			ImVec2 lineNoEnd = ImVec2(lineStartScreenPos.x + mTextStart, lineStartScreenPos.y + mCharAdvance.y);
+			ImVec2 lineNoEnd = ImVec2(lineStartScreenPos.x + mTextStart - 2.0f * mCharAdvance.x, lineStartScreenPos.y + mCharAdvance.y);
 			if (ImGui::IsMouseHoveringRect(lineNoStart, lineNoEnd))
 			{
 				if (ImGui::IsMouseDoubleClicked(ImGuiMouseButton_Left))
@@ -1024,7 +1806,7 @@ void TextEditor::Render()
 				// Highlight the current line (where the cursor is)
 				if (!HasSelection())
 				{
-					auto end = ImVec2(start.x + contentSize.x + scrollX, start.y + mCharAdvance.y);
+					auto end = ImVec2(start.x + contentSize.x + scrollX, start.y + lineHeight);
 					drawList->AddRectFilled(start, end, mPalette[(int)(focused ? PaletteIndex::CurrentLineFill : PaletteIndex::CurrentLineFillInactive)]);
 					drawList->AddRect(start, end, mPalette[(int)PaletteIndex::CurrentLineEdge], 1.0f);
 				}
@@ -1042,7 +1824,7 @@ void TextEditor::Render()
 
 						if (mOverwrite && cindex < (int)line.size())
 						{
-							auto c = line[cindex].mChar;
+							auto c = line[cindex];
 							if (c == '\t')
 							{
 								auto x = (1.0f + std::floor((1.0f + cx) / (float(mTabSize) * spaceSize))) * (float(mTabSize) * spaceSize);
@@ -1051,13 +1833,13 @@ void TextEditor::Render()
 							else
 							{
 								char buf2[2];
-								buf2[0] = line[cindex].mChar;
+								buf2[0] = line[cindex];
 								buf2[1] = '\0';
 								width = ImGui::GetFont()->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX, -1.0f, buf2).x;
 							}
 						}
-						ImVec2 cstart(textScreenPos.x + cx, lineStartScreenPos.y);
-						ImVec2 cend(textScreenPos.x + cx + width, lineStartScreenPos.y + mCharAdvance.y);
+						ImVec2 cstart = textPos(cx);
+						ImVec2 cend(cstart.x + width, cstart.y + mCharAdvance.y);
 						drawList->AddRectFilled(cstart, cend, mPalette[(int)PaletteIndex::Cursor]);
 						if (elapsed > 800)
 							mStartTime = timeEnd;
@@ -1065,37 +1847,42 @@ void TextEditor::Render()
 				}
 			}
 
-			// Render colorized text
-			auto prevColor = line.empty() ? mPalette[(int)PaletteIndex::Default] : GetGlyphColor(line[0]);
-			ImVec2 bufferOffset;
-
-			for (int i = 0; i < line.size();)
+			// Render colorized text, starting at the first run that is visible: horizontally, or
+			// on the first row in view of a wrapped line
+			const char* text = line.mText.data();
+			float visibleLeft = windowPos.x - textScreenPos.x;
+			float visibleRight = windowPos.x + windowWidth - textScreenPos.x;
+			if (lineRows > 1)
 			{
-				auto& glyph = line[i];
-				auto color = GetGlyphColor(glyph);
-
-				if ((color != prevColor || glyph.mChar == '\t' || glyph.mChar == ' ') && !mLineBuffer.empty())
-				{
-					const ImVec2 newOffset(textScreenPos.x + bufferOffset.x, textScreenPos.y + bufferOffset.y);
-					drawList->AddText(newOffset, prevColor, mLineBuffer.c_str());
-					auto textSize = ImGui::GetFont()->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX, -1.0f, mLineBuffer.c_str(), nullptr, nullptr);
-					bufferOffset.x += textSize.x;
-					mLineBuffer.clear();
-				}
-				prevColor = color;
-
-				if (glyph.mChar == '\t')
+				auto lastRow = std::min(lineRows - 1, rowMax - row);
+				visibleLeft = wrapX[std::max(0, std::min(lastRow, firstRow - row))];
+				visibleRight = lastRow + 1 < lineRows ? wrapX[lastRow + 1] : FLT_MAX;
+			}
+			auto firstRun = std::lower_bound(runs.begin(), runs.end(), visibleLeft,
+				[](const DrawRun& aRun, float aX) { return aRun.mX + aRun.mWidth < aX; });
+			for (auto it = firstRun; it != runs.end() && it->mX <= visibleRight; ++it)
+			{
+				auto& run = *it;
+				if (run.mKind != DrawRun::Text && !mShowWhitespaces)
+					continue;
+
+				// A run reaching past the end of a row goes on on the next one
+				auto k = rowOf(run.mX);
+				auto x = run.mX;
+				for (auto begin = run.mBegin; begin < run.mEnd; x = wrapX[++k])
 				{
-					auto oldX = bufferOffset.x;
-					bufferOffset.x = (1.0f + std::floor((1.0f + bufferOffset.x) / (float(mTabSize) * spaceSize))) * (float(mTabSize) * spaceSize);
-					++i;
-
-					if (mShowWhitespaces)
+					auto end = k + 1 < lineRows ? std::min(run.mEnd, (uint32_t)wraps[k + 1].mIndex) : run.mEnd;
+					const ImVec2 runScreenPos(textScreenPos.x + x - wrapX[k], textScreenPos.y + k * mCharAdvance.y);
+					if (run.mKind == DrawRun::Text)
+					{
+						drawList->AddText(runScreenPos, GetGlyphColor(run.mColor), text + begin, text + end);
+					}
+					else if (run.mKind == DrawRun::Tab)
 					{
 						const auto s = ImGui::GetFontSize();
-						const auto x1 = textScreenPos.x + oldX + 1.0f;
-						const auto x2 = textScreenPos.x + bufferOffset.x - 1.0f;
-						const auto y = textScreenPos.y + bufferOffset.y + s * 0.5f;
+						const auto x1 = runScreenPos.x + 1.0f;
+						const auto x2 = runScreenPos.x + run.mWidth - 1.0f;
+						const auto y = runScreenPos.y + s * 0.5f;
 						const ImVec2 p1(x1, y);
 						const ImVec2 p2(x2, y);
 						const ImVec2 p3(x2 - s * 0.2f, y - s * 0.2f);
@@ -1104,46 +1891,83 @@ void TextEditor::Render()
 						drawList->AddLine(p2, p3, 0x90909090);
 						drawList->AddLine(p2, p4, 0x90909090);
 					}
-				}
-				else if (glyph.mChar == ' ')
-				{
-					if (mShowWhitespaces)
+					else
 					{
 						const auto s = ImGui::GetFontSize();
-						const auto x = textScreenPos.x + bufferOffset.x + spaceSize * 0.5f;
-						const auto y = textScreenPos.y + bufferOffset.y + s * 0.5f;
-						drawList->AddCircleFilled(ImVec2(x, y), 1.5f, 0x80808080, 4);
+						const auto y = runScreenPos.y + s * 0.5f;
+						for (auto i = begin; i < end; ++i)
+						{
+							const auto x = runScreenPos.x + (i - begin) * spaceSize + spaceSize * 0.5f;
+							drawList->AddCircleFilled(ImVec2(x, y), 1.5f, 0x80808080, 4);
+						}
 					}
-					bufferOffset.x += spaceSize;
-					i++;
-				}
-				else
-				{
-					auto l = UTF8CharLength(glyph.mChar);
-					while (l-- > 0)
-						mLineBuffer.push_back(line[i++].mChar);
+					begin = end;
+					if (k + 1 >= lineRows)
+						break;
 				}
-				++columnNo;
 			}
 
-			if (!mLineBuffer.empty())
+			// A folded line ends with a box standing for the lines folded below it, and the
+			// next line shown is the one after them
+			if (folded)
 			{
-				const ImVec2 newOffset(textScreenPos.x + bufferOffset.x, textScreenPos.y + bufferOffset.y);
-				drawList->AddText(newOffset, prevColor, mLineBuffer.c_str());
-				mLineBuffer.clear();
+				auto lineEnd = textPos(runs.empty() ? 0.0f : runs.back().mX + runs.back().mWidth);
+				auto x = lineEnd.x + spaceSize;
+				auto width = ImGui::GetFont()->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX, -1.0f, "...").x;
+				ImVec2 boxStart(x, lineEnd.y + 1.0f);
+				ImVec2 boxEnd(x + width + spaceSize, lineEnd.y + mCharAdvance.y - 1.0f);
+				drawList->AddRectFilled(boxStart, boxEnd, mPalette[(int)PaletteIndex::Selection], 2.0f);
+				drawList->AddText(ImVec2(x + spaceSize * 0.5f, lineEnd.y), mPalette[(int)PaletteIndex::LineNumber], "...");
+				longest = std::max(boxEnd.x - textScreenPos.x + mTextStart, longest);
+
+				lineNo += fold->mCount;
+				++fold;
+				match = std::partition_point(match, mFindMatches.end(), [lineNo](const FindMatch& aMatch) { return aMatch.mLine <= lineNo; });
 			}
 
 			++lineNo;
+			row += lineRows;
+		}
+
+		// Forget the runs, indexes and wrap points of lines that scrolled out of view
+		auto pruneLimit = 2 * (size_t)(rowMax - firstRow + 1) + 64;
+		if (mDrawRuns.size() > pruneLimit)
+			PruneLineCache(mDrawRuns, mDrawRunsFrame);
+		if (mColumnIndexes.size() > pruneLimit)
+			PruneLineCache(mColumnIndexes, mDrawRunsFrame);
+		if (mWrapPoints.size() > pruneLimit)
+			PruneLineCache(mWrapPoints, mDrawRunsFrame);
+
+		// The minimap stays at the right edge of the view, over the text that reaches it
+		auto overMinimap = false;
+		if (mShowMinimap)
+		{
+			ImVec2 minimapMax(windowPos.x + contentSize.x + scrollX, windowPos.y + contentSize.y + scrollY);
+			ImVec2 minimapMin(minimapMax.x - GetMinimapWidth(), windowPos.y + ImGui::GetWindowContentRegionMin().y + scrollY);
+			RenderMinimap(minimapMin, minimapMax, scrollY, ImGui::GetScrollMaxY());
+			overMinimap = ImGui::IsMouseHoveringRect(minimapMin, minimapMax, false);
 		}
 
 		// Draw a tooltip on known identifiers/preprocessor symbols
-		if (ImGui::IsMousePosValid())
+		auto overCompletion = mCompletionOpen && ImGui::IsMouseHoveringRect(mCompletionRectMin, mCompletionRectMax, false);
+		if (ImGui::IsMousePosValid() && !overCompletion && !overMinimap)
 		{
-			auto id = GetWordAt(ScreenPosToCoordinates(ImGui::GetMousePos()));
+			auto coords = ScreenPosToCoordinates(ImGui::GetMousePos());
+			auto id = GetWordAt(coords);
 			if (!id.empty())
 			{
+				// Names defined in the text come first: they shadow the built-in ones
+				auto symbol = FindDefinition(id, coords.mLine);
 				auto it = mLanguageDefinition.mIdentifiers.find(id);
-				if (it != mLanguageDefinition.mIdentifiers.end())
+				if (symbol != nullptr)
+				{
+					auto& text = mLines[symbol->mLine].mText;
+					ImGui::BeginTooltip();
+					ImGui::TextUnformatted(text.data() + symbol->mIndent, text.data() + text.size());
+					ImGui::TextDisabled("Line %d", symbol->mLine + 1);
+					ImGui::EndTooltip();
+				}
+				else if (it != mLanguageDefinition.mIdentifiers.end())
 				{
 					ImGui::BeginTooltip();
 					ImGui::TextUnformatted(it->second.mDeclaration.c_str());
@@ -1161,10 +1985,16 @@ void TextEditor::Render()
 				}
 			}
 		}
+
+		if (mCompletionOpen)
+			RenderCompletion(ImVec2(cursorScreenPos.x + mTextStart, cursorScreenPos.y));
 	}
 
 
-	ImGui::Dummy(ImVec2((longest + 2), mLines.size() * mCharAdvance.y));
+	// Wrapped text never needs horizontal scrolling
+	if (mWordWrap)
+		longest = mTextStart;
+	ImGui::Dummy(ImVec2((longest + 2 + GetMinimapWidth()), GetRowCount() * mCharAdvance.y));
 
 	if (mScrollToCursor)
 	{
@@ -1200,7 +2030,18 @@ void TextEditor::Render(const char* aTitle, const ImVec2& aSize, bool aBorder)
 	if (mHandleMouseInputs)
 		HandleMouseInputs();
 
+	if (mCompletionOpen && !ImGui::IsWindowFocused())
+		CloseCompletion();
+
+	// Whatever put the cursor on a folded line (a search, an undo, a jump) shows it
+	if (!mFolds.empty())
+		RevealLine(mState.mCursorPosition.mLine);
+
 	ColorizeInternal();
+	UpdateSymbols();
+	if (mCompletionRequested || (mCompletionOpen && (mTextChanged || mCursorPositionChanged)))
+		UpdateCompletion();
+	UpdateFindIndex();
 	Render();
 
 	if (mHandleKeyboardInputs)
@@ -1216,30 +2057,49 @@ void TextEditor::Render(const char* aTitle, const ImVec2& aSize, bool aBorder)
 }
 
 void TextEditor::SetText(const std::string & aText)
+{
+	SetText(aText.data(), aText.size());
+}
+
+void TextEditor::SetText(const char * aText, size_t aLength)
 {
 	mLines.clear();
-	mLines.emplace_back(Line());
-	for (auto chr : aText)
+
+	auto text = aLength > 0 ? aText : "";
+	auto textEnd = text + aLength;
+
+	// Carriage returns are ignored. Most files have none, so one scan of the whole text
+	// saves searching every line for them.
+	auto hasCarriageReturns = memchr(text, '\r', aLength) != nullptr;
+
+	for (;;)
 	{
-		if (chr == '\r')
-		{
-			// ignore the carriage return character
-		}
-		else if (chr == '\n')
-			mLines.emplace_back(Line());
-		else
+		auto newline = (const char*)memchr(text, '\n', textEnd - text);
+		auto lineEnd = newline != nullptr ? newline : textEnd;
+
+		auto& line = mLines.push_back(Line());
+		line.assign(text, lineEnd - text);
+
+		auto& lineText = line.mText;
+		if (hasCarriageReturns && lineText.find('\r') != std::string::npos)
 		{
-			mLines.back().emplace_back(Glyph(chr, PaletteIndex::Default));
+			lineText.erase(std::remove(lineText.begin(), lineText.end(), '\r'), lineText.end());
+			line.mAttributes.resize(lineText.size());
 		}
+
+		if (newline == nullptr)
+			break;
+		text = newline + 1;
 	}
 
 	mTextChanged = true;
 	mScrollToTop = true;
 
-	mUndoBuffer.clear();
-	mUndoIndex = 0;
+	ClearUndo();
 
 	Colorize();
+	ResetSymbols();
+	UnfoldAll();
 }
 
 void TextEditor::SetTextLines(const std::vector<std::string> & aLines)
@@ -1248,29 +2108,27 @@ void TextEditor::SetTextLines(const std::vector<std::string> & aLines)
 
 	if (aLines.empty())
 	{
-		mLines.emplace_back(Line());
+		mLines.push_back(Line());
 	}
 	else
 	{
-		mLines.resize(aLines.size());
-
 		for (size_t i = 0; i < aLines.size(); ++i)
 		{
 			const std::string & aLine = aLines[i];
 
-			mLines[i].reserve(aLine.size());
-			for (size_t j = 0; j < aLine.size(); ++j)
-				mLines[i].emplace_back(Glyph(aLine[j], PaletteIndex::Default));
+			auto& line = mLines.push_back(Line());
+			line.assign(aLine.data(), aLine.size());
 		}
 	}
 
 	mTextChanged = true;
 	mScrollToTop = true;
 
-	mUndoBuffer.clear();
-	mUndoIndex = 0;
+	ClearUndo();
 
 	Colorize();
+	ResetSymbols();
+	UnfoldAll();
 }
 
 void TextEditor::EnterCharacter(ImWchar aChar, bool aShift)
@@ -1316,16 +2174,16 @@ void TextEditor::EnterCharacter(ImWchar aChar, bool aShift)
 				{
 					if (!line.empty())
 					{
-						if (line.front().mChar == '\t')
+						if (line.front() == '\t')
 						{
-							line.erase(line.begin());
+							line.erase(0);
 							modified = true;
 						}
 						else
 						{
-							for (int j = 0; j < mTabSize && !line.empty() && line.front().mChar == ' '; j++)
+							for (int j = 0; j < mTabSize && !line.empty() && line.front() == ' '; j++)
 							{
-								line.erase(line.begin());
+								line.erase(0);
 								modified = true;
 							}
 						}
@@ -1333,7 +2191,8 @@ void TextEditor::EnterCharacter(ImWchar aChar, bool aShift)
 				}
 				else
 				{
-					line.insert(line.begin(), Glyph('\t', TextEditor::PaletteIndex::Background));
+					line.insert(0, '\t');
+					line.SetColor(0, TextEditor::PaletteIndex::Background);
 					modified = true;
 				}
 			}
@@ -1364,6 +2223,7 @@ void TextEditor::EnterCharacter(ImWchar aChar, bool aShift)
 				AddUndo(u);
 
 				mTextChanged = true;
+				Colorize(start.mLine, end.mLine - start.mLine + 1);
 
 				EnsureCursorVisible();
 			}
@@ -1391,15 +2251,16 @@ void TextEditor::EnterCharacter(ImWchar aChar, bool aShift)
 		auto& newLine = mLines[coord.mLine + 1];
 
 		if (mLanguageDefinition.mAutoIndentation)
-			for (size_t it = 0; it < line.size() && isascii(line[it].mChar) && isblank(line[it].mChar); ++it)
+			for (size_t it = 0; it < line.size() && isascii(line[it]) && isblank(line[it]); ++it)
 				newLine.push_back(line[it]);
 
 		const size_t whitespaceSize = newLine.size();
 		auto cindex = GetCharacterIndex(coord);
-		newLine.insert(newLine.end(), line.begin() + cindex, line.end());
-		line.erase(line.begin() + cindex, line.begin() + line.size());
+		newLine.append(line, cindex);
+		line.erase(cindex, line.size());
 		SetCursorPosition(Coordinates(coord.mLine + 1, GetCharacterColumn(coord.mLine + 1, (int)whitespaceSize)));
 		u.mAdded = (char)aChar;
+		u.mAdded.append(newLine.mText, 0, whitespaceSize);
 	}
 	else
 	{
@@ -1413,20 +2274,20 @@ void TextEditor::EnterCharacter(ImWchar aChar, bool aShift)
 
 			if (mOverwrite && cindex < (int)line.size())
 			{
-				auto d = UTF8CharLength(line[cindex].mChar);
+				auto d = UTF8CharLength(line[cindex]);
 
 				u.mRemovedStart = mState.mCursorPosition;
 				u.mRemovedEnd = Coordinates(coord.mLine, GetCharacterColumn(coord.mLine, cindex + d));
 
 				while (d-- > 0 && cindex < (int)line.size())
 				{
-					u.mRemoved += line[cindex].mChar;
-					line.erase(line.begin() + cindex);
+					u.mRemoved += line[cindex];
+					line.erase(cindex);
 				}
 			}
 
-			for (auto p = buf; *p != '\0'; p++, ++cindex)
-				line.insert(line.begin() + cindex, Glyph(*p, PaletteIndex::Default));
+			line.insert(cindex, buf, e);
+			cindex += e;
 			u.mAdded = buf;
 
 			SetCursorPosition(Coordinates(coord.mLine, GetCharacterColumn(coord.mLine, cindex)));
@@ -1440,7 +2301,7 @@ void TextEditor::EnterCharacter(ImWchar aChar, bool aShift)
 	u.mAddedEnd = GetActualCursorCoordinates();
 	u.mAfter = mState;
 
-	AddUndo(u);
+	AddUndo(u, true);
 
 	Colorize(coord.mLine - 1, 3);
 	EnsureCursorVisible();
@@ -1521,6 +2382,11 @@ void TextEditor::SetSelection(const Coordinates & aStart, const Coordinates & aE
 void TextEditor::SetTabSize(int aValue)
 {
 	mTabSize = std::max(0, std::min(32, aValue));
+	mDrawRuns.clear();
+	mColumnIndexes.clear();
+	mMinimapLines.clear();
+	mWrapPoints.clear();
+	SetWrapColumns(mWrapColumns);
 }
 
 void TextEditor::InsertText(const std::string & aValue)
@@ -1561,7 +2427,9 @@ void TextEditor::DeleteSelection()
 void TextEditor::MoveUp(int aAmount, bool aSelect)
 {
 	auto oldPos = mState.mCursorPosition;
-	mState.mCursorPosition.mLine = std::max(0, mState.mCursorPosition.mLine - aAmount);
+	int rowColumn;
+	auto row = CoordinatesToRow(oldPos, &rowColumn);
+	mState.mCursorPosition = RowToCoordinates(std::max(0, row - aAmount), oldPos.mColumn - rowColumn);
 	if (oldPos != mState.mCursorPosition)
 	{
 		if (aSelect)
@@ -1588,7 +2456,9 @@ void TextEditor::MoveDown(int aAmount, bool aSelect)
 {
 	assert(mState.mCursorPosition.mColumn >= 0);
 	auto oldPos = mState.mCursorPosition;
-	mState.mCursorPosition.mLine = std::max(0, std::min((int)mLines.size() - 1, mState.mCursorPosition.mLine + aAmount));
+	int rowColumn;
+	auto row = CoordinatesToRow(oldPos, &rowColumn);
+	mState.mCursorPosition = RowToCoordinates(std::max(0, std::min(GetRowCount() - 1, row + aAmount)), oldPos.mColumn - rowColumn);
 
 	if (mState.mCursorPosition != oldPos)
 	{
@@ -1647,7 +2517,7 @@ void TextEditor::MoveLeft(int aAmount, bool aSelect, bool aWordMode)
 			{
 				if ((int)mLines.size() > line)
 				{
-					while (cindex > 0 && IsUTFSequence(mLines[line][cindex].mChar))
+					while (cindex > 0 && IsUTFSequence(mLines[line][cindex]))
 						--cindex;
 				}
 			}
@@ -1708,7 +2578,7 @@ void TextEditor::MoveRight(int aAmount, bool aSelect, bool aWordMode)
 		}
 		else
 		{
-			cindex += UTF8CharLength(line[cindex].mChar);
+			cindex += UTF8CharLength(line[cindex]);
 			mState.mCursorPosition = Coordinates(lindex, GetCharacterColumn(lindex, cindex));
 			if (aWordMode)
 				mState.mCursorPosition = FindNextWord(mState.mCursorPosition);
@@ -1851,7 +2721,8 @@ void TextEditor::Delete()
 			Advance(u.mRemovedEnd);
 
 			auto& nextLine = mLines[pos.mLine + 1];
-			line.insert(line.end(), nextLine.begin(), nextLine.end());
+			line.append(nextLine);
+			JoinErrorMarker(pos.mLine, pos.mLine + 1);
 			RemoveLine(pos.mLine + 1);
 		}
 		else
@@ -1861,9 +2732,8 @@ void TextEditor::Delete()
 			u.mRemovedEnd.mColumn++;
 			u.mRemoved = GetText(u.mRemovedStart, u.mRemovedEnd);
 
-			auto d = UTF8CharLength(line[cindex].mChar);
-			while (d-- > 0 && cindex < (int)line.size())
-				line.erase(line.begin() + cindex);
+			auto d = UTF8CharLength(line[cindex]);
+			line.erase(cindex, std::min(cindex + d, (int)line.size()));
 		}
 
 		mTextChanged = true;
@@ -1910,13 +2780,9 @@ void TextEditor::Backspace()
 			auto& line = mLines[mState.mCursorPosition.mLine];
 			auto& prevLine = mLines[mState.mCursorPosition.mLine - 1];
 			auto prevSize = GetLineMaxColumn(mState.mCursorPosition.mLine - 1);
-			prevLine.insert(prevLine.end(), line.begin(), line.end());
-
-			ErrorMarkers etmp;
-			for (auto& i : mErrorMarkers)
-				etmp.insert(ErrorMarkers::value_type(i.first - 1 == mState.mCursorPosition.mLine ? i.first - 1 : i.first, i.second));
-			mErrorMarkers = std::move(etmp);
+			prevLine.append(line);
 
+			JoinErrorMarker(mState.mCursorPosition.mLine - 1, mState.mCursorPosition.mLine);
 			RemoveLine(mState.mCursorPosition.mLine);
 			--mState.mCursorPosition.mLine;
 			mState.mCursorPosition.mColumn = prevSize;
@@ -1926,10 +2792,10 @@ void TextEditor::Backspace()
 			auto& line = mLines[mState.mCursorPosition.mLine];
 			auto cindex = GetCharacterIndex(pos) - 1;
 			auto cend = cindex + 1;
-			while (cindex > 0 && IsUTFSequence(line[cindex].mChar))
+			while (cindex > 0 && IsUTFSequence(line[cindex]))
 				--cindex;
 
-			//if (cindex > 0 && UTF8CharLength(line[cindex].mChar) > 1)
+			//if (cindex > 0 && UTF8CharLength(line[cindex]) > 1)
 			//	--cindex;
 
 			u.mRemovedStart = u.mRemovedEnd = GetActualCursorCoordinates();
@@ -1938,8 +2804,8 @@ void TextEditor::Backspace()
 
 			while (cindex < line.size() && cend-- > cindex)
 			{
-				u.mRemoved += line[cindex].mChar;
-				line.erase(line.begin() + cindex);
+				u.mRemoved += line[cindex];
+				line.erase(cindex);
 			}
 		}
 
@@ -1950,7 +2816,7 @@ void TextEditor::Backspace()
 	}
 
 	u.mAfter = mState;
-	AddUndo(u);
+	AddUndo(u, true);
 }
 
 void TextEditor::SelectWordUnderCursor()
@@ -1979,11 +2845,8 @@ void TextEditor::Copy()
 	{
 		if (!mLines.empty())
 		{
-			std::string str;
 			auto& line = mLines[GetActualCursorCoordinates().mLine];
-			for (auto& g : line)
-				str.push_back(g.mChar);
-			ImGui::SetClipboardText(str.c_str());
+			ImGui::SetClipboardText(line.mText.c_str());
 		}
 	}
 }
@@ -2055,97 +2918,1829 @@ bool TextEditor::CanRedo() const
 
 void TextEditor::Undo(int aSteps)
 {
+	mUndoMergeable = false;
 	while (CanUndo() && aSteps-- > 0)
 		mUndoBuffer[--mUndoIndex].Undo(this);
 }
 
 void TextEditor::Redo(int aSteps)
 {
+	mUndoMergeable = false;
 	while (CanRedo() && aSteps-- > 0)
 		mUndoBuffer[mUndoIndex++].Redo(this);
 }
 
-const TextEditor::Palette & TextEditor::GetDarkPalette()
+void TextEditor::SetUndoMemoryBudget(size_t aBytes)
 {
-	const static Palette p = { {
-			0xff7f7f7f,	// Default
-			0xffd69c56,	// Keyword	
-			0xff00ff00,	// Number
-			0xff7070e0,	// String
-			0xff70a0e0, // Char literal
-			0xffffffff, // Punctuation
-			0xff408080,	// Preprocessor
-			0xffaaaaaa, // Identifier
-			0xff9bc64d, // Known identifier
-			0xffc040a0, // Preproc identifier
-			0xff206020, // Comment (single line)
-			0xff406020, // Comment (multi line)
-			0xff101010, // Background
-			0xffe0e0e0, // Cursor
-			0x80a06020, // Selection
-			0x800020ff, // ErrorMarker
-			0x40f08000, // Breakpoint
-			0xff707000, // Line number
-			0x40000000, // Current line fill
-			0x40808080, // Current line fill (inactive)
-			0x40a0a0a0, // Current line edge
-			0x80ffff00, // Debug current line (bright yellow with transparency)
-		} };
-	return p;
+	mUndoMemoryBudget = aBytes;
+	TrimUndo();
 }
 
-const TextEditor::Palette & TextEditor::GetLightPalette()
+TextEditor::History TextEditor::TakeHistory()
 {
-	const static Palette p = { {
-			0xff7f7f7f,	// None
-			0xffff0c06,	// Keyword	
-			0xff008000,	// Number
-			0xff2020a0,	// String
-			0xff304070, // Char literal
-			0xff000000, // Punctuation
-			0xff406060,	// Preprocessor
-			0xff404040, // Identifier
-			0xff606010, // Known identifier
-			0xffc040a0, // Preproc identifier
-			0xff205020, // Comment (single line)
-			0xff405020, // Comment (multi line)
-			0xffffffff, // Background
-			0xff000000, // Cursor
-			0x80600000, // Selection
-			0xa00010ff, // ErrorMarker
-			0x80f08000, // Breakpoint
-			0xff505000, // Line number
-			0x40000000, // Current line fill
-			0x40808080, // Current line fill (inactive)
-			0x40000000, // Current line edge
-			0x80ffff00, // Debug current line (bright yellow with transparency)
-		} };
-	return p;
+	History result;
+	result.mUndoBuffer = std::move(mUndoBuffer);
+	result.mUndoIndex = mUndoIndex;
+	result.mUndoMemoryUsage = mUndoMemoryUsage;
+	result.mState = mState;
+	result.mBreakpoints = std::move(mBreakpoints);
+	result.mFolds = std::move(mFolds);
+
+	ClearUndo();
+	mBreakpoints.clear();
+	mRemovedBreakpoints.clear();
+	mBreakpointsChanged = false;
+	UnfoldAll();
+	return result;
 }
 
-const TextEditor::Palette & TextEditor::GetRetroBluePalette()
+void TextEditor::RestoreHistory(History&& aHistory)
 {
-	const static Palette p = { {
-			0xff00ffff,	// None
-			0xffffff00,	// Keyword	
-			0xff00ff00,	// Number
-			0xff808000,	// String
-			0xff808000, // Char literal
-			0xffffffff, // Punctuation
-			0xff008000,	// Preprocessor
-			0xff00ffff, // Identifier
-			0xffffffff, // Known identifier
-			0xffff00ff, // Preproc identifier
-			0xff808080, // Comment (single line)
-			0xff404040, // Comment (multi line)
-			0xff800000, // Background
-			0xff0080ff, // Cursor
-			0x80ffff00, // Selection
-			0xa00000ff, // ErrorMarker
-			0x80ff8000, // Breakpoint
-			0xff808000, // Line number
-			0x40000000, // Current line fill
-			0x40808080, // Current line fill (inactive)
+	mUndoBuffer = std::move(aHistory.mUndoBuffer);
+	mUndoIndex = aHistory.mUndoIndex;
+	mUndoMemoryUsage = aHistory.mUndoMemoryUsage;
+	mUndoMergeable = false;
+	mBreakpoints = std::move(aHistory.mBreakpoints);
+	mRemovedBreakpoints.clear();
+	mBreakpointsChanged = false;
+	TrimUndo();
+
+	// Folds past the end of the text (which should be the one the history was taken from) are dropped
+	mFolds = std::move(aHistory.mFolds);
+	auto lineCount = (int)mLines.size();
+	mFolds.erase(std::remove_if(mFolds.begin(), mFolds.end(), [lineCount](const FoldedRegion& aFold) { return aFold.mLine + aFold.mCount >= lineCount; }), mFolds.end());
+	UpdateFoldSums();
+
+	mState.mCursorPosition = SanitizeCoordinates(aHistory.mState.mCursorPosition);
+	SetSelection(aHistory.mState.mSelectionStart, aHistory.mState.mSelectionEnd);
+	mScrollToTop = false;
+	EnsureCursorVisible();
+}
+
+void TextEditor::SetFindQuery(const std::string& aText, bool aRegex, bool aCaseSensitive)
+{
+	if (aText == mFindQuery && aRegex == mFindRegex && aCaseSensitive == mFindCaseSensitive)
+		return;
+
+	mFindQuery = aText;
+	mFindRegex = aRegex;
+	mFindCaseSensitive = aCaseSensitive;
+	mFindRegexObject.reset();
+	if (aRegex && !aText.empty())
+	{
+		auto flags = std::regex::ECMAScript | std::regex::optimize;
+		if (!aCaseSensitive)
+			flags |= std::regex::icase;
+		try
+		{
+			mFindRegexObject = std::make_shared<const std::regex>(aText, flags);
+		}
+		catch (const std::regex_error&)
+		{
+		}
+	}
+
+	// Everything is searched again; a job in flight for the previous query is dropped by its id
+	++mFindQueryId;
+	mFindMatches.clear();
+	mFindShift = 0;
+	mFindRangeMin = 0;
+	mFindRangeMax = (int)mLines.size();
+	UpdateFindIndex();
+}
+
+int TextEditor::GetFindMatchCount()
+{
+	UpdateFindIndex();
+	return (int)mFindMatches.size();
+}
+
+int TextEditor::GetFindMatchIndex()
+{
+	UpdateFindIndex();
+	auto& start = mState.mSelectionStart;
+	auto& end = mState.mSelectionEnd;
+	if (!HasSelection() || start.mLine != end.mLine)
+		return -1;
+
+	FindMatch selection = { start.mLine, GetCharacterIndex(start), GetCharacterIndex(end) };
+	auto it = std::lower_bound(mFindMatches.begin(), mFindMatches.end(), selection, FindMatchLess);
+	if (it == mFindMatches.end() || it->mLine != selection.mLine || it->mBegin != selection.mBegin || it->mEnd != selection.mEnd)
+		return -1;
+	return (int)(it - mFindMatches.begin());
+}
+
+bool TextEditor::FindNext(bool aBackwards)
+{
+	UpdateFindIndex(true);
+	if (mFindMatches.empty())
+		return false;
+
+	auto from = HasSelection() ? (aBackwards ? mState.mSelectionStart : mState.mSelectionEnd) : GetActualCursorCoordinates();
+	FindMatch position = { from.mLine, GetCharacterIndex(from), 0 };
+	auto it = std::lower_bound(mFindMatches.begin(), mFindMatches.end(), position, FindMatchLess);
+	if (aBackwards)
+		SelectFindMatch(it != mFindMatches.begin() ? *(it - 1) : mFindMatches.back());
+	else
+		SelectFindMatch(it != mFindMatches.end() ? *it : mFindMatches.front());
+	return true;
+}
+
+bool TextEditor::Replace(const std::string& aReplacement)
+{
+	if (mReadOnly)
+		return false;
+
+	// The first Replace only selects a match, so that what gets replaced can be seen first
+	auto index = GetFindMatchIndex();
+	if (index < 0)
+	{
+		FindNext();
+		return false;
+	}
+
+	auto text = FormatReplacement(mFindMatches[index], aReplacement);
+
+	UndoRecord u;
+	u.mBefore = mState;
+	u.mRemoved = GetSelectedText();
+	u.mRemovedStart = mState.mSelectionStart;
+	u.mRemovedEnd = mState.mSelectionEnd;
+	DeleteSelection();
+
+	u.mAdded = text;
+	u.mAddedStart = GetActualCursorCoordinates();
+	InsertText(text);
+	u.mAddedEnd = GetActualCursorCoordinates();
+	u.mAfter = mState;
+	AddUndo(u);
+
+	FindNext();
+	return true;
+}
+
+int TextEditor::ReplaceAll(const std::string& aReplacement)
+{
+	UpdateFindIndex(true);
+	if (mReadOnly || mFindMatches.empty())
+		return 0;
+
+	// Every line is rewritten in place and recorded whole, so no line can be added
+	if (aReplacement.find('\n') != std::string::npos)
+		return 0;
+
+	UndoRecord u;
+	u.mBefore = mState;
+
+	std::string text;
+	for (size_t i = 0; i < mFindMatches.size(); )
+	{
+		auto lineIndex = mFindMatches[i].mLine;
+		auto& line = mLines[lineIndex];
+
+		text.clear();
+		int copied = 0;
+		for (; i < mFindMatches.size() && mFindMatches[i].mLine == lineIndex; ++i)
+		{
+			auto& match = mFindMatches[i];
+			text.append(line.mText, copied, match.mBegin - copied);
+			text += FormatReplacement(match, aReplacement);
+			copied = match.mEnd;
+		}
+		text.append(line.mText, copied, std::string::npos);
+
+		UndoRecord::LineChange change;
+		change.mLine = lineIndex;
+		change.mBefore = std::move(line.mText);
+		change.mAfter = text;
+		line.assign(text.data(), text.size());
+		u.mLineChanges.push_back(std::move(change));
+	}
+
+	auto count = (int)mFindMatches.size();
+	auto firstLine = u.mLineChanges.front().mLine;
+	auto lastLine = u.mLineChanges.back().mLine;
+
+	auto cursor = SanitizeCoordinates(GetActualCursorCoordinates());
+	SetSelection(cursor, cursor);
+	SetCursorPosition(cursor);
+	mTextChanged = true;
+	Colorize(firstLine, lastLine - firstLine + 1);
+
+	u.mAfter = mState;
+	AddUndo(u);
+	return count;
+}
+
+// Where aLine of the text before aChanges is after them. A line that was replaced goes to the
+// line that took its place, or to the last one if fewer took it.
+static int LineAfterChanges(int aLine, const std::vector<TextEditor::TextChange>& aChanges)
+{
+	auto delta = 0;
+	for (auto& change : aChanges)
+	{
+		if (aLine < change.mFirstLine)
+			break;
+		if (aLine < change.mFirstLine + change.mRemovedLines)
+			return change.mFirstLine + delta + std::min(aLine - change.mFirstLine, std::max(0, (int)change.mLines.size() - 1));
+		delta += (int)change.mLines.size() - change.mRemovedLines;
+	}
+	return aLine + delta;
+}
+
+void TextEditor::ReplaceLines(const std::vector<TextChange>& aChanges)
+{
+	if (mReadOnly || aChanges.empty())
+		return;
+
+	UndoRecord u;
+	u.mBefore = mState;
+
+	// From the last range up, so that the ranges above stay where they were
+	u.mRangeChanges.resize(aChanges.size());
+	for (size_t i = aChanges.size(); i-- > 0; )
+	{
+		auto& change = aChanges[i];
+		assert(i == 0 || aChanges[i - 1].mFirstLine + aChanges[i - 1].mRemovedLines < change.mFirstLine);
+		auto& range = u.mRangeChanges[i];
+		range.mLine = change.mFirstLine;
+		range.mBefore.reserve(change.mRemovedLines);
+		for (int j = 0; j < change.mRemovedLines; ++j)
+			range.mBefore.push_back(mLines[change.mFirstLine + j].mText);
+		range.mAfter = change.mLines;
+		ReplaceLineRange(change.mFirstLine, change.mRemovedLines, change.mLines);
+	}
+
+	// The cursor and the selection stay with the text they were on
+	for (auto position : { &mState.mCursorPosition, &mState.mSelectionStart, &mState.mSelectionEnd })
+		*position = SanitizeCoordinates(Coordinates(LineAfterChanges(position->mLine, aChanges), position->mColumn));
+
+	u.mAfter = mState;
+	AddUndo(u);
+}
+
+void TextEditor::ReplaceLineRange(int aLine, int aRemoved, const std::vector<std::string>& aLines)
+{
+	// As many lines as both have are rewritten in place; only the rest are inserted or removed
+	auto count = (int)aLines.size();
+	auto common = std::min(aRemoved, count);
+	for (int i = 0; i < common; ++i)
+		mLines[aLine + i].assign(aLines[i].data(), aLines[i].size());
+
+	if (aRemoved > common)
+	{
+		RemoveLine(aLine + common, aLine + aRemoved);
+	}
+	else if (count > common)
+	{
+		std::vector<Line> lines(count - common);
+		for (int i = common; i < count; ++i)
+			lines[i - common].assign(aLines[i].data(), aLines[i].size());
+		InsertLines(aLine + common, std::move(lines));
+	}
+
+	mTextChanged = true;
+	Colorize(aLine - 1, count + 2);
+}
+
+bool TextEditor::FindMatchLess(const FindMatch& aLeft, const FindMatch& aRight)
+{
+	return aLeft.mLine < aRight.mLine || (aLeft.mLine == aRight.mLine && aLeft.mBegin < aRight.mBegin);
+}
+
+void TextEditor::UpdateFindIndex(bool aWait)
+{
+	FlushFindShift();
+	if (mFindInFlight)
+		ApplyFindResult();
+
+	if (mFindQuery.empty() || (mFindRegex && mFindRegexObject == nullptr))
+	{
+		mFindRangeMin = std::numeric_limits<int>::max();
+		mFindRangeMax = 0;
+		return;
+	}
+
+	auto fromLine = mFindRangeMin;
+	auto toLine = std::min(mFindRangeMax, (int)mLines.size());
+	if (mFindRangeMin >= mFindRangeMax)
+		return;
+
+	if (!mFindRegex || aWait || toLine - fromLine <= kFindSyncLines)
+	{
+		std::vector<FindMatch> matches;
+		for (int i = fromLine; i < toLine; ++i)
+		{
+			auto& text = mLines[i].mText;
+			if (mFindRegex)
+				FindRegex(*mFindRegexObject, text.data(), text.data() + text.size(), i, matches);
+			else
+				FindLiteral(mFindQuery, mFindCaseSensitive, text.data(), text.data() + text.size(), i, matches);
+		}
+		ReplaceFindMatches(fromLine, toLine, matches);
+
+		mFindRangeMin = std::numeric_limits<int>::max();
+		mFindRangeMax = 0;
+	}
+	else if (!mFindInFlight)
+	{
+		SubmitFindJob(fromLine, std::min(toLine, fromLine + kFindJobLines));
+	}
+}
+
+// Find matches and symbols are kept in vectors sorted by line (their mLine), and move along
+// as lines are inserted and removed.
+
+template<class T>
+static typename std::vector<T>::iterator LowerBoundLine(std::vector<T>& aItems, typename std::vector<T>::iterator aFrom, int aLine)
+{
+	return std::partition_point(aFrom, aItems.end(), [aLine](const T& aItem) { return aItem.mLine < aLine; });
+}
+
+// Replaces the items of lines [aFromLine, aToLine); items past the last line (aToLine reaching
+// aLineCount) are left over from lines that no longer exist
+template<class T>
+static void ReplaceLineItems(std::vector<T>& aItems, int aFromLine, int aToLine, int aLineCount, const std::vector<T>& aNewItems)
+{
+	auto first = LowerBoundLine(aItems, aItems.begin(), aFromLine);
+	auto last = aToLine >= aLineCount ? aItems.end() : LowerBoundLine(aItems, first, aToLine);
+
+	// Most edits leave the number of items of a line alone: only the difference moves the
+	// items below
+	auto kept = std::min((size_t)(last - first), aNewItems.size());
+	first = std::copy(aNewItems.begin(), aNewItems.begin() + kept, first);
+	first = aItems.erase(first, last);
+	aItems.insert(first, aNewItems.begin() + kept, aNewItems.end());
+}
+
+// Items from aShiftLine down are aShift lines further down than recorded
+template<class T>
+static void FlushLineItemsShift(std::vector<T>& aItems, int& aShiftLine, int& aShift)
+{
+	if (aShift == 0)
+		return;
+
+	for (auto it = LowerBoundLine(aItems, aItems.begin(), aShiftLine); it != aItems.end(); ++it)
+		it->mLine += aShift;
+	aShift = 0;
+}
+
+template<class T>
+static void ShiftLineItems(std::vector<T>& aItems, int& aShiftLine, int& aShift, int aFromLine, int aDelta)
+{
+	if (aItems.empty())
+		return;
+
+	// Text with many lines is inserted one line at a time, each line right below the previous
+	// one: the shifts are summed up and applied once instead of moving every later item again
+	// for every line
+	if (aDelta > 0 && aShift > 0 && aFromLine >= aShiftLine && aFromLine <= aShiftLine + aShift)
+	{
+		aShift += aDelta;
+		return;
+	}
+
+	FlushLineItemsShift(aItems, aShiftLine, aShift);
+	if (aDelta > 0)
+	{
+		aShiftLine = aFromLine;
+		aShift = aDelta;
+		return;
+	}
+
+	auto it = LowerBoundLine(aItems, aItems.begin(), aFromLine);
+	it = aItems.erase(it, LowerBoundLine(aItems, it, aFromLine - aDelta));
+	for (; it != aItems.end(); ++it)
+		it->mLine += aDelta;
+}
+
+void TextEditor::ReplaceFindMatches(int aFromLine, int aToLine, const std::vector<FindMatch>& aMatches)
+{
+	ReplaceLineItems(mFindMatches, aFromLine, aToLine, (int)mLines.size(), aMatches);
+}
+
+void TextEditor::ShiftFindMatches(int aFromLine, int aDelta)
+{
+	if (aFromLine < mFindRangeMax && mFindRangeMax != std::numeric_limits<int>::max())
+		mFindRangeMax = std::max(aFromLine, mFindRangeMax + aDelta);
+	ShiftLineItems(mFindMatches, mFindShiftLine, mFindShift, aFromLine, aDelta);
+}
+
+void TextEditor::FlushFindShift()
+{
+	FlushLineItemsShift(mFindMatches, mFindShiftLine, mFindShift);
+}
+
+static size_t FindByte(const char* aText, size_t aFrom, size_t aEnd, char aByte)
+{
+	auto found = (const char*)memchr(aText + aFrom, aByte, aEnd - aFrom);
+	return found != nullptr ? (size_t)(found - aText) : aEnd;
+}
+
+static bool EqualsIgnoreCase(const char* aLeft, const char* aRight, size_t aLength)
+{
+	for (size_t i = 0; i < aLength; ++i)
+	{
+		if (tolower((unsigned char)aLeft[i]) != tolower((unsigned char)aRight[i]))
+			return false;
+	}
+	return true;
+}
+
+void TextEditor::FindLiteral(const std::string& aQuery, bool aCaseSensitive, const char* aBegin, const char* aEnd, int aLine, std::vector<FindMatch>& aMatches)
+{
+	auto length = aQuery.size();
+	if (length == 0 || (size_t)(aEnd - aBegin) < length)
+		return;
+
+	// memchr, which the C runtime vectorizes, skips to the next occurrence of the first byte
+	// (of either case) of the query, and only those candidates are compared in full
+	auto query = aQuery.data();
+	auto first = query[0];
+	auto other = aCaseSensitive ? first : (char)(islower((unsigned char)first) ? toupper((unsigned char)first) : tolower((unsigned char)first));
+	auto candidates = (size_t)(aEnd - aBegin) - length + 1;
+
+	auto nextFirst = FindByte(aBegin, 0, candidates, first);
+	auto nextOther = other != first ? FindByte(aBegin, 0, candidates, other) : candidates;
+	for (;;)
+	{
+		auto index = std::min(nextFirst, nextOther);
+		if (index >= candidates)
+			break;
+
+		auto equal = aCaseSensitive
+			? memcmp(aBegin + index + 1, query + 1, length - 1) == 0
+			: EqualsIgnoreCase(aBegin + index + 1, query + 1, length - 1);
+		auto next = index + (equal ? length : 1);
+		if (equal)
+			aMatches.push_back({ aLine, (int)index, (int)(index + length) });
+
+		if (nextFirst < next)
+			nextFirst = FindByte(aBegin, next, candidates, first);
+		if (nextOther < next)
+			nextOther = FindByte(aBegin, next, candidates, other);
+	}
+}
+
+void TextEditor::FindRegex(const std::regex& aRegex, const char* aBegin, const char* aEnd, int aLine, std::vector<FindMatch>& aMatches)
+{
+	for (std::cregex_iterator it(aBegin, aEnd, aRegex), end; it != end; ++it)
+	{
+		if (it->length(0) > 0)
+			aMatches.push_back({ aLine, (int)it->position(0), (int)(it->position(0) + it->length(0)) });
+	}
+}
+
+void TextEditor::FindThread()
+{
+	std::unique_lock<std::mutex> lock(mFindMutex);
+	for (;;)
+	{
+		mFindCondition.wait(lock, [this] { return mFindQuit || mFindJob != nullptr; });
+		if (mFindQuit)
+			return;
+
+		auto job = std::move(mFindJob);
+		lock.unlock();
+
+		auto result = std::make_unique<FindResult>();
+		result->mGeneration = job->mGeneration;
+		result->mQueryId = job->mQueryId;
+		result->mFirstLine = job->mFirstLine;
+		result->mLineCount = (int)job->mLineEnds.size();
+
+		const char* text = job->mText.data();
+		int lineStart = 0;
+		for (size_t i = 0; i < job->mLineEnds.size(); ++i)
+		{
+			FindRegex(*job->mRegex, text + lineStart, text + job->mLineEnds[i], job->mFirstLine + (int)i, result->mMatches);
+			lineStart = job->mLineEnds[i];
+		}
+
+		lock.lock();
+		mFindResult = std::move(result);
+	}
+}
+
+void TextEditor::StopFindThread()
+{
+	if (!mFindThread.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(mFindMutex);
+		mFindQuit = true;
+	}
+	mFindCondition.notify_one();
+	mFindThread.join();
+}
+
+void TextEditor::SubmitFindJob(int aFromLine, int aToLine)
+{
+	auto job = std::make_unique<FindJob>();
+	job->mGeneration = mEditGeneration;
+	job->mQueryId = mFindQueryId;
+	job->mFirstLine = aFromLine;
+	job->mRegex = mFindRegexObject;
+	job->mLineEnds.reserve(aToLine - aFromLine);
+	for (int i = aFromLine; i < aToLine; ++i)
+	{
+		job->mText += mLines[i].mText;
+		job->mLineEnds.push_back((int)job->mText.size());
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mFindMutex);
+		mFindJob = std::move(job);
+	}
+	mFindInFlight = true;
+
+	if (mFindThread.joinable())
+		mFindCondition.notify_one();
+	else
+		mFindThread = std::thread(&TextEditor::FindThread, this);
+}
+
+bool TextEditor::ApplyFindResult()
+{
+	std::unique_ptr<FindResult> result;
+	{
+		std::lock_guard<std::mutex> lock(mFindMutex);
+		result = std::move(mFindResult);
+	}
+	if (!result)
+		return false;
+
+	mFindInFlight = false;
+
+	// Edited lines, or another query, since the job was submitted: the pending range still
+	// covers the lines, which will be resubmitted
+	if (result->mGeneration != mEditGeneration || result->mQueryId != mFindQueryId || result->mFirstLine != mFindRangeMin)
+		return true;
+
+	auto toLine = result->mFirstLine + result->mLineCount;
+	ReplaceFindMatches(result->mFirstLine, toLine, result->mMatches);
+	mFindRangeMin = toLine;
+	if (mFindRangeMin >= mFindRangeMax)
+	{
+		mFindRangeMin = std::numeric_limits<int>::max();
+		mFindRangeMax = 0;
+	}
+	return true;
+}
+
+std::string TextEditor::FormatReplacement(const FindMatch& aMatch, const std::string& aReplacement) const
+{
+	if (!mFindRegex || mFindRegexObject == nullptr)
+		return aReplacement;
+
+	// Match again at the same place to get the captures
+	auto& text = mLines[aMatch.mLine].mText;
+	auto flags = std::regex_constants::match_continuous;
+	if (aMatch.mBegin > 0)
+		flags |= std::regex_constants::match_prev_avail;
+	std::cmatch results;
+	if (!std::regex_search(text.data() + aMatch.mBegin, text.data() + text.size(), results, *mFindRegexObject, flags))
+		return aReplacement;
+	return results.format(aReplacement);
+}
+
+void TextEditor::SelectFindMatch(const FindMatch& aMatch)
+{
+	Coordinates start(aMatch.mLine, GetCharacterColumn(aMatch.mLine, aMatch.mBegin));
+	Coordinates end(aMatch.mLine, GetCharacterColumn(aMatch.mLine, aMatch.mEnd));
+	SetSelection(start, end);
+	SetCursorPosition(end);
+}
+
+const TextEditor::Symbols& TextEditor::GetSymbols()
+{
+	FlushLineItemsShift(mSymbols, mSymbolShiftLine, mSymbolShift);
+	return mSymbols;
+}
+
+const TextEditor::Symbol* TextEditor::FindDefinition(const std::string& aName, int aLine)
+{
+	auto& symbols = GetSymbols();
+	if (aLine < 0 || aLine >= (int)mLines.size())
+		return nullptr;
+
+	// Going up from aLine, a definition less indented than the ones seen so far closes the
+	// blocks those are in: the ones indented deeper than it are out of reach
+	auto& text = mLines[aLine].mText;
+	auto reach = (int)(std::find_if(text.begin(), text.end(), [](char c) { return c != ' ' && c != '\t'; }) - text.begin());
+	auto below = std::partition_point(symbols.begin(), symbols.end(), [aLine](const Symbol& aSymbol) { return aSymbol.mLine <= aLine; });
+	for (auto it = below; it != symbols.begin(); )
+	{
+		--it;
+		if (it->mIndent <= reach && it->mName == aName)
+			return &*it;
+		reach = std::min(reach, it->mIndent);
+	}
+
+	// Not defined above: defined further down at the top level, or else a function or class
+	// defined anywhere, e.g. a method called from another class
+	auto isCallable = [](const Symbol& aSymbol) { return aSymbol.mKind == SymbolKind::Function || aSymbol.mKind == SymbolKind::Class; };
+	const Symbol* callable = nullptr;
+	for (auto it = below; it != symbols.end(); ++it)
+	{
+		if (it->mName != aName)
+			continue;
+		if (it->mIndent == 0)
+			return &*it;
+		if (callable == nullptr && isCallable(*it))
+			callable = &*it;
+	}
+	for (auto it = symbols.begin(); it != below && callable == nullptr; ++it)
+	{
+		if (it->mName == aName && isCallable(*it))
+			callable = &*it;
+	}
+	return callable;
+}
+
+void TextEditor::GoToSymbol(const Symbol& aSymbol)
+{
+	if (aSymbol.mLine >= (int)mLines.size())
+		return;
+
+	Coordinates start(aSymbol.mLine, GetCharacterColumn(aSymbol.mLine, aSymbol.mIndex));
+	Coordinates end(aSymbol.mLine, GetCharacterColumn(aSymbol.mLine, aSymbol.mIndex + (int)aSymbol.mName.size()));
+	SetSelection(start, end);
+	SetCursorPosition(start);
+	mScrollToCursor = true;
+}
+
+bool TextEditor::GoToDefinition()
+{
+	auto cursor = GetCursorPosition();
+	auto symbol = FindDefinition(GetWordAt(cursor), cursor.mLine);
+	if (symbol == nullptr)
+		return false;
+
+	GoToSymbol(*symbol);
+	return true;
+}
+
+void TextEditor::UpdateSymbols()
+{
+	FlushLineItemsShift(mSymbols, mSymbolShiftLine, mSymbolShift);
+
+	auto symbolize = mLanguageDefinition.mSymbolize;
+	auto lineCount = (int)mLines.size();
+	auto fromLine = mSymbolRangeMin;
+	auto toLine = std::min({ mSymbolRangeMax, lineCount, fromLine + kSymbolFrameLines });
+	if (symbolize == nullptr || fromLine >= toLine)
+	{
+		if (symbolize == nullptr)
+		{
+			mSymbols.clear();
+			mSymbolNames.Clear();
+		}
+		mSymbolRangeMin = std::numeric_limits<int>::max();
+		mSymbolRangeMax = 0;
+		return;
+	}
+
+	Symbols symbols;
+	for (int i = fromLine; i < toLine; ++i)
+	{
+		auto& line = mLines[i];
+		if (mColorizerEnabled && StartsInStringOrComment(line))
+			continue;
+		symbolize(line.mText.data(), line.mText.data() + line.mText.size(), i, symbols);
+	}
+
+	// The names of the symbols replaced leave the completion names, the new ones join them
+	auto first = LowerBoundLine(mSymbols, mSymbols.begin(), fromLine);
+	auto last = toLine >= lineCount ? mSymbols.end() : LowerBoundLine(mSymbols, first, toLine);
+	for (auto it = first; it != last; ++it)
+		mSymbolNames.Remove(it->mName);
+	for (auto& symbol : symbols)
+		mSymbolNames.Add(symbol.mName);
+	ReplaceLineItems(mSymbols, fromLine, toLine, lineCount, symbols);
+
+	mSymbolRangeMin = toLine;
+	if (mSymbolRangeMin >= std::min(mSymbolRangeMax, lineCount))
+	{
+		mSymbolRangeMin = std::numeric_limits<int>::max();
+		mSymbolRangeMax = 0;
+	}
+}
+
+bool TextEditor::StartsInStringOrComment(const Line& aLine) const
+{
+	if (mLanguageDefinition.mTokenizeLine != nullptr)
+		return aLine.mLexState != 0;
+	return (aLine.mLexState & (LexState_String | LexState_MultiLineComment)) != 0;
+}
+
+void TextEditor::ResetSymbols()
+{
+	mSymbols.clear();
+	mSymbolNames.Clear();
+	mSymbolShift = 0;
+	if (mLanguageDefinition.mSymbolize != nullptr)
+	{
+		mSymbolRangeMin = 0;
+		mSymbolRangeMax = (int)mLines.size();
+	}
+}
+
+void TextEditor::ShiftSymbols(int aFromLine, int aDelta)
+{
+	if (aFromLine < mSymbolRangeMax && mSymbolRangeMax != std::numeric_limits<int>::max())
+		mSymbolRangeMax = std::max(aFromLine, mSymbolRangeMax + aDelta);
+
+	// The symbols of removed lines go, and their names with them
+	if (aDelta < 0)
+	{
+		FlushLineItemsShift(mSymbols, mSymbolShiftLine, mSymbolShift);
+		auto first = LowerBoundLine(mSymbols, mSymbols.begin(), aFromLine);
+		auto last = LowerBoundLine(mSymbols, first, aFromLine - aDelta);
+		for (auto it = first; it != last; ++it)
+			mSymbolNames.Remove(it->mName);
+	}
+	ShiftLineItems(mSymbols, mSymbolShiftLine, mSymbolShift, aFromLine, aDelta);
+}
+
+void TextEditor::CompletionTrie::Add(const std::string& aWord)
+{
+	if (mNodes.empty())
+		mNodes.emplace_back();
+
+	auto node = 0;
+	++mNodes[node].mTotal;
+	for (auto c : aWord)
+	{
+		auto child = FindChild(node, c);
+		if (child < 0)
+		{
+			if (mFreeNodes.empty())
+			{
+				child = (int)mNodes.size();
+				mNodes.emplace_back();
+			}
+			else
+			{
+				child = mFreeNodes.back();
+				mFreeNodes.pop_back();
+			}
+
+			auto& children = mNodes[node].mChildren;
+			auto at = std::lower_bound(children.begin(), children.end(), c, [](const std::pair<char, int>& aChild, char aChar) {
+				return (unsigned char)aChild.first < (unsigned char)aChar; });
+			children.insert(at, std::make_pair(c, child));
+		}
+		node = child;
+		++mNodes[node].mTotal;
+	}
+	++mNodes[node].mCount;
+}
+
+void TextEditor::CompletionTrie::Remove(const std::string& aWord)
+{
+	if (mNodes.empty())
+		return;
+
+	// The word is there if its node counts it, and then every node on its path counts it too
+	std::vector<int> path(1, 0);
+	for (auto c : aWord)
+	{
+		auto child = FindChild(path.back(), c);
+		if (child < 0)
+			return;
+		path.push_back(child);
+	}
+	if (mNodes[path.back()].mCount == 0)
+		return;
+
+	--mNodes[path.back()].mCount;
+	for (auto node : path)
+		--mNodes[node].mTotal;
+
+	// Below the first node left without words, the path holds nothing else either
+	for (size_t i = 1; i < path.size(); ++i)
+	{
+		if (mNodes[path[i]].mTotal != 0)
+			continue;
+
+		auto& children = mNodes[path[i - 1]].mChildren;
+		children.erase(std::find_if(children.begin(), children.end(), [&](const std::pair<char, int>& aChild) { return aChild.second == path[i]; }));
+		for (auto j = i; j < path.size(); ++j)
+		{
+			mNodes[path[j]].mChildren.clear();
+			mFreeNodes.push_back(path[j]);
+		}
+		break;
+	}
+}
+
+void TextEditor::CompletionTrie::Clear()
+{
+	mNodes.clear();
+	mFreeNodes.clear();
+}
+
+void TextEditor::CompletionTrie::Find(const std::string& aPrefix, size_t aMax, std::vector<std::string>& aWords) const
+{
+	if (mNodes.empty() || aMax == 0)
+		return;
+
+	auto node = 0;
+	for (auto c : aPrefix)
+	{
+		node = FindChild(node, c);
+		if (node < 0)
+			return;
+	}
+
+	// Depth first, children in byte order: the words come out sorted
+	auto end = aWords.size() + aMax;
+	std::string word = aPrefix;
+	std::vector<std::pair<int, size_t>> stack;	// node, and index of the next child to visit
+	if (mNodes[node].mCount > 0)
+		aWords.push_back(word);
+	stack.emplace_back(node, 0);
+	while (!stack.empty() && aWords.size() < end)
+	{
+		auto& top = stack.back();
+		auto& children = mNodes[top.first].mChildren;
+		if (top.second == children.size())
+		{
+			stack.pop_back();
+			if (!stack.empty())
+				word.pop_back();
+			continue;
+		}
+
+		auto& child = children[top.second++];
+		word.push_back(child.first);
+		if (mNodes[child.second].mCount > 0)
+			aWords.push_back(word);
+		stack.emplace_back(child.second, 0);
+	}
+}
+
+int TextEditor::CompletionTrie::FindChild(int aNode, char aChar) const
+{
+	for (auto& child : mNodes[aNode].mChildren)
+	{
+		if (child.first == aChar)
+			return child.second;
+	}
+	return -1;
+}
+
+void TextEditor::SetCompletionWords(const std::vector<std::string>& aWords)
+{
+	for (auto& word : mExtraCompletionWords)
+		mCompletionWords.Remove(word);
+	mExtraCompletionWords = aWords;
+	for (auto& word : mExtraCompletionWords)
+		mCompletionWords.Add(word);
+	CloseCompletion();
+}
+
+void TextEditor::SetCompletionMembers(const std::string& aObject, const std::vector<std::string>& aMembers)
+{
+	CloseCompletion();
+	if (aMembers.empty())
+	{
+		mCompletionMembers.erase(aObject);
+		return;
+	}
+
+	auto& members = mCompletionMembers[aObject];
+	members.Clear();
+	for (auto& member : aMembers)
+		members.Add(member);
+}
+
+void TextEditor::SetCompletionEnabled(bool aValue)
+{
+	mCompletionEnabled = aValue;
+	if (!aValue)
+		CloseCompletion();
+}
+
+void TextEditor::AddLanguageCompletionWords(const LanguageDefinition& aLanguageDef, bool aAdd)
+{
+	// Counted words: a keyword that is also given to SetCompletionWords stays when either goes
+	for (auto& keyword : aLanguageDef.mKeywords)
+		aAdd ? mCompletionWords.Add(keyword) : mCompletionWords.Remove(keyword);
+	for (auto& identifier : aLanguageDef.mIdentifiers)
+		aAdd ? mCompletionWords.Add(identifier.first) : mCompletionWords.Remove(identifier.first);
+}
+
+void TextEditor::UpdateCompletion()
+{
+	auto requested = mCompletionRequested;
+	mCompletionRequested = false;
+	if (!mCompletionEnabled || HasSelection())
+	{
+		CloseCompletion();
+		return;
+	}
+
+	// The name being typed ends at the cursor
+	auto cursor = GetActualCursorCoordinates();
+	auto& text = mLines[cursor.mLine].mText;
+	auto end = GetCharacterIndex(cursor);
+	auto start = end;
+	while (start > 0 && IsWordCharacter(text[start - 1]))
+		--start;
+
+	Coordinates startCoords(cursor.mLine, GetCharacterColumn(cursor.mLine, start));
+	auto moved = !mCompletionOpen || startCoords != mCompletionStart;
+	if ((moved && !requested) || (start < end && isdigit((unsigned char)text[start])))
+	{
+		CloseCompletion();
+		return;
+	}
+
+	// After "object." only the members of object are listed, if it is one of the known objects
+	// and not itself a member of something else
+	const CompletionTrie* members = nullptr;
+	if (start > 0 && text[start - 1] == '.')
+	{
+		auto objectStart = start - 1;
+		while (objectStart > 0 && IsWordCharacter(text[objectStart - 1]))
+			--objectStart;
+		auto it = mCompletionMembers.find(text.substr(objectStart, start - 1 - objectStart));
+		if (it == mCompletionMembers.end() || (objectStart > 0 && text[objectStart - 1] == '.'))
+		{
+			CloseCompletion();
+			return;
+		}
+		members = &it->second;
+	}
+	if ((members == nullptr && start == end) || IsInStringOrComment(cursor.mLine, members != nullptr ? start - 1 : start))
+	{
+		CloseCompletion();
+		return;
+	}
+
+	auto prefix = text.substr(start, end - start);
+	mCompletions.clear();
+	if (members != nullptr)
+	{
+		members->Find(prefix, kMaxCompletions, mCompletions);
+	}
+	else
+	{
+		// Both lists are sorted: the first kMaxCompletions names of both are among theirs
+		mSymbolNames.Find(prefix, kMaxCompletions, mCompletions);
+		auto symbolCount = mCompletions.size();
+		mCompletionWords.Find(prefix, kMaxCompletions, mCompletions);
+		std::inplace_merge(mCompletions.begin(), mCompletions.begin() + symbolCount, mCompletions.end());
+		mCompletions.erase(std::unique(mCompletions.begin(), mCompletions.end()), mCompletions.end());
+		if (mCompletions.size() > kMaxCompletions)
+			mCompletions.resize(kMaxCompletions);
+	}
+
+	// Nothing to add to a name typed in full
+	if (!mCompletions.empty() && mCompletions.front() == prefix)
+		mCompletions.erase(mCompletions.begin());
+	if (mCompletions.empty())
+	{
+		CloseCompletion();
+		return;
+	}
+
+	mCompletionOpen = true;
+	mCompletionStart = startCoords;
+	mCompletionIndex = 0;
+	mCompletionTop = 0;
+}
+
+void TextEditor::CloseCompletion()
+{
+	mCompletionOpen = false;
+	mCompletionRequested = false;
+	mCompletions.clear();
+	mCompletionRectMin = mCompletionRectMax = ImVec2();
+}
+
+void TextEditor::AcceptCompletion()
+{
+	if (!mCompletionOpen || IsReadOnly())
+		return;
+
+	auto word = mCompletions[mCompletionIndex];
+	auto start = mCompletionStart;
+	CloseCompletion();
+
+	UndoRecord u;
+	u.mBefore = mState;
+
+	auto cursor = GetActualCursorCoordinates();
+	if (start < cursor)
+	{
+		SetSelection(start, cursor);
+		u.mRemoved = GetSelectedText();
+		u.mRemovedStart = mState.mSelectionStart;
+		u.mRemovedEnd = mState.mSelectionEnd;
+		DeleteSelection();
+	}
+
+	u.mAdded = word;
+	u.mAddedStart = GetActualCursorCoordinates();
+
+	InsertText(word);
+
+	u.mAddedEnd = GetActualCursorCoordinates();
+	u.mAfter = mState;
+	AddUndo(u);
+}
+
+bool TextEditor::HandleCompletionKeys()
+{
+	ImGuiIO& io = ImGui::GetIO();
+	auto shift = io.KeyShift;
+	auto ctrl = io.ConfigMacOSXBehaviors ? io.KeySuper : io.KeyCtrl;
+	auto alt = io.ConfigMacOSXBehaviors ? io.KeyCtrl : io.KeyAlt;
+	if (ctrl || alt)
+		return false;
+
+	auto count = (int)mCompletions.size();
+	if (!shift && ImGui::IsKeyPressed(ImGui_GetKeyIndex(ImGuiKey_UpArrow)))
+		mCompletionIndex = (mCompletionIndex + count - 1) % count;
+	else if (!shift && ImGui::IsKeyPressed(ImGui_GetKeyIndex(ImGuiKey_DownArrow)))
+		mCompletionIndex = (mCompletionIndex + 1) % count;
+	else if (!shift && ImGui::IsKeyPressed(ImGui_GetKeyIndex(ImGuiKey_PageUp)))
+		mCompletionIndex = std::max(0, mCompletionIndex - kCompletionRows);
+	else if (!shift && ImGui::IsKeyPressed(ImGui_GetKeyIndex(ImGuiKey_PageDown)))
+		mCompletionIndex = std::min(count - 1, mCompletionIndex + kCompletionRows);
+	else if (!shift && (ImGui::IsKeyPressed(ImGui_GetKeyIndex(ImGuiKey_Enter)) || ImGui::IsKeyPressed(ImGui_GetKeyIndex(ImGuiKey_Tab))))
+		AcceptCompletion();
+	else if (ImGui::IsKeyPressed(ImGui_GetKeyIndex(ImGuiKey_Escape)))
+		CloseCompletion();
+	else
+		return false;
+	return true;
+}
+
+bool TextEditor::IsInStringOrComment(int aLine, int aIndex) const
+{
+	auto& line = mLines[aLine];
+	if (mLanguageDefinition.mTokenizeLine != nullptr)
+	{
+		Tokens tokens;
+		mLanguageDefinition.mTokenizeLine(line.mText.data(), line.mText.data() + line.mText.size(), line.mLexState, &tokens);
+		for (auto& token : tokens)
+		{
+			if (token.mBegin <= aIndex && aIndex < token.mEnd)
+				return token.mColor == PaletteIndex::String || token.mColor == PaletteIndex::Comment;
+		}
+		return false;
+	}
+
+	// Colors come from the colorizer and may lag behind the text just typed: the character
+	// before tells
+	if (aIndex == 0 || !mColorizerEnabled)
+		return false;
+	auto color = line.GetColor(aIndex - 1);
+	return line.HasFlag(aIndex - 1, (AttributeFlags)(Attribute_Comment | Attribute_MultiLineComment)) ||
+		color == PaletteIndex::String || color == PaletteIndex::CharLiteral;
+}
+
+void TextEditor::RenderCompletion(const ImVec2& aTextOrigin)
+{
+	auto count = (int)mCompletions.size();
+	auto rows = std::min(count, (int)kCompletionRows);
+	mCompletionTop = std::max(std::min(mCompletionTop, mCompletionIndex), mCompletionIndex - rows + 1);
+
+	auto font = ImGui::GetFont();
+	auto fontSize = ImGui::GetFontSize();
+	auto padding = mCharAdvance.x * 0.5f;
+	auto width = 0.0f;
+	for (int i = mCompletionTop; i < mCompletionTop + rows; ++i)
+		width = std::max(width, font->CalcTextSizeA(fontSize, FLT_MAX, -1.0f, mCompletions[i].c_str()).x);
+
+	// Below the line of the name, or above it if there is no room below
+	auto height = rows * mCharAdvance.y;
+	int rowColumn;
+	auto lineY = aTextOrigin.y + CoordinatesToRow(mCompletionStart, &rowColumn) * mCharAdvance.y;
+	auto windowTop = ImGui::GetWindowPos().y;
+	auto windowBottom = windowTop + ImGui::GetWindowHeight();
+	if (lineY + mCharAdvance.y <= windowTop || lineY >= windowBottom)
+	{
+		mCompletionRectMin = mCompletionRectMax = ImVec2();
+		return;
+	}
+	auto y = lineY + mCharAdvance.y;
+	if (y + height > windowBottom && lineY - height >= windowTop)
+		y = lineY - height;
+
+	auto x = TextDistanceToLineStart(mCompletionStart) - TextDistanceToLineStart(Coordinates(mCompletionStart.mLine, rowColumn));
+	mCompletionRectMin = ImVec2(aTextOrigin.x + x - padding, y);
+	mCompletionRectMax = ImVec2(mCompletionRectMin.x + width + 2.0f * padding, y + height);
+
+	// Drawn over the other windows, like a tooltip
+	auto drawList = ImGui::GetForegroundDrawList();
+	drawList->AddRectFilled(mCompletionRectMin, mCompletionRectMax, mPalette[(int)PaletteIndex::Background]);
+	for (int i = mCompletionTop; i < mCompletionTop + rows; ++i)
+	{
+		ImVec2 rowStart(mCompletionRectMin.x, y + (i - mCompletionTop) * mCharAdvance.y);
+		if (i == mCompletionIndex)
+			drawList->AddRectFilled(rowStart, ImVec2(mCompletionRectMax.x, rowStart.y + mCharAdvance.y), mPalette[(int)PaletteIndex::Selection]);
+		drawList->AddText(font, fontSize, ImVec2(rowStart.x + padding, rowStart.y), mPalette[(int)PaletteIndex::Identifier], mCompletions[i].c_str());
+	}
+	drawList->AddRect(mCompletionRectMin, mCompletionRectMax, mPalette[(int)PaletteIndex::LineNumber]);
+}
+
+// Rows of the minimap are a few pixels high, columns half as wide
+static float MinimapRowHeight(float aLineHeight)
+{
+	return std::max(1.0f, std::floor(aLineHeight / 8.0f));
+}
+
+float TextEditor::GetMinimapWidth() const
+{
+	return mShowMinimap ? kMinimapColumns * 0.5f * MinimapRowHeight(mCharAdvance.y) : 0.0f;
+}
+
+bool TextEditor::HandleMinimapMouse()
+{
+	if (mMinimapDragging && !ImGui::IsMouseDown(0))
+		mMinimapDragging = false;
+
+	if (!mMinimapDragging)
+	{
+		if (!ImGui::IsWindowHovered() || !ImGui::IsMouseHoveringRect(mMinimapRectMin, mMinimapRectMax, false))
+			return false;
+
+		ImGui::SetMouseCursor(ImGuiMouseCursor_Arrow);
+		if (!ImGui::IsMouseClicked(0))
+			return true;
+
+		// The frame is dragged by the point clicked on it; a click elsewhere centers it there
+		auto y = ImGui::GetMousePos().y;
+		if (y >= mMinimapFrameTop && y < mMinimapFrameBottom)
+			mMinimapGrab = y - mMinimapFrameTop;
+		else
+			mMinimapGrab = 0.5f * (mMinimapFrameBottom - mMinimapFrameTop);
+		mMinimapDragging = true;
+	}
+
+	ImGui::GetIO().WantCaptureMouse = true;
+	if (mMinimapTrack > 0.0f)
+	{
+		auto progress = (ImGui::GetMousePos().y - mMinimapGrab - mMinimapRectMin.y) / mMinimapTrack;
+		ImGui::SetScrollY(std::max(0.0f, std::min(1.0f, progress)) * ImGui::GetScrollMaxY());
+	}
+	return true;
+}
+
+void TextEditor::RenderMinimap(const ImVec2& aMin, const ImVec2& aMax, float aScrollY, float aScrollMaxY)
+{
+	auto drawList = ImGui::GetWindowDrawList();
+	auto rowHeight = MinimapRowHeight(mCharAdvance.y);
+	auto columnWidth = 0.5f * rowHeight;
+	auto barHeight = rowHeight > 2.0f ? rowHeight - 1.0f : rowHeight;
+
+	mMinimapRectMin = aMin;
+	mMinimapRectMax = aMax;
+	drawList->PushClipRect(aMin, aMax, true);
+	drawList->AddRectFilled(aMin, aMax, mPalette[(int)PaletteIndex::Background]);
+	drawList->AddLine(aMin, ImVec2(aMin.x, aMax.y), ImGui::GetColorU32(ImGuiCol_Border));
+
+	// A document taller than the minimap scrolls through it along with the text, its top row
+	// going from the first row of the document to the last rows that fill the minimap
+	auto rows = GetRowCount();
+	auto fitRows = (aMax.y - aMin.y) / rowHeight;
+	auto overflow = std::max(0.0f, rows - fitRows);
+	auto progress = aScrollMaxY > 0.0f ? std::max(0.0f, std::min(1.0f, aScrollY / aScrollMaxY)) : 0.0f;
+	auto top = progress * overflow;
+
+	// The frame around the rows shown by the text moves by mMinimapTrack over the scroll range
+	mMinimapFrameTop = aMin.y + (aScrollY / mCharAdvance.y - top) * rowHeight;
+	mMinimapFrameBottom = mMinimapFrameTop + (aMax.y - aMin.y) / mCharAdvance.y * rowHeight;
+	mMinimapTrack = (aScrollMaxY / mCharAdvance.y - overflow) * rowHeight;
+
+	auto row = std::min((int)top, rows - 1);
+	auto rowEnd = std::min(rows, (int)std::ceil(top + fitRows));
+	auto lineNo = RowToLine(row);
+	row = LineToRow(lineNo);
+	auto fold = std::partition_point(mFolds.begin(), mFolds.end(), [lineNo](const FoldedRegion& aFold) { return aFold.mLine < lineNo; });
+	FindMatch firstMatch = { lineNo, 0, 0 };
+	auto match = std::lower_bound(mFindMatches.begin(), mFindMatches.end(), firstMatch, FindMatchLess);
+	auto breakpoint = std::lower_bound(mBreakpoints.begin(), mBreakpoints.end(), lineNo + 1, BreakpointBefore);
+	auto error = mErrorMarkers.lower_bound(lineNo + 1);
+	auto matchColor = mPalette[(int)PaletteIndex::Selection] | IM_COL32_A_MASK;
+	auto markerWidth = 4.0f * columnWidth;
+
+	for (; row < rowEnd && lineNo < (int)mLines.size(); ++lineNo)
+	{
+		// A wrapped line is drawn as if each of its rows held mWrapColumns columns
+		auto lineRows = GetLineRows(lineNo);
+		auto span = lineRows > 1 ? mWrapColumns : std::numeric_limits<int>::max();
+		ImVec2 rowStart(aMin.x, aMin.y + (row - top) * rowHeight);
+		ImVec2 rowStop(aMax.x, rowStart.y + lineRows * rowHeight);
+
+		// Breakpoints, errors and the debug line shade their row and are marked on the right edge
+		ImU32 marker = 0;
+		while (breakpoint != mBreakpoints.end() && breakpoint->mLine < lineNo + 1)
+			++breakpoint;
+		if (breakpoint != mBreakpoints.end() && breakpoint->mLine == lineNo + 1)
+			marker = mPalette[(int)PaletteIndex::Breakpoint];
+		while (error != mErrorMarkers.end() && error->first < lineNo + 1)
+			++error;
+		if (error != mErrorMarkers.end() && error->first == lineNo + 1)
+			marker = mPalette[(int)PaletteIndex::ErrorMarker];
+		if (mDebugCurrentLine == lineNo + 1)
+			marker = mPalette[(int)PaletteIndex::DebugCurrentLine];
+		if (marker != 0)
+		{
+			drawList->AddRectFilled(rowStart, rowStop, marker);
+			drawList->AddRectFilled(ImVec2(aMax.x - markerWidth, rowStart.y), rowStop, marker | IM_COL32_A_MASK);
+		}
+
+		auto& summary = GetMinimapLine(mLines[lineNo]);
+		for (int k = std::max(0, (int)top - row), kEnd = std::min(lineRows, rowEnd - row); k < kEnd; ++k)
+		{
+			auto begin = std::max(summary.mBegin - k * span, 0);
+			auto end = std::min({ summary.mEnd - k * span, span, (int)kMinimapColumns });
+			if (begin >= end)
+				continue;
+			ImVec2 barStart(aMin.x + begin * columnWidth, rowStart.y + k * rowHeight);
+			ImVec2 barEnd(aMin.x + end * columnWidth, barStart.y + barHeight);
+			drawList->AddRectFilled(barStart, barEnd, GetGlyphColor(summary.mColor));
+		}
+
+		while (match != mFindMatches.end() && match->mLine < lineNo)
+			++match;
+		for (; match != mFindMatches.end() && match->mLine == lineNo; ++match)
+		{
+			auto begin = GetCharacterColumn(lineNo, match->mBegin);
+			auto k = std::min(begin / span, lineRows - 1);
+			begin -= k * span;
+			if (begin >= kMinimapColumns)
+				continue;
+			auto end = std::min({ std::max(GetCharacterColumn(lineNo, match->mEnd) - k * span, begin + 1), span, (int)kMinimapColumns });
+			auto y = rowStart.y + k * rowHeight;
+			drawList->AddRectFilled(ImVec2(aMin.x + begin * columnWidth, y), ImVec2(aMin.x + end * columnWidth, y + rowHeight), matchColor);
+		}
+
+		row += lineRows;
+		if (fold != mFolds.end() && fold->mLine == lineNo)
+		{
+			lineNo += fold->mCount;
+			++fold;
+		}
+	}
+
+	auto frameColor = mMinimapDragging ? ImGuiCol_ScrollbarGrabActive : ImGui::IsMouseHoveringRect(aMin, aMax, false) ? ImGuiCol_ScrollbarGrabHovered : ImGuiCol_ScrollbarGrab;
+	drawList->AddRectFilled(ImVec2(aMin.x, mMinimapFrameTop), ImVec2(aMax.x, mMinimapFrameBottom), ImGui::GetColorU32(frameColor, 0.35f));
+	drawList->PopClipRect();
+
+	// Forget the summaries of lines that scrolled out of the minimap
+	if (mMinimapLines.size() > 2 * (size_t)std::ceil(fitRows) + 64)
+		PruneLineCache(mMinimapLines, mDrawRunsFrame);
+}
+
+bool TextEditor::IsFoldable(int aLine) const
+{
+	if (aLine < 0 || aLine >= (int)mLines.size() || (mColorizerEnabled && StartsInStringOrComment(mLines[aLine])))
+		return false;
+
+	auto indentation = GetLineIndentation(aLine);
+	if (indentation < 0)
+		return false;
+	for (int i = aLine + 1; i < (int)mLines.size(); ++i)
+	{
+		// A string or comment going on below belongs to the line
+		if (mColorizerEnabled && StartsInStringOrComment(mLines[i]))
+			return true;
+		auto next = GetLineIndentation(i);
+		if (next >= 0)
+			return next > indentation;
+	}
+	return false;
+}
+
+bool TextEditor::IsFolded(int aLine) const
+{
+	auto it = std::partition_point(mFolds.begin(), mFolds.end(), [aLine](const FoldedRegion& aFold) { return aFold.mLine < aLine; });
+	return it != mFolds.end() && it->mLine == aLine;
+}
+
+void TextEditor::Fold(int aLine)
+{
+	auto end = GetFoldRegionEnd(aLine);
+	if (end <= aLine)
+		return;
+
+	// Only shown lines fold, and their region takes in the folds inside it
+	RevealLine(aLine);
+	auto first = std::partition_point(mFolds.begin(), mFolds.end(), [aLine](const FoldedRegion& aFold) { return aFold.mLine < aLine; });
+	auto last = std::partition_point(first, mFolds.end(), [end](const FoldedRegion& aFold) { return aFold.mLine <= end; });
+	first = mFolds.erase(first, last);
+	mFolds.insert(first, FoldedRegion{ aLine, end - aLine });
+	UpdateFoldSums();
+
+	// Left in the region, the cursor would unfold it again
+	if (mState.mCursorPosition.mLine > aLine && mState.mCursorPosition.mLine <= end)
+	{
+		Coordinates lineEnd(aLine, GetLineMaxColumn(aLine));
+		SetSelection(lineEnd, lineEnd);
+		SetCursorPosition(lineEnd);
+	}
+}
+
+void TextEditor::Unfold(int aLine)
+{
+	auto it = std::partition_point(mFolds.begin(), mFolds.end(), [aLine](const FoldedRegion& aFold) { return aFold.mLine < aLine; });
+	if (it == mFolds.end() || it->mLine != aLine)
+		return;
+
+	mFolds.erase(it);
+	UpdateFoldSums();
+}
+
+void TextEditor::ToggleFold(int aLine)
+{
+	if (IsFolded(aLine))
+		Unfold(aLine);
+	else
+		Fold(aLine);
+}
+
+void TextEditor::UnfoldAll()
+{
+	mFolds.clear();
+	UpdateFoldSums();
+}
+
+int TextEditor::LineToRow(int aLine) const
+{
+	if (mFolds.empty())
+		return mWordWrap ? RowTreePrefix(aLine) : aLine;
+
+	auto it = std::partition_point(mFolds.begin(), mFolds.end(), [aLine](const FoldedRegion& aFold) { return aFold.mLine < aLine; });
+	auto index = it - mFolds.begin();
+	if (mWordWrap)
+		return RowTreePrefix(index > 0 && aLine <= it[-1].mLine + it[-1].mCount ? it[-1].mLine : aLine);
+	if (index > 0 && aLine <= it[-1].mLine + it[-1].mCount)
+		return it[-1].mLine - mFoldHidden[index - 1];
+	return aLine - mFoldHidden[index];
+}
+
+int TextEditor::RowToLine(int aRow) const
+{
+	if (mWordWrap)
+	{
+		int rowInLine;
+		return RowTreeFind(aRow, rowInLine);
+	}
+	if (mFolds.empty())
+		return aRow;
+
+	// The folds shown above aRow hide lines above its line
+	auto it = std::partition_point(mFolds.begin(), mFolds.end(), [this, aRow](const FoldedRegion& aFold) {
+		return aFold.mLine - mFoldHidden[&aFold - mFolds.data()] < aRow; });
+	return aRow + mFoldHidden[it - mFolds.begin()];
+}
+
+bool TextEditor::IsLineHidden(int aLine) const
+{
+	auto it = std::partition_point(mFolds.begin(), mFolds.end(), [aLine](const FoldedRegion& aFold) { return aFold.mLine < aLine; });
+	return it != mFolds.begin() && aLine <= it[-1].mLine + it[-1].mCount;
+}
+
+int TextEditor::GetRowCount() const
+{
+	return mWordWrap ? RowTreePrefix((int)mLines.size()) : GetVisibleLineCount();
+}
+
+int TextEditor::GetLineRows(int aLine) const
+{
+	if (!mWordWrap)
+		return 1;
+	UpdateWrap();
+	return std::max(1, (int)mLines[aLine].mWrapRows);
+}
+
+int TextEditor::CoordinatesToRow(const Coordinates& aCoords, int* aRowColumn) const
+{
+	auto row = LineToRow(aCoords.mLine);
+	auto rowColumn = 0;
+	if (mWordWrap && !IsLineHidden(aCoords.mLine) && GetLineRows(aCoords.mLine) > 1)
+	{
+		auto& points = GetWrapPoints(aCoords.mLine);
+		auto point = std::upper_bound(points.begin() + 1, points.end(), aCoords.mColumn,
+			[](int aColumn, const WrapPoint& aPoint) { return aColumn < aPoint.mColumn; }) - 1;
+		row += (int)(point - points.begin());
+		rowColumn = point->mColumn;
+	}
+	if (aRowColumn != nullptr)
+		*aRowColumn = rowColumn;
+	return row;
+}
+
+TextEditor::Coordinates TextEditor::RowToCoordinates(int aRow, int aColumnInRow) const
+{
+	if (!mWordWrap)
+		return Coordinates(RowToLine(aRow), aColumnInRow);
+
+	// A row other than the last of its line ends before the column the next one starts at
+	int rowInLine;
+	auto line = RowTreeFind(aRow, rowInLine);
+	if (rowInLine == 0 && GetLineRows(line) == 1)
+		return Coordinates(line, aColumnInRow);
+	auto& points = GetWrapPoints(line);
+	auto index = std::min(rowInLine, (int)points.size() - 1);
+	auto column = points[index].mColumn + aColumnInRow;
+	if (index + 1 < (int)points.size())
+		column = std::min(column, points[index + 1].mColumn - 1);
+	return Coordinates(line, column);
+}
+
+int TextEditor::GetLineIndentation(int aLine) const
+{
+	auto& text = mLines[aLine].mText;
+	auto& comment = mLanguageDefinition.mSingleLineComment;
+	auto indentation = 0;
+	for (size_t i = 0; i < text.size(); ++i)
+	{
+		if (text[i] == ' ')
+			++indentation;
+		else if (text[i] == '\t')
+			indentation = (indentation / mTabSize + 1) * mTabSize;
+		else
+			return !comment.empty() && text.compare(i, comment.size(), comment) == 0 ? -1 : indentation;
+	}
+	return -1;
+}
+
+int TextEditor::GetFoldRegionEnd(int aLine) const
+{
+	if (!IsFoldable(aLine))
+		return aLine;
+
+	// Lines without code only count if the region goes on after them
+	auto indentation = GetLineIndentation(aLine);
+	auto end = aLine;
+	for (int i = aLine + 1; i < (int)mLines.size(); ++i)
+	{
+		if (mColorizerEnabled && StartsInStringOrComment(mLines[i]))
+		{
+			end = i;
+			continue;
+		}
+		auto next = GetLineIndentation(i);
+		if (next < 0)
+			continue;
+		if (next <= indentation)
+			break;
+		end = i;
+	}
+	return end;
+}
+
+int TextEditor::FindFoldRegion(int aLine) const
+{
+	if (IsFoldable(aLine))
+		return aLine;
+
+	// The nearest line above indented less than the code of aLine starts the region around it
+	auto inner = -1;
+	for (int i = aLine; i >= 0; --i)
+	{
+		auto indentation = mColorizerEnabled && StartsInStringOrComment(mLines[i]) ? -1 : GetLineIndentation(i);
+		if (indentation < 0)
+			continue;
+		if (inner < 0)
+			inner = indentation;
+		else if (indentation < inner)
+			return i;
+	}
+	return -1;
+}
+
+int TextEditor::FoldMarkerAt(const ImVec2& aPosition) const
+{
+	ImVec2 origin = ImGui::GetCursorScreenPos();
+	auto x = aPosition.x - origin.x;
+	auto y = aPosition.y - origin.y;
+	if (x < mTextStart - 2.0f * mCharAdvance.x || x >= mTextStart || y < 0.0f)
+		return -1;
+
+	auto row = (int)floor(y / mCharAdvance.y);
+	auto line = RowToLine(row);
+	if (line >= (int)mLines.size() || LineToRow(line) != row)
+		return -1;
+	return IsFolded(line) || IsFoldable(line) ? line : -1;
+}
+
+void TextEditor::RevealLine(int aLine)
+{
+	auto it = std::partition_point(mFolds.begin(), mFolds.end(), [aLine](const FoldedRegion& aFold) { return aFold.mLine < aLine; });
+	if (it == mFolds.begin() || aLine > it[-1].mLine + it[-1].mCount)
+		return;
+
+	mFolds.erase(it - 1);
+	UpdateFoldSums();
+}
+
+void TextEditor::ShiftFolds(int aFromLine, int aDelta)
+{
+	if (mFolds.empty())
+		return;
+
+	// A region that lines are inserted in, or that loses any of its lines, unfolds; the ones
+	// below move along
+	auto removedEnd = aFromLine - std::min(aDelta, 0);
+	auto unfolded = false;
+	auto it = std::partition_point(mFolds.begin(), mFolds.end(), [aFromLine](const FoldedRegion& aFold) { return aFold.mLine + aFold.mCount < aFromLine; });
+	while (it != mFolds.end())
+	{
+		if (it->mLine < (aDelta > 0 ? aFromLine : removedEnd))
+		{
+			it = mFolds.erase(it);
+			unfolded = true;
+		}
+		else
+		{
+			it->mLine += aDelta;
+			++it;
+		}
+	}
+	if (unfolded)
+		UpdateFoldSums();
+}
+
+void TextEditor::SetWordWrap(bool aValue)
+{
+	if (mWordWrap == aValue)
+		return;
+	mWordWrap = aValue;
+	if (mWordWrap)
+		SetWrapColumns(mWrapColumns);
+	mScrollToCursor = true;
+}
+
+void TextEditor::SetWrapColumns(int aColumns)
+{
+	mWrapColumns = aColumns;
+	mWrapRangeMin = 0;
+	mWrapRangeMax = (int)mLines.size();
+	mRowTreeStaleFrom = 0;
+}
+
+int TextEditor::WrapLine(const Line& aLine, int aColumns, std::vector<WrapPoint>* aPoints) const
+{
+	if (aPoints != nullptr)
+		aPoints->assign(1, WrapPoint{ 0, 0 });
+
+	// Rows break before the character that would overflow them, or after their last space.
+	// Spaces themselves never break a row: they may hang past its end.
+	// Most lines fit: with no tabs, a line has at most as many columns as bytes
+	auto text = aLine.mText.data();
+	auto size = (int)aLine.size();
+	if (size <= aColumns && memchr(text, '\t', size) == nullptr)
+		return 1;
+
+	auto rows = 1;
+	auto rowColumn = 0;
+	auto breakIndex = -1;
+	auto breakColumn = 0;
+	auto column = 0;
+	for (int i = 0; i < size && rows < kMaxWrapRows; ++i)
+	{
+		auto c = (Char)text[i];
+		if ((c & 0xc0) == 0x80)
+			continue;		// the rest of a UTF-8 sequence
+
+		auto next = c == '\t' ? (column / mTabSize) * mTabSize + mTabSize : column + 1;
+		if (c != ' ' && next - rowColumn > aColumns && column > rowColumn)
+		{
+			WrapPoint point = breakIndex >= 0 ? WrapPoint{ breakIndex, breakColumn } : WrapPoint{ i, column };
+			if (aPoints != nullptr)
+				aPoints->push_back(point);
+			rowColumn = point.mColumn;
+			breakIndex = -1;
+			++rows;
+			--i;		// measured again against the new row
+			continue;
+		}
+
+		column = next;
+		if (c == ' ' || c == '\t')
+		{
+			breakIndex = i + 1;
+			breakColumn = column;
+		}
+	}
+	return rows;
+}
+
+const std::vector<TextEditor::WrapPoint>& TextEditor::GetWrapPoints(int aLine) const
+{
+	auto& line = mLines[aLine];
+	auto& entry = mWrapPoints[GetCacheId(line)];
+	entry.mFrame = mDrawRunsFrame;
+	if (entry.mPoints.empty() || entry.mColumns != mWrapColumns)
+	{
+		WrapLine(line, mWrapColumns, &entry.mPoints);
+		entry.mColumns = mWrapColumns;
+	}
+	return entry.mPoints;
+}
+
+void TextEditor::UpdateWrap() const
+{
+	if (!mWordWrap)
+		return;
+
+	// Lines edited or inserted since are laid out again; where the tree is still valid, it is
+	// only updated for the lines whose row count changed
+	auto lineCount = (int)mLines.size();
+	if (mRowTreeLines != lineCount)
+		mRowTreeStaleFrom = 0;		// the lines were replaced
+	if (mWrapRangeMin < mWrapRangeMax)
+	{
+		auto toLine = std::min(mWrapRangeMax, lineCount);
+		for (int i = mWrapRangeMin; i < toLine; ++i)
+		{
+			auto& line = mLines[i];
+			auto rows = WrapLine(line, mWrapColumns, nullptr);
+			auto delta = rows - std::max(1, (int)line.mWrapRows);
+			line.mWrapRows = (uint16_t)rows;
+			if (delta != 0 && i < mRowTreeStaleFrom && !IsLineHidden(i))
+			{
+				for (int j = i + 1; j < (int)mRowTree.size(); j += j & -j)
+					mRowTree[j] += delta;
+			}
+		}
+		mWrapRangeMin = std::numeric_limits<int>::max();
+		mWrapRangeMax = 0;
+	}
+	if (mRowTreeStaleFrom == std::numeric_limits<int>::max())
+		return;
+
+	// Each node j holds the rows of the lines (j - lowbit(j), j], the folded-away ones left out.
+	// The nodes of the lines above the first stale one only cover lines above it, and stay.
+	auto from = std::min(mRowTreeStaleFrom, lineCount);
+	mRowTree.resize(lineCount + 1);
+	for (int i = from; i < lineCount; ++i)
+		mRowTree[i + 1] = std::max(1, (int)mLines[i].mWrapRows);
+	for (auto& fold : mFolds)
+	{
+		for (int i = std::max(fold.mLine + 1, from); i <= fold.mLine + fold.mCount && i < lineCount; ++i)
+			mRowTree[i + 1] = 0;
+	}
+	// Nodes that stay are added to their stale parents, which are those of the prefix of 'from'
+	for (int j = from; j > 0; j -= j & -j)
+	{
+		auto parent = j + (j & -j);
+		if (parent <= lineCount)
+			mRowTree[parent] += mRowTree[j];
+	}
+	for (int j = from + 1; j <= lineCount; ++j)
+	{
+		auto parent = j + (j & -j);
+		if (parent <= lineCount)
+			mRowTree[parent] += mRowTree[j];
+	}
+	mRowTreeStaleFrom = std::numeric_limits<int>::max();
+	mRowTreeLines = lineCount;
+}
+
+void TextEditor::ShiftWrap(int aFromLine, int aDelta)
+{
+	if (!mWordWrap)
+		return;
+	if (aFromLine < mWrapRangeMax && mWrapRangeMax != std::numeric_limits<int>::max())
+		mWrapRangeMax = std::max(aFromLine, mWrapRangeMax + aDelta);
+	mRowTreeStaleFrom = std::min(mRowTreeStaleFrom, aFromLine);
+	mRowTreeLines += aDelta;
+}
+
+// Rows of the lines shown above aLine
+int TextEditor::RowTreePrefix(int aLine) const
+{
+	UpdateWrap();
+	auto rows = 0;
+	for (int j = std::min(aLine, (int)mLines.size()); j > 0; j -= j & -j)
+		rows += mRowTree[j];
+	return rows;
+}
+
+// The line shown on aRow, and which of its rows aRow is
+int TextEditor::RowTreeFind(int aRow, int& aRowInLine) const
+{
+	UpdateWrap();
+	auto lineCount = (int)mLines.size();
+	auto step = 1;
+	while (step * 2 <= lineCount)
+		step *= 2;
+
+	// The most lines whose rows all come before aRow
+	auto line = 0;
+	aRowInLine = std::max(0, aRow);
+	for (; step > 0; step /= 2)
+	{
+		if (line + step <= lineCount && mRowTree[line + step] <= aRowInLine)
+		{
+			line += step;
+			aRowInLine -= mRowTree[line];
+		}
+	}
+	return std::min(line, lineCount - 1);
+}
+
+void TextEditor::UpdateFoldSums()
+{
+	mFoldHidden.resize(mFolds.size() + 1);
+	mFoldHidden[0] = 0;
+	for (size_t i = 0; i < mFolds.size(); ++i)
+		mFoldHidden[i + 1] = mFoldHidden[i] + mFolds[i].mCount;
+	mRowTreeStaleFrom = 0;
+}
+
+const TextEditor::Palette & TextEditor::GetDarkPalette()
+{
+	const static Palette p = { {
+			0xff7f7f7f,	// Default
+			0xffd69c56,	// Keyword	
+			0xff00ff00,	// Number
+			0xff7070e0,	// String
+			0xff70a0e0, // Char literal
+			0xffffffff, // Punctuation
+			0xff408080,	// Preprocessor
+			0xffaaaaaa, // Identifier
+			0xff9bc64d, // Known identifier
+			0xffc040a0, // Preproc identifier
+			0xff206020, // Comment (single line)
+			0xff406020, // Comment (multi line)
+			0xff101010, // Background
+			0xffe0e0e0, // Cursor
+			0x80a06020, // Selection
+			0x800020ff, // ErrorMarker
+			0x40f08000, // Breakpoint
+			0xff707000, // Line number
+			0x40000000, // Current line fill
+			0x40808080, // Current line fill (inactive)
+			0x40a0a0a0, // Current line edge
+			0x80ffff00, // Debug current line (bright yellow with transparency)
+		} };
+	return p;
+}
+
+const TextEditor::Palette & TextEditor::GetLightPalette()
+{
+	const static Palette p = { {
+			0xff7f7f7f,	// None
+			0xffff0c06,	// Keyword	
+			0xff008000,	// Number
+			0xff2020a0,	// String
+			0xff304070, // Char literal
+			0xff000000, // Punctuation
+			0xff406060,	// Preprocessor
+			0xff404040, // Identifier
+			0xff606010, // Known identifier
+			0xffc040a0, // Preproc identifier
+			0xff205020, // Comment (single line)
+			0xff405020, // Comment (multi line)
+			0xffffffff, // Background
+			0xff000000, // Cursor
+			0x80600000, // Selection
+			0xa00010ff, // ErrorMarker
+			0x80f08000, // Breakpoint
+			0xff505000, // Line number
+			0x40000000, // Current line fill
+			0x40808080, // Current line fill (inactive)
+			0x40000000, // Current line edge
+			0x80ffff00, // Debug current line (bright yellow with transparency)
+		} };
+	return p;
+}
+
+const TextEditor::Palette & TextEditor::GetRetroBluePalette()
+{
+	const static Palette p = { {
+			0xff00ffff,	// None
+			0xffffff00,	// Keyword	
+			0xff00ff00,	// Number
+			0xff808000,	// String
+			0xff808000, // Char literal
+			0xffffffff, // Punctuation
+			0xff008000,	// Preprocessor
+			0xff00ffff, // Identifier
+			0xffffffff, // Known identifier
+			0xffff00ff, // Preproc identifier
+			0xff808080, // Comment (single line)
+			0xff404040, // Comment (multi line)
+			0xff800000, // Background
+			0xff0080ff, // Cursor
+			0x80ffff00, // Selection
+			0xa00000ff, // ErrorMarker
+			0x80ff8000, // Breakpoint
+			0xff808000, // Line number
+			0x40000000, // Current line fill
+			0x40808080, // Current line fill (inactive)
 			0x40000000, // Current line edge
 			0x80ffff00, // Debug current line (bright yellow with transparency)
 		} };
@@ -2165,16 +4760,7 @@ std::vector<std::string> TextEditor::GetTextLines() const
 	result.reserve(mLines.size());
 
 	for (auto & line : mLines)
-	{
-		std::string text;
-
-		text.resize(line.size());
-
-		for (size_t i = 0; i < line.size(); ++i)
-			text[i] = line[i].mChar;
-
-		result.emplace_back(std::move(text));
-	}
+		result.push_back(line.mText);
 
 	return result;
 }
@@ -2204,111 +4790,338 @@ void TextEditor::Colorize(int aFromLine, int aLines)
 	mColorRangeMin = std::max(0, mColorRangeMin);
 	mColorRangeMax = std::max(mColorRangeMin, mColorRangeMax);
 	mCheckComments = true;
+	mCommentRangeMin = std::max(0, std::min(mCommentRangeMin, aFromLine));
+	mCommentRangeMax = std::max(mCommentRangeMax, toLine);
+	if (!mFindQuery.empty())
+	{
+		mFindRangeMin = std::max(0, std::min(mFindRangeMin, aFromLine));
+		mFindRangeMax = std::max(mFindRangeMax, toLine);
+	}
+	if (mLanguageDefinition.mSymbolize != nullptr)
+	{
+		mSymbolRangeMin = std::max(0, std::min(mSymbolRangeMin, aFromLine));
+		mSymbolRangeMax = std::max(mSymbolRangeMax, toLine);
+	}
+	if (mWordWrap)
+	{
+		mWrapRangeMin = std::max(0, std::min(mWrapRangeMin, aFromLine));
+		mWrapRangeMax = std::max(mWrapRangeMax, toLine);
+	}
+	mChangeRangeMin = std::max(0, std::min(mChangeRangeMin, aFromLine));
+	mChangeRangeMax = std::max(mChangeRangeMax, toLine);
+	++mEditGeneration;
+}
+
+void TextEditor::ShiftColorRanges(int aFromLine, int aDelta)
+{
+	// Pending colorize ranges must keep covering the same lines when lines above their end move
+	for (auto rangeMax : { &mColorRangeMax, &mCommentRangeMax })
+	{
+		if (aFromLine < *rangeMax && *rangeMax != std::numeric_limits<int>::max())
+			*rangeMax = std::max(aFromLine, *rangeMax + aDelta);
+	}
+}
+
+void TextEditor::ShiftTextChange(int aFromLine, int aDelta)
+{
+	// The range grows to reach lines inserted or removed outside it, whose text it must carry
+	mChangeRangeMin = std::min(mChangeRangeMin, aFromLine);
+	if (aDelta > 0)
+		mChangeRangeMax = std::max(mChangeRangeMax, aFromLine) + aDelta;
+	else
+		mChangeRangeMax = std::max(aFromLine, mChangeRangeMax + aDelta);
+}
+
+bool TextEditor::TakeTextChange(TextChange& aChange)
+{
+	if (mChangeRangeMin > mChangeRangeMax)
+		return false;
+
+	auto lineCount = (int)mLines.size();
+	auto first = std::min(mChangeRangeMin, lineCount);
+	auto last = std::max(first, std::min(mChangeRangeMax, lineCount));
+	aChange.mFirstLine = first;
+	aChange.mRemovedLines = last - first - (lineCount - mChangeLineCount);
+	aChange.mLines.clear();
+	aChange.mLines.reserve(last - first);
+	for (int i = first; i < last; ++i)
+		aChange.mLines.push_back(mLines[i].mText);
+	DiscardTextChange();
+	return true;
+}
+
+void TextEditor::DiscardTextChange()
+{
+	mChangeRangeMin = std::numeric_limits<int>::max();
+	mChangeRangeMax = 0;
+	mChangeLineCount = (int)mLines.size();
+}
+
+void TextEditor::ColorizeLine(const ColorizerContext& aContext, const char* aBegin, const char* aEnd, int aPreprocStart, std::vector<ColorSpan>& aSpans)
+{
+	auto& langDef = aContext.mLanguageDefinition;
+	std::cmatch results;
+	std::string id;
+
+	// aSpans may already hold the spans of previous lines, which must not be merged into
+	auto lineSpansBegin = aSpans.size();
+	auto emit = [&aSpans, lineSpansBegin](int aLength, PaletteIndex aColor)
+	{
+		if (aLength <= 0)
+			return;
+		if (aSpans.size() > lineSpansBegin && aSpans.back().mColorIndex == aColor)
+			aSpans.back().mLength += aLength;
+		else
+			aSpans.push_back(ColorSpan{ aLength, aColor });
+	};
+
+	auto colored = aBegin;	// everything before this already has a span
+	for (auto first = aBegin; first != aEnd; )
+	{
+		const char * token_begin = nullptr;
+		const char * token_end = nullptr;
+		PaletteIndex token_color = PaletteIndex::Default;
+
+		bool hasTokenizeResult = false;
+
+		if (langDef.mTokenize != nullptr)
+		{
+			if (langDef.mTokenize(first, aEnd, token_begin, token_end, token_color))
+				hasTokenizeResult = true;
+		}
+
+		if (hasTokenizeResult == false)
+		{
+			for (auto& p : aContext.mRegexList)
+			{
+				if (std::regex_search(first, aEnd, results, p.first, std::regex_constants::match_continuous))
+				{
+					hasTokenizeResult = true;
+
+					auto& v = *results.begin();
+					token_begin = v.first;
+					token_end = v.second;
+					token_color = p.second;
+					break;
+				}
+			}
+		}
+
+		if (hasTokenizeResult == false || token_end <= first)
+		{
+			first++;
+		}
+		else
+		{
+			if (token_color == PaletteIndex::Identifier)
+			{
+				id.assign(token_begin, token_end);
+
+				// todo : allmost all language definitions use lower case to specify keywords, so shouldn't this use ::tolower ?
+				if (!langDef.mCaseSensitive)
+					std::transform(id.begin(), id.end(), id.begin(), ::toupper);
+
+				if (first - aBegin < aPreprocStart)
+				{
+					if (langDef.mKeywords.count(id) != 0)
+						token_color = PaletteIndex::Keyword;
+					else if (langDef.mIdentifiers.count(id) != 0)
+						token_color = PaletteIndex::KnownIdentifier;
+					else if (langDef.mPreprocIdentifiers.count(id) != 0)
+						token_color = PaletteIndex::PreprocIdentifier;
+				}
+				else
+				{
+					if (langDef.mPreprocIdentifiers.count(id) != 0)
+						token_color = PaletteIndex::PreprocIdentifier;
+				}
+			}
+
+			emit((int)(token_begin - colored), PaletteIndex::Default);
+			emit((int)(token_end - token_begin), token_color);
+			colored = token_end;
+			first = token_end;
+		}
+	}
+	emit((int)(aEnd - colored), PaletteIndex::Default);
+}
+
+void TextEditor::ColorizeTokenizedLine(const ColorizerContext& aContext, const char* aBegin, const char* aEnd, LexState aState, Tokens& aTokens, std::vector<ColorSpan>& aSpans)
+{
+	auto& langDef = aContext.mLanguageDefinition;
+	std::string id;
+
+	aTokens.clear();
+	langDef.mTokenizeLine(aBegin, aEnd, aState, &aTokens);
+
+	auto lineSpansBegin = aSpans.size();
+	auto emit = [&aSpans, lineSpansBegin](int aLength, PaletteIndex aColor)
+	{
+		if (aLength <= 0)
+			return;
+		if (aSpans.size() > lineSpansBegin && aSpans.back().mColorIndex == aColor)
+			aSpans.back().mLength += aLength;
+		else
+			aSpans.push_back(ColorSpan{ aLength, aColor });
+	};
+
+	auto length = (int)(aEnd - aBegin);
+	auto colored = 0;
+	for (auto& token : aTokens)
+	{
+		auto begin = std::max(token.mBegin, colored);
+		auto end = std::min(token.mEnd, length);
+		if (end <= begin)
+			continue;
+
+		auto color = token.mColor;
+		if (color == PaletteIndex::Identifier)
+		{
+			id.assign(aBegin + begin, aBegin + end);
+			if (!langDef.mCaseSensitive)
+				std::transform(id.begin(), id.end(), id.begin(), ::toupper);
+			if (langDef.mIdentifiers.count(id) != 0)
+				color = PaletteIndex::KnownIdentifier;
+		}
+
+		emit(begin - colored, PaletteIndex::Default);
+		emit(end - begin, color);
+		colored = end;
+	}
+	emit(length - colored, PaletteIndex::Default);
 }
 
-void TextEditor::ColorizeRange(int aFromLine, int aToLine)
+void TextEditor::RunColorizeJob(const ColorizeJob& aJob, ColorizeResult& aResult)
 {
-	if (mLines.empty() || aFromLine >= aToLine)
-		return;
+	aResult.mGeneration = aJob.mGeneration;
+	aResult.mFirstLine = aJob.mFirstLine;
+	aResult.mLineSpanEnds.reserve(aJob.mLineEnds.size());
 
-	std::string buffer;
-	std::cmatch results;
-	std::string id;
+	auto tokenizeLine = aJob.mContext->mLanguageDefinition.mTokenizeLine != nullptr;
+	Tokens tokens;
 
-	int endLine = std::max(0, std::min((int)mLines.size(), aToLine));
-	for (int i = aFromLine; i < endLine; ++i)
+	const char* text = aJob.mText.data();
+	int lineStart = 0;
+	for (size_t i = 0; i < aJob.mLineEnds.size(); ++i)
 	{
-		auto& line = mLines[i];
-
-		if (line.empty())
-			continue;
-
-		buffer.resize(line.size());
-		for (size_t j = 0; j < line.size(); ++j)
-		{
-			auto& col = line[j];
-			buffer[j] = col.mChar;
-			col.mColorIndex = PaletteIndex::Default;
-		}
+		auto lineEnd = aJob.mLineEnds[i];
+		if (tokenizeLine)
+			ColorizeTokenizedLine(*aJob.mContext, text + lineStart, text + lineEnd, aJob.mLexStates[i], tokens, aResult.mSpans);
+		else
+			ColorizeLine(*aJob.mContext, text + lineStart, text + lineEnd, aJob.mPreprocStarts[i], aResult.mSpans);
+		aResult.mLineSpanEnds.push_back((int)aResult.mSpans.size());
+		lineStart = lineEnd;
+	}
+}
 
-		const char * bufferBegin = &buffer.front();
-		const char * bufferEnd = bufferBegin + buffer.size();
+void TextEditor::ColorizerThread()
+{
+	std::unique_lock<std::mutex> lock(mColorizerMutex);
+	for (;;)
+	{
+		mColorizerCondition.wait(lock, [this] { return mColorizerQuit || mColorizerJob != nullptr; });
+		if (mColorizerQuit)
+			return;
 
-		auto last = bufferEnd;
+		auto job = std::move(mColorizerJob);
+		lock.unlock();
 
-		for (auto first = bufferBegin; first != last; )
-		{
-			const char * token_begin = nullptr;
-			const char * token_end = nullptr;
-			PaletteIndex token_color = PaletteIndex::Default;
+		auto result = std::make_unique<ColorizeResult>();
+		RunColorizeJob(*job, *result);
 
-			bool hasTokenizeResult = false;
+		lock.lock();
+		mColorizerResult = std::move(result);
+	}
+}
 
-			if (mLanguageDefinition.mTokenize != nullptr)
-			{
-				if (mLanguageDefinition.mTokenize(first, last, token_begin, token_end, token_color))
-					hasTokenizeResult = true;
-			}
+void TextEditor::StopColorizer()
+{
+	if (!mColorizerThread.joinable())
+		return;
 
-			if (hasTokenizeResult == false)
-			{
-				// todo : remove
-				//printf("using regex for %.*s\n", first + 10 < last ? 10 : int(last - first), first);
+	{
+		std::lock_guard<std::mutex> lock(mColorizerMutex);
+		mColorizerQuit = true;
+	}
+	mColorizerCondition.notify_one();
+	mColorizerThread.join();
+}
 
-				for (auto& p : mRegexList)
-				{
-					if (std::regex_search(first, last, results, p.first, std::regex_constants::match_continuous))
-					{
-						hasTokenizeResult = true;
+void TextEditor::SubmitColorizeJob(int aFromLine, int aToLine)
+{
+	auto job = std::make_unique<ColorizeJob>();
+	job->mGeneration = mEditGeneration;
+	job->mFirstLine = aFromLine;
+	job->mContext = mColorizerContext;
+	job->mLineEnds.reserve(aToLine - aFromLine);
+	job->mPreprocStarts.reserve(aToLine - aFromLine);
+	job->mLexStates.reserve(aToLine - aFromLine);
+
+	for (int i = aFromLine; i < aToLine; ++i)
+	{
+		auto& line = mLines[i];
+		job->mText += line.mText;
+		job->mLineEnds.push_back((int)job->mText.size());
 
-						auto& v = *results.begin();
-						token_begin = v.first;
-						token_end = v.second;
-						token_color = p.second;
-						break;
-					}
-				}
-			}
+		auto preproc = std::find_if(line.mAttributes.begin(), line.mAttributes.end(), [](Attribute a) { return (a & Attribute_Preprocessor) != 0; });
+		job->mPreprocStarts.push_back((int)(preproc - line.mAttributes.begin()));
+		job->mLexStates.push_back(line.mLexState);
+	}
 
-			if (hasTokenizeResult == false)
-			{
-				first++;
-			}
-			else
-			{
-				const size_t token_length = token_end - token_begin;
+	{
+		std::lock_guard<std::mutex> lock(mColorizerMutex);
+		mColorizerJob = std::move(job);
+	}
+	mColorizeInFlight = true;
 
-				if (token_color == PaletteIndex::Identifier)
-				{
-					id.assign(token_begin, token_end);
+	if (mColorizerThread.joinable())
+		mColorizerCondition.notify_one();
+	else
+		mColorizerThread = std::thread(&TextEditor::ColorizerThread, this);
+}
 
-					// todo : allmost all language definitions use lower case to specify keywords, so shouldn't this use ::tolower ?
-					if (!mLanguageDefinition.mCaseSensitive)
-						std::transform(id.begin(), id.end(), id.begin(), ::toupper);
+bool TextEditor::ApplyColorizeResult()
+{
+	std::unique_ptr<ColorizeResult> result;
+	{
+		std::lock_guard<std::mutex> lock(mColorizerMutex);
+		result = std::move(mColorizerResult);
+	}
+	if (!result)
+		return false;
 
-					if (!line[first - bufferBegin].mPreprocessor)
-					{
-						if (mLanguageDefinition.mKeywords.count(id) != 0)
-							token_color = PaletteIndex::Keyword;
-						else if (mLanguageDefinition.mIdentifiers.count(id) != 0)
-							token_color = PaletteIndex::KnownIdentifier;
-						else if (mLanguageDefinition.mPreprocIdentifiers.count(id) != 0)
-							token_color = PaletteIndex::PreprocIdentifier;
-					}
-					else
-					{
-						if (mLanguageDefinition.mPreprocIdentifiers.count(id) != 0)
-							token_color = PaletteIndex::PreprocIdentifier;
-					}
-				}
+	mColorizeInFlight = false;
 
-				for (size_t j = 0; j < token_length; ++j)
-					line[(token_begin - bufferBegin) + j].mColorIndex = token_color;
+	// The lines were edited after the job was submitted: they are still inside the pending
+	// range (which has been kept up to date with the edits) and will be resubmitted.
+	if (result->mGeneration != mEditGeneration)
+		return true;
 
-				first = token_end;
-			}
+	auto lineCount = std::min((int)result->mLineSpanEnds.size(), (int)mLines.size() - result->mFirstLine);
+	auto span = 0;
+	for (int i = 0; i < lineCount; ++i)
+	{
+		auto& line = mLines[result->mFirstLine + i];
+		auto cacheId = line.mCacheId;
+		auto index = 0;
+		for (; span < result->mLineSpanEnds[i]; ++span)
+		{
+			auto& s = result->mSpans[span];
+			auto end = std::min(index + s.mLength, (int)line.size());
+			for (; index < end; ++index)
+				line.SetColor(index, s.mColorIndex);
 		}
+		KeepTextCaches(line, cacheId);
 	}
+
+	// Nothing was edited since the job was submitted, so the pending range still starts at its first line
+	mColorRangeMin = result->mFirstLine + lineCount;
+	if (mColorRangeMin >= mColorRangeMax)
+	{
+		mColorRangeMin = std::numeric_limits<int>::max();
+		mColorRangeMax = 0;
+	}
+	return true;
 }
 
 void TextEditor::ColorizeInternal()
@@ -2316,24 +5129,86 @@ void TextEditor::ColorizeInternal()
 	if (mLines.empty() || !mColorizerEnabled)
 		return;
 
-	if (mCheckComments)
-	{
-		auto endLine = mLines.size();
-		auto endIndex = 0;
-		auto commentStartLine = endLine;
-		auto commentStartIndex = endIndex;
-		auto withinString = false;
-		auto withinSingleLineComment = false;
-		auto withinPreproc = false;
-		auto firstChar = true;			// there is no other non-whitespace characters in the line before
-		auto concatenate = false;		// '\' on the very end of the line
-		auto currentLine = 0;
-		auto currentIndex = 0;
-		while (currentLine < endLine || currentIndex < endIndex)
+	if (mCheckComments && mLanguageDefinition.mTokenizeLine != nullptr)
+	{
+		// Same resumption as below, with the states of the language's own lexer. A line whose
+		// state changes is tokenized differently, so it is colorized again.
+		auto endLine = (int)mLines.size();
+		auto firstLine = std::min(mCommentRangeMin, endLine - 1);
+		auto dirtyEnd = std::min(mCommentRangeMax, endLine);
+		auto state = mLines[firstLine].mLexState;
+
+		for (auto currentLine = firstLine; currentLine < endLine; ++currentLine)
+		{
+			auto& line = mLines[currentLine];
+			if (currentLine >= dirtyEnd && line.mLexState == state)
+				break;
+			if (line.mLexState != state)
+			{
+				mColorRangeMin = std::min(mColorRangeMin, currentLine);
+				mColorRangeMax = std::max(mColorRangeMax, currentLine + 1);
+				if (mLanguageDefinition.mSymbolize != nullptr)
+				{
+					mSymbolRangeMin = std::min(mSymbolRangeMin, currentLine);
+					mSymbolRangeMax = std::max(mSymbolRangeMax, currentLine + 1);
+				}
+			}
+			line.mLexState = state;
+			state = mLanguageDefinition.mTokenizeLine(line.mText.data(), line.mText.data() + line.mText.size(), state, nullptr);
+		}
+
+		mCheckComments = false;
+		mCommentRangeMin = std::numeric_limits<int>::max();
+		mCommentRangeMax = 0;
+	}
+	else if (mCheckComments)
+	{
+		// Resume at the first edited line with the lexer state cached for it, and stop as soon
+		// as the state reaching an unedited line matches what was cached for that line:
+		// from there on nothing can differ from the previous pass.
+		auto endLine = (int)mLines.size();
+		auto firstLine = std::min(mCommentRangeMin, endLine - 1);
+		auto dirtyEnd = std::min(mCommentRangeMax, endLine);
+		auto initialState = mLines[firstLine].mLexState;
+
+		auto withinString = (initialState & LexState_String) != 0;
+		auto withinMultiLineComment = (initialState & LexState_MultiLineComment) != 0;
+		auto concatenate = (initialState & LexState_Concatenate) != 0;		// '\' on the very end of the line
+		auto withinSingleLineComment = (initialState & LexState_SingleLineComment) != 0;
+		auto withinPreproc = (initialState & LexState_Preprocessor) != 0;
+		auto firstChar = (initialState & LexState_FirstChar) != 0;			// there is no other non-whitespace characters in the line before
+
+		for (auto currentLine = firstLine; currentLine < endLine; ++currentLine)
 		{
 			auto& line = mLines[currentLine];
 
-			if (currentIndex == 0 && !concatenate)
+			LexState state = 0;
+			if (withinString)
+				state |= LexState_String;
+			if (withinMultiLineComment)
+				state |= LexState_MultiLineComment;
+			if (concatenate)
+			{
+				state |= LexState_Concatenate;
+				if (withinSingleLineComment)
+					state |= LexState_SingleLineComment;
+				if (withinPreproc)
+					state |= LexState_Preprocessor;
+				if (firstChar)
+					state |= LexState_FirstChar;
+			}
+
+			if (currentLine >= dirtyEnd && line.mLexState == state)
+				break;
+			// The symbols of lines moving into or out of a string change with their text
+			if (line.mLexState != state && mLanguageDefinition.mSymbolize != nullptr)
+			{
+				mSymbolRangeMin = std::min(mSymbolRangeMin, currentLine);
+				mSymbolRangeMax = std::max(mSymbolRangeMax, currentLine + 1);
+			}
+			line.mLexState = state;
+
+			if (!concatenate)
 			{
 				withinSingleLineComment = false;
 				withinPreproc = false;
@@ -2342,30 +5217,35 @@ void TextEditor::ColorizeInternal()
 
 			concatenate = false;
 
-			if (!line.empty())
+			auto& text = line.mText;
+			auto size = (int)text.size();
+			auto commentStartIndex = withinMultiLineComment ? 0 : size;
+			auto setMultiLineComment = [&line](int aIndex, bool aValue) { line.SetFlag(aIndex, Attribute_MultiLineComment, aValue); };
+
+			for (auto currentIndex = 0; currentIndex < size;)
 			{
-				auto& g = line[currentIndex];
-				auto c = g.mChar;
+				auto c = line[currentIndex];
+
+				concatenate = false;
 
 				if (c != mLanguageDefinition.mPreprocChar && !isspace(c))
 					firstChar = false;
 
-				if (currentIndex == (int)line.size() - 1 && line[line.size() - 1].mChar == '\\')
+				if (currentIndex == size - 1 && c == '\\')
 					concatenate = true;
 
-				bool inComment = (commentStartLine < currentLine || (commentStartLine == currentLine && commentStartIndex <= currentIndex));
+				bool inComment = commentStartIndex <= currentIndex;
 
 				if (withinString)
 				{
-					line[currentIndex].mMultiLineComment = inComment;
+					setMultiLineComment(currentIndex, inComment);
 
 					if (c == '\"')
 					{
-						if (currentIndex + 1 < (int)line.size() && line[currentIndex + 1].mChar == '\"')
+						if (currentIndex + 1 < size && text[currentIndex + 1] == '\"')
 						{
 							currentIndex += 1;
-							if (currentIndex < (int)line.size())
-								line[currentIndex].mMultiLineComment = inComment;
+							setMultiLineComment(currentIndex, inComment);
 						}
 						else
 							withinString = false;
@@ -2373,8 +5253,8 @@ void TextEditor::ColorizeInternal()
 					else if (c == '\\')
 					{
 						currentIndex += 1;
-						if (currentIndex < (int)line.size())
-							line[currentIndex].mMultiLineComment = inComment;
+						if (currentIndex < size)
+							setMultiLineComment(currentIndex, inComment);
 					}
 				}
 				else
@@ -2385,72 +5265,66 @@ void TextEditor::ColorizeInternal()
 					if (c == '\"')
 					{
 						withinString = true;
-						line[currentIndex].mMultiLineComment = inComment;
+						setMultiLineComment(currentIndex, inComment);
 					}
 					else
 					{
-						auto pred = [](const char& a, const Glyph& b) { return a == b.mChar; };
-						auto from = line.begin() + currentIndex;
 						auto& startStr = mLanguageDefinition.mCommentStart;
 						auto& singleStartStr = mLanguageDefinition.mSingleLineComment;
 
 						if (singleStartStr.size() > 0 &&
-							currentIndex + singleStartStr.size() <= line.size() &&
-							equals(singleStartStr.begin(), singleStartStr.end(), from, from + singleStartStr.size(), pred))
+							currentIndex + singleStartStr.size() <= text.size() &&
+							text.compare(currentIndex, singleStartStr.size(), singleStartStr) == 0)
 						{
 							withinSingleLineComment = true;
 						}
-						else if (!withinSingleLineComment && currentIndex + startStr.size() <= line.size() &&
-							equals(startStr.begin(), startStr.end(), from, from + startStr.size(), pred))
+						else if (!withinSingleLineComment && currentIndex + startStr.size() <= text.size() &&
+							text.compare(currentIndex, startStr.size(), startStr) == 0)
 						{
-							commentStartLine = currentLine;
-							commentStartIndex = currentIndex;
+							commentStartIndex = std::min(commentStartIndex, currentIndex);
+							withinMultiLineComment = true;
 						}
 
-						inComment = inComment = (commentStartLine < currentLine || (commentStartLine == currentLine && commentStartIndex <= currentIndex));
+						inComment = commentStartIndex <= currentIndex;
 
-						line[currentIndex].mMultiLineComment = inComment;
-						line[currentIndex].mComment = withinSingleLineComment;
+						setMultiLineComment(currentIndex, inComment);
+						line.SetFlag(currentIndex, Attribute_Comment, withinSingleLineComment);
 
 						auto& endStr = mLanguageDefinition.mCommentEnd;
 						if (currentIndex + 1 >= (int)endStr.size() &&
-							equals(endStr.begin(), endStr.end(), from + 1 - endStr.size(), from + 1, pred))
+							text.compare(currentIndex + 1 - endStr.size(), endStr.size(), endStr) == 0)
 						{
-							commentStartIndex = endIndex;
-							commentStartLine = endLine;
+							commentStartIndex = size;
+							withinMultiLineComment = false;
 						}
 					}
 				}
-				line[currentIndex].mPreprocessor = withinPreproc;
+				if (currentIndex < size)
+					line.SetFlag(currentIndex, Attribute_Preprocessor, withinPreproc);
 				currentIndex += UTF8CharLength(c);
-				if (currentIndex >= (int)line.size())
-				{
-					currentIndex = 0;
-					++currentLine;
-				}
-			}
-			else
-			{
-				currentIndex = 0;
-				++currentLine;
 			}
 		}
+
 		mCheckComments = false;
+		mCommentRangeMin = std::numeric_limits<int>::max();
+		mCommentRangeMax = 0;
 	}
 
+	if (mColorizeInFlight && !ApplyColorizeResult())
+		return;
+
 	if (mColorRangeMin < mColorRangeMax)
 	{
-		const int increment = (mLanguageDefinition.mTokenize == nullptr) ? 10 : 10000;
-		const int to = std::min(mColorRangeMin + increment, mColorRangeMax);
-		ColorizeRange(mColorRangeMin, to);
-		mColorRangeMin = to;
-
-		if (mColorRangeMax == mColorRangeMin)
+		// Regex matching is slow: keep its batches small so an edit does not throw away much work
+		const int increment = (mLanguageDefinition.mTokenize == nullptr && mLanguageDefinition.mTokenizeLine == nullptr) ? 200 : 10000;
+		const int to = std::min({ mColorRangeMin + increment, mColorRangeMax, (int)mLines.size() });
+		if (mColorRangeMin < to)
+			SubmitColorizeJob(mColorRangeMin, to);
+		else
 		{
 			mColorRangeMin = std::numeric_limits<int>::max();
 			mColorRangeMax = 0;
 		}
-		return;
 	}
 }
 
@@ -2460,20 +5334,40 @@ float TextEditor::TextDistanceToLineStart(const Coordinates& aFrom) const
 	float distance = 0.0f;
 	float spaceSize = ImGui::GetFont()->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX, -1.0f, " ", nullptr, nullptr).x;
 	int colIndex = GetCharacterIndex(aFrom);
+
+	if (line.size() >= kLongLine)
+	{
+		// Measure from the draw run holding aFrom instead of from the start of the line
+		auto& runs = GetDrawRuns(line, spaceSize);
+		auto run = std::upper_bound(runs.begin(), runs.end(), colIndex,
+			[](int aIndex, const DrawRun& aRun) { return aIndex < (int)aRun.mBegin; });
+		if (run == runs.begin())
+			return 0.0f;
+		--run;
+		if (colIndex >= (int)run->mEnd)
+			return run->mX + run->mWidth;
+		if (run->mKind == DrawRun::Spaces)
+			return run->mX + (colIndex - run->mBegin) * spaceSize;
+		if (run->mKind == DrawRun::Tab)
+			return run->mX;
+		auto text = line.mText.data();
+		return run->mX + ImGui::GetFont()->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX, -1.0f, text + run->mBegin, text + colIndex, nullptr).x;
+	}
+
 	for (size_t it = 0u; it < line.size() && it < colIndex; )
 	{
-		if (line[it].mChar == '\t')
+		if (line[it] == '\t')
 		{
 			distance = (1.0f + std::floor((1.0f + distance) / (float(mTabSize) * spaceSize))) * (float(mTabSize) * spaceSize);
 			++it;
 		}
 		else
 		{
-			auto d = UTF8CharLength(line[it].mChar);
+			auto d = UTF8CharLength(line[it]);
 			char tempCString[7];
 			int i = 0;
 			for (; i < 6 && d-- > 0 && it < (int)line.size(); i++, it++)
-				tempCString[i] = line[it].mChar;
+				tempCString[i] = line[it];
 
 			tempCString[i] = '\0';
 			distance += ImGui::GetFont()->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX, -1.0f, tempCString, nullptr, nullptr).x;
@@ -2495,7 +5389,7 @@ void TextEditor::EnsureCursorVisible()
 	float scrollY = ImGui::GetScrollY();
 
 	auto height = ImGui::GetWindowHeight();
-	auto width = ImGui::GetWindowWidth();
+	auto width = ImGui::GetWindowWidth() - GetMinimapWidth();
 
 	auto top = 1 + (int)ceil(scrollY / mCharAdvance.y);
 	auto bottom = (int)ceil((scrollY + height) / mCharAdvance.y);
@@ -2505,11 +5399,14 @@ void TextEditor::EnsureCursorVisible()
 
 	auto pos = GetActualCursorCoordinates();
 	auto len = TextDistanceToLineStart(pos);
+	auto row = CoordinatesToRow(pos);
 
-	if (pos.mLine < top)
-		ImGui::SetScrollY(std::max(0.0f, (pos.mLine - 1) * mCharAdvance.y));
-	if (pos.mLine > bottom - 4)
-		ImGui::SetScrollY(std::max(0.0f, (pos.mLine + 4) * mCharAdvance.y - height));
+	if (row < top)
+		ImGui::SetScrollY(std::max(0.0f, (row - 1) * mCharAdvance.y));
+	if (row > bottom - 4)
+		ImGui::SetScrollY(std::max(0.0f, (row + 4) * mCharAdvance.y - height));
+	if (mWordWrap)
+		return;
 	if (len + mTextStart < left + 4)
 		ImGui::SetScrollX(std::max(0.0f, len + mTextStart - 4));
 	if (len + mTextStart > right - 4)
@@ -2544,6 +5441,23 @@ TextEditor::UndoRecord::UndoRecord(
 	assert(mRemovedStart <= mRemovedEnd);
 }
 
+size_t TextEditor::UndoRecord::MemoryUsage() const
+{
+	auto result = sizeof(UndoRecord) + StringHeapBytes(mAdded) + StringHeapBytes(mRemoved) + mLineChanges.capacity() * sizeof(LineChange);
+	for (auto& change : mLineChanges)
+		result += StringHeapBytes(change.mBefore) + StringHeapBytes(change.mAfter);
+	result += mRangeChanges.capacity() * sizeof(RangeChange);
+	for (auto& change : mRangeChanges)
+	{
+		result += (change.mBefore.capacity() + change.mAfter.capacity()) * sizeof(std::string);
+		for (auto& line : change.mBefore)
+			result += StringHeapBytes(line);
+		for (auto& line : change.mAfter)
+			result += StringHeapBytes(line);
+	}
+	return result;
+}
+
 void TextEditor::UndoRecord::Undo(TextEditor * aEditor)
 {
 	if (!mAdded.empty())
@@ -2559,6 +5473,18 @@ void TextEditor::UndoRecord::Undo(TextEditor * aEditor)
 		aEditor->Colorize(mRemovedStart.mLine - 1, mRemovedEnd.mLine - mRemovedStart.mLine + 2);
 	}
 
+	if (!mLineChanges.empty())
+	{
+		for (auto& change : mLineChanges)
+			aEditor->mLines[change.mLine].assign(change.mBefore.data(), change.mBefore.size());
+		aEditor->Colorize(mLineChanges.front().mLine, mLineChanges.back().mLine - mLineChanges.front().mLine + 1);
+		aEditor->mTextChanged = true;
+	}
+
+	// From the first range down: the ones above are back where they were by then
+	for (auto& change : mRangeChanges)
+		aEditor->ReplaceLineRange(change.mLine, (int)change.mAfter.size(), change.mBefore);
+
 	aEditor->mState = mBefore;
 	aEditor->EnsureCursorVisible();
 
@@ -2569,16 +5495,27 @@ void TextEditor::UndoRecord::Redo(TextEditor * aEditor)
 	if (!mRemoved.empty())
 	{
 		aEditor->DeleteRange(mRemovedStart, mRemovedEnd);
-		aEditor->Colorize(mRemovedStart.mLine - 1, mRemovedEnd.mLine - mRemovedStart.mLine + 1);
+		aEditor->Colorize(mRemovedStart.mLine - 1, mRemovedEnd.mLine - mRemovedStart.mLine + 2);
 	}
 
 	if (!mAdded.empty())
 	{
 		auto start = mAddedStart;
 		aEditor->InsertTextAt(start, mAdded.c_str());
-		aEditor->Colorize(mAddedStart.mLine - 1, mAddedEnd.mLine - mAddedStart.mLine + 1);
+		aEditor->Colorize(mAddedStart.mLine - 1, mAddedEnd.mLine - mAddedStart.mLine + 2);
+	}
+
+	if (!mLineChanges.empty())
+	{
+		for (auto& change : mLineChanges)
+			aEditor->mLines[change.mLine].assign(change.mAfter.data(), change.mAfter.size());
+		aEditor->Colorize(mLineChanges.front().mLine, mLineChanges.back().mLine - mLineChanges.front().mLine + 1);
+		aEditor->mTextChanged = true;
 	}
 
+	for (auto it = mRangeChanges.rbegin(); it != mRangeChanges.rend(); ++it)
+		aEditor->ReplaceLineRange(it->mLine, (int)it->mBefore.size(), it->mAfter);
+
 	aEditor->mState = mAfter;
 	aEditor->EnsureCursorVisible();
 }
@@ -2651,109 +5588,278 @@ static bool TokenizeCStyleIdentifier(const char * in_begin, const char * in_end,
 			p++;
 
 		out_begin = in_begin;
-		out_end = p;
+		out_end = p;
+		return true;
+	}
+
+	return false;
+}
+
+static bool TokenizeCStyleNumber(const char * in_begin, const char * in_end, const char *& out_begin, const char *& out_end)
+{
+	const char * p = in_begin;
+
+	const bool startsWithNumber = *p >= '0' && *p <= '9';
+
+	if (*p != '+' && *p != '-' && !startsWithNumber)
+		return false;
+
+	p++;
+
+	bool hasNumber = startsWithNumber;
+
+	while (p < in_end && (*p >= '0' && *p <= '9'))
+	{
+		hasNumber = true;
+
+		p++;
+	}
+
+	if (hasNumber == false)
+		return false;
+
+	bool isFloat = false;
+	bool isHex = false;
+	bool isBinary = false;
+
+	if (p < in_end)
+	{
+		if (*p == '.')
+		{
+			isFloat = true;
+
+			p++;
+
+			while (p < in_end && (*p >= '0' && *p <= '9'))
+				p++;
+		}
+		else if (*p == 'x' || *p == 'X')
+		{
+			// hex formatted integer of the type 0xef80
+
+			isHex = true;
+
+			p++;
+
+			while (p < in_end && ((*p >= '0' && *p <= '9') || (*p >= 'a' && *p <= 'f') || (*p >= 'A' && *p <= 'F')))
+				p++;
+		}
+		else if (*p == 'b' || *p == 'B')
+		{
+			// binary formatted integer of the type 0b01011101
+
+			isBinary = true;
+
+			p++;
+
+			while (p < in_end && (*p >= '0' && *p <= '1'))
+				p++;
+		}
+	}
+
+	if (isHex == false && isBinary == false)
+	{
+		// floating point exponent
+		if (p < in_end && (*p == 'e' || *p == 'E'))
+		{
+			isFloat = true;
+
+			p++;
+
+			if (p < in_end && (*p == '+' || *p == '-'))
+				p++;
+
+			bool hasDigits = false;
+
+			while (p < in_end && (*p >= '0' && *p <= '9'))
+			{
+				hasDigits = true;
+
+				p++;
+			}
+
+			if (hasDigits == false)
+				return false;
+		}
+
+		// single precision floating point type
+		if (p < in_end && *p == 'f')
+			p++;
+	}
+
+	if (isFloat == false)
+	{
+		// integer size type
+		while (p < in_end && (*p == 'u' || *p == 'U' || *p == 'l' || *p == 'L'))
+			p++;
+	}
+
+	out_begin = in_begin;
+	out_end = p;
+	return true;
+}
+
+static bool TokenizeCStylePunctuation(const char * in_begin, const char * in_end, const char *& out_begin, const char *& out_end)
+{
+	(void)in_end;
+
+	switch (*in_begin)
+	{
+	case '[':
+	case ']':
+	case '{':
+	case '}':
+	case '!':
+	case '%':
+	case '^':
+	case '&':
+	case '*':
+	case '(':
+	case ')':
+	case '-':
+	case '+':
+	case '=':
+	case '~':
+	case '|':
+	case '<':
+	case '>':
+	case '?':
+	case ':':
+	case '/':
+	case ';':
+	case ',':
+	case '.':
+		out_begin = in_begin;
+		out_end = in_begin + 1;
 		return true;
 	}
 
 	return false;
 }
 
-static bool TokenizeCStyleNumber(const char * in_begin, const char * in_end, const char *& out_begin, const char *& out_end)
+static bool TokenizePythonString(const char * in_begin, const char * in_end, const char *& out_begin, const char *& out_end)
 {
 	const char * p = in_begin;
 
-	const bool startsWithNumber = *p >= '0' && *p <= '9';
-
-	if (*p != '+' && *p != '-' && !startsWithNumber)
-		return false;
-
-	p++;
-
-	bool hasNumber = startsWithNumber;
-
-	while (p < in_end && (*p >= '0' && *p <= '9'))
+	// string prefix: r, u, b, f and the two-letter combinations rb/br/rf/fr, in any case
+	for (int i = 0; i < 2 && p < in_end; i++)
 	{
-		hasNumber = true;
-
+		const char c = *p | 0x20;
+		if (c != 'r' && c != 'u' && c != 'b' && c != 'f')
+			break;
 		p++;
 	}
 
-	if (hasNumber == false)
+	if (p >= in_end || (*p != '"' && *p != '\''))
 		return false;
 
-	bool isFloat = false;
-	bool isHex = false;
-	bool isBinary = false;
+	const char quote = *p;
+	const bool triple = p + 2 < in_end && p[1] == quote && p[2] == quote;
+	p += triple ? 3 : 1;
 
-	if (p < in_end)
+	while (p < in_end)
 	{
-		if (*p == '.')
+		// a backslash always protects the next character, even in raw strings
+		if (*p == '\\')
 		{
-			isFloat = true;
-
-			p++;
+			p += 2;
+			continue;
+		}
 
-			while (p < in_end && (*p >= '0' && *p <= '9'))
+		if (*p == quote)
+		{
+			if (!triple)
+			{
 				p++;
+				break;
+			}
+			if (p + 2 < in_end && p[1] == quote && p[2] == quote)
+			{
+				p += 3;
+				break;
+			}
 		}
-		else if (*p == 'x' || *p == 'X')
-		{
-			// hex formatted integer of the type 0xef80
 
-			isHex = true;
+		p++;
+	}
 
-			p++;
+	// unterminated strings run to the end of the line
+	out_begin = in_begin;
+	out_end = p < in_end ? p : in_end;
+	return true;
+}
 
-			while (p < in_end && ((*p >= '0' && *p <= '9') || (*p >= 'a' && *p <= 'f') || (*p >= 'A' && *p <= 'F')))
-				p++;
-		}
-		else if (*p == 'b' || *p == 'B')
-		{
-			// binary formatted integer of the type 0b01011101
+static bool IsPythonIdentifierChar(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || (c & 0x80) != 0;
+}
 
-			isBinary = true;
+static bool TokenizePythonIdentifier(const char * in_begin, const char * in_end, const char *& out_begin, const char *& out_end)
+{
+	const char * p = in_begin;
 
-			p++;
+	if ((*p >= '0' && *p <= '9') || !IsPythonIdentifierChar(*p))
+		return false;
 
-			while (p < in_end && (*p >= '0' && *p <= '1'))
-				p++;
-		}
-	}
+	p++;
+	while (p < in_end && IsPythonIdentifierChar(*p))
+		p++;
 
-	if (isHex == false && isBinary == false)
+	out_begin = in_begin;
+	out_end = p;
+	return true;
+}
+
+static bool TokenizePythonNumber(const char * in_begin, const char * in_end, const char *& out_begin, const char *& out_end)
+{
+	const char * p = in_begin;
+
+	auto isDigit = [](char c) { return (c >= '0' && c <= '9') || c == '_'; };
+	auto isHexDigit = [](char c) { return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F') || c == '_'; };
+
+	if (*p == '.')
 	{
-		// floating point exponent
-		if (p < in_end && (*p == 'e' || *p == 'E'))
-		{
-			isFloat = true;
+		if (p + 1 >= in_end || p[1] < '0' || p[1] > '9')
+			return false;
+	}
+	else if (*p < '0' || *p > '9')
+		return false;
 
+	if (*p == '0' && p + 1 < in_end && ((p[1] | 0x20) == 'x' || (p[1] | 0x20) == 'o' || (p[1] | 0x20) == 'b'))
+	{
+		// hex, octal and binary integers: 0xff, 0o17, 0b1010; the digit class is validated by the compiler
+		p += 2;
+		while (p < in_end && isHexDigit(*p))
+			p++;
+	}
+	else
+	{
+		while (p < in_end && isDigit(*p))
 			p++;
 
-			if (p < in_end && (*p == '+' || *p == '-'))
+		if (p < in_end && *p == '.')
+		{
+			p++;
+			while (p < in_end && isDigit(*p))
 				p++;
+		}
 
-			bool hasDigits = false;
-
-			while (p < in_end && (*p >= '0' && *p <= '9'))
+		// exponent
+		if (p < in_end && (*p | 0x20) == 'e')
+		{
+			const char * e = p + 1;
+			if (e < in_end && (*e == '+' || *e == '-'))
+				e++;
+			if (e < in_end && *e >= '0' && *e <= '9')
 			{
-				hasDigits = true;
-
-				p++;
+				p = e;
+				while (p < in_end && isDigit(*p))
+					p++;
 			}
-
-			if (hasDigits == false)
-				return false;
 		}
 
-		// single precision floating point type
-		if (p < in_end && *p == 'f')
-			p++;
-	}
-
-	if (isFloat == false)
-	{
-		// integer size type
-		while (p < in_end && (*p == 'u' || *p == 'U' || *p == 'l' || *p == 'L'))
+		// imaginary suffix
+		if (p < in_end && (*p | 0x20) == 'j')
 			p++;
 	}
 
@@ -2762,7 +5868,7 @@ static bool TokenizeCStyleNumber(const char * in_begin, const char * in_end, con
 	return true;
 }
 
-static bool TokenizeCStylePunctuation(const char * in_begin, const char * in_end, const char *& out_begin, const char *& out_end)
+static bool TokenizePythonPunctuation(const char * in_begin, const char * in_end, const char *& out_begin, const char *& out_end)
 {
 	(void)in_end;
 
@@ -2786,12 +5892,12 @@ static bool TokenizeCStylePunctuation(const char * in_begin, const char * in_end
 	case '|':
 	case '<':
 	case '>':
-	case '?':
 	case ':':
 	case '/':
 	case ';':
 	case ',':
 	case '.':
+	case '@':
 		out_begin = in_begin;
 		out_end = in_begin + 1;
 		return true;
@@ -2800,6 +5906,173 @@ static bool TokenizeCStylePunctuation(const char * in_begin, const char * in_end
 	return false;
 }
 
+// Finds the names bound by a line of Python: "def", "class", "import", "from ... import" and
+// assignments at the start of a statement. Continuation lines of bracketed expressions are not
+// told apart from statements, so "name=value" (without spaces, as keyword arguments are
+// written) on an indented line is not taken for an assignment.
+static void SymbolizePythonLine(const char * in_begin, const char * in_end, int aLine, TextEditor::Symbols & aSymbols)
+{
+	const char * p = in_begin;
+	while (p < in_end && (*p == ' ' || *p == '\t'))
+		p++;
+	auto indent = (int)(p - in_begin);
+
+	auto skipSpaces = [&p, in_end]()
+	{
+		while (p < in_end && (*p == ' ' || *p == '\t'))
+			p++;
+	};
+	auto readName = [&p, in_end]() -> const char *
+	{
+		const char * begin = p;
+		if (p == in_end || (*p >= '0' && *p <= '9') || !IsPythonIdentifierChar(*p))
+			return nullptr;
+		while (p < in_end && IsPythonIdentifierChar(*p))
+			p++;
+		return begin;
+	};
+	auto isWord = [](const char * aBegin, const char * aEnd, const char * aWord)
+	{
+		auto length = strlen(aWord);
+		return (size_t)(aEnd - aBegin) == length && memcmp(aBegin, aWord, length) == 0;
+	};
+	auto add = [&](const char * aName, const char * aNameEnd, TextEditor::SymbolKind aKind)
+	{
+		aSymbols.push_back(TextEditor::Symbol{ aLine, (int)(aName - in_begin), indent, aKind, std::string(aName, aNameEnd) });
+	};
+	// "a.b.c as d" binds d, "a.b.c" binds a
+	auto readImported = [&]()
+	{
+		auto name = readName();
+		if (name == nullptr)
+			return false;
+		auto nameEnd = p;
+		while (p < in_end && *p == '.')
+		{
+			p++;
+			if (readName() == nullptr)
+				return false;
+		}
+		skipSpaces();
+		auto asBegin = p;
+		if (readName() != nullptr && isWord(asBegin, p, "as"))
+		{
+			skipSpaces();
+			name = readName();
+			if (name == nullptr)
+				return false;
+			nameEnd = p;
+		}
+		else
+		{
+			p = asBegin;
+		}
+		add(name, nameEnd, TextEditor::SymbolKind::Import);
+		skipSpaces();
+		return true;
+	};
+
+	auto word = readName();
+	if (word == nullptr)
+		return;
+	auto wordEnd = p;
+
+	if (isWord(word, wordEnd, "async"))
+	{
+		skipSpaces();
+		word = readName();
+		if (word == nullptr)
+			return;
+		wordEnd = p;
+	}
+
+	if (isWord(word, wordEnd, "def") || isWord(word, wordEnd, "class"))
+	{
+		auto kind = *word == 'd' ? TextEditor::SymbolKind::Function : TextEditor::SymbolKind::Class;
+		skipSpaces();
+		auto name = readName();
+		if (name != nullptr)
+			add(name, p, kind);
+		return;
+	}
+
+	if (isWord(word, wordEnd, "import"))
+	{
+		do
+		{
+			skipSpaces();
+			if (!readImported())
+				return;
+		} while (p < in_end && *p++ == ',');
+		return;
+	}
+
+	if (isWord(word, wordEnd, "from"))
+	{
+		// from .module import (a as b, c
+		skipSpaces();
+		while (p < in_end && (*p == '.' || IsPythonIdentifierChar(*p)))
+			p++;
+		skipSpaces();
+		auto import = readName();
+		if (import == nullptr || !isWord(import, p, "import"))
+			return;
+		skipSpaces();
+		if (p < in_end && *p == '(')
+			p++;
+		do
+		{
+			skipSpaces();
+			if (!readImported())
+				return;
+		} while (p < in_end && *p++ == ',');
+		return;
+	}
+
+	// Assignments: "a = ...", "a: int = ...", "a, b = ..."
+	std::vector<const char *> targets = { word, wordEnd };
+	auto spaced = p < in_end && (*p == ' ' || *p == '\t');
+	skipSpaces();
+	while (p < in_end && *p == ',')
+	{
+		p++;
+		skipSpaces();
+		auto name = readName();
+		if (name == nullptr)
+			return;
+		targets.push_back(name);
+		targets.push_back(p);
+		spaced = p < in_end && (*p == ' ' || *p == '\t');
+		skipSpaces();
+	}
+	if (p == in_end)
+		return;
+
+	bool assignment = false;
+	if (*p == '=')
+	{
+		assignment = (p + 1 == in_end || p[1] != '=') && (spaced || indent == 0 || targets.size() > 2);
+	}
+	else if (*p == ':' && targets.size() == 2)
+	{
+		// An annotation, unless the word is a keyword opening a block ("else:"), or the line is
+		// an entry of a dictionary display ("key: value,")
+		static const char * const blockKeywords[] = { "else", "try", "finally", "except", "lambda" };
+		assignment = (p + 1 == in_end || p[1] != '=');
+		for (auto keyword : blockKeywords)
+			assignment = assignment && !isWord(word, wordEnd, keyword);
+		auto last = in_end;
+		while (last > p && isspace((unsigned char)last[-1]))
+			last--;
+		assignment = assignment && last[-1] != ',';
+	}
+	if (!assignment)
+		return;
+
+	for (size_t i = 0; i < targets.size(); i += 2)
+		add(targets[i], targets[i + 1], TextEditor::SymbolKind::Variable);
+}
+
 const TextEditor::LanguageDefinition& TextEditor::LanguageDefinition::CPlusPlus()
 {
 	static bool inited = false;
@@ -3271,6 +6544,45 @@ const TextEditor::LanguageDefinition& TextEditor::LanguageDefinition::Python()
 			langDef.mIdentifiers.insert(std::make_pair(std::string(k), id));
 		}
 
+		langDef.mTokenize = [](const char * in_begin, const char * in_end, const char *& out_begin, const char *& out_end, PaletteIndex & paletteIndex) -> bool
+		{
+			paletteIndex = PaletteIndex::Max;
+
+			while (in_begin < in_end && isascii(*in_begin) && isblank(*in_begin))
+				in_begin++;
+
+			if (in_begin == in_end)
+			{
+				out_begin = in_end;
+				out_end = in_end;
+				paletteIndex = PaletteIndex::Default;
+			}
+			else if (*in_begin == '#')
+			{
+				out_begin = in_begin;
+				out_end = in_end;
+				paletteIndex = PaletteIndex::Comment;
+			}
+			else if (TokenizePythonString(in_begin, in_end, out_begin, out_end))
+				paletteIndex = PaletteIndex::String;
+			else if (TokenizePythonIdentifier(in_begin, in_end, out_begin, out_end))
+				paletteIndex = PaletteIndex::Identifier;
+			else if (TokenizePythonNumber(in_begin, in_end, out_begin, out_end))
+				paletteIndex = PaletteIndex::Number;
+			else if (TokenizePythonPunctuation(in_begin, in_end, out_begin, out_end))
+				paletteIndex = PaletteIndex::Punctuation;
+			else
+			{
+				// anything else ('$', '?', a line continuation...) is plain text; never fall back to the regexes
+				out_begin = in_begin;
+				out_end = in_begin + 1;
+				paletteIndex = PaletteIndex::Default;
+			}
+
+			return true;
+		};
+
+		// Regex equivalents of the tokenizer above, only used if mTokenize is cleared
 		// Python string patterns: support for ", ', r"", f"", etc.
 		langDef.mTokenRegexStrings.push_back(std::make_pair<std::string, PaletteIndex>("[rf]?\\\"\\\"\\\"([^\\\"\\\\]|\\\\.|\\\"[^\\\"]|\\\"\\\"[^\\\"])*\\\"\\\"\\\"", PaletteIndex::String));
 		langDef.mTokenRegexStrings.push_back(std::make_pair<std::string, PaletteIndex>("[rf]?\\\'\\\'\\\'([^\\\'\\\\]|\\\\.|\\\'[^\\\']|\\\'\\\'[^\\\'])*\\\'\\\'\\\'", PaletteIndex::String));
@@ -3293,6 +6605,8 @@ const TextEditor::LanguageDefinition& TextEditor::LanguageDefinition::Python()
 		langDef.mCommentEnd = "\"\"\"";
 		langDef.mSingleLineComment = "#";
 
+		langDef.mSymbolize = SymbolizePythonLine;
+
 		langDef.mCaseSensitive = true;
 		langDef.mAutoIndentation = true;
 
@@ -3303,14 +6617,140 @@ const TextEditor::LanguageDefinition& TextEditor::LanguageDefinition::Python()
 	return langDef;
 }
 
+void TextEditor::SetBreakpoints(const Breakpoints& aMarkers)
+{
+	mBreakpoints.clear();
+	mBreakpoints.reserve(aMarkers.size());
+	for (int line : aMarkers)
+		mBreakpoints.push_back(BreakpointEntry{ line, line });
+	mRemovedBreakpoints.clear();
+	mBreakpointsChanged = false;
+}
+
+TextEditor::Breakpoints TextEditor::GetBreakpoints() const
+{
+	Breakpoints result;
+	for (auto& breakpoint : mBreakpoints)
+		result.insert(result.end(), breakpoint.mLine);
+	return result;
+}
+
+void TextEditor::AddBreakpoint(int aLine)
+{
+	auto it = std::lower_bound(mBreakpoints.begin(), mBreakpoints.end(), aLine, BreakpointBefore);
+	if (it != mBreakpoints.end() && it->mLine == aLine)
+		return;
+
+	mBreakpoints.insert(it, BreakpointEntry{ aLine, -1 });
+	mBreakpointsChanged = true;
+}
+
+void TextEditor::RemoveBreakpoint(int aLine)
+{
+	auto it = std::lower_bound(mBreakpoints.begin(), mBreakpoints.end(), aLine, BreakpointBefore);
+	if (it == mBreakpoints.end() || it->mLine != aLine)
+		return;
+
+	if (it->mReportedLine != -1)
+		mRemovedBreakpoints.push_back(it->mReportedLine);
+	mBreakpoints.erase(it);
+	mBreakpointsChanged = true;
+}
+
 void TextEditor::ToggleBreakpoint(int aLine)
 {
-	if (mBreakpoints.count(aLine) != 0)
+	if (HasBreakpoint(aLine))
 	{
-		mBreakpoints.erase(aLine);
+		RemoveBreakpoint(aLine);
 	}
 	else
 	{
-		mBreakpoints.insert(aLine);
+		AddBreakpoint(aLine);
+	}
+}
+
+bool TextEditor::HasBreakpoint(int aLine) const
+{
+	auto it = std::lower_bound(mBreakpoints.begin(), mBreakpoints.end(), aLine, BreakpointBefore);
+	return it != mBreakpoints.end() && it->mLine == aLine;
+}
+
+std::vector<TextEditor::BreakpointChange> TextEditor::TakeBreakpointChanges()
+{
+	std::vector<BreakpointChange> result;
+	if (!mBreakpointsChanged)
+		return result;
+
+	// Ordered so that the changes can be applied one by one to a set of lines: no breakpoint
+	// is reported on a line before the one last reported there has left it. Breakpoints never
+	// pass each other, so moves up are safe top to bottom and moves down bottom to top.
+	for (int line : mRemovedBreakpoints)
+		result.push_back(BreakpointChange{ BreakpointChange::Type::Removed, line, -1 });
+	for (auto& breakpoint : mBreakpoints)
+	{
+		if (breakpoint.mReportedLine != -1 && breakpoint.mLine < breakpoint.mReportedLine)
+			result.push_back(BreakpointChange{ BreakpointChange::Type::Moved, breakpoint.mLine, breakpoint.mReportedLine });
+	}
+	for (auto it = mBreakpoints.rbegin(); it != mBreakpoints.rend(); ++it)
+	{
+		if (it->mReportedLine != -1 && it->mLine > it->mReportedLine)
+			result.push_back(BreakpointChange{ BreakpointChange::Type::Moved, it->mLine, it->mReportedLine });
+	}
+	for (auto& breakpoint : mBreakpoints)
+	{
+		if (breakpoint.mReportedLine == -1)
+			result.push_back(BreakpointChange{ BreakpointChange::Type::Added, breakpoint.mLine, -1 });
+		breakpoint.mReportedLine = breakpoint.mLine;
+	}
+
+	mRemovedBreakpoints.clear();
+	mBreakpointsChanged = false;
+	return result;
+}
+
+// Error markers are on 1-based lines too, and move like breakpoints. A marker on a line that is
+// gone goes with it.
+void TextEditor::ShiftErrorMarkers(int aLine, int aCount)
+{
+	auto first = mErrorMarkers.lower_bound(aLine + 1 + std::min(aCount, 0));
+	auto last = mErrorMarkers.lower_bound(aLine + 1);
+	if (first == mErrorMarkers.end())
+		return;
+
+	ErrorMarkers shifted(mErrorMarkers.begin(), first);
+	for (auto it = last; it != mErrorMarkers.end(); ++it)
+		shifted.emplace_hint(shifted.end(), it->first + aCount, std::move(it->second));
+	mErrorMarkers = std::move(shifted);
+}
+
+// The rest of aJoinedLine is being appended to aLine, before the lines after aLine up to
+// aJoinedLine are removed: the error marker of aJoinedLine goes with its text, unless aLine
+// has one of its own
+void TextEditor::JoinErrorMarker(int aLine, int aJoinedLine)
+{
+	auto joined = mErrorMarkers.find(aJoinedLine + 1);
+	if (joined == mErrorMarkers.end())
+		return;
+	mErrorMarkers.emplace(aLine + 1, std::move(joined->second));
+	mErrorMarkers.erase(joined);
+}
+
+// Lines are 0-based here, breakpoint lines 1-based: line aLine and the ones below it move by
+// aCount lines, and when aCount is negative the -aCount lines above aLine are gone
+void TextEditor::ShiftBreakpoints(int aLine, int aCount)
+{
+	auto first = std::lower_bound(mBreakpoints.begin(), mBreakpoints.end(), aLine + 1 + std::min(aCount, 0), BreakpointBefore);
+	auto last = std::lower_bound(first, mBreakpoints.end(), aLine + 1, BreakpointBefore);
+	if (first == mBreakpoints.end())
+		return;
+
+	for (auto it = first; it != last; ++it)
+	{
+		if (it->mReportedLine != -1)
+			mRemovedBreakpoints.push_back(it->mReportedLine);
 	}
+	for (auto it = last; it != mBreakpoints.end(); ++it)
+		it->mLine += aCount;
+	mBreakpoints.erase(first, last);
+	mBreakpointsChanged = true;
 }
@@ -2,12 +2,17 @@
 
 #include <string>
 #include <vector>
+#include <deque>
 #include <array>
 #include <memory>
 #include <unordered_set>
 #include <unordered_map>
 #include <map>
+#include <set>
 #include <regex>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include "imgui.h"
 
 class TextEditor
@@ -126,34 +131,193 @@ public:
 		std::string mDeclaration;
 	};
 
+	// A name defined by a line of code: a class, a function, a variable assigned to or an
+	// imported module or name
+	enum class SymbolKind : uint8_t
+	{
+		Class,
+		Function,
+		Variable,
+		Import
+	};
+
+	struct Symbol
+	{
+		int mLine;
+		int mIndex;		// byte index of the name in the line
+		int mIndent;	// width in bytes of the indentation of the line, by which definitions nest
+		SymbolKind mKind;
+		std::string mName;
+	};
+	typedef std::vector<Symbol> Symbols;
+
+	// A token found by a LanguageDefinition::LineTokenizeCallback: a byte range of the line and its color
+	struct Token
+	{
+		int mBegin, mEnd;
+		PaletteIndex mColor;
+	};
+	typedef std::vector<Token> Tokens;
+
 	typedef std::string String;
 	typedef std::unordered_map<std::string, Identifier> Identifiers;
 	typedef std::unordered_set<std::string> Keywords;
 	typedef std::map<int, std::string> ErrorMarkers;
-	typedef std::unordered_set<int> Breakpoints;
+	typedef std::set<int> Breakpoints;
 	typedef std::array<ImU32, (unsigned)PaletteIndex::Max> Palette;
 	typedef uint8_t Char;
 
-	struct Glyph
+	// Per-byte attributes of a line: the token color in the low bits and the flags set by the
+	// comment/string pass in the high bits
+	typedef uint8_t Attribute;
+
+	enum AttributeFlags : Attribute
 	{
-		Char mChar;
-		PaletteIndex mColorIndex = PaletteIndex::Default;
-		bool mComment : 1;
-		bool mMultiLineComment : 1;
-		bool mPreprocessor : 1;
+		Attribute_ColorMask = 0x1f,
+		Attribute_Comment = 1 << 5,
+		Attribute_MultiLineComment = 1 << 6,
+		Attribute_Preprocessor = 1 << 7
+	};
+	static_assert((unsigned)PaletteIndex::Max <= Attribute_ColorMask + 1, "PaletteIndex does not fit in Attribute_ColorMask");
+
+	// Comment/string lexer state in effect at the start of a line (LexStateFlags, see below, or a
+	// state of the language's LanguageDefinition::mTokenizeLine)
+	typedef uint8_t LexState;
 
-		Glyph(Char aChar, PaletteIndex aColorIndex) : mChar(aChar), mColorIndex(aColorIndex),
-			mComment(false), mMultiLineComment(false), mPreprocessor(false) {}
+	// The UTF-8 bytes of a line and, in a parallel array, one Attribute per byte. Keeping the
+	// text contiguous lets tokenizers and searches run on it directly, and costs 2 bytes per
+	// character. Also caches the lexer state computed by ColorizeInternal so that it can
+	// resume scanning at any line instead of at the top of the document.
+	struct Line
+	{
+		std::string mText;
+		std::vector<Attribute> mAttributes;
+		LexState mLexState = 0;
+		mutable uint16_t mWrapRows = 0;	// rows the line takes when word wrap is on, as of its last layout
+		mutable uint32_t mCacheId = 0;	// key of the line's entries in the per-line caches of TextEditor, reset to 0 by every change
+
+		size_t size() const { return mText.size(); }
+		bool empty() const { return mText.empty(); }
+		Char operator[](size_t aIndex) const { return (Char)mText[aIndex]; }
+		Char front() const { return (Char)mText.front(); }
+		Char back() const { return (Char)mText.back(); }
+
+		PaletteIndex GetColor(size_t aIndex) const { return (PaletteIndex)(mAttributes[aIndex] & Attribute_ColorMask); }
+		void SetColor(size_t aIndex, PaletteIndex aColor) { SetAttribute(aIndex, (Attribute)((mAttributes[aIndex] & ~Attribute_ColorMask) | (Attribute)aColor)); }
+		bool HasFlag(size_t aIndex, AttributeFlags aFlag) const { return (mAttributes[aIndex] & aFlag) != 0; }
+		void SetFlag(size_t aIndex, AttributeFlags aFlag, bool aValue) { SetAttribute(aIndex, aValue ? (Attribute)(mAttributes[aIndex] | aFlag) : (Attribute)(mAttributes[aIndex] & ~aFlag)); }
+		void SetAttribute(size_t aIndex, Attribute aValue)
+		{
+			// Recoloring a line to the colors it already has keeps its draw runs
+			if (mAttributes[aIndex] != aValue)
+			{
+				mAttributes[aIndex] = aValue;
+				mCacheId = 0;
+			}
+		}
+
+		// Inserted text gets the Default color and no flags until it is colorized
+		void insert(size_t aIndex, const char* aText, size_t aLength);
+		void insert(size_t aIndex, Char aChar) { insert(aIndex, (const char*)&aChar, 1); }
+		void push_back(Char aChar) { mText.push_back((char)aChar); mAttributes.push_back(0); mCacheId = 0; }
+		// Appends aOther[aFrom, end) together with its attributes
+		void append(const Line& aOther, size_t aFrom = 0);
+		void erase(size_t aFirst, size_t aLast);
+		void erase(size_t aIndex) { erase(aIndex, aIndex + 1); }
+		void assign(const char* aText, size_t aLength);
+		size_t MemoryUsage() const;
 	};
 
-	typedef std::vector<Glyph> Line;
-	typedef std::vector<Line> Lines;
+	// Sequence of lines stored as a two-level rope: a table of chunks, each holding up to
+	// 2 * kChunkSize consecutive lines. Inserting or removing lines only shifts the lines of
+	// the touched chunk plus the chunk table, so the cost does not grow with the document
+	// the way a flat std::vector<Line> does. Indexing is a binary search over the chunk table,
+	// short-circuited by remembering the last chunk hit (sequential walks are O(1)).
+	class LineBuffer
+	{
+	public:
+		static const size_t kChunkSize = 512;
+
+		template<class TBuffer, class TLine>
+		class Iterator
+		{
+		public:
+			Iterator(TBuffer* aBuffer, size_t aIndex) : mBuffer(aBuffer), mIndex(aIndex) {}
+			TLine& operator*() const { return (*mBuffer)[mIndex]; }
+			TLine* operator->() const { return &(*mBuffer)[mIndex]; }
+			Iterator& operator++() { ++mIndex; return *this; }
+			bool operator==(const Iterator& o) const { return mIndex == o.mIndex; }
+			bool operator!=(const Iterator& o) const { return mIndex != o.mIndex; }
+		private:
+			TBuffer* mBuffer;
+			size_t mIndex;
+		};
+		typedef Iterator<LineBuffer, Line> iterator;
+		typedef Iterator<const LineBuffer, const Line> const_iterator;
+
+		LineBuffer() : mSize(0), mLastChunk(0) {}
+
+		size_t size() const { return mSize; }
+		bool empty() const { return mSize == 0; }
+		void clear();
+
+		Line& operator[](size_t aIndex) { size_t offset; auto& chunk = mChunks[Locate(aIndex, offset)]; return chunk[offset]; }
+		const Line& operator[](size_t aIndex) const { size_t offset; auto& chunk = mChunks[Locate(aIndex, offset)]; return chunk[offset]; }
+		Line& at(size_t aIndex) { assert(aIndex < mSize); return (*this)[aIndex]; }
+		const Line& at(size_t aIndex) const { assert(aIndex < mSize); return (*this)[aIndex]; }
+		Line& front() { return mChunks.front().front(); }
+		Line& back() { return mChunks.back().back(); }
+		const Line& back() const { return mChunks.back().back(); }
+
+		iterator begin() { return iterator(this, 0); }
+		iterator end() { return iterator(this, mSize); }
+		const_iterator begin() const { return const_iterator(this, 0); }
+		const_iterator end() const { return const_iterator(this, mSize); }
+
+		Line& push_back(Line&& aLine);
+		Line& insert(size_t aIndex, Line&& aLine);
+		// Moves aLines in before aIndex, filling new chunks with them rather than growing one
+		void insert(size_t aIndex, std::vector<Line>&& aLines);
+		void erase(size_t aFirst, size_t aLast);
+		void erase(size_t aIndex) { erase(aIndex, aIndex + 1); }
+
+		size_t MemoryUsage() const;
+
+	private:
+		size_t Locate(size_t aIndex, size_t& aOffset) const
+		{
+			auto chunk = mLastChunk;
+			if (chunk >= mChunks.size() || aIndex < mChunkStart[chunk] || aIndex - mChunkStart[chunk] >= mChunks[chunk].size())
+				chunk = FindChunk(aIndex);
+			aOffset = aIndex - mChunkStart[chunk];
+			return chunk;
+		}
+		size_t FindChunk(size_t aIndex) const;
+		void SplitChunk(size_t aChunk);
+		void UpdateChunkStarts(size_t aFromChunk);
+
+		std::vector<std::vector<Line>> mChunks;
+		std::vector<size_t> mChunkStart;	// index of the first line of each chunk
+		size_t mSize;
+		mutable size_t mLastChunk;
+	};
+	typedef LineBuffer Lines;
 
 	struct LanguageDefinition
 	{
 		typedef std::pair<std::string, PaletteIndex> TokenRegexString;
 		typedef std::vector<TokenRegexString> TokenRegexStrings;
 		typedef bool(*TokenizeCallback)(const char * in_begin, const char * in_end, const char *& out_begin, const char *& out_end, PaletteIndex & paletteIndex);
+		// Appends the tokens of a whole line to aTokens (or only lexes it if aTokens is null), given
+		// the state the line starts in, and returns the state the next line starts in. The first
+		// line starts in state 0, which must mean outside of any string or comment; other states
+		// are up to the callback. Languages with one are colored by it alone instead of by
+		// mTokenize, the regexes and the comment delimiters. It colors keywords itself, while
+		// identifiers are still looked up in mIdentifiers.
+		typedef LexState(*LineTokenizeCallback)(const char * in_begin, const char * in_end, LexState aState, Tokens * aTokens);
+		// Appends the symbols defined by line aLine to aSymbols. Lines starting within a string
+		// or a multi-line comment are not passed.
+		typedef void(*SymbolizeCallback)(const char * in_begin, const char * in_end, int aLine, Symbols & aSymbols);
 
 		std::string mName;
 		Keywords mKeywords;
@@ -164,13 +328,15 @@ public:
 		bool mAutoIndentation;
 
 		TokenizeCallback mTokenize;
+		LineTokenizeCallback mTokenizeLine;
+		SymbolizeCallback mSymbolize;
 
 		TokenRegexStrings mTokenRegexStrings;
 
 		bool mCaseSensitive;
 
 		LanguageDefinition()
-			: mPreprocChar('#'), mAutoIndentation(true), mTokenize(nullptr), mCaseSensitive(true)
+			: mPreprocChar('#'), mAutoIndentation(true), mTokenize(nullptr), mTokenizeLine(nullptr), mSymbolize(nullptr), mCaseSensitive(true)
 		{
 		}
 
@@ -194,12 +360,28 @@ public:
 	void SetPalette(const Palette& aValue);
 
 	void SetErrorMarkers(const ErrorMarkers& aMarkers) { mErrorMarkers = aMarkers; }
-	void SetBreakpoints(const Breakpoints& aMarkers) { mBreakpoints = aMarkers; }
-	const Breakpoints& GetBreakpoints() const { return mBreakpoints; }
-	void AddBreakpoint(int aLine) { mBreakpoints.insert(aLine); }
-	void RemoveBreakpoint(int aLine) { mBreakpoints.erase(aLine); }
+	const ErrorMarkers& GetErrorMarkers() const { return mErrorMarkers; }
+
+	// Breakpoints (on 1-based lines) stay on their line as lines are inserted or removed above
+	// them, and go away with their line. Every change except SetBreakpoints() is recorded until
+	// it is taken with TakeBreakpointChanges(), a breakpoint moved several times being reported
+	// as one move.
+	struct BreakpointChange
+	{
+		enum class Type { Added, Removed, Moved };
+		Type mType;
+		int mLine;		// for Removed, the line it was last reported on
+		int mOldLine;	// for Moved, the line it was last reported on
+	};
+
+	void SetBreakpoints(const Breakpoints& aMarkers);	// taken as already known, no changes are recorded
+	Breakpoints GetBreakpoints() const;
+	void AddBreakpoint(int aLine);
+	void RemoveBreakpoint(int aLine);
 	void ToggleBreakpoint(int aLine);
-	bool HasBreakpoint(int aLine) const { return mBreakpoints.count(aLine) != 0; }
+	bool HasBreakpoint(int aLine) const;
+	bool HasBreakpointChanges() const { return mBreakpointsChanged; }
+	std::vector<BreakpointChange> TakeBreakpointChanges();
 	
 	// Debug current line (where debugger is paused)
 	void SetDebugCurrentLine(int aLine) { mDebugCurrentLine = aLine; }
@@ -208,6 +390,7 @@ public:
 
 	void Render(const char* aTitle, const ImVec2& aSize = ImVec2(), bool aBorder = false);
 	void SetText(const std::string& aText);
+	void SetText(const char* aText, size_t aLength);
 	std::string GetText() const;
 
 	void SetTextLines(const std::vector<std::string>& aLines);
@@ -217,6 +400,8 @@ public:
 	std::string GetCurrentLineText()const;
 
 	int GetTotalLines() const { return (int)mLines.size(); }
+	uint64_t GetEditGeneration() const { return mEditGeneration; }	// changes whenever the text may have changed
+	size_t GetMemoryUsage() const { return mLines.MemoryUsage(); }	// bytes held by the lines, their attributes and the line table
 	bool IsOverwrite() const { return mOverwrite; }
 
 	void SetReadOnly(bool aValue);
@@ -224,7 +409,19 @@ public:
 	bool IsTextChanged() const { return mTextChanged; }
 	bool IsCursorPositionChanged() const { return mCursorPositionChanged; }
 
+	// The edits since the last TakeTextChange() or DiscardTextChange(), as one range of the
+	// lines then, replaced by the lines now in its place
+	struct TextChange
+	{
+		int mFirstLine;
+		int mRemovedLines;
+		std::vector<std::string> mLines;
+	};
+	bool TakeTextChange(TextChange& aChange);	// false if no line was touched
+	void DiscardTextChange();
+
 	bool IsColorizerEnabled() const { return mColorizerEnabled; }
+	bool IsColorizePending() const { return mColorizerEnabled && (mCheckComments || mColorizeInFlight || mColorRangeMin < mColorRangeMax); }	// some lines are not colored yet
 	void SetColorizerEnable(bool aValue);
 
 	Coordinates GetCursorPosition() const { return GetActualCursorCoordinates(); }
@@ -242,6 +439,12 @@ public:
 	inline void SetShowWhitespaces(bool aValue) { mShowWhitespaces = aValue; }
 	inline bool IsShowingWhitespaces() const { return mShowWhitespaces; }
 
+	// A zoomed-out view of the text along the right edge, a few pixels per line, with the
+	// breakpoints, the debug line, error markers and find matches on it and the visible part
+	// framed. Clicking or dragging on it scrolls.
+	inline void SetShowMinimap(bool aValue) { mShowMinimap = aValue; }
+	inline bool IsShowingMinimap() const { return mShowMinimap; }
+
 	void SetTabSize(int aValue);
 	inline int GetTabSize() const { return mTabSize; }
 
@@ -274,6 +477,84 @@ public:
 	void Undo(int aSteps = 1);
 	void Redo(int aSteps = 1);
 
+	// The oldest undo steps are dropped once the history holds more than aBytes. The most
+	// recent step is always kept, however large it is.
+	void SetUndoMemoryBudget(size_t aBytes);
+	size_t GetUndoMemoryBudget() const { return mUndoMemoryBudget; }
+	size_t GetUndoMemoryUsage() const { return mUndoMemoryUsage; }	// bytes held by the undo history, redo steps included
+	int GetUndoRecordCount() const { return (int)mUndoBuffer.size(); }
+
+	// The undo history, cursor, breakpoints and folds, detached from the lines: a document that
+	// is not being edited can be kept as its plain text plus its History, and brought back with
+	// SetText() followed by RestoreHistory().
+	class History;
+	History TakeHistory();	// leaves an empty history behind
+	void RestoreHistory(History&& aHistory);
+
+	// Find and replace. The matches of the query are indexed and kept up to date as lines are
+	// edited, by searching only the edited lines again. Literal queries are searched on the
+	// spot; regular expressions (ECMAScript syntax) are searched on a worker thread when many
+	// lines must be searched. Matches do not span lines.
+	void SetFindQuery(const std::string& aText, bool aRegex = false, bool aCaseSensitive = true);
+	const std::string& GetFindQuery() const { return mFindQuery; }
+	bool IsFindQueryValid() const { return mFindQuery.empty() || !mFindRegex || mFindRegexObject != nullptr; }
+	bool IsFindPending() const { return !mFindQuery.empty() && mFindRangeMin < mFindRangeMax; }	// some lines have not been searched yet
+	int GetFindMatchCount();
+	int GetFindMatchIndex();	// index of the selected match, -1 if the selection is not a match
+	// Selects the next (or previous) match from the cursor, wrapping around. Returns false if there is none.
+	bool FindNext(bool aBackwards = false);
+	// Replaces the selected match and selects the next one. With a regular expression, $1, $& etc. in
+	// aReplacement are replaced by what the match captured.
+	bool Replace(const std::string& aReplacement);
+	// Replaces every match as a single edit and a single undo step. Returns the number of replacements.
+	int ReplaceAll(const std::string& aReplacement);
+	// Replaces ranges of lines, given in order by where they are in the current text and apart
+	// from each other, as a single edit and a single undo step. The lines around them keep
+	// their colors, breakpoints and folds, e.g. when a file changed on disk is loaded again.
+	void ReplaceLines(const std::vector<TextChange>& aChanges);
+
+	// Symbols defined in the text, sorted by line, for languages with a mSymbolize. Like the find
+	// matches they are kept up to date by indexing only the edited lines again, when rendering;
+	// a new text is indexed over a few frames if it is very long.
+	const Symbols& GetSymbols();
+	bool IsSymbolIndexPending() const { return mSymbolRangeMin < mSymbolRangeMax; }
+	// The definition of aName that code on aLine most likely refers to: the closest one above
+	// that is not nested deeper than aLine, else the first one below. Null if there is none.
+	const Symbol* FindDefinition(const std::string& aName, int aLine);
+	void GoToSymbol(const Symbol& aSymbol);		// selects its name and scrolls to it
+	bool GoToDefinition();						// of the word under the cursor; false if none is known
+
+	// Completion. Typing a name lists the known names starting with it: the symbols defined in
+	// the text, the keywords and identifiers of the language and the words given to
+	// SetCompletionWords. After "object." it lists the members given for object instead, and
+	// nothing for other objects. Up/Down choose, Enter or Tab insert, Escape closes the list.
+	// The names are kept in prefix trees; the one of the symbols follows the symbol index.
+	void SetCompletionWords(const std::vector<std::string>& aWords);
+	void SetCompletionMembers(const std::string& aObject, const std::vector<std::string>& aMembers);
+	void SetCompletionEnabled(bool aValue);
+	bool IsCompletionEnabled() const { return mCompletionEnabled; }
+	bool IsCompletionOpen() const { return mCompletionOpen; }
+	const std::vector<std::string>& GetCompletions() const { return mCompletions; }
+
+	// Folding. A line followed by more indented lines folds them away, up to the next line
+	// indented as much or less; blank and comment lines count with the region only when it
+	// goes on after them. Folding a region drops the folds inside it. Lines inserted or
+	// removed in a folded region, or the cursor reaching one of its lines, unfold it.
+	// Ctrl+Shift+[ folds the region around the cursor, Ctrl+Shift+] unfolds it, and the
+	// markers left of the text toggle them.
+	bool IsFoldable(int aLine) const;
+	bool IsFolded(int aLine) const;
+	void Fold(int aLine);
+	void Unfold(int aLine);
+	void ToggleFold(int aLine);
+	void UnfoldAll();
+	int GetVisibleLineCount() const { return (int)mLines.size() - (mFolds.empty() ? 0 : mFoldHidden.back()); }
+
+	// Word wrap breaks lines wider than the view into rows that fit it, after the last space
+	// of a row where there is one. There is no horizontal scrolling while it is on.
+	void SetWordWrap(bool aValue);
+	bool IsWordWrapping() const { return mWordWrap; }
+
 	static const Palette& GetDarkPalette();
 	static const Palette& GetLightPalette();
 	static const Palette& GetRetroBluePalette();
@@ -308,6 +589,23 @@ private:
 
 		void Undo(TextEditor* aEditor);
 		void Redo(TextEditor* aEditor);
+		size_t MemoryUsage() const;
+
+		// Lines rewritten in place by ReplaceAll, which neither adds nor removes lines
+		struct LineChange
+		{
+			int mLine;
+			std::string mBefore;
+			std::string mAfter;
+		};
+
+		// Ranges of lines replaced by ReplaceLines, at their place in the text before
+		struct RangeChange
+		{
+			int mLine;
+			std::vector<std::string> mBefore;
+			std::vector<std::string> mAfter;
+		};
 
 		std::string mAdded;
 		Coordinates mAddedStart;
@@ -319,14 +617,187 @@ private:
 
 		EditorState mBefore;
 		EditorState mAfter;
+
+		std::vector<LineChange> mLineChanges;
+		std::vector<RangeChange> mRangeChanges;
+	};
+
+	typedef std::deque<UndoRecord> UndoBuffer;
+
+	// Words counted by occurrence, in a prefix tree whose nodes share one vector. Each node
+	// also counts the words below it, so that branches emptied by removals are unlinked and
+	// their nodes reused.
+	class CompletionTrie
+	{
+	public:
+		void Add(const std::string& aWord);
+		void Remove(const std::string& aWord);
+		void Clear();
+		// Appends the words starting with aPrefix in byte order, until aWords holds aMax words
+		void Find(const std::string& aPrefix, size_t aMax, std::vector<std::string>& aWords) const;
+
+	private:
+		struct Node
+		{
+			std::vector<std::pair<char, int>> mChildren;	// sorted by character
+			int mCount = 0;		// occurrences of the word ending here
+			int mTotal = 0;		// occurrences of the words ending here or below
+		};
+
+		int FindChild(int aNode, char aChar) const;
+
+		std::vector<Node> mNodes;	// mNodes[0] is the root once a word was added
+		std::vector<int> mFreeNodes;
+	};
+
+	// A piece of a line as Render draws it: a stretch of text in one color, a run of spaces
+	// or a tab. Positions are relative to the start of the line text. Runs are at most
+	// kDrawRunBytes long, so that on long lines they double as x-offset checkpoints.
+	struct DrawRun
+	{
+		enum Kind : uint8_t { Text, Spaces, Tab };
+
+		float mX;
+		float mWidth;
+		uint32_t mBegin, mEnd;	// byte range within the line
+		Attribute mColor;		// normalized, see DrawColor()
+		Kind mKind;
 	};
 
-	typedef std::vector<UndoRecord> UndoBuffer;
+	struct DrawRuns
+	{
+		std::vector<DrawRun> mRuns;
+		int mFrame;		// last frame the runs were used in
+	};
+
+	// Byte index and column of a long line every kColumnCheckpointBytes, so that columns can
+	// be converted from the closest checkpoint instead of from the start of the line
+	struct ColumnCheckpoint
+	{
+		int mIndex;
+		int mColumn;
+	};
+
+	struct ColumnIndex
+	{
+		std::vector<ColumnCheckpoint> mCheckpoints;
+		int mMaxColumn;
+		int mFrame;		// last frame the index was used in
+	};
+
+	// What the minimap draws of a line: a bar over the columns its text spans, in the color
+	// most of its characters have
+	struct MinimapLine
+	{
+		int mBegin, mEnd;	// columns, leading and trailing whitespace left out
+		Attribute mColor;	// normalized, see DrawColor()
+		int mFrame;		// last frame the summary was used in
+	};
+
+	// Where a row of a line starts when word wrap is on; the first row starts at 0
+	struct WrapPoint
+	{
+		int mIndex;
+		int mColumn;
+	};
+
+	struct WrapPoints
+	{
+		std::vector<WrapPoint> mPoints;
+		int mColumns;	// the line was wrapped at
+		int mFrame;		// last frame the points were used in
+	};
+
+	static const size_t kDrawRunBytes = 256;
+	static const size_t kColumnCheckpointBytes = 64;
+	static const size_t kLongLine = 1024;	// lines shorter than this are simply walked from their start
+
+	enum LexStateFlags : LexState
+	{
+		LexState_String = 1 << 0,
+		LexState_MultiLineComment = 1 << 1,
+		LexState_Concatenate = 1 << 2,
+		// only meaningful when the previous line ends with a '\\'
+		LexState_SingleLineComment = 1 << 3,
+		LexState_Preprocessor = 1 << 4,
+		LexState_FirstChar = 1 << 5
+	};
+
+	// Everything the tokenizer reads, shared read-only with the colorizer thread
+	struct ColorizerContext
+	{
+		LanguageDefinition mLanguageDefinition;
+		RegexList mRegexList;
+	};
+
+	struct ColorSpan
+	{
+		int mLength;
+		PaletteIndex mColorIndex;
+	};
+
+	// A copy of a range of lines, tokenized on the colorizer thread
+	struct ColorizeJob
+	{
+		uint64_t mGeneration;
+		int mFirstLine;
+		std::shared_ptr<const ColorizerContext> mContext;
+		std::string mText;					// the lines back to back, without separators
+		std::vector<int> mLineEnds;			// end offset of each line in mText
+		std::vector<int> mPreprocStarts;	// first index of each line within a preprocessor directive
+		std::vector<LexState> mLexStates;	// state each line starts in, for LanguageDefinition::mTokenizeLine
+	};
+
+	struct ColorizeResult
+	{
+		uint64_t mGeneration;				// mEditGeneration of the job; the spans are stale if it changed since
+		int mFirstLine;
+		std::vector<ColorSpan> mSpans;
+		std::vector<int> mLineSpanEnds;		// end index into mSpans of each line
+	};
+
+	struct FindMatch
+	{
+		int mLine;
+		int mBegin, mEnd;	// byte range within the line
+	};
+
+	// A copy of a range of lines, searched for a regular expression on the find thread
+	struct FindJob
+	{
+		uint64_t mGeneration;
+		uint64_t mQueryId;
+		int mFirstLine;
+		std::shared_ptr<const std::regex> mRegex;
+		std::string mText;					// the lines back to back, without separators
+		std::vector<int> mLineEnds;			// end offset of each line in mText
+	};
+
+	struct FindResult
+	{
+		uint64_t mGeneration;				// mEditGeneration of the job; the matches are stale if it changed since
+		uint64_t mQueryId;
+		int mFirstLine;
+		int mLineCount;
+		std::vector<FindMatch> mMatches;
+	};
+
+	static const int kFindSyncLines = 256;		// regular expression searches of more lines go to the find thread
+	static const int kFindJobLines = 16384;		// lines searched per find job
 
 	void ProcessInputs();
 	void Colorize(int aFromLine = 0, int aCount = -1);
-	void ColorizeRange(int aFromLine = 0, int aToLine = 0);
+	static void ColorizeLine(const ColorizerContext& aContext, const char* aBegin, const char* aEnd, int aPreprocStart, std::vector<ColorSpan>& aSpans);
+	static void ColorizeTokenizedLine(const ColorizerContext& aContext, const char* aBegin, const char* aEnd, LexState aState, Tokens& aTokens, std::vector<ColorSpan>& aSpans);
+	bool StartsInStringOrComment(const Line& aLine) const;
+	static void RunColorizeJob(const ColorizeJob& aJob, ColorizeResult& aResult);
+	void ColorizerThread();
+	bool ApplyColorizeResult();
+	void SubmitColorizeJob(int aFromLine, int aToLine);
+	void StopColorizer();
 	void ColorizeInternal();
+	void ShiftColorRanges(int aFromLine, int aDelta);
+	void ShiftTextChange(int aFromLine, int aDelta);
 	float TextDistanceToLineStart(const Coordinates& aFrom) const;
 	void EnsureCursorVisible();
 	int GetPageSize() const;
@@ -336,7 +807,10 @@ private:
 	void Advance(Coordinates& aCoordinates) const;
 	void DeleteRange(const Coordinates& aStart, const Coordinates& aEnd);
 	int InsertTextAt(Coordinates& aWhere, const char* aValue);
-	void AddUndo(UndoRecord& aValue);
+	void AddUndo(UndoRecord& aValue, bool aMergeable = false);
+	bool MergeUndo(const UndoRecord& aValue);
+	void ClearUndo();
+	void TrimUndo();
 	Coordinates ScreenPosToCoordinates(const ImVec2& aPosition) const;
 	Coordinates FindWordStart(const Coordinates& aFrom) const;
 	Coordinates FindWordEnd(const Coordinates& aFrom) const;
@@ -349,12 +823,87 @@ private:
 	void RemoveLine(int aStart, int aEnd);
 	void RemoveLine(int aIndex);
 	Line& InsertLine(int aIndex);
+	void InsertLines(int aIndex, std::vector<Line>&& aLines);
+	void ReplaceLineRange(int aLine, int aRemoved, const std::vector<std::string>& aLines);
 	void EnterCharacter(ImWchar aChar, bool aShift);
 	void Backspace();
 	void DeleteSelection();
 	std::string GetWordUnderCursor() const;
 	std::string GetWordAt(const Coordinates& aCoords) const;
-	ImU32 GetGlyphColor(const Glyph& aGlyph) const;
+	ImU32 GetGlyphColor(Attribute aAttribute) const;
+	uint32_t GetCacheId(const Line& aLine) const;
+	const std::vector<DrawRun>& GetDrawRuns(const Line& aLine, float aSpaceSize) const;
+	const ColumnIndex* GetColumnIndex(const Line& aLine) const;
+	void KeepTextCaches(const Line& aLine, uint32_t aOldCacheId) const;
+	const MinimapLine& GetMinimapLine(const Line& aLine) const;
+	const std::vector<WrapPoint>& GetWrapPoints(int aLine) const;
+
+	static bool FindMatchLess(const FindMatch& aLeft, const FindMatch& aRight);
+	void UpdateFindIndex(bool aWait = false);	// aWait searches all pending lines, including the ones of the find thread
+	void ReplaceFindMatches(int aFromLine, int aToLine, const std::vector<FindMatch>& aMatches);
+	void ShiftFindMatches(int aFromLine, int aDelta);
+	void FlushFindShift();
+	static void FindLiteral(const std::string& aQuery, bool aCaseSensitive, const char* aBegin, const char* aEnd, int aLine, std::vector<FindMatch>& aMatches);
+	static void FindRegex(const std::regex& aRegex, const char* aBegin, const char* aEnd, int aLine, std::vector<FindMatch>& aMatches);
+	void FindThread();
+	void SubmitFindJob(int aFromLine, int aToLine);
+	bool ApplyFindResult();
+	void StopFindThread();
+	std::string FormatReplacement(const FindMatch& aMatch, const std::string& aReplacement) const;
+	void SelectFindMatch(const FindMatch& aMatch);
+
+	static const int kSymbolFrameLines = 32768;	// lines indexed per frame at most
+
+	void UpdateSymbols();
+	void ResetSymbols();
+	void ShiftSymbols(int aFromLine, int aDelta);
+
+	static const size_t kMaxCompletions = 64;
+	static const int kCompletionRows = 10;
+
+	void AddLanguageCompletionWords(const LanguageDefinition& aLanguageDef, bool aAdd);
+	void UpdateCompletion();
+	void CloseCompletion();
+	void AcceptCompletion();
+	bool HandleCompletionKeys();
+	bool IsInStringOrComment(int aLine, int aIndex) const;
+	void RenderCompletion(const ImVec2& aTextOrigin);
+
+	static const int kMinimapColumns = 120;
+
+	float GetMinimapWidth() const;
+	bool HandleMinimapMouse();
+	void RenderMinimap(const ImVec2& aMin, const ImVec2& aMax, float aScrollY, float aScrollMaxY);
+
+	// Screen rows: lines that are not folded away, from the top, and the rows they wrap onto
+	int LineToRow(int aLine) const;			// first row of aLine, or of the fold hiding it
+	int RowToLine(int aRow) const;
+	bool IsLineHidden(int aLine) const;		// folded away
+	int GetRowCount() const;
+	int GetLineRows(int aLine) const;		// rows aLine takes when shown
+	int CoordinatesToRow(const Coordinates& aCoords, int* aRowColumn = nullptr) const;	// aRowColumn: the column its row starts at
+	Coordinates RowToCoordinates(int aRow, int aColumnInRow) const;
+	int GetLineIndentation(int aLine) const;	// -1 for lines without code
+	int GetFoldRegionEnd(int aLine) const;		// last line of the region folded at aLine, or aLine
+	int FindFoldRegion(int aLine) const;		// innermost region holding aLine, or -1
+	int FoldMarkerAt(const ImVec2& aPosition) const;
+	void RevealLine(int aLine);
+	void ShiftFolds(int aFromLine, int aDelta);
+	void UpdateFoldSums();
+
+	// Word wrap: each line keeps its row count in Line::mWrapRows, summed up by mRowTree for
+	// the lines shown, so that rows map to lines in O(log n). Edited lines are laid out again
+	// when the rows are next needed; lines inserted or removed rebuild the tree from the first
+	// of them on, and folds rebuild all of it.
+	static const int kMinWrapColumns = 20;
+	static const int kMaxWrapRows = 0xffff;	// the rest of a longer line stays on its last row
+
+	int WrapLine(const Line& aLine, int aColumns, std::vector<WrapPoint>* aPoints) const;
+	void SetWrapColumns(int aColumns);
+	void UpdateWrap() const;
+	void ShiftWrap(int aFromLine, int aDelta);
+	int RowTreePrefix(int aLine) const;
+	int RowTreeFind(int aRow, int& aRowInLine) const;
 
 	void HandleKeyboardInputs();
 	void HandleMouseInputs();
@@ -365,6 +914,12 @@ private:
 	EditorState mState;
 	UndoBuffer mUndoBuffer;
 	int mUndoIndex;
+	size_t mUndoMemoryUsage;
+	size_t mUndoMemoryBudget;
+	// Typed characters and backspaces following each other within a short time are merged
+	// into the last undo record while this is set; undo, redo and non-typing edits close it.
+	bool mUndoMergeable;
+	uint64_t mUndoMergeTime;
 
 	int mTabSize;
 	bool mOverwrite;
@@ -386,17 +941,141 @@ private:
 
 	Palette mPaletteBase;
 	Palette mPalette;
+	float mPaletteAlpha;	// style alpha mPalette was computed with, negative when it must be recomputed
 	LanguageDefinition mLanguageDefinition;
-	RegexList mRegexList;
+
+	// Token colors are computed on mColorizerThread from copies of the dirty lines. Every edit
+	// bumps mEditGeneration, and a result is only applied if no edit happened since its job
+	// was submitted; otherwise its lines simply stay in the pending mColorRange.
+	std::shared_ptr<const ColorizerContext> mColorizerContext;
+	uint64_t mEditGeneration;
+	bool mColorizeInFlight;
+	std::thread mColorizerThread;
+	std::mutex mColorizerMutex;
+	std::condition_variable mColorizerCondition;
+	std::unique_ptr<ColorizeJob> mColorizerJob;			// guarded by mColorizerMutex
+	std::unique_ptr<ColorizeResult> mColorizerResult;	// guarded by mColorizerMutex
+	bool mColorizerQuit;								// guarded by mColorizerMutex
 
 	bool mCheckComments;
-	Breakpoints mBreakpoints;
+	int mCommentRangeMin, mCommentRangeMax;	// lines whose comment/string flags must be recomputed
+	// Matches of the find query, sorted by position. Edits mark lines in the mFindRange like
+	// they mark them for colorizing, and only those lines are searched again.
+	std::string mFindQuery;
+	bool mFindRegex;
+	bool mFindCaseSensitive;
+	std::shared_ptr<const std::regex> mFindRegexObject;	// null unless the query is a valid regular expression
+	uint64_t mFindQueryId;
+	std::vector<FindMatch> mFindMatches;
+	int mFindRangeMin, mFindRangeMax;	// lines whose matches must be recomputed
+	int mFindShiftLine, mFindShift;		// matches from mFindShiftLine down are mFindShift lines further down than recorded
+	bool mFindInFlight;
+	std::thread mFindThread;
+	std::mutex mFindMutex;
+	std::condition_variable mFindCondition;
+	std::unique_ptr<FindJob> mFindJob;			// guarded by mFindMutex
+	std::unique_ptr<FindResult> mFindResult;	// guarded by mFindMutex
+	bool mFindQuit;								// guarded by mFindMutex
+
+	// Symbols, sorted by line. Edits mark lines in the mSymbolRange, and only those lines are
+	// indexed again.
+	Symbols mSymbols;
+	int mSymbolRangeMin, mSymbolRangeMax;	// lines whose symbols must be recomputed
+	int mSymbolShiftLine, mSymbolShift;		// symbols from mSymbolShiftLine down are mSymbolShift lines further down than recorded
+
+	// Completion names: of the symbols, of the language and SetCompletionWords, and of the
+	// objects given to SetCompletionMembers
+	CompletionTrie mSymbolNames;
+	CompletionTrie mCompletionWords;
+	std::vector<std::string> mExtraCompletionWords;
+	std::unordered_map<std::string, CompletionTrie> mCompletionMembers;
+	bool mCompletionEnabled;
+	bool mCompletionRequested;		// a name character was typed: open the list if there are completions
+	bool mCompletionOpen;
+	Coordinates mCompletionStart;	// of the name being completed
+	std::vector<std::string> mCompletions;
+	int mCompletionIndex;			// selected completion
+	int mCompletionTop;				// first completion shown
+	ImVec2 mCompletionRectMin, mCompletionRectMax;	// where the list was drawn
+
+	// Where the minimap and its frame around the visible rows were drawn, and how far the frame
+	// moves from the top to the bottom of the document
+	bool mShowMinimap;
+	ImVec2 mMinimapRectMin, mMinimapRectMax;
+	float mMinimapFrameTop, mMinimapFrameBottom;
+	float mMinimapTrack;
+	bool mMinimapDragging;
+	float mMinimapGrab;		// of the frame, from its top
+
+	// Folded regions, sorted by line and disjoint, and mFoldHidden[i], the lines hidden by
+	// mFolds[0] to mFolds[i - 1]: a screen row maps to its line, and back, by binary search
+	struct FoldedRegion
+	{
+		int mLine;
+		int mCount;		// lines hidden below mLine
+	};
+	std::vector<FoldedRegion> mFolds;
+	std::vector<int> mFoldHidden;
+
+	bool mWordWrap;
+	int mWrapColumns;
+	mutable int mWrapRangeMin, mWrapRangeMax;	// lines to lay out again
+	mutable std::vector<int> mRowTree;			// Fenwick tree, 1-based, of the rows of the lines shown
+	mutable int mRowTreeStaleFrom;				// first line whose tree nodes need rebuilding
+	mutable int mRowTreeLines;					// lines the tree will have once rebuilt
+
+	// Lines that may differ from the text of the last TakeTextChange(), which had
+	// mChangeLineCount lines; the lines outside the range are the same as then
+	int mChangeRangeMin, mChangeRangeMax;
+	int mChangeLineCount;
+
+	struct BreakpointEntry
+	{
+		int mLine;
+		int mReportedLine;	// -1 until the breakpoint is reported as added
+	};
+	typedef std::vector<BreakpointEntry> BreakpointEntries;	// sorted by mLine
+
+	static bool BreakpointBefore(const BreakpointEntry& aBreakpoint, int aLine) { return aBreakpoint.mLine < aLine; }
+	void ShiftBreakpoints(int aLine, int aCount);
+
+	BreakpointEntries mBreakpoints;
+	std::vector<int> mRemovedBreakpoints;	// reported lines of the breakpoints removed since
+	bool mBreakpointsChanged;
+	void ShiftErrorMarkers(int aLine, int aCount);	// as ShiftBreakpoints()
+	void JoinErrorMarker(int aLine, int aJoinedLine);
 	ErrorMarkers mErrorMarkers;
 	int mDebugCurrentLine;  // Line where debugger is currently paused (-1 if not debugging)
 	ImVec2 mCharAdvance;
 	Coordinates mInteractiveStart, mInteractiveEnd;
-	std::string mLineBuffer;
+	// Draw runs, column indexes, minimap summaries and wrap points of the lines used recently,
+	// keyed by Line::mCacheId. A line loses its key when it changes, so they are only
+	// recomputed for lines that changed.
+	mutable std::unordered_map<uint32_t, DrawRuns> mDrawRuns;
+	mutable std::unordered_map<uint32_t, ColumnIndex> mColumnIndexes;
+	mutable std::unordered_map<uint32_t, MinimapLine> mMinimapLines;
+	mutable std::unordered_map<uint32_t, WrapPoints> mWrapPoints;
+	mutable uint32_t mLastCacheId;
+	int mDrawRunsFrame;
+	ImFont* mDrawRunsFont;
+	float mDrawRunsFontSize;
 	uint64_t mStartTime;
 
 	float mLastClick;
 };
+
+class TextEditor::History
+{
+public:
+	size_t MemoryUsage() const { return sizeof(History) + mUndoMemoryUsage + mFolds.capacity() * sizeof(FoldedRegion); }
+
+private:
+	friend class TextEditor;
+
+	UndoBuffer mUndoBuffer;
+	int mUndoIndex = 0;
+	size_t mUndoMemoryUsage = 0;
+	EditorState mState;
+	BreakpointEntries mBreakpoints;
+	std::vector<FoldedRegion> mFolds;
+};
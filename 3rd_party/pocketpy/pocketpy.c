@@ -24140,6 +24140,74 @@ Error* Lexer__process(SourceData_ src, Token** out_tokens, int* out_length) {
     return NULL;
 }
 
+/******************************/
+// MiniPythonIDE patch: the name and number rules of eat_name() and eat_number(), for the
+// editor's highlighter (src/ide/python_lexer.cpp), which lexes a line at a time on its own.
+
+int py_lexname(const char* begin, const char* end, bool* keyword) {
+    const char* p = begin;
+    while(p < end) {
+        unsigned char c = *p;
+        int u8bytes = c11__u8_header(c, true);
+        if(u8bytes == 0) break;
+        if(u8bytes == 1) {
+            if(!isalnum(c) && c != '_') break;
+            p++;
+            continue;
+        }
+        if(end - p < u8bytes || !c11__is_unicode_Lo_char(c11__u8_value(u8bytes, p))) break;
+        p += u8bytes;
+    }
+    if(keyword && p > begin) {
+        c11_sv name = {begin, p - begin};
+        const char** KW_BEGIN = TokenSymbols + TK_FALSE;
+        int KW_COUNT = TK__COUNT__ - TK_FALSE;
+#define less(a, b) (c11_sv__cmp2(b, a) > 0)
+        int out;
+        c11__lower_bound(const char*, KW_BEGIN, KW_COUNT, name, less, &out);
+#undef less
+        *keyword = out != KW_COUNT && c11__sveq2(name, KW_BEGIN[out]);
+    }
+    return (int)(p - begin);
+}
+
+int py_lexnumber(const char* begin, const char* end, bool* valid) {
+    const char* i = begin;
+    while(i < end && is_possible_number_char(*i))
+        i++;
+
+    bool is_scientific_notation = false;
+    if(i < end && i[-1] == 'e' && (*i == '+' || *i == '-')) {
+        i++;
+        while(i < end && (isdigit(*i) || *i == 'j'))
+            i++;
+        is_scientific_notation = true;
+    }
+    if(!valid) return (int)(i - begin);
+
+    c11_sv text = {begin, i - begin};
+    if(text.data[0] != '.' && !is_scientific_notation) {
+        int64_t value;
+        switch(c11__parse_uint(text, &value, -1)) {
+            case IntParsing_SUCCESS: *valid = true; return text.size;
+            case IntParsing_OVERFLOW: *valid = false; return text.size;
+            case IntParsing_FAILURE: break;
+        }
+    }
+
+    // strtod() needs a terminated copy; longer literals are not floats anyone writes
+    char buffer[128];
+    *valid = false;
+    if(text.size < (int)sizeof(buffer)) {
+        memcpy(buffer, text.data, text.size);
+        buffer[text.size] = '\0';
+        char* p_end;
+        strtod(buffer, &p_end);
+        *valid = p_end == buffer + text.size || (i[-1] == 'j' && p_end == buffer + text.size - 1);
+    }
+    return text.size;
+}
+
 const char* TokenSymbols[] = {
     "@eof",
     "@eol",
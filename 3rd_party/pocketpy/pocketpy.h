@@ -427,6 +427,17 @@ PK_API bool py_smartexec(const char* source, py_Ref module, ...) PY_RAISE PY_RET
 /// `// res will be 3`.
 PK_API bool py_smarteval(const char* source, py_Ref module, ...) PY_RAISE PY_RETURN;
 
+/************* Lexer *************/
+// MiniPythonIDE patch: rules of the compiler's lexer, for the editor's highlighter.
+
+/// Length of the name starting at `begin` as the compiler's lexer reads one, `0` if `begin` is
+/// not a name character. Unless `keyword` is NULL, it is set to whether the name is a keyword.
+PK_API int py_lexname(const char* begin, const char* end, bool* keyword);
+/// Length of the number literal starting at `begin` (a digit, or a '.' followed by one) as the
+/// compiler's lexer reads one. Unless `valid` is NULL, it is set to whether the compiler accepts
+/// the literal.
+PK_API int py_lexnumber(const char* begin, const char* end, bool* valid);
+
 /************* Value Creation *************/
 
 /// Create an `int` object.
@@ -0,0 +1,335 @@
+// Benchmarks of the editor on generated text. ImGui runs headless: frames are laid out and
+// their draw lists built, but nothing is drawn.
+//
+//   editor_bench [name...]     runs the benchmarks named, or all of them
+
+#include "TextEditor.h"
+#include "file_viewer.h"
+#include "mapped_file.h"
+#include "imgui.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <thread>
+
+#ifdef __linux__
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+namespace
+{
+
+double NowMs()
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void InitImGui()
+{
+    ImGui::CreateContext();
+    ImGuiIO& io = ImGui::GetIO();
+    io.DisplaySize = ImVec2(1920, 1080);
+    io.DeltaTime = 1.0f / 60.0f;
+    io.IniFilename = nullptr;
+    io.Fonts->AddFontDefault();
+    io.BackendFlags |= ImGuiBackendFlags_RendererHasTextures;
+}
+
+// One frame with draw() in a full-size window
+void Frame(const std::function<void()>& draw)
+{
+    ImGui::NewFrame();
+    ImGui::SetNextWindowPos(ImVec2(0, 0));
+    ImGui::SetNextWindowSize(ImGui::GetIO().DisplaySize);
+    ImGui::Begin("bench", nullptr, ImGuiWindowFlags_NoDecoration);
+    draw();
+    ImGui::End();
+    ImGui::Render();
+
+    // Stand-in for a renderer: textures are taken as uploaded
+    for (ImTextureData* texture : ImGui::GetPlatformIO().Textures)
+    {
+        if (texture->Status == ImTextureStatus_WantCreate)
+        {
+            texture->SetTexID((ImTextureID)1);
+            texture->SetStatus(ImTextureStatus_OK);
+        }
+        else if (texture->Status == ImTextureStatus_WantUpdates)
+            texture->SetStatus(ImTextureStatus_OK);
+        else if (texture->Status == ImTextureStatus_WantDestroy)
+        {
+            texture->SetTexID(ImTextureID_Invalid);
+            texture->SetStatus(ImTextureStatus_Destroyed);
+        }
+    }
+}
+
+// Python source of the given number of lines, functions of 8 lines each
+std::string GeneratePython(int lines)
+{
+    std::string text;
+    text.reserve((size_t)lines * 40);
+    for (int i = 0; i < lines; ++i)
+    {
+        switch (i % 8)
+        {
+        case 0: text += "def func_" + std::to_string(i) + "(a, b=3):\n"; break;
+        case 1: text += "    \"\"\"docstring for it\"\"\"\n"; break;
+        case 2: text += "    x = a + b * 0x1F - 3.5e2  # comment here\n"; break;
+        case 3: text += "    s = f'value {x}' + \"str\\\"ing\" + r'raw'\n"; break;
+        case 4: text += "    if x > 10 and not b:\n"; break;
+        case 5: text += "        return [i for i in range(x)]\n"; break;
+        case 6: text += "    return None\n"; break;
+        case 7: text += "\n"; break;
+        }
+    }
+    return text;
+}
+
+// Typing near the top of a 100k-line file, where every edit used to shift the lines below
+void BenchKeystrokes()
+{
+    TextEditor editor;
+    editor.SetLanguageDefinition(TextEditor::LanguageDefinition::Python());
+    editor.SetText(GeneratePython(100000));
+    auto draw = [&] { editor.Render("##editor"); };
+    while (editor.IsColorizePending())
+        Frame(draw);
+
+    const int keystrokes = 1000;
+    editor.SetCursorPosition(TextEditor::Coordinates(3, 0));
+    auto start = NowMs();
+    for (int i = 0; i < keystrokes; ++i)
+        editor.InsertText(i % 20 == 19 ? "\n" : "x");
+    auto typed = NowMs();
+    for (int i = 0; i < keystrokes; ++i)
+    {
+        editor.InsertText(i % 20 == 19 ? "\n" : "x");
+        Frame(draw);
+    }
+    auto rendered = NowMs();
+    printf("keystrokes: %d lines, %.4f ms per keystroke, %.3f ms with a frame each\n",
+        editor.GetTotalLines(), (typed - start) / keystrokes, (rendered - typed) / keystrokes);
+
+    // A block of lines inserted, deleted and brought back
+    editor.SetCursorPosition(TextEditor::Coordinates(10, 0));
+    start = NowMs();
+    editor.InsertText(GeneratePython(2000));
+    auto inserted = NowMs();
+    editor.SetSelection(TextEditor::Coordinates(10, 0), TextEditor::Coordinates(2010, 0));
+    editor.Delete();
+    auto deleted = NowMs();
+    editor.Undo();
+    auto undone = NowMs();
+    printf("keystrokes: 2000-line block near the top, insert %.2f ms, delete %.2f ms, undo %.2f ms\n",
+        inserted - start, deleted - inserted, undone - deleted);
+}
+
+// Coloring a file from scratch, with the Python tokenizer and with the regexes it replaced.
+// Coloring runs on a worker thread, a batch of lines per frame.
+void BenchColorize()
+{
+    auto tokenizer = TextEditor::LanguageDefinition::Python();
+    auto regex = tokenizer;
+    regex.mTokenize = nullptr;
+
+    struct Case
+    {
+        const char* name;
+        const TextEditor::LanguageDefinition* language;
+        int lines;
+    };
+    const Case cases[] = { { "tokenizer", &tokenizer, 100000 }, { "regex", &regex, 5000 } };
+    for (auto& c : cases)
+    {
+        auto text = GeneratePython(c.lines);
+        TextEditor editor;
+        editor.SetText(text);
+        auto draw = [&] { editor.Render("##editor"); };
+        Frame(draw);
+
+        auto start = NowMs();
+        editor.SetLanguageDefinition(*c.language);
+        int frames = 0;
+        while (editor.IsColorizePending())
+        {
+            Frame(draw);
+            ++frames;
+        }
+        auto elapsed = NowMs() - start;
+        printf("colorize: %-9s %.2f MB/s (%zu bytes in %.1f ms, %d frames)\n",
+            c.name, text.size() / 1e6 / (elapsed / 1000.0), text.size(), elapsed, frames);
+    }
+}
+
+// Scrolling across a line of minified JSON a million characters long, by moving the cursor
+// along it a step per frame: each frame draws only the part of the line in view
+void BenchLongLine()
+{
+    const char* const tokens[] = { "{\"id\":", "12345,", "\"name\":\"value\",", "[1,2,3],", "true,", "null}" };
+    std::string line;
+    for (unsigned i = 1; line.size() < 1000000; ++i)
+        line += tokens[(i * 2654435761u >> 16) % 6];
+
+    TextEditor editor;
+    editor.SetLanguageDefinition(TextEditor::LanguageDefinition::Python());
+    editor.SetText("x = 1\n" + line + "\ny = 2\n");
+    auto draw = [&] { editor.Render("##editor"); };
+    while (editor.IsColorizePending())
+        Frame(draw);
+
+    const int steps = 200;
+    editor.SetCursorPosition(TextEditor::Coordinates(1, 0));
+    Frame(draw);
+    auto start = NowMs();
+    double worst = 0.0;
+    for (int step = 1; step <= steps; ++step)
+    {
+        editor.SetCursorPosition(TextEditor::Coordinates(1, (int)((long long)line.size() * step / steps)));
+        auto frameStart = NowMs();
+        Frame(draw);
+        worst = std::max(worst, NowMs() - frameStart);
+    }
+    printf("long line: %zu characters scrolled across in %d frames, %.3f ms per frame, %.3f ms worst\n",
+        line.size(), steps, (NowMs() - start) / steps, worst);
+
+    // Typing in the middle of the line, which changes it under the cached layout
+    editor.SetCursorPosition(TextEditor::Coordinates(1, (int)line.size() / 2));
+    Frame(draw);
+    const int keystrokes = 20;
+    start = NowMs();
+    for (int i = 0; i < keystrokes; ++i)
+    {
+        editor.InsertText("a");
+        Frame(draw);
+    }
+    printf("long line: %.3f ms per keystroke in the middle, with a frame each\n", (NowMs() - start) / keystrokes);
+}
+
+// Pasting 1 MB and 10 MB of code into the middle of a line of a 10k-line file, as one undo step
+void BenchPaste()
+{
+    for (size_t megabytes : { 1, 10 })
+    {
+        auto block = GeneratePython((int)(megabytes * 1000000 / 20));
+        block.resize(megabytes * 1000000);
+
+        TextEditor editor;
+        editor.SetLanguageDefinition(TextEditor::LanguageDefinition::Python());
+        editor.SetText(GeneratePython(10000));
+        auto draw = [&] { editor.Render("##editor"); };
+        while (editor.IsColorizePending())
+            Frame(draw);
+
+        ImGui::SetClipboardText(block.c_str());
+        editor.SetCursorPosition(TextEditor::Coordinates(5000, 4));
+        auto start = NowMs();
+        editor.Paste();
+        auto pasted = NowMs();
+        Frame(draw);
+        auto shown = NowMs();
+        editor.Undo();
+        auto undone = NowMs();
+        editor.Redo();
+        auto redone = NowMs();
+        printf("paste: %2zu MB, %.1f ms, %.1f ms to the next frame, undo %.1f ms, redo %.1f ms\n",
+            megabytes, pasted - start, shown - pasted, undone - shown, redone - undone);
+    }
+}
+
+// Drops the pages of path from the OS cache, where it can, so that opening it reads the disk
+void EvictFromCache(const std::filesystem::path& path)
+{
+#ifdef __linux__
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+#else
+    (void)path;
+#endif
+}
+
+// Opening files of 1, 10 and 100 MB as Editor::LoadFile does: read in one copy and handed to
+// a TextEditor in one SetText, or, at the size FileViewer takes over, mapped and indexed in the
+// background while the first lines are drawn
+void BenchOpen()
+{
+    auto directory = std::filesystem::temp_directory_path() / "editor_bench";
+    std::filesystem::create_directories(directory);
+
+    for (size_t megabytes : { 1, 10, 100 })
+    {
+        auto path = directory / ("open_" + std::to_string(megabytes) + ".py");
+        auto text = GeneratePython((int)(megabytes * 1000000 / 20));
+        text.resize(megabytes * 1000000);
+        std::ofstream(path, std::ios::binary).write(text.data(), (std::streamsize)text.size());
+        text = std::string();
+
+        EvictFromCache(path);
+        auto start = NowMs();
+        {
+            TextEditor editor;
+            MappedFile file(path);
+            std::string contents(file.Size(), '\0');
+            contents.resize(file.Read(0, contents.data(), contents.size()));
+            editor.SetText(contents);
+            auto loaded = NowMs();
+            printf("open: %3zu MB, editor %.1f ms (%d lines)", megabytes, loaded - start, editor.GetTotalLines());
+        }
+
+        EvictFromCache(path);
+        start = NowMs();
+        FileViewer viewer;
+        viewer.Open(path);
+        Frame([&] { viewer.Render("##viewer"); });
+        auto shown = NowMs();
+        while (viewer.IsIndexing())
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        auto indexed = NowMs();
+        printf(", viewer %.2f ms to the first frame, %.1f ms to index %llu lines\n",
+            shown - start, indexed - start, (unsigned long long)viewer.GetLineCount());
+        viewer.Close();
+        std::filesystem::remove(path);
+    }
+    std::filesystem::remove(directory);
+}
+
+struct Benchmark
+{
+    const char* name;
+    void (*run)();
+};
+
+const Benchmark kBenchmarks[] = {
+    { "keystrokes", BenchKeystrokes },
+    { "colorize", BenchColorize },
+    { "open", BenchOpen },
+    { "longline", BenchLongLine },
+    { "paste", BenchPaste },
+};
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    InitImGui();
+    for (auto& benchmark : kBenchmarks)
+    {
+        bool selected = argc < 2;
+        for (int i = 1; i < argc; ++i)
+            selected |= strcmp(argv[i], benchmark.name) == 0;
+        if (selected)
+            benchmark.run();
+    }
+    ImGui::DestroyContext();
+    return 0;
+}
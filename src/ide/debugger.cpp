@@ -23,7 +23,8 @@ Debugger::~Debugger() {
     Stop();
 }
 
-bool Debugger::Start(const std::string& code, const std::string& filename,
+bool Debugger::Start(const std::string& filename,
+                     std::function<bool(const std::string& path)> writeScript,
                      std::function<void(const std::string&)> logCallback) {
     if (m_debugging.load()) {
         return false; // Already debugging
@@ -54,15 +55,12 @@ bool Debugger::Start(const std::string& code, const std::string& filename,
         m_currentFile = filename;
         
         // Write code to the file (in case there are unsaved changes)
-        std::ofstream outFile(scriptPath);
-        if (!outFile) {
+        if (!writeScript(scriptPath)) {
             if (m_logCallback) {
                 m_logCallback("[error] Failed to write to file: " + scriptPath + "\n");
             }
             return false;
         }
-        outFile << code;
-        outFile.close();
         
         if (m_logCallback) {
             m_logCallback("[info] Using file: " + scriptPath + "\n");
@@ -73,15 +71,12 @@ bool Debugger::Start(const std::string& code, const std::string& filename,
         scriptPath = m_tempScriptPath;
         m_currentFile = m_tempScriptPath;
         
-        std::ofstream outFile(m_tempScriptPath);
-        if (!outFile) {
+        if (!writeScript(m_tempScriptPath)) {
             if (m_logCallback) {
                 m_logCallback("[error] Failed to create temporary script file\n");
             }
             return false;
         }
-        outFile << code;
-        outFile.close();
         
         if (m_logCallback) {
             m_logCallback("[info] Using temporary file: " + m_tempScriptPath + "\n");
@@ -269,6 +264,13 @@ void Debugger::RemoveBreakpoint(const std::string& filename, int line) {
     }
 }
 
+void Debugger::MoveBreakpoint(const std::string& filename, int fromLine, int toLine) {
+    auto it = m_breakpoints.find(filename);
+    if (it != m_breakpoints.end() && it->second.erase(fromLine) != 0) {
+        it->second.insert(toLine);
+    }
+}
+
 void Debugger::ClearBreakpoints() {
     m_breakpoints.clear();
 }
@@ -40,8 +40,10 @@ public:
     Debugger();
     ~Debugger();
 
-    // Start debugging: launches pkpy with debug flag
-    bool Start(const std::string& script, const std::string& filename,
+    // Start debugging: launches pkpy with debug flag. writeScript must write the code
+    // to debug to the given path and return false if that failed.
+    bool Start(const std::string& filename,
+               std::function<bool(const std::string& path)> writeScript,
                std::function<void(const std::string&)> logCallback);
     
     // Stop debugging
@@ -50,6 +52,7 @@ public:
     // Breakpoint management
     void AddBreakpoint(const std::string& filename, int line);
     void RemoveBreakpoint(const std::string& filename, int line);
+    void MoveBreakpoint(const std::string& filename, int fromLine, int toLine);
     void ClearBreakpoints();
     bool HasBreakpoint(const std::string& filename, int line) const;
     const std::set<int>& GetBreakpoints(const std::string& filename) const;
@@ -0,0 +1,653 @@
+#include "edit_journal.h"
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+
+#ifdef _WIN32
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/file.h>
+    #include <unistd.h>
+    #include <cerrno>
+#endif
+
+namespace fs = std::filesystem;
+
+// File layout, in native byte order: the 8-byte magic and a u32 version, then records of
+//     u32 payload size, u32 checksum of the type and payload, u8 type, payload
+// where strings are a u32 size and their bytes, and the payloads are
+//     kSnapshot: u64 document, string path, u32 line count, the lines
+//     kEdit:     u64 document, u32 first line, u32 lines removed, u32 line count, the lines
+//     kForget:   u64 document
+// A crash can leave a torn record at the end; replay stops at the first one that does not
+// check out.
+static const char kMagic[8] = { 'p', 'k', 'p', 'y', 'j', 'r', 'n', 'l' };
+static const size_t kHeaderSize = sizeof(kMagic) + 4;
+static const size_t kRecordHeaderSize = 9;
+
+static void PutU32(std::string& out, uint32_t value)
+{
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static void PutU64(std::string& out, uint64_t value)
+{
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static void PutString(std::string& out, const char* data, size_t size)
+{
+    PutU32(out, (uint32_t)size);
+    out.append(data, size);
+}
+
+static void PutLines(std::string& out, const std::vector<std::string>& lines)
+{
+    PutU32(out, (uint32_t)lines.size());
+    for (auto& line : lines)
+        PutString(out, line.data(), line.size());
+}
+
+// Reads a record payload, failing on anything that runs past its end
+struct PayloadReader
+{
+    const char* pos;
+    const char* end;
+
+    bool GetU32(uint32_t& value)
+    {
+        if (end - pos < (ptrdiff_t)sizeof(value))
+            return false;
+        memcpy(&value, pos, sizeof(value));
+        pos += sizeof(value);
+        return true;
+    }
+
+    bool GetU64(uint64_t& value)
+    {
+        if (end - pos < (ptrdiff_t)sizeof(value))
+            return false;
+        memcpy(&value, pos, sizeof(value));
+        pos += sizeof(value);
+        return true;
+    }
+
+    bool GetString(const char*& data, uint32_t& size)
+    {
+        if (!GetU32(size) || (size_t)(end - pos) < size)
+            return false;
+        data = pos;
+        pos += size;
+        return true;
+    }
+
+    bool GetLines(std::vector<std::string>& lines)
+    {
+        uint32_t count;
+        // Every line takes at least its size, which keeps a corrupt count from reserving gigabytes
+        if (!GetU32(count) || (size_t)(end - pos) / 4 < count)
+            return false;
+        lines.reserve(count);
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            const char* data;
+            uint32_t size;
+            if (!GetString(data, size))
+                return false;
+            lines.emplace_back(data, size);
+        }
+        return true;
+    }
+};
+
+static uint32_t Checksum(const char* data, size_t size)
+{
+    // 32-bit FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= (unsigned char)data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Replaces removed lines from first on with inserted, assigning the lines they have in common
+// in place so that an edit within lines moves nothing below it
+static void ReplaceLines(std::vector<std::string>& lines, size_t first, size_t removed, std::vector<std::string>&& inserted)
+{
+    auto common = std::min(removed, inserted.size());
+    std::move(inserted.begin(), inserted.begin() + common, lines.begin() + first);
+    if (removed > common)
+        lines.erase(lines.begin() + first + common, lines.begin() + first + removed);
+    else
+        lines.insert(lines.begin() + first + common, std::make_move_iterator(inserted.begin() + common), std::make_move_iterator(inserted.end()));
+}
+
+EditJournal::~EditJournal()
+{
+    if (!m_thread.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_condition.notify_one();
+    m_thread.join();
+}
+
+void EditJournal::Open(const fs::path& directory)
+{
+    if (m_thread.joinable())
+        return;
+    m_directory = directory;
+    m_thread = std::thread(&EditJournal::WorkerThread, this);
+}
+
+void EditJournal::Snapshot(uint64_t document, const fs::path& path, std::vector<std::string> lines)
+{
+    Record record;
+    record.type = kSnapshot;
+    record.document = document;
+    record.path = path;
+    record.lines = std::move(lines);
+    Push(std::move(record));
+}
+
+void EditJournal::Edit(uint64_t document, int firstLine, int removedLines, std::vector<std::string> lines)
+{
+    Record record;
+    record.type = kEdit;
+    record.document = document;
+    record.firstLine = (uint32_t)firstLine;
+    record.removedLines = (uint32_t)removedLines;
+    record.lines = std::move(lines);
+    Push(std::move(record));
+}
+
+void EditJournal::Forget(uint64_t document)
+{
+    Record record;
+    record.type = kForget;
+    record.document = document;
+    Push(std::move(record));
+}
+
+void EditJournal::Push(Record&& record)
+{
+    if (!m_thread.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queue.push_back(std::move(record));
+    }
+    m_condition.notify_one();
+}
+
+bool EditJournal::TakeRecovered(std::vector<Document>& documents)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_hasRecovered)
+        return false;
+
+    documents = std::move(m_recovered);
+    m_recovered.clear();
+    m_hasRecovered = false;
+    return true;
+}
+
+void EditJournal::DropRecovered()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_dropRecovered = true;
+    }
+    m_condition.notify_one();
+}
+
+void EditJournal::WorkerThread()
+{
+    Recover();
+    bool ok = Create();
+
+    std::vector<Record> records;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;)
+    {
+        m_condition.wait(lock, [this] { return m_quit || m_dropRecovered || !m_queue.empty(); });
+
+        // Everything queued meanwhile goes to disk with a single write and flush
+        records.swap(m_queue);
+        bool drop = m_dropRecovered;
+        bool quit = m_quit;
+        m_dropRecovered = false;
+        lock.unlock();
+
+        if (ok)
+            Commit(records);
+        records.clear();
+
+        // The recovered documents were queued before the drop, so they are on disk by now
+        // unless writing failed, in which case the journals they came from are kept
+        if (drop && ok && !m_rewrite)
+        {
+            for (auto& orphan : m_orphans)
+            {
+                std::error_code ec;
+                fs::remove(orphan.path, ec);
+                CloseFile(orphan.file);
+            }
+            m_orphans.clear();
+        }
+
+        if (quit)
+        {
+            // Journals not recovered yet are left for the next run
+            for (auto& orphan : m_orphans)
+                CloseFile(orphan.file);
+            if (ok)
+            {
+                std::error_code ec;
+                fs::remove(m_path, ec);
+            }
+            CloseFile(m_file);
+            return;
+        }
+        lock.lock();
+    }
+}
+
+void EditJournal::Recover()
+{
+    struct Journal
+    {
+        fs::path path;
+        fs::file_time_type time;
+    };
+    std::vector<Journal> journals;
+    std::error_code ec;
+    for (auto& entry : fs::directory_iterator(m_directory, ec))
+    {
+        auto extension = entry.path().extension();
+        if (extension == ".journal")
+        {
+            journals.push_back({ entry.path(), entry.last_write_time(ec) });
+        }
+        else if (extension == ".compacting")
+        {
+            // Left behind by a crash in the middle of a compaction, unless it is being written
+            auto file = OpenLocked(entry.path(), false);
+            if (file != kNoFile)
+            {
+                fs::remove(entry.path(), ec);
+                CloseFile(file);
+            }
+        }
+    }
+    std::sort(journals.begin(), journals.end(), [](const Journal& a, const Journal& b) { return a.time > b.time; });
+
+    // The newest journal with documents in it is recovered. An older one can only be left
+    // over from a crash before its documents were journaled again, so it is superseded.
+    std::vector<Document> documents;
+    for (auto& journal : journals)
+    {
+        auto file = OpenLocked(journal.path, false);
+        if (file == kNoFile)
+            continue;   // an instance still running holds it
+
+        if (documents.empty())
+            Replay(journal.path, documents);
+        if (documents.empty())
+        {
+            fs::remove(journal.path, ec);
+            CloseFile(file);
+            continue;
+        }
+        m_orphans.push_back({ journal.path, file });
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_recovered = std::move(documents);
+    m_hasRecovered = !m_recovered.empty();
+}
+
+bool EditJournal::Create()
+{
+    std::error_code ec;
+    fs::create_directories(m_directory, ec);
+
+#ifdef _WIN32
+    auto pid = (unsigned long long)GetCurrentProcessId();
+#else
+    auto pid = (unsigned long long)getpid();
+#endif
+    auto now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    char name[64];
+    snprintf(name, sizeof(name), "%lld-%llu.journal", (long long)now, pid);
+    m_path = m_directory / name;
+
+    m_file = OpenLocked(m_path, true);
+    if (m_file == kNoFile)
+        return false;
+
+    std::string header(kMagic, sizeof(kMagic));
+    PutU32(header, kVersion);
+    if (!WriteAll(m_file, header) || !Sync(m_file))
+    {
+        fs::remove(m_path, ec);
+        CloseFile(m_file);
+        m_file = kNoFile;
+        return false;
+    }
+    SyncDirectory(m_directory);
+    m_size = header.size();
+    return true;
+}
+
+void EditJournal::Commit(std::vector<Record>& records)
+{
+    if (records.empty())
+        return;
+
+    std::string data;
+    for (auto& record : records)
+    {
+        Encode(record, data);
+        Apply(m_documents, std::move(record));
+    }
+
+    if (!m_rewrite)
+    {
+        m_rewrite = !WriteAll(m_file, data) || !Sync(m_file);
+        m_size += data.size();
+    }
+    if (m_rewrite || m_size >= m_compactAt)
+        m_rewrite = !Compact();
+}
+
+bool EditJournal::Compact()
+{
+    // One snapshot per document, written next to the journal and then renamed over it, so
+    // that the journal on disk is whole at every point
+    std::string data(kMagic, sizeof(kMagic));
+    PutU32(data, kVersion);
+    for (auto& [id, document] : m_documents)
+        EncodeSnapshot(id, document.path, document.lines, data);
+
+    fs::path tempPath = m_path;
+    tempPath.replace_extension(".compacting");
+    auto file = OpenLocked(tempPath, true);
+    if (file == kNoFile)
+        return false;
+
+    std::error_code ec;
+    if (!WriteAll(file, data) || !Sync(file))
+    {
+        fs::remove(tempPath, ec);
+        CloseFile(file);
+        return false;
+    }
+
+#ifdef _WIN32
+    // Windows cannot replace a file that is open
+    CloseFile(m_file);
+    m_file = kNoFile;
+#endif
+    fs::rename(tempPath, m_path, ec);
+    if (ec)
+    {
+        fs::remove(tempPath, ec);
+        CloseFile(file);
+        return false;
+    }
+    SyncDirectory(m_directory);
+
+    CloseFile(m_file);
+    m_file = file;
+    m_size = data.size();
+    m_compactAt = std::max(kMinCompactBytes, 2 * m_size);
+    return true;
+}
+
+void EditJournal::Encode(const Record& record, std::string& out)
+{
+    if (record.type == kSnapshot)
+    {
+        EncodeSnapshot(record.document, record.path, record.lines, out);
+        return;
+    }
+
+    auto start = out.size();
+    out.append(kRecordHeaderSize, '\0');
+    out[start + 8] = (char)record.type;
+    PutU64(out, record.document);
+    if (record.type == kEdit)
+    {
+        PutU32(out, record.firstLine);
+        PutU32(out, record.removedLines);
+        PutLines(out, record.lines);
+    }
+
+    uint32_t size = (uint32_t)(out.size() - start - kRecordHeaderSize);
+    uint32_t checksum = Checksum(out.data() + start + 8, out.size() - start - 8);
+    memcpy(&out[start], &size, 4);
+    memcpy(&out[start + 4], &checksum, 4);
+}
+
+void EditJournal::EncodeSnapshot(uint64_t document, const fs::path& path, const std::vector<std::string>& lines, std::string& out)
+{
+    auto start = out.size();
+    out.append(kRecordHeaderSize, '\0');
+    out[start + 8] = (char)kSnapshot;
+    PutU64(out, document);
+    auto utf8 = path.u8string();
+    PutString(out, reinterpret_cast<const char*>(utf8.data()), utf8.size());
+    PutLines(out, lines);
+
+    uint32_t size = (uint32_t)(out.size() - start - kRecordHeaderSize);
+    uint32_t checksum = Checksum(out.data() + start + 8, out.size() - start - 8);
+    memcpy(&out[start], &size, 4);
+    memcpy(&out[start + 4], &checksum, 4);
+}
+
+bool EditJournal::Replay(const fs::path& path, std::vector<Document>& documents)
+{
+    MappedFile file;
+    if (!file.Open(path) || file.Size() < kHeaderSize)
+        return false;
+
+    const char* data = file.Data();
+    uint32_t version;
+    memcpy(&version, data + sizeof(kMagic), 4);
+    if (memcmp(data, kMagic, sizeof(kMagic)) != 0 || version != kVersion)
+        return false;
+
+    std::map<uint64_t, Document> replayed;
+    const char* end = data + file.Size();
+    const char* pos = data + kHeaderSize;
+    while ((size_t)(end - pos) >= kRecordHeaderSize)
+    {
+        uint32_t size, checksum;
+        memcpy(&size, pos, 4);
+        memcpy(&checksum, pos + 4, 4);
+        if ((size_t)(end - pos) - kRecordHeaderSize < size || Checksum(pos + 8, size + 1) != checksum)
+            break;
+
+        Record record;
+        record.type = (RecordType)pos[8];
+        PayloadReader reader{ pos + kRecordHeaderSize, pos + kRecordHeaderSize + size };
+        bool ok = reader.GetU64(record.document);
+        if (ok && record.type == kSnapshot)
+        {
+            const char* pathData;
+            uint32_t pathSize;
+            ok = reader.GetString(pathData, pathSize) && reader.GetLines(record.lines);
+            if (ok)
+                record.path = fs::path(std::u8string(reinterpret_cast<const char8_t*>(pathData), pathSize));
+        }
+        else if (ok && record.type == kEdit)
+        {
+            ok = reader.GetU32(record.firstLine) && reader.GetU32(record.removedLines) && reader.GetLines(record.lines);
+        }
+        if (!ok || !Apply(replayed, std::move(record)))
+            break;
+        pos += kRecordHeaderSize + size;
+    }
+
+    documents.clear();
+    for (auto& [id, document] : replayed)
+        documents.push_back(std::move(document));
+    return true;
+}
+
+bool EditJournal::Apply(std::map<uint64_t, Document>& documents, Record&& record)
+{
+    switch (record.type)
+    {
+    case kSnapshot:
+    {
+        auto& document = documents[record.document];
+        document.id = record.document;
+        document.path = std::move(record.path);
+        document.lines = std::move(record.lines);
+        return true;
+    }
+    case kEdit:
+    {
+        auto it = documents.find(record.document);
+        if (it == documents.end())
+            return false;
+        auto& lines = it->second.lines;
+        if (record.firstLine > lines.size() || record.removedLines > lines.size() - record.firstLine)
+            return false;
+        ReplaceLines(lines, record.firstLine, record.removedLines, std::move(record.lines));
+        return true;
+    }
+    case kForget:
+        documents.erase(record.document);
+        return true;
+    }
+    return false;
+}
+
+#ifdef _WIN32
+
+EditJournal::FileHandle EditJournal::OpenLocked(const fs::path& path, bool create)
+{
+    // A journal is held by opening it without sharing reads: other instances cannot open it
+    // until its owner closes it, or exits or crashes. A journal is opened for recovery with
+    // sharing reads, so that it can be mapped, and deletes, so that it can be deleted.
+    HANDLE file = create
+        ? CreateFileW(path.c_str(), GENERIC_WRITE, FILE_SHARE_DELETE, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr)
+        : CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    return file == INVALID_HANDLE_VALUE ? kNoFile : file;
+}
+
+bool EditJournal::WriteAll(FileHandle file, const std::string& data)
+{
+    if (file == kNoFile)
+        return false;
+
+    size_t offset = 0;
+    while (offset < data.size())
+    {
+        DWORD chunk = (DWORD)std::min<size_t>(data.size() - offset, 1u << 30);
+        DWORD written = 0;
+        if (!::WriteFile(file, data.data() + offset, chunk, &written, nullptr) || written == 0)
+            return false;
+        offset += written;
+    }
+    return true;
+}
+
+bool EditJournal::Sync(FileHandle file)
+{
+    return file != kNoFile && FlushFileBuffers(file);
+}
+
+void EditJournal::CloseFile(FileHandle file)
+{
+    if (file != kNoFile)
+        CloseHandle(file);
+}
+
+void EditJournal::SyncDirectory(const fs::path&)
+{
+    // Renames and new files are durable once MoveFileEx and FlushFileBuffers return
+}
+
+#else
+
+EditJournal::FileHandle EditJournal::OpenLocked(const fs::path& path, bool create)
+{
+    // Journals are held with an exclusive flock() for as long as their owner runs: the lock
+    // goes away with the process however it ends
+    int fd = create ? open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)
+                    : open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return kNoFile;
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0)
+    {
+        close(fd);
+        return kNoFile;
+    }
+    return fd;
+}
+
+bool EditJournal::WriteAll(FileHandle file, const std::string& data)
+{
+    if (file == kNoFile)
+        return false;
+
+    const char* pos = data.data();
+    size_t remaining = data.size();
+    while (remaining > 0)
+    {
+        ssize_t written = write(file, pos, remaining);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return false;
+        pos += written;
+        remaining -= (size_t)written;
+    }
+    return true;
+}
+
+bool EditJournal::Sync(FileHandle file)
+{
+#ifdef __APPLE__
+    // fsync() leaves the data in the drive's cache on macOS
+    return file != kNoFile && fcntl(file, F_FULLFSYNC) == 0;
+#else
+    return file != kNoFile && fdatasync(file) == 0;
+#endif
+}
+
+void EditJournal::CloseFile(FileHandle file)
+{
+    if (file != kNoFile)
+        close(file);
+}
+
+void EditJournal::SyncDirectory(const fs::path& directory)
+{
+    int fd = open(directory.c_str(), O_RDONLY);
+    if (fd >= 0)
+    {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+#endif
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Append-only journal of the unsaved edits of the open documents, so that they survive a
+// crash. A background thread appends the records queued since its last write and flushes
+// them to disk together, so that typing costs the main thread a copy of the lines touched and
+// no I/O. The thread also keeps the text of each journaled document, and rewrites the journal
+// as one snapshot per document once it has grown to twice that size, which bounds the time it
+// takes to replay.
+//
+// Each running instance journals to a file of its own in the directory and holds it locked.
+// On Open(), the newest journal nobody holds is replayed on the background thread, and its
+// documents can be taken with TakeRecovered(). A clean exit deletes the journal.
+class EditJournal
+{
+public:
+    struct Document
+    {
+        uint64_t id = 0;
+        std::filesystem::path path;
+        std::vector<std::string> lines;
+    };
+
+    EditJournal() = default;
+    ~EditJournal();  // Writes the pending records, then deletes the journal
+
+    EditJournal(const EditJournal&) = delete;
+    EditJournal& operator=(const EditJournal&) = delete;
+
+    // Starts journaling to a new file in directory, which is created if need be, and the
+    // recovery of the journals left there by instances that crashed
+    void Open(const std::filesystem::path& directory);
+    bool IsOpen() const { return m_thread.joinable(); }
+
+    // The whole text of a document, which starts (or starts over) its journal
+    void Snapshot(uint64_t document, const std::filesystem::path& path, std::vector<std::string> lines);
+    // Replaces removedLines lines from firstLine on, in the text journaled so far, with lines
+    void Edit(uint64_t document, int firstLine, int removedLines, std::vector<std::string> lines);
+    // The document was saved or closed: nothing of it is left to recover
+    void Forget(uint64_t document);
+
+    // The documents of the journal recovered, once, when they are available. Once they are
+    // journaled again, DropRecovered() deletes the journals they came from.
+    bool TakeRecovered(std::vector<Document>& documents);
+    void DropRecovered();
+
+private:
+#ifdef _WIN32
+    using FileHandle = void*;
+    static constexpr FileHandle kNoFile = nullptr;
+#else
+    using FileHandle = int;
+    static constexpr FileHandle kNoFile = -1;
+#endif
+
+    static constexpr uint32_t kVersion = 1;
+    static constexpr uint64_t kMinCompactBytes = 4ull << 20;
+
+    enum RecordType : uint8_t
+    {
+        kSnapshot = 1,
+        kEdit = 2,
+        kForget = 3,
+    };
+
+    struct Record
+    {
+        RecordType type = kSnapshot;
+        uint64_t document = 0;
+        std::filesystem::path path;     // kSnapshot
+        uint32_t firstLine = 0;         // kEdit
+        uint32_t removedLines = 0;      // kEdit
+        std::vector<std::string> lines; // kSnapshot, kEdit
+    };
+
+    // A journal of a crashed instance, held locked until its documents are journaled again
+    struct Orphan
+    {
+        std::filesystem::path path;
+        FileHandle file;
+    };
+
+    void Push(Record&& record);
+    void WorkerThread();
+    void Recover();
+    bool Create();
+    void Commit(std::vector<Record>& records);
+    bool Compact();
+
+    static void Encode(const Record& record, std::string& out);
+    static void EncodeSnapshot(uint64_t document, const std::filesystem::path& path, const std::vector<std::string>& lines, std::string& out);
+    static bool Replay(const std::filesystem::path& path, std::vector<Document>& documents);
+    static bool Apply(std::map<uint64_t, Document>& documents, Record&& record);
+
+    static FileHandle OpenLocked(const std::filesystem::path& path, bool create);
+    static bool WriteAll(FileHandle file, const std::string& data);
+    static bool Sync(FileHandle file);
+    static void CloseFile(FileHandle file);
+    static void SyncDirectory(const std::filesystem::path& directory);
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::vector<Record> m_queue;
+    std::vector<Document> m_recovered;  // available if m_hasRecovered
+    bool m_hasRecovered = false;
+    bool m_dropRecovered = false;
+    bool m_quit = false;
+
+    // Owned by the worker thread
+    std::filesystem::path m_directory;
+    std::filesystem::path m_path;
+    FileHandle m_file = kNoFile;
+    uint64_t m_size = 0;                // bytes in m_file
+    uint64_t m_compactAt = kMinCompactBytes;
+    bool m_rewrite = false;             // a failed write may have left a torn record behind
+    std::map<uint64_t, Document> m_documents;   // the text each record so far leaves
+    std::vector<Orphan> m_orphans;
+};
@@ -1,112 +1,938 @@
 #include "editor.h"
+#include "mapped_file.h"
+#include "pocketpy.h"
+#include "python_lexer.h"
+#include <algorithm>
+#include <cstring>
 #include <fstream>
 #include <sstream>
 
+namespace fs = std::filesystem;
+
+// Python as pocketpy's own lexer reads it, so that the highlighting shows the tokens the
+// interpreter will parse: its keywords, its number and string literal syntax, f-string
+// expressions, and anything it rejects left uncolored.
+static TextEditor::LexState TokenizePocketpyLine(const char* begin, const char* end, TextEditor::LexState state, TextEditor::Tokens* tokens)
+{
+    PythonLexer::Callback callback = nullptr;
+    if (tokens != nullptr)
+    {
+        callback = [](void* context, PythonLexer::TokenKind kind, int tokenBegin, int tokenEnd)
+        {
+            auto color = TextEditor::PaletteIndex::Default;
+            switch (kind)
+            {
+            case PythonLexer::TokenKind::Name: color = TextEditor::PaletteIndex::Identifier; break;
+            case PythonLexer::TokenKind::Keyword: color = TextEditor::PaletteIndex::Keyword; break;
+            case PythonLexer::TokenKind::Number: color = TextEditor::PaletteIndex::Number; break;
+            case PythonLexer::TokenKind::String: color = TextEditor::PaletteIndex::String; break;
+            case PythonLexer::TokenKind::Operator: color = TextEditor::PaletteIndex::Punctuation; break;
+            case PythonLexer::TokenKind::Comment: color = TextEditor::PaletteIndex::Comment; break;
+            case PythonLexer::TokenKind::Error: break;
+            }
+            static_cast<TextEditor::Tokens*>(context)->push_back({ tokenBegin, tokenEnd, color });
+        };
+    }
+    return (TextEditor::LexState)PythonLexer::Lex(begin, end, state, callback, tokens);
+}
+
+static const TextEditor::LanguageDefinition& PocketpyLanguage()
+{
+    static const TextEditor::LanguageDefinition language = []
+    {
+        auto language = TextEditor::LanguageDefinition::Python();
+        language.mTokenizeLine = TokenizePocketpyLine;
+        return language;
+    }();
+    return language;
+}
+
 Editor::Editor()
 {
-    // Set language to Python with full syntax highlighting support
-    auto lang = TextEditor::LanguageDefinition::Python();
-    m_textEditor.SetLanguageDefinition(lang);
+    NewDocument();
+}
+
+Editor::~Editor()
+{
+}
+
+std::unique_ptr<Editor::Document> Editor::CreateDocument()
+{
+    auto document = std::make_unique<Document>();
+    document->id = ++m_nextId;
+    Hydrate(*document, m_documents.empty() ? nullptr : Active().editor.get());
+    return document;
+}
+
+void Editor::Hydrate(Document& document, const TextEditor* settings)
+{
+    document.editor = std::make_unique<TextEditor>();
+    document.editorId = ++m_nextId;
+    auto& textEditor = *document.editor;
+
+    // Set language to Python, highlighted by the interpreter's lexer
+    textEditor.SetLanguageDefinition(PocketpyLanguage());
     
-    // Set default style (dark theme)
-    m_textEditor.SetPalette(TextEditor::GetDarkPalette());
+    // Set default style (dark theme), or the one of the editor being left
+    textEditor.SetPalette(settings != nullptr ? settings->GetPalette() : TextEditor::GetDarkPalette());
     
     // Show line numbers
-    m_textEditor.SetShowWhitespaces(false);
+    textEditor.SetShowWhitespaces(settings != nullptr && settings->IsShowingWhitespaces());
+
+    // Show the minimap unless it was turned off
+    textEditor.SetShowMinimap(settings == nullptr || settings->IsShowingMinimap());
+
+    // Wrap long lines if the editor being left does
+    textEditor.SetWordWrap(settings != nullptr && settings->IsWordWrapping());
     
     // Enable auto-indentation
-    m_textEditor.SetTabSize(4);
+    textEditor.SetTabSize(4);
     
     // Ensure editor is not in read-only mode
-    m_textEditor.SetReadOnly(false);
+    textEditor.SetReadOnly(false);
     
     // Ensure keyboard and mouse input handling is enabled
-    m_textEditor.SetHandleKeyboardInputs(true);
-    m_textEditor.SetHandleMouseInputs(true);
+    textEditor.SetHandleKeyboardInputs(true);
+    textEditor.SetHandleMouseInputs(true);
+
+    textEditor.SetCompletionWords(m_completionWords);
+    for (auto& [object, members] : m_completionMembers)
+        textEditor.SetCompletionMembers(object, members);
+
+    // Back from the compact form (a new document just has nothing to restore)
+    textEditor.SetText(document.text);
+    textEditor.DiscardTextChange();
+    textEditor.RestoreHistory(std::move(document.history));
+    document.history = TextEditor::History();
+    std::string().swap(document.text);
+    document.savedGeneration = document.modified ? ~0ull : textEditor.GetEditGeneration();
+
+    // The error markers come back with the text they were found in. Otherwise the text is
+    // checked on the first frame, without waiting for typing to pause.
+    textEditor.SetErrorMarkers(document.errorMarkers);
+    document.errorMarkers.clear();
+    document.seenGeneration = textEditor.GetEditGeneration();
+    document.checkedGeneration = document.checked ? document.seenGeneration : ~0ull;
+    document.changeTime = -kSyntaxCheckDelay;
 }
 
-Editor::~Editor()
+void Editor::Dehydrate(Document& document)
+{
+    UpdateJournal(document);
+    document.modified = IsModified(document);
+    document.checked = document.checkedGeneration == document.editor->GetEditGeneration();
+    document.errorMarkers = document.editor->GetErrorMarkers();
+    document.text = document.editor->GetText();
+    // GetText() ends the last line with a newline too, which SetText() would read as one more line
+    if (!document.text.empty())
+        document.text.pop_back();
+    document.history = document.editor->TakeHistory();
+    document.editor.reset();
+    document.memoryUsage = document.text.capacity() + document.history.MemoryUsage();
+}
+
+bool Editor::IsModified(const Document& document) const
+{
+    if (document.editor == nullptr)
+        return document.modified;
+    return document.viewer == nullptr && document.editor->GetEditGeneration() != document.savedGeneration;
+}
+
+// An untitled document nobody typed in, like the one there is at startup
+bool Editor::IsBlank(const Document& document) const
+{
+    return document.path.empty() && !IsModified(document) && document.viewer == nullptr &&
+           document.editor->GetTotalLines() == 1 && document.editor->GetTextLines()[0].empty();
+}
+
+void Editor::SetMemoryBudget(size_t bytes)
+{
+    m_memoryBudget = bytes;
+    EnforceMemoryBudget();
+}
+
+void Editor::EnforceMemoryBudget()
+{
+    // Inactive documents cannot have changed since they were left, so only the active one
+    // needs measuring
+    auto& active = Active();
+    active.memoryUsage = active.editor->GetMemoryUsage() + active.editor->GetUndoMemoryUsage();
+
+    size_t total = 0;
+    for (auto& document : m_documents)
+    {
+        if (document->editor != nullptr)
+            total += document->memoryUsage;
+    }
+
+    while (total > m_memoryBudget)
+    {
+        Document* oldest = nullptr;
+        for (auto& document : m_documents)
+        {
+            // A document being saved keeps its editor, whose generation the save is for
+            if (document->editor != nullptr && document.get() != &active && !IsSaving(*document) &&
+                (oldest == nullptr || document->lastUsed < oldest->lastUsed))
+                oldest = document.get();
+        }
+        if (oldest == nullptr)
+            break;
+
+        total -= oldest->memoryUsage;
+        Dehydrate(*oldest);
+    }
+}
+
+void Editor::NewDocument()
+{
+    m_documents.push_back(CreateDocument());
+    ActivateDocument(m_documents.size() - 1);
+}
+
+void Editor::ActivateDocument(size_t index)
+{
+    if (index >= m_documents.size())
+        return;
+
+    auto previous = m_active < m_documents.size() ? Active().editor.get() : nullptr;
+    if (previous != nullptr && index != m_active)
+    {
+        UpdateJournal(Active());
+        Active().memoryUsage = previous->GetMemoryUsage() + previous->GetUndoMemoryUsage();
+        // The find bar applies its query to whichever document is active
+        previous->SetFindQuery("");
+    }
+
+    m_active = index;
+    m_selectTab = true;
+    auto& document = Active();
+    document.lastUsed = ++m_clock;
+    if (document.editor == nullptr)
+    {
+        Hydrate(document, previous);
+    }
+    else if (previous != nullptr && previous != document.editor.get())
+    {
+        document.editor->SetPalette(previous->GetPalette());
+        document.editor->SetShowWhitespaces(previous->IsShowingWhitespaces());
+        document.editor->SetShowMinimap(previous->IsShowingMinimap());
+        document.editor->SetWordWrap(previous->IsWordWrapping());
+    }
+    EnforceMemoryBudget();
+}
+
+void Editor::CloseDocument(size_t index)
+{
+    if (index >= m_documents.size())
+        return;
+
+    // Show the document while asking what to do with its edits
+    if (IsModified(*m_documents[index]))
+    {
+        ActivateDocument(index);
+        m_closing = m_documents[index]->id;
+        return;
+    }
+    CloseDocumentNow(index);
+}
+
+void Editor::CloseDocumentNow(size_t index)
 {
+    if (m_documents[index]->id == m_closing)
+        m_closing = 0;
+
+    // Move off the document first, so that the next one takes over its settings
+    if (m_documents.size() == 1)
+        m_documents.push_back(CreateDocument());
+    if (index == m_active)
+        ActivateDocument(index + 1 < m_documents.size() ? index + 1 : index - 1);
+
+    if (m_documents[index]->journaled)
+        m_journal.Forget(m_documents[index]->id);
+    SetPath(*m_documents[index], {});
+    m_documents.erase(m_documents.begin() + index);
+    if (m_active > index)
+        --m_active;
 }
 
 void Editor::LoadFile(const std::filesystem::path& path)
 {
-    std::ifstream file(path);
-    if (file)
+    std::error_code ec;
+    for (size_t i = 0; i < m_documents.size(); ++i)
+    {
+        auto& openPath = m_documents[i]->path;
+        if (!openPath.empty() && (openPath == path || fs::equivalent(openPath, path, ec)))
+        {
+            ActivateDocument(i);
+            return;
+        }
+    }
+
+    auto document = CreateDocument();
+    auto& textEditor = *document->editor;
+    bool loaded = false;
+
+    // Too large to edit comfortably: view it straight from the mapping instead
+    auto size = fs::file_size(path, ec);
+    if (!ec && size >= kViewerThreshold)
     {
-        std::stringstream buffer;
-        buffer << file.rdbuf();
-        m_textEditor.SetText(buffer.str());
-        m_currentFile = path;
+        auto viewer = std::make_unique<FileViewer>();
+        if (viewer->Open(path))
+        {
+            viewer->SetLanguageDefinition(textEditor.GetLanguageDefinition());
+            viewer->SetPalette(textEditor.GetPalette());
+            document->viewer = std::move(viewer);
+            loaded = true;
+        }
     }
+
+    // Read in one copy, rather than through a stream, a stringstream and a std::string. The
+    // lines are not split straight out of the mapping: if another program truncates the file
+    // meanwhile, touching its old last pages would fault, where a read just comes up short.
+    MappedFile mapped;
+    if (!loaded && mapped.Open(path))
+    {
+        std::string text(mapped.Size(), '\0');
+        text.resize(mapped.Read(0, text.data(), text.size()));
+        textEditor.SetText(text);
+        loaded = true;
+    }
+
+    // Not something that can be mapped (e.g. not a regular file), read it instead
+    if (!loaded)
+    {
+        std::ifstream file(path);
+        if (file)
+        {
+            std::stringstream buffer;
+            buffer << file.rdbuf();
+            textEditor.SetText(buffer.str());
+            loaded = true;
+        }
+    }
+
+    if (!loaded)
+        return;
+
+    SetPath(*document, path);
+    document->savedGeneration = textEditor.GetEditGeneration();
+
+    // A blank untitled document (the one there is at startup) is replaced rather than kept
+    if (IsBlank(Active()))
+    {
+        m_documents[m_active] = std::move(document);
+        ActivateDocument(m_active);
+    }
+    else
+    {
+        m_documents.push_back(std::move(document));
+        ActivateDocument(m_documents.size() - 1);
+    }
+}
+
+std::shared_future<bool> Editor::SaveFile(const std::filesystem::path& path)
+{
+    auto& document = Active();
+    SetPath(document, path);
+    auto result = WriteFile(path);
+    auto generation = document.viewer == nullptr ? document.editor->GetEditGeneration() : document.savedGeneration;
+    m_saves.push_back(PendingSave{ document.id, document.editorId, generation, path, result });
+    return result;
 }
 
-void Editor::SaveFile(const std::filesystem::path& path)
+std::shared_future<bool> Editor::WriteFile(const std::filesystem::path& path)
 {
-    std::ofstream file(path);
-    if (file)
+    auto& document = Active();
+
+    // A viewed file cannot have changed, so writing it is a copy of the file
+    if (document.viewer != nullptr)
+    {
+        std::error_code ec;
+        bool ok = fs::equivalent(path, document.path, ec) ||
+                  fs::copy_file(document.path, path, fs::copy_options::overwrite_existing, ec);
+        std::promise<bool> done;
+        done.set_value(ok);
+        return done.get_future().share();
+    }
+
+    auto& textEditor = *document.editor;
+    auto generation = textEditor.GetEditGeneration();
+    auto it = m_writes.find(path);
+    if (it != m_writes.end() && it->second.editorId == document.editorId && it->second.generation == generation)
     {
-        auto text = m_textEditor.GetText();
-        file << text;
-        m_currentFile = path;
+        auto& result = it->second.result;
+        // Still being written, or written and left alone since
+        if (result.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            return result;
+        if (result.get() && m_saver.IsUnchangedOnDisk(path))
+            return result;
     }
+
+    auto result = m_saver.Save(path, textEditor.GetText());
+    m_writes[path] = PendingWrite{ document.editorId, generation, result };
+    return result;
 }
 
 std::string Editor::GetText() const
 {
-    return m_textEditor.GetText();
+    auto& document = Active();
+    if (document.viewer != nullptr)
+        return document.viewer->GetText();
+    return document.editor->GetText();
 }
 
 void Editor::SetText(const std::string& text)
 {
-    m_textEditor.SetText(text);
+    auto& document = Active();
+    document.viewer.reset();
+    document.editor->SetText(text);
+}
+
+void Editor::RenderTabs()
+{
+    if (!ImGui::BeginTabBar("##documents", ImGuiTabBarFlags_Reorderable | ImGuiTabBarFlags_FittingPolicyScroll))
+        return;
+
+    size_t selected = m_active;
+    size_t closed = m_documents.size();
+    for (size_t i = 0; i < m_documents.size(); ++i)
+    {
+        auto& document = *m_documents[i];
+        ImGuiTabItemFlags flags = 0;
+        if (IsModified(document))
+            flags |= ImGuiTabItemFlags_UnsavedDocument;
+        if (m_selectTab && i == m_active)
+            flags |= ImGuiTabItemFlags_SetSelected;
+
+        char label[300];
+        snprintf(label, sizeof(label), "%s###document%llu",
+            document.path.empty() ? "untitled" : document.path.filename().string().c_str(),
+            (unsigned long long)document.id);
+
+        bool open = true;
+        if (ImGui::BeginTabItem(label, &open, flags))
+        {
+            // The tab bar shows the tab selected through SetSelected from the next frame on
+            if (!m_selectTab)
+                selected = i;
+            ImGui::EndTabItem();
+        }
+        if (!open)
+            closed = i;
+    }
+    ImGui::EndTabBar();
+    m_selectTab = false;
+
+    if (selected != m_active)
+        ActivateDocument(selected);
+    if (closed < m_documents.size())
+        CloseDocument(closed);
+}
+
+void Editor::RenderCloseDialog()
+{
+    if (m_closing == 0)
+        return;
+
+    size_t index = 0;
+    while (index < m_documents.size() && m_documents[index]->id != m_closing)
+        ++index;
+    if (index == m_documents.size())
+    {
+        m_closing = 0;
+        return;
+    }
+
+    auto& document = *m_documents[index];
+    if (!ImGui::IsPopupOpen("Unsaved Changes"))
+        ImGui::OpenPopup("Unsaved Changes");
+    if (!ImGui::BeginPopupModal("Unsaved Changes", nullptr, ImGuiWindowFlags_AlwaysAutoResize))
+        return;
+
+    ImGui::Text("Save changes to %s before closing?",
+        document.path.empty() ? "untitled" : document.path.filename().string().c_str());
+    ImGui::Spacing();
+
+    bool done = false;
+    if (ImGui::Button("Save"))
+    {
+        // The document closes once the save succeeds; if it fails it stays open, modified
+        auto path = document.path;
+        if (path.empty() && m_saveAsDialog)
+            path = m_saveAsDialog();
+        if (!path.empty())
+        {
+            ActivateDocument(index);
+            SaveFile(path);
+            m_saves.back().close = true;
+        }
+        done = true;
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Don't Save"))
+    {
+        CloseDocumentNow(index);
+        done = true;
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Cancel") || ImGui::IsKeyPressed(ImGuiKey_Escape))
+        done = true;
+
+    if (done)
+    {
+        m_closing = 0;
+        ImGui::CloseCurrentPopup();
+    }
+    ImGui::EndPopup();
 }
 
 void Editor::Render(const char* title, const ImVec2& size, bool border)
 {
-    // Store breakpoints before render
-    auto oldBreakpoints = m_textEditor.GetBreakpoints();
-    
-    m_textEditor.Render(title, size, border);
-    
-    // Check if breakpoints changed (user double-clicked line number)
-    auto newBreakpoints = m_textEditor.GetBreakpoints();
-    if (oldBreakpoints != newBreakpoints && m_breakpointCallback)
+    // The tab bar and the find bar take their height off the text
+    float top = ImGui::GetCursorPosY();
+    RenderTabs();
+
+    // Documents of a run that crashed, read back in the background
+    std::vector<EditJournal::Document> recovered;
+    if (m_journal.TakeRecovered(recovered))
+        RestoreDocuments(recovered);
+    UpdateReload();
+    UpdateSaves();
+    RenderCloseDialog();
+
+    // Separate child windows per document keep their own scroll positions
+    auto& document = Active();
+    ImGui::PushID((int)document.id);
+
+    if (document.viewer != nullptr)
     {
-        // Find which breakpoint was added or removed
-        for (int line : newBreakpoints)
+        ImVec2 viewerSize = size;
+        if (viewerSize.y > 0.0f)
+            viewerSize.y = std::max(1.0f, viewerSize.y - (ImGui::GetCursorPosY() - top));
+        document.viewer->SetPalette(document.editor->GetPalette());
+        document.viewer->Render(title, viewerSize, border);
+        ImGui::PopID();
+        return;
+    }
+
+    if (m_showFind)
+        RenderFindPanel();
+    ImVec2 editorSize = size;
+    if (editorSize.y > 0.0f)
+        editorSize.y = std::max(1.0f, editorSize.y - (ImGui::GetCursorPosY() - top));
+
+    auto& textEditor = *document.editor;
+    textEditor.Render(title, editorSize, border);
+    ImGui::PopID();
+
+    UpdateSyntaxCheck(document);
+    UpdateJournal(document);
+
+    // Breakpoints toggled (user double-clicked line number) or moved by the edits of the frame
+    if (textEditor.HasBreakpointChanges())
+    {
+        for (auto& change : textEditor.TakeBreakpointChanges())
         {
-            if (oldBreakpoints.count(line) == 0)
-            {
-                // Breakpoint added
-                m_breakpointCallback(line, true);
-            }
+            if (m_breakpointCallback)
+                m_breakpointCallback(change);
+        }
+    }
+}
+
+void Editor::UpdateJournal(Document& document)
+{
+    if (!m_journal.IsOpen() || document.editor == nullptr)
+        return;
+
+    // Only unsaved text is journaled: saving a document drops it from the journal, and its
+    // next edit snapshots it again
+    auto& textEditor = *document.editor;
+    if (!IsModified(document))
+    {
+        if (document.journaled)
+            m_journal.Forget(document.id);
+        document.journaled = false;
+        textEditor.DiscardTextChange();
+        return;
+    }
+
+    if (!document.journaled)
+    {
+        textEditor.DiscardTextChange();
+        m_journal.Snapshot(document.id, document.path, textEditor.GetTextLines());
+        document.journaled = true;
+        return;
+    }
+
+    TextEditor::TextChange change;
+    if (textEditor.TakeTextChange(change))
+        m_journal.Edit(document.id, change.mFirstLine, change.mRemovedLines, std::move(change.mLines));
+}
+
+void Editor::RestoreDocuments(std::vector<EditJournal::Document>& recovered)
+{
+    for (auto& saved : recovered)
+    {
+        auto document = CreateDocument();
+        auto& textEditor = *document->editor;
+        textEditor.SetTextLines(saved.lines);
+        textEditor.DiscardTextChange();
+        SetPath(*document, saved.path);
+        document->savedGeneration = ~0ull;     // unsaved, whatever the file holds now
+        m_journal.Snapshot(document->id, document->path, std::move(saved.lines));
+        document->journaled = true;
+
+        // It takes the place of its file if that is open and unmodified, or of a blank document
+        size_t replaced = m_documents.size();
+        std::error_code ec;
+        for (size_t i = 0; i < m_documents.size() && !document->path.empty(); ++i)
+        {
+            auto& open = *m_documents[i];
+            if (!open.path.empty() && !IsModified(open) && (open.path == document->path || fs::equivalent(open.path, document->path, ec)))
+                replaced = i;
+        }
+        if (replaced == m_documents.size() && IsBlank(Active()))
+            replaced = m_active;
+
+        if (replaced < m_documents.size())
+        {
+            if (m_documents[replaced]->journaled)
+                m_journal.Forget(m_documents[replaced]->id);
+            SetPath(*m_documents[replaced], {});
+            m_documents[replaced] = std::move(document);
+            ActivateDocument(replaced);
+        }
+        else
+        {
+            m_documents.push_back(std::move(document));
+            ActivateDocument(m_documents.size() - 1);
+        }
+    }
+
+    // The journals they came from can go once the snapshots above are written
+    m_journal.DropRecovered();
+}
+
+void Editor::UpdateSaves()
+{
+    for (size_t i = 0; i < m_saves.size(); )
+    {
+        auto& save = m_saves[i];
+        if (save.result.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            ++i;
+            continue;
         }
-        for (int line : oldBreakpoints)
+
+        // Edits made while it was written leave the document modified, and open
+        bool ok = save.result.get();
+        size_t closed = m_documents.size();
+        for (size_t j = 0; j < m_documents.size(); ++j)
         {
-            if (newBreakpoints.count(line) == 0)
+            auto& document = *m_documents[j];
+            if (!ok || document.id != save.document || document.editorId != save.editorId)
+                continue;
+            document.savedGeneration = save.generation;
+            if (save.close && !IsModified(document))
+                closed = j;
+        }
+        if (m_saveCallback)
+            m_saveCallback(save.path, ok);
+        m_saves.erase(m_saves.begin() + i);
+        if (closed < m_documents.size())
+            CloseDocumentNow(closed);
+    }
+}
+
+bool Editor::IsSaving(const Document& document) const
+{
+    for (auto& save : m_saves)
+    {
+        if (save.document == document.id)
+            return true;
+    }
+    return false;
+}
+
+void Editor::SetPath(Document& document, const fs::path& path)
+{
+    if (path == document.path)
+        return;
+    if (!document.path.empty())
+        m_watcher.Unwatch(document.path);
+    document.path = path;
+    if (!path.empty())
+        m_watcher.Watch(path);
+}
+
+void Editor::UpdateReload()
+{
+    std::vector<fs::path> changed;
+    if (m_watcher.TakeChanges(changed))
+    {
+        for (auto& document : m_documents)
+        {
+            // Our own saves are noticed too
+            if (document->path.empty() || m_saver.IsUnchangedOnDisk(document->path))
+                continue;
+            if (std::find(changed.begin(), changed.end(), FileWatcher::Normalize(document->path)) != changed.end())
+                document->changedOnDisk = true;
+        }
+    }
+
+    // The text is diffed against the file in the background; a compact document waits until
+    // it is next activated. Unsaved edits are kept, to be saved over the file or not.
+    for (auto& document : m_documents)
+    {
+        if (!document->changedOnDisk || document->editor == nullptr || document->viewer != nullptr)
+            continue;
+        document->changedOnDisk = false;
+        if (!IsModified(*document))
+            m_reloader.Reload(document->editorId, document->editor->GetEditGeneration(), document->path, document->editor->GetTextLines());
+    }
+
+    // Results for a text edited meanwhile are dropped
+    FileReloader::Result result;
+    while (m_reloader.TakeResult(result))
+    {
+        for (auto& document : m_documents)
+        {
+            if (document->editorId != result.document || document->editor == nullptr)
+                continue;
+            auto& textEditor = *document->editor;
+            if (result.ok && !result.changes.empty() && textEditor.GetEditGeneration() == result.generation && !IsModified(*document))
             {
-                // Breakpoint removed
-                m_breakpointCallback(line, false);
+                textEditor.ReplaceLines(result.changes);
+                document->savedGeneration = textEditor.GetEditGeneration();
             }
         }
     }
-    
-    // Store as unordered_set
-    m_lastKnownBreakpoints.clear();
-    m_lastKnownBreakpoints.insert(newBreakpoints.begin(), newBreakpoints.end());
+}
+
+void Editor::UpdateSyntaxCheck(Document& document)
+{
+    auto& textEditor = *document.editor;
+    auto generation = textEditor.GetEditGeneration();
+    auto now = ImGui::GetTime();
+
+    // An edit makes the check in flight for the document pointless
+    if (generation != document.seenGeneration)
+    {
+        document.seenGeneration = generation;
+        document.changeTime = now;
+        if (m_checkEditor == document.editorId)
+        {
+            m_checker.Cancel();
+            m_checkEditor = 0;
+        }
+    }
+
+    // A check for another document is replaced, and done again when that one is shown
+    bool inFlight = m_checkEditor == document.editorId && m_checkGeneration == generation;
+    if (generation != document.checkedGeneration && !inFlight && now - document.changeTime >= kSyntaxCheckDelay)
+    {
+        m_checker.Check(document.editorId, generation, textEditor.GetText());
+        m_checkEditor = document.editorId;
+        m_checkGeneration = generation;
+    }
+
+    SyntaxChecker::Result result;
+    if (!m_checker.TakeResult(result))
+        return;
+
+    m_checkEditor = 0;
+    for (auto& checked : m_documents)
+    {
+        if (checked->editor == nullptr || checked->editorId != result.document || checked->editor->GetEditGeneration() != result.generation)
+            continue;
+
+        TextEditor::ErrorMarkers markers;
+        if (!result.ok)
+            markers[result.line] = result.message;
+        checked->editor->SetErrorMarkers(markers);
+        checked->checkedGeneration = result.generation;
+    }
 }
 
 void Editor::SyncBreakpoints(const std::set<int>& breakpoints)
 {
-    TextEditor::Breakpoints editorBreakpoints;
-    for (int line : breakpoints)
+    GetTextEditor().SetBreakpoints(breakpoints);
+}
+
+void Editor::SetCompletionWords(const std::vector<std::string>& words)
+{
+    m_completionWords = words;
+    for (auto& document : m_documents)
     {
-        editorBreakpoints.insert(line);
+        if (document->editor != nullptr)
+            document->editor->SetCompletionWords(words);
     }
-    m_textEditor.SetBreakpoints(editorBreakpoints);
-    
-    // Store as unordered_set
-    m_lastKnownBreakpoints.clear();
-    m_lastKnownBreakpoints.insert(breakpoints.begin(), breakpoints.end());
+}
+
+void Editor::SetCompletionMembers(const std::string& object, const std::vector<std::string>& members)
+{
+    m_completionMembers[object] = members;
+    for (auto& document : m_documents)
+    {
+        if (document->editor != nullptr)
+            document->editor->SetCompletionMembers(object, members);
+    }
+}
+
+void Editor::ShowFindPanel()
+{
+    m_showFind = true;
+    m_focusFind = true;
+
+    auto selection = GetTextEditor().GetSelectedText();
+    if (!selection.empty() && selection.find('\n') == std::string::npos && selection.size() < sizeof(m_findText))
+    {
+        memcpy(m_findText, selection.c_str(), selection.size() + 1);
+        m_findRegex = false;
+    }
+}
+
+void Editor::FindNext(bool backwards)
+{
+    if (m_findText[0] == '\0')
+    {
+        ShowFindPanel();
+        return;
+    }
+    GetTextEditor().SetFindQuery(m_findText, m_findRegex, m_findCaseSensitive);
+    GetTextEditor().FindNext(backwards);
+}
+
+void Editor::RenderFindPanel()
+{
+    ImGui::PushID("##findpanel");
+    const float fontSize = ImGui::GetFontSize();
+
+    if (m_focusFind)
+    {
+        ImGui::SetKeyboardFocusHere();
+        m_focusFind = false;
+    }
+    ImGui::SetNextItemWidth(fontSize * 20.0f);
+    bool next = ImGui::InputTextWithHint("##find", "Find", m_findText, sizeof(m_findText), ImGuiInputTextFlags_EnterReturnsTrue);
+    if (next)
+        ImGui::SetKeyboardFocusHere(-1);  // keep typing in the query after Enter
+    ImGui::SameLine();
+    ImGui::Checkbox("Aa", &m_findCaseSensitive);
+    ImGui::SetItemTooltip("Match case");
+    ImGui::SameLine();
+    ImGui::Checkbox(".*", &m_findRegex);
+    ImGui::SetItemTooltip("Regular expression");
+
+    // Does nothing unless the query changed
+    GetTextEditor().SetFindQuery(m_findText, m_findRegex, m_findCaseSensitive);
+
+    ImGui::SameLine();
+    if (ImGui::ArrowButton("##previous", ImGuiDir_Up))
+        GetTextEditor().FindNext(true);
+    ImGui::SameLine();
+    if (ImGui::ArrowButton("##next", ImGuiDir_Down) || next)
+        GetTextEditor().FindNext(next && ImGui::GetIO().KeyShift);
+
+    ImGui::SameLine();
+    if (!GetTextEditor().IsFindQueryValid())
+    {
+        ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "Invalid expression");
+    }
+    else if (m_findText[0] != '\0')
+    {
+        int count = GetTextEditor().GetFindMatchCount();
+        int index = GetTextEditor().GetFindMatchIndex();
+        if (GetTextEditor().IsFindPending())
+            ImGui::TextDisabled("%d matches so far...", count);
+        else if (index >= 0)
+            ImGui::TextDisabled("%d of %d", index + 1, count);
+        else
+            ImGui::TextDisabled("%d matches", count);
+    }
+
+    ImGui::SameLine();
+    bool close = ImGui::SmallButton("x");
+
+    ImGui::SetNextItemWidth(fontSize * 20.0f);
+    bool replace = ImGui::InputTextWithHint("##replace", "Replace", m_replaceText, sizeof(m_replaceText), ImGuiInputTextFlags_EnterReturnsTrue);
+    ImGui::SameLine();
+    if (ImGui::Button("Replace") || replace)
+        GetTextEditor().Replace(m_replaceText);
+    ImGui::SameLine();
+    if (ImGui::Button("Replace All"))
+        GetTextEditor().ReplaceAll(m_replaceText);
+
+    // Escape closes the bar while one of its widgets has focus (not the text)
+    if (close || (ImGui::IsWindowFocused() && ImGui::IsKeyPressed(ImGuiKey_Escape)))
+    {
+        m_showFind = false;
+        GetTextEditor().SetFindQuery("");
+    }
+    ImGui::PopID();
+}
+
+void Editor::RenderOutline()
+{
+    if (IsViewing())
+    {
+        ImGui::TextDisabled("(no outline for read-only files)");
+        return;
+    }
+
+    auto& textEditor = GetTextEditor();
+    auto& symbols = textEditor.GetSymbols();
+
+    // Nesting follows indentation: the stack holds the indentation of the enclosing entries
+    m_outline.clear();
+    int stack[32];
+    int depth = 0;
+    for (auto& symbol : symbols)
+    {
+        if (symbol.mKind == TextEditor::SymbolKind::Import)
+            continue;
+        while (depth > 0 && stack[depth - 1] >= symbol.mIndent)
+            --depth;
+        if (symbol.mKind == TextEditor::SymbolKind::Variable && symbol.mIndent > 0)
+            continue;
+        m_outline.push_back(OutlineEntry{ &symbol, depth });
+        if (depth < (int)(sizeof(stack) / sizeof(stack[0])))
+            stack[depth++] = symbol.mIndent;
+    }
+
+    if (m_outline.empty())
+    {
+        ImGui::TextDisabled(textEditor.IsSymbolIndexPending() ? "(indexing...)" : "(no definitions)");
+        return;
+    }
+
+    // The entry the cursor is in: the last one starting above it
+    auto cursorLine = textEditor.GetCursorPosition().mLine;
+    auto current = std::partition_point(m_outline.begin(), m_outline.end(),
+        [cursorLine](const OutlineEntry& entry) { return entry.symbol->mLine <= cursorLine; }) - m_outline.begin() - 1;
+
+    const float indent = ImGui::GetFontSize();
+    const TextEditor::Symbol* clicked = nullptr;
+    ImGuiListClipper clipper;
+    clipper.Begin((int)m_outline.size());
+    while (clipper.Step())
+    {
+        for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i)
+        {
+            auto& entry = m_outline[i];
+            auto& symbol = *entry.symbol;
+            const char* kind = symbol.mKind == TextEditor::SymbolKind::Class ? "class " :
+                               symbol.mKind == TextEditor::SymbolKind::Function ? "def " : "";
+
+            char label[160];
+            snprintf(label, sizeof(label), "%s%.120s##%d", kind, symbol.mName.c_str(), i);
+            ImGui::SetCursorPosX(ImGui::GetCursorPosX() + entry.depth * indent);
+            if (ImGui::Selectable(label, i == current))
+                clicked = &symbol;
+        }
+    }
+    clipper.End();
+
+    if (clicked != nullptr)
+        textEditor.GoToSymbol(*clicked);
 }
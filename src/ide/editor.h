@@ -1,43 +1,230 @@
 #pragma once
 
 #include "TextEditor.h"
+#include "edit_journal.h"
+#include "file_reloader.h"
+#include "file_saver.h"
+#include "file_viewer.h"
+#include "file_watcher.h"
+#include "syntax_checker.h"
 #include "imgui.h"
 #include <filesystem>
 #include <functional>
+#include <future>
+#include <map>
+#include <memory>
 #include <set>
-#include <unordered_set>
+#include <string>
+#include <vector>
 
-// Simple wrapper class for TextEditor
+// Wrapper around TextEditor holding the open documents, one of which is shown and edited
+// at a time in a tab bar
 class Editor
 {
 public:
     Editor();
     ~Editor();
-    
+
+    // Opens path in a new tab, or switches to its tab if it is already open. Open files are
+    // watched: when another program writes one, its document is brought up to date by
+    // replacing the lines that differ, as an edit that can be undone, unless it has unsaved
+    // edits of its own.
     void LoadFile(const std::filesystem::path& path);
-    void SaveFile(const std::filesystem::path& path);
+    void NewDocument();
+    // A document with unsaved edits is only closed once the user chose to save it (and the
+    // save succeeded) or to discard its edits, in a dialog that Render shows
+    void CloseDocument(size_t index);
+    void ActivateDocument(size_t index);
+    size_t GetDocumentCount() const { return m_documents.size(); }
+    size_t GetActiveDocument() const { return m_active; }
+
+    // Everything below works on the active document.
+
+    // Saves in the background and makes path the current file. The future becomes true
+    // once path holds the buffer, false if the write failed. The document counts as modified
+    // (and stays in the journal) until the write succeeds, and then only if it was edited
+    // since SaveFile.
+    std::shared_future<bool> SaveFile(const std::filesystem::path& path);
+    // Same as SaveFile, without changing the current file (e.g. a scratch copy to run)
+    std::shared_future<bool> WriteFile(const std::filesystem::path& path);
     std::string GetText() const;
     void SetText(const std::string& text);
     void Render(const char* title = "Text Editor", const ImVec2& size = ImVec2(), bool border = false);
-    
-    TextEditor& GetTextEditor() { return m_textEditor; }
-    const std::filesystem::path& GetCurrentFile() const { return m_currentFile; }
-    
-    // Breakpoint callback - called when breakpoint is toggled in editor
-    void SetBreakpointCallback(std::function<void(int line, bool added)> callback) {
+
+    TextEditor& GetTextEditor() { return *Active().editor; }
+    const std::filesystem::path& GetCurrentFile() const { return Active().path; }
+    bool IsModified() const { return IsModified(Active()); }
+
+    // Files of kViewerThreshold bytes or more are opened read-only in a FileViewer instead
+    // of being loaded into the TextEditor
+    static const uintmax_t kViewerThreshold = 64ull << 20;
+    bool IsViewing() const { return Active().viewer != nullptr; }
+    FileViewer& GetFileViewer() { return *Active().viewer; }
+
+    // Inactive documents keep their TextEditor, with its colors and caches, as long as all
+    // of them fit in the budget. Beyond it the least recently used ones are reduced to their
+    // text and undo history, and loaded back into a TextEditor when they are activated.
+    void SetMemoryBudget(size_t bytes);
+    size_t GetMemoryBudget() const { return m_memoryBudget; }
+
+    // Breakpoint callback - called for each breakpoint toggled in the editor, or moved with its
+    // line by an edit above it, after the frame that changed it
+    void SetBreakpointCallback(std::function<void(const TextEditor::BreakpointChange& change)> callback) {
         m_breakpointCallback = callback;
     }
-    
+
+    // Save callback - called in Render once each SaveFile is done, with whether it succeeded
+    void SetSaveCallback(std::function<void(const std::filesystem::path& path, bool ok)> callback) {
+        m_saveCallback = callback;
+    }
+
+    // Save As dialog - asks where to save an untitled document being closed, empty to cancel
+    void SetSaveAsDialog(std::function<std::filesystem::path()> dialog) {
+        m_saveAsDialog = dialog;
+    }
+
     // Sync breakpoints from external source (e.g., Debugger)
     void SyncBreakpoints(const std::set<int>& breakpoints);
-    
+
     // Debug current line (where debugger is paused)
-    void SetDebugCurrentLine(int line) { m_textEditor.SetDebugCurrentLine(line); }
-    void ClearDebugCurrentLine() { m_textEditor.ClearDebugCurrentLine(); }
-    
+    void SetDebugCurrentLine(int line) { GetTextEditor().SetDebugCurrentLine(line); }
+    void ClearDebugCurrentLine() { GetTextEditor().ClearDebugCurrentLine(); }
+
+    // Find/replace bar above the text. Opening it searches for the selection, if any.
+    void ShowFindPanel();
+    void FindNext(bool backwards = false);
+
+    // Classes and functions of the active document, and its top-level variables, nested by
+    // indentation; clicking one goes to it. Meant to be drawn in a window of its own.
+    void RenderOutline();
+    bool GoToDefinition() { return !IsViewing() && GetTextEditor().GoToDefinition(); }
+
+    // Names completed in every document besides those defined in it and the Python ones, e.g.
+    // the builtins of the VM, and the members completed after "object."
+    void SetCompletionWords(const std::vector<std::string>& words);
+    void SetCompletionMembers(const std::string& object, const std::vector<std::string>& members);
+
+    // The active document is compiled in the background once its text has been left alone for
+    // kSyntaxCheckDelay seconds, and its first syntax error is shown with an error marker.
+    // Checks start with the first frame, which must come after py_initialize(); stop them
+    // before py_finalize().
+    static constexpr double kSyntaxCheckDelay = 0.5;
+    void StopSyntaxCheck() { m_checker.Stop(); }
+
+    // Journals the unsaved edits of every document to a file in directory, and reopens the
+    // documents that had unsaved edits when a previous run crashed, as modified tabs, once the
+    // background thread has read them back
+    void StartJournal(const std::filesystem::path& directory) { m_journal.Open(directory); }
+
 private:
-    TextEditor m_textEditor;
-    std::filesystem::path m_currentFile;
-    std::unordered_set<int> m_lastKnownBreakpoints;  // Use unordered_set to match TextEditor::Breakpoints
-    std::function<void(int line, bool added)> m_breakpointCallback;
+    struct Document
+    {
+        uint64_t id = 0;
+        std::filesystem::path path;
+        std::unique_ptr<TextEditor> editor;     // null while the document is compact
+        std::unique_ptr<FileViewer> viewer;     // set for files opened read-only
+        uint64_t editorId = 0;                  // identifies editor, whose edit generations start over
+        uint64_t savedGeneration = 0;           // edit generation of editor when last loaded or saved
+        uint64_t lastUsed = 0;
+        size_t memoryUsage = 0;                 // as of the last time the document was left
+        uint64_t seenGeneration = ~0ull;        // edit generation of editor as of the last frame
+        double changeTime = 0.0;                // when it changed
+        uint64_t checkedGeneration = ~0ull;     // edit generation the error markers are for
+        bool journaled = false;                 // its unsaved text is in the journal
+        bool changedOnDisk = false;             // to reload once it has a TextEditor
+
+        // Compact form
+        std::string text;
+        TextEditor::History history;
+        bool modified = false;
+        TextEditor::ErrorMarkers errorMarkers;
+        bool checked = false;                   // errorMarkers are for text
+    };
+
+    Document& Active() { return *m_documents[m_active]; }
+    const Document& Active() const { return *m_documents[m_active]; }
+    bool IsModified(const Document& document) const;
+    bool IsBlank(const Document& document) const;
+    std::unique_ptr<Document> CreateDocument();
+    void Hydrate(Document& document, const TextEditor* settings);
+    void Dehydrate(Document& document);
+    void EnforceMemoryBudget();
+    void RenderTabs();
+    void RenderCloseDialog();
+    void CloseDocumentNow(size_t index);
+    void RenderFindPanel();
+    void UpdateSyntaxCheck(Document& document);
+    void UpdateJournal(Document& document);
+    void UpdateReload();
+    void UpdateSaves();
+    bool IsSaving(const Document& document) const;
+    void SetPath(Document& document, const std::filesystem::path& path);
+    void RestoreDocuments(std::vector<EditJournal::Document>& recovered);
+
+    std::vector<std::unique_ptr<Document>> m_documents;
+    size_t m_active = 0;
+    bool m_selectTab = false;       // make the tab bar show m_active on the next frame
+    uint64_t m_nextId = 0;
+    uint64_t m_clock = 0;
+    size_t m_memoryBudget = 256 * 1024 * 1024;
+
+    std::function<void(const TextEditor::BreakpointChange& change)> m_breakpointCallback;
+    std::function<void(const std::filesystem::path& path, bool ok)> m_saveCallback;
+    std::function<std::filesystem::path()> m_saveAsDialog;
+
+    // Document whose close waits for the user to save or discard its edits, if not 0
+    uint64_t m_closing = 0;
+
+    // Given to the TextEditor of every document
+    std::vector<std::string> m_completionWords;
+    std::map<std::string, std::vector<std::string>> m_completionMembers;
+
+    // Last write issued per path, so that writing an unchanged buffer again does not even
+    // serialize it
+    struct PendingWrite
+    {
+        uint64_t editorId;
+        uint64_t generation;
+        std::shared_future<bool> result;
+    };
+    std::map<std::filesystem::path, PendingWrite> m_writes;
+
+    // Saves in flight, which make their document unmodified once they succeed
+    struct PendingSave
+    {
+        uint64_t document;
+        uint64_t editorId;
+        uint64_t generation;            // edit generation of the text written
+        std::filesystem::path path;
+        std::shared_future<bool> result;
+        bool close = false;             // close the document once it is saved
+    };
+    std::vector<PendingSave> m_saves;
+    FileSaver m_saver;
+
+    // Syntax check in flight, if m_checkEditor is not 0
+    SyntaxChecker m_checker;
+    uint64_t m_checkEditor = 0;
+    uint64_t m_checkGeneration = 0;
+
+    EditJournal m_journal;
+
+    FileWatcher m_watcher;
+    FileReloader m_reloader;
+
+    // Outline entries of the last frame, reused to save allocations
+    struct OutlineEntry
+    {
+        const TextEditor::Symbol* symbol;
+        int depth;
+    };
+    std::vector<OutlineEntry> m_outline;
+
+    // Find/replace bar
+    bool m_showFind = false;
+    bool m_focusFind = false;
+    bool m_findRegex = false;
+    bool m_findCaseSensitive = false;
+    char m_findText[256] = {};
+    char m_replaceText[256] = {};
 };
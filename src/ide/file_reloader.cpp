@@ -0,0 +1,211 @@
+#include "file_reloader.h"
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+#include <unordered_map>
+
+namespace fs = std::filesystem;
+
+FileReloader::~FileReloader()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_condition.notify_one();
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+void FileReloader::Reload(uint64_t document, uint64_t generation, const fs::path& path, std::vector<std::string> lines)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_thread.joinable())
+            m_thread = std::thread(&FileReloader::WorkerThread, this);
+
+        auto& request = m_requests[document];
+        request.generation = generation;
+        request.path = path;
+        request.lines = std::move(lines);
+    }
+    m_condition.notify_one();
+}
+
+bool FileReloader::TakeResult(Result& result)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_results.empty())
+        return false;
+
+    result = std::move(m_results.front());
+    m_results.pop_front();
+    return true;
+}
+
+void FileReloader::WorkerThread()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;)
+    {
+        m_condition.wait(lock, [this] { return m_quit || !m_requests.empty(); });
+        if (m_quit)
+            return;
+
+        auto document = m_requests.begin()->first;
+        Request request = std::move(m_requests.begin()->second);
+        m_requests.erase(m_requests.begin());
+        lock.unlock();
+
+        Result result;
+        result.document = document;
+        result.generation = request.generation;
+        std::vector<std::string> lines;
+        result.ok = ReadLines(request.path, lines);
+        if (result.ok)
+            result.changes = Diff(request.lines, lines);
+
+        lock.lock();
+        m_results.push_back(std::move(result));
+    }
+}
+
+bool FileReloader::ReadLines(const fs::path& path, std::vector<std::string>& lines)
+{
+    MappedFile file;
+    if (!file.Open(path))
+        return false;
+
+    // Read rather than split out of the mapping: the file is being rewritten, and if it is
+    // truncated again while mapped, touching its old last pages would fault. A short read is
+    // followed by another change notification.
+    std::string contents(file.Size(), '\0');
+    contents.resize(file.Read(0, contents.data(), contents.size()));
+
+    // Split as TextEditor::SetText splits, carriage returns left out
+    const char* text = contents.data();
+    const char* end = text + contents.size();
+    for (;;)
+    {
+        auto newline = (const char*)memchr(text, '\n', end - text);
+        auto lineEnd = newline != nullptr ? newline : end;
+        auto& line = lines.emplace_back(text, lineEnd);
+        if (line.find('\r') != std::string::npos)
+            line.erase(std::remove(line.begin(), line.end(), '\r'), line.end());
+
+        if (newline == nullptr)
+            break;
+        text = newline + 1;
+    }
+    return true;
+}
+
+std::vector<TextEditor::TextChange> FileReloader::Diff(const std::vector<std::string>& before, const std::vector<std::string>& after)
+{
+    std::vector<TextEditor::TextChange> changes;
+
+    // The lines both start and end with are left out of the search
+    size_t prefix = 0;
+    while (prefix < before.size() && prefix < after.size() && before[prefix] == after[prefix])
+        ++prefix;
+    size_t suffix = 0;
+    while (suffix < before.size() - prefix && suffix < after.size() - prefix &&
+           before[before.size() - 1 - suffix] == after[after.size() - 1 - suffix])
+        ++suffix;
+
+    auto n = (int)(before.size() - prefix - suffix);
+    auto m = (int)(after.size() - prefix - suffix);
+    if (n == 0 && m == 0)
+        return changes;
+
+    // Lines are compared by number, the same for equal lines
+    std::unordered_map<std::string_view, int> numbers;
+    std::vector<int> a(n), b(m);
+    for (int i = 0; i < n; ++i)
+        a[i] = numbers.emplace(before[prefix + i], (int)numbers.size()).first->second;
+    for (int j = 0; j < m; ++j)
+        b[j] = numbers.emplace(after[prefix + j], (int)numbers.size()).first->second;
+
+    // Myers' greedy search for the shortest edit script: v[k] is how far along a the furthest
+    // path with d lines inserted or removed reaches on diagonal k = x - y. The v of every d is
+    // kept to trace the path back.
+    auto maxD = std::min(n + m, kMaxDiffLines);
+    auto offset = maxD + 1;
+    std::vector<int> v(2 * maxD + 3, 0);
+    std::vector<std::vector<int>> trace;
+    auto found = -1;
+    for (int d = 0; d <= maxD && found < 0; ++d)
+    {
+        for (int k = -d; k <= d; k += 2)
+        {
+            auto x = (k == -d || (k != d && v[offset + k - 1] < v[offset + k + 1])) ? v[offset + k + 1] : v[offset + k - 1] + 1;
+            auto y = x - k;
+            while (x < n && y < m && a[x] == b[y])
+            {
+                ++x;
+                ++y;
+            }
+            v[offset + k] = x;
+            if (x >= n && y >= m)
+            {
+                found = d;
+                break;
+            }
+        }
+        trace.emplace_back(v.begin() + offset - d, v.begin() + offset + d + 1);
+    }
+
+    if (found < 0)
+    {
+        TextEditor::TextChange change;
+        change.mFirstLine = (int)prefix;
+        change.mRemovedLines = n;
+        change.mLines.assign(after.begin() + prefix, after.begin() + prefix + m);
+        changes.push_back(std::move(change));
+        return changes;
+    }
+
+    std::vector<char> removed(n), inserted(m);
+    for (int d = found, x = n, y = m; d > 0; --d)
+    {
+        auto& previous = trace[d - 1];     // diagonals -(d - 1) to d - 1
+        auto k = x - y;
+        auto down = k == -d || (k != d && previous[k - 1 + d - 1] < previous[k + 1 + d - 1]);
+        auto previousK = down ? k + 1 : k - 1;
+        auto previousX = previous[previousK + d - 1];
+        auto previousY = previousX - previousK;
+        if (down)
+            inserted[previousY] = 1;
+        else
+            removed[previousX] = 1;
+        x = previousX;
+        y = previousY;
+    }
+
+    // Runs of lines removed and inserted between lines kept make the changes
+    for (int i = 0, j = 0; i < n || j < m; )
+    {
+        if (i < n && j < m && !removed[i] && !inserted[j])
+        {
+            ++i;
+            ++j;
+            continue;
+        }
+
+        TextEditor::TextChange change;
+        change.mFirstLine = (int)prefix + i;
+        auto first = i;
+        while ((i < n && removed[i]) || (j < m && inserted[j]))
+        {
+            if (i < n && removed[i])
+                ++i;
+            else
+                change.mLines.push_back(after[prefix + j++]);
+        }
+        change.mRemovedLines = i - first;
+        changes.push_back(std::move(change));
+    }
+    return changes;
+}
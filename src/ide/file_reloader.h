@@ -0,0 +1,66 @@
+#pragma once
+
+#include "TextEditor.h"
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Reads files that changed on disk and diffs their lines against the text of the documents
+// showing them, on a background thread, so that a document can be brought up to date by
+// replacing only the lines that differ. A newer request for a document replaces one that has
+// not started yet.
+class FileReloader
+{
+public:
+    // The diff stops looking for the fewest lines to replace beyond this many lines inserted
+    // and removed, and replaces everything between the first and the last line that differ
+    static constexpr int kMaxDiffLines = 2000;
+
+    struct Result
+    {
+        uint64_t document = 0;
+        uint64_t generation = 0;
+        bool ok = false;                                // the file could be read
+        std::vector<TextEditor::TextChange> changes;    // none if the file holds the text already
+    };
+
+    FileReloader() = default;
+    ~FileReloader();
+
+    FileReloader(const FileReloader&) = delete;
+    FileReloader& operator=(const FileReloader&) = delete;
+
+    // lines is the text of the document at generation
+    void Reload(uint64_t document, uint64_t generation, const std::filesystem::path& path, std::vector<std::string> lines);
+
+    // One result per call, for every request done
+    bool TakeResult(Result& result);
+
+    // The ranges of lines to replace in before to get after, in order, as TextEditor::ReplaceLines
+    // takes them
+    static std::vector<TextEditor::TextChange> Diff(const std::vector<std::string>& before, const std::vector<std::string>& after);
+
+private:
+    struct Request
+    {
+        uint64_t generation = 0;
+        std::filesystem::path path;
+        std::vector<std::string> lines;
+    };
+
+    void WorkerThread();
+    static bool ReadLines(const std::filesystem::path& path, std::vector<std::string>& lines);
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::map<uint64_t, Request> m_requests;    // by document
+    std::deque<Result> m_results;
+    bool m_quit = false;
+};
@@ -0,0 +1,213 @@
+#include "file_saver.h"
+
+#ifdef _WIN32
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+    #include <cerrno>
+#endif
+
+namespace fs = std::filesystem;
+
+FileSaver::FileSaver()
+{
+    m_thread = std::thread(&FileSaver::WorkerThread, this);
+}
+
+FileSaver::~FileSaver()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_condition.notify_one();
+    m_thread.join();
+}
+
+std::shared_future<bool> FileSaver::Save(const fs::path& path, std::string contents)
+{
+    Request request;
+    request.path = path;
+    request.contents = std::move(contents);
+    std::shared_future<bool> result = request.done.get_future().share();
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queue.push_back(std::move(request));
+    }
+    m_condition.notify_one();
+    return result;
+}
+
+bool FileSaver::IsUnchangedOnDisk(const fs::path& path) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_written.find(path);
+    return it != m_written.end() && MatchesDisk(path, it->second);
+}
+
+void FileSaver::WorkerThread()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;)
+    {
+        m_condition.wait(lock, [this] { return m_quit || !m_queue.empty(); });
+        if (m_queue.empty())
+            return;
+
+        Request request = std::move(m_queue.front());
+        m_queue.pop_front();
+        lock.unlock();
+
+        uint64_t hash = Hash(request.contents);
+
+        lock.lock();
+        auto it = m_written.find(request.path);
+        bool unchanged = it != m_written.end() && it->second.hash == hash && MatchesDisk(request.path, it->second);
+        lock.unlock();
+
+        bool ok = unchanged || WriteAtomically(request.path, request.contents);
+
+        lock.lock();
+        if (ok && !unchanged)
+        {
+            std::error_code ec;
+            WrittenFile written;
+            written.hash = hash;
+            written.size = fs::file_size(request.path, ec);
+            written.time = fs::last_write_time(request.path, ec);
+            if (ec)
+                m_written.erase(request.path);
+            else
+                m_written[request.path] = written;
+        }
+        else if (!ok)
+        {
+            m_written.erase(request.path);
+        }
+        request.done.set_value(ok);
+    }
+}
+
+bool FileSaver::MatchesDisk(const fs::path& path, const WrittenFile& written) const
+{
+    std::error_code ec;
+    auto size = fs::file_size(path, ec);
+    if (ec || size != written.size)
+        return false;
+    auto time = fs::last_write_time(path, ec);
+    return !ec && time == written.time;
+}
+
+uint64_t FileSaver::Hash(const std::string& contents)
+{
+    // 64-bit FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : contents)
+    {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+#ifdef _WIN32
+
+bool FileSaver::WriteAtomically(const fs::path& path, const std::string& contents)
+{
+    fs::path tempPath = path;
+    tempPath += L".saving";
+
+    HANDLE file = CreateFileW(tempPath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    // Files are written with CRLF line endings, as the text mode streams used to do
+    bool ok = true;
+    std::string buffer;
+    buffer.reserve(64 * 1024 + 2);
+    for (size_t i = 0; ok && i <= contents.size(); ++i)
+    {
+        if (i < contents.size())
+        {
+            if (contents[i] == '\n')
+                buffer += '\r';
+            buffer += contents[i];
+        }
+        if (buffer.size() >= 64 * 1024 || (i == contents.size() && !buffer.empty()))
+        {
+            DWORD written = 0;
+            ok = WriteFile(file, buffer.data(), (DWORD)buffer.size(), &written, nullptr) && written == buffer.size();
+            buffer.clear();
+        }
+    }
+
+    ok = ok && FlushFileBuffers(file);
+    CloseHandle(file);
+
+    ok = ok && MoveFileExW(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+    if (!ok)
+        DeleteFileW(tempPath.c_str());
+    return ok;
+}
+
+#else
+
+bool FileSaver::WriteAtomically(const fs::path& path, const std::string& contents)
+{
+    fs::path tempPath = path;
+    tempPath += ".saving";
+
+    // Keep the permissions of the file being replaced
+    mode_t mode = 0644;
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0)
+        mode = st.st_mode & 07777;
+
+    int fd = open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, mode);
+    if (fd < 0)
+        return false;
+
+    bool ok = true;
+    const char* data = contents.data();
+    size_t remaining = contents.size();
+    while (ok && remaining > 0)
+    {
+        ssize_t written = write(fd, data, remaining);
+        if (written < 0 && errno == EINTR)
+            continue;
+        ok = written > 0;
+        if (ok)
+        {
+            data += written;
+            remaining -= (size_t)written;
+        }
+    }
+
+    ok = ok && fsync(fd) == 0;
+    ok = close(fd) == 0 && ok;
+
+    ok = ok && rename(tempPath.c_str(), path.c_str()) == 0;
+    if (!ok)
+    {
+        unlink(tempPath.c_str());
+        return false;
+    }
+
+    // Make the rename itself durable
+    fs::path directory = path.parent_path();
+    int dirFd = open(directory.empty() ? "." : directory.c_str(), O_RDONLY);
+    if (dirFd >= 0)
+    {
+        fsync(dirFd);
+        close(dirFd);
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <future>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Writes files on a background thread. Each write goes to a temporary file next to the
+// target, is flushed to disk and then renamed over the target, so a crash or a full disk
+// never leaves a half-written file behind. A write whose contents hash the same as the
+// last write to that path completes without touching the disk, as long as the file has
+// not been modified since.
+class FileSaver
+{
+public:
+    FileSaver();
+    ~FileSaver();  // Finishes the pending writes
+
+    FileSaver(const FileSaver&) = delete;
+    FileSaver& operator=(const FileSaver&) = delete;
+
+    // The future becomes true once path holds contents, false if writing failed
+    std::shared_future<bool> Save(const std::filesystem::path& path, std::string contents);
+
+    // True if path still looks exactly like the last successful Save() left it
+    bool IsUnchangedOnDisk(const std::filesystem::path& path) const;
+
+private:
+    struct Request
+    {
+        std::filesystem::path path;
+        std::string contents;
+        std::promise<bool> done;
+    };
+
+    // Identifies what a successful Save() left on disk
+    struct WrittenFile
+    {
+        uint64_t hash;
+        uintmax_t size;
+        std::filesystem::file_time_type time;
+    };
+
+    void WorkerThread();
+    bool MatchesDisk(const std::filesystem::path& path, const WrittenFile& written) const;
+    static uint64_t Hash(const std::string& contents);
+    static bool WriteAtomically(const std::filesystem::path& path, const std::string& contents);
+
+    std::thread m_thread;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::deque<Request> m_queue;
+    std::map<std::filesystem::path, WrittenFile> m_written;
+    bool m_quit = false;
+};
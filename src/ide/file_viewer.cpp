@@ -0,0 +1,426 @@
+#include "file_viewer.h"
+#include "imgui_internal.h"
+#include <algorithm>
+#include <cstring>
+#include <functional>
+
+FileViewer::~FileViewer()
+{
+    Close();
+}
+
+bool FileViewer::Open(const std::filesystem::path& path)
+{
+    Close();
+    if (!m_file.Open(path))
+        return false;
+    m_path = path;
+
+    m_lineSamples.assign(1, 0);
+    m_lineCount = 1;
+    m_indexedBytes = 0;
+    m_quit = false;
+    if (m_file.Size() > 0)
+        m_indexThread = std::thread(&FileViewer::IndexThread, this);
+    return true;
+}
+
+void FileViewer::Close()
+{
+    StopSearch();
+    m_quit = true;
+    if (m_indexThread.joinable())
+        m_indexThread.join();
+    m_file.Close();
+
+    m_lineSamples.clear();
+    m_lineCount = 0;
+    m_indexedBytes = 0;
+    m_matchOffset = kNoMatch;
+    m_noMatch = false;
+    m_topLine = 0;
+    m_pendingLine = -1;
+    m_pendingMatch = kNoMatch;
+}
+
+uint64_t FileViewer::GetLineCount() const
+{
+    std::lock_guard<std::mutex> lock(m_indexMutex);
+    return m_lineCount;
+}
+
+float FileViewer::GetIndexProgress() const
+{
+    return m_file.Size() == 0 ? 1.0f : (float)((double)m_indexedBytes.load() / (double)m_file.Size());
+}
+
+std::string FileViewer::GetText() const
+{
+    std::string text(m_file.Size(), '\0');
+    text.resize(m_file.Read(0, text.data(), text.size()));
+    return text;
+}
+
+void FileViewer::ReopenIfShrunk()
+{
+    if (!m_file.IsOpen() || m_file.CurrentSize() >= m_file.Size())
+        return;
+
+    // Lines move with the new contents; the same line number is the best guess
+    auto path = m_path;
+    int64_t line = m_topLine;
+    if (Open(path))
+        m_pendingLine = line;
+}
+
+void FileViewer::GoToLine(uint64_t line)
+{
+    m_pendingLine = (int64_t)line;
+}
+
+void FileViewer::Find(const std::string& text)
+{
+    StopSearch();
+    if (text.empty() || text.size() > m_file.Size())
+        return;
+
+    uint64_t from = (m_matchOffset != kNoMatch && text == m_findText) ? m_matchOffset + 1 : LineStart((uint64_t)m_topLine);
+    m_findText = text;
+    m_noMatch = false;
+    m_searchResult = kNoMatch;
+    m_searching = true;
+    m_searchThread = std::thread(&FileViewer::SearchThread, this, text, from);
+}
+
+void FileViewer::StopSearch()
+{
+    m_searchCancel = true;
+    if (m_searchThread.joinable())
+        m_searchThread.join();
+    m_searchCancel = false;
+    m_searching = false;
+}
+
+void FileViewer::IndexThread()
+{
+    const uint64_t size = m_file.Size();
+    const uint64_t kBlockSize = 16 << 20;
+    std::vector<char> buffer(std::min(size, kBlockSize));
+
+    // Lines are published a block at a time, so the first screen is available right away
+    std::vector<uint64_t> samples;
+    uint64_t lines = 1;
+    for (uint64_t offset = 0; offset < size && !m_quit; )
+    {
+        // A short read means the file has shrunk: Render() maps it again and starts over
+        size_t length = (size_t)std::min(size - offset, kBlockSize);
+        if (m_file.Read(offset, buffer.data(), length) < length)
+            break;
+
+        uint64_t end = offset + length;
+        const char* p = buffer.data();
+        const char* blockEnd = buffer.data() + length;
+        while ((p = (const char*)memchr(p, '\n', blockEnd - p)) != nullptr)
+        {
+            ++p;
+            if (lines % kLineSample == 0)
+                samples.push_back(offset + (uint64_t)(p - buffer.data()));
+            ++lines;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_indexMutex);
+            m_lineSamples.insert(m_lineSamples.end(), samples.begin(), samples.end());
+            m_lineCount = lines;
+        }
+        samples.clear();
+        m_indexedBytes = end;
+        offset = end;
+    }
+}
+
+void FileViewer::SearchThread(std::string text, uint64_t from)
+{
+    const uint64_t size = m_file.Size();
+    const uint64_t kBlockSize = 16 << 20;
+    std::boyer_moore_horspool_searcher<std::string::const_iterator> searcher(text.begin(), text.end());
+    std::vector<char> buffer(std::min(size, kBlockSize + text.size() - 1));
+
+    // Blocks overlap by text.size() - 1 bytes so that matches across block boundaries are found.
+    // A short read (the file has shrunk) ends the search there.
+    auto search = [&](uint64_t begin, uint64_t end) {
+        for (uint64_t block = begin; block < end && !m_searchCancel; block += kBlockSize)
+        {
+            size_t length = (size_t)(std::min(end, block + kBlockSize + text.size() - 1) - block);
+            const char* blockEnd = buffer.data() + m_file.Read(block, buffer.data(), length);
+            const char* match = std::search((const char*)buffer.data(), blockEnd, searcher);
+            if (match != blockEnd)
+                return block + (uint64_t)(match - buffer.data());
+            if (blockEnd < buffer.data() + length)
+                break;
+        }
+        return kNoMatch;
+    };
+
+    uint64_t result = search(from, size);
+    if (result == kNoMatch)
+        result = search(0, std::min(size, from + text.size() - 1));
+
+    m_searchResult = result;
+    m_searching = false;
+}
+
+uint64_t FileViewer::LineStart(uint64_t line) const
+{
+    uint64_t offset;
+    {
+        std::lock_guard<std::mutex> lock(m_indexMutex);
+        if (m_lineSamples.empty())
+            return 0;
+        line = std::min(line, m_lineCount - 1);
+        offset = m_lineSamples[line / kLineSample];
+    }
+
+    const char* data = m_file.Data();
+    const char* end = data + m_file.Size();
+    for (uint64_t skip = line % kLineSample; skip > 0; --skip)
+        offset = (uint64_t)((const char*)memchr(data + offset, '\n', end - (data + offset)) + 1 - data);
+    return offset;
+}
+
+uint64_t FileViewer::LineOfOffset(uint64_t offset) const
+{
+    uint64_t line, sample;
+    {
+        std::lock_guard<std::mutex> lock(m_indexMutex);
+        auto it = std::upper_bound(m_lineSamples.begin(), m_lineSamples.end(), offset) - 1;
+        line = (uint64_t)(it - m_lineSamples.begin()) * kLineSample;
+        sample = *it;
+    }
+
+    const char* data = m_file.Data();
+    for (const char* p = data + sample; (p = (const char*)memchr(p, '\n', data + offset - p)) != nullptr; ++p)
+        ++line;
+    return line;
+}
+
+const char* FileViewer::LineEnd(const char* lineStart) const
+{
+    const char* end = m_file.Data() + m_file.Size();
+    const char* newline = (const char*)memchr(lineStart, '\n', end - lineStart);
+    return newline != nullptr ? newline : end;
+}
+
+void FileViewer::DrawLine(ImDrawList* drawList, ImVec2 pos, const char* begin, const char* end, uint64_t matchBegin, uint64_t matchEnd)
+{
+    ImFont* font = ImGui::GetFont();
+    const float fontSize = ImGui::GetFontSize();
+    auto width = [&](const char* from, const char* to) {
+        return font->CalcTextSizeA(fontSize, FLT_MAX, -1.0f, from, to).x;
+    };
+
+    const uint64_t lineOffset = (uint64_t)(begin - m_file.Data());
+    if (matchBegin < lineOffset + (end - begin) && matchEnd > lineOffset)
+    {
+        const char* from = begin + (matchBegin > lineOffset ? matchBegin - lineOffset : 0);
+        const char* to = begin + std::min<uint64_t>(matchEnd - lineOffset, end - begin);
+        float x = pos.x + width(begin, from);
+        drawList->AddRectFilled(ImVec2(x, pos.y), ImVec2(x + width(from, to), pos.y + ImGui::GetTextLineHeight()),
+                                m_palette[(int)TextEditor::PaletteIndex::Selection]);
+    }
+
+    // Same tokenizer pass as the editor's colorizer, one line at a time: constructs that span
+    // lines (triple-quoted strings) are not known here
+    std::string identifier;
+    const char* first = begin;
+    auto drawToken = [&](const char* tokenBegin, const char* tokenEnd, TextEditor::PaletteIndex color, bool keywords)
+    {
+        if (color == TextEditor::PaletteIndex::Identifier)
+        {
+            identifier.assign(tokenBegin, tokenEnd);
+            if (keywords && m_language.mKeywords.count(identifier) != 0)
+                color = TextEditor::PaletteIndex::Keyword;
+            else if (m_language.mIdentifiers.count(identifier) != 0)
+                color = TextEditor::PaletteIndex::KnownIdentifier;
+        }
+
+        pos.x += width(first, tokenBegin);
+        drawList->AddText(pos, m_palette[(int)color], tokenBegin, tokenEnd);
+        pos.x += width(tokenBegin, tokenEnd);
+        first = tokenEnd;
+    };
+
+    if (m_language.mTokenizeLine != nullptr)
+    {
+        m_tokens.clear();
+        m_language.mTokenizeLine(begin, end, 0, &m_tokens);
+        for (auto& token : m_tokens)
+        {
+            if (begin + token.mBegin >= first && token.mEnd <= end - begin)
+                drawToken(begin + token.mBegin, begin + token.mEnd, token.mColor, false);
+        }
+        drawToken(first, end, TextEditor::PaletteIndex::Default, false);
+        return;
+    }
+
+    while (first < end)
+    {
+        const char* tokenBegin = nullptr;
+        const char* tokenEnd = nullptr;
+        auto color = TextEditor::PaletteIndex::Default;
+        if (m_language.mTokenize == nullptr || !m_language.mTokenize(first, end, tokenBegin, tokenEnd, color) || tokenEnd <= first)
+        {
+            tokenBegin = first;
+            tokenEnd = first + 1;
+            color = TextEditor::PaletteIndex::Default;
+        }
+        drawToken(tokenBegin, tokenEnd, color, true);
+    }
+}
+
+void FileViewer::Render(const char* title, const ImVec2& size, bool border)
+{
+    ImGuiIO& io = ImGui::GetIO();
+    ReopenIfShrunk();
+    ImGui::PushID(title);
+
+    // Toolbar: find, go to line and indexing status
+    bool focusFind = ImGui::IsWindowFocused(ImGuiFocusedFlags_RootAndChildWindows) && io.KeyCtrl && ImGui::IsKeyPressed(ImGuiKey_F);
+    bool focusLine = ImGui::IsWindowFocused(ImGuiFocusedFlags_RootAndChildWindows) && io.KeyCtrl && ImGui::IsKeyPressed(ImGuiKey_G);
+
+    ImGui::SetNextItemWidth(ImGui::GetFontSize() * 16.0f);
+    if (focusFind)
+        ImGui::SetKeyboardFocusHere();
+    bool find = ImGui::InputTextWithHint("##find", "Find (Ctrl+F)", m_findBuffer, sizeof(m_findBuffer), ImGuiInputTextFlags_EnterReturnsTrue);
+    ImGui::SameLine();
+    find |= ImGui::Button("Next") || ImGui::IsKeyPressed(ImGuiKey_F3);
+    if (find)
+        Find(m_findBuffer);
+
+    ImGui::SameLine();
+    ImGui::SetNextItemWidth(ImGui::GetFontSize() * 8.0f);
+    if (focusLine)
+        ImGui::SetKeyboardFocusHere();
+    if (ImGui::InputTextWithHint("##line", "Line (Ctrl+G)", m_lineBuffer, sizeof(m_lineBuffer), ImGuiInputTextFlags_CharsDecimal | ImGuiInputTextFlags_EnterReturnsTrue))
+    {
+        auto line = strtoull(m_lineBuffer, nullptr, 10);
+        GoToLine(line > 0 ? line - 1 : 0);
+    }
+
+    // Pick up a finished search
+    if (!m_searching && m_searchThread.joinable())
+    {
+        m_searchThread.join();
+        m_matchOffset = m_searchResult;
+        m_matchLength = m_findText.size();
+        m_noMatch = m_matchOffset == kNoMatch;
+        m_pendingMatch = m_matchOffset;
+    }
+
+    uint64_t lineCount = GetLineCount();
+    ImGui::SameLine();
+    if (m_searching)
+        ImGui::TextDisabled("Searching...");
+    else if (m_noMatch)
+        ImGui::TextDisabled("Not found");
+    ImGui::SameLine();
+    if (IsIndexing())
+        ImGui::TextDisabled("Read-only | indexing %.0f%% | %llu lines so far", GetIndexProgress() * 100.0f, (unsigned long long)lineCount);
+    else
+        ImGui::TextDisabled("Read-only | %llu lines", (unsigned long long)lineCount);
+
+    ImVec2 childSize(size.x, size.y > 0.0f ? std::max(1.0f, size.y - ImGui::GetFrameHeightWithSpacing()) : 0.0f);
+    ImGui::BeginChild(title, childSize, border, ImGuiWindowFlags_HorizontalScrollbar | ImGuiWindowFlags_NoScrollWithMouse | ImGuiWindowFlags_NoMove);
+
+    const float lineHeight = ImGui::GetTextLineHeightWithSpacing();
+    const float scrollbarWidth = ImGui::GetStyle().ScrollbarSize;
+    const ImVec2 windowPos = ImGui::GetWindowPos();
+    const ImVec2 windowSize = ImGui::GetWindowSize();
+    const int64_t visibleLines = std::max<int64_t>(1, (int64_t)(ImGui::GetContentRegionAvail().y / lineHeight));
+
+    // Scrolling is done in lines, outside of ImGui's float scroll positions, which cannot
+    // address every line of a file with hundreds of millions of them
+    if (m_pendingMatch != kNoMatch && m_pendingMatch < m_indexedBytes.load())
+    {
+        m_topLine = (int64_t)LineOfOffset(m_pendingMatch) - visibleLines / 2;
+        m_pendingMatch = kNoMatch;
+    }
+    if (m_pendingLine >= 0 && (m_pendingLine < (int64_t)lineCount || !IsIndexing()))
+    {
+        m_topLine = m_pendingLine - visibleLines / 2;
+        m_pendingLine = -1;
+    }
+
+    if (ImGui::IsWindowHovered())
+    {
+        if (io.MouseWheel != 0.0f)
+            m_topLine -= (int64_t)(io.MouseWheel * 3.0f);
+        if (io.MouseWheelH != 0.0f)
+            ImGui::SetScrollX(ImGui::GetScrollX() - io.MouseWheelH * ImGui::GetFontSize() * 4.0f);
+    }
+    if (ImGui::IsWindowFocused())
+    {
+        if (ImGui::IsKeyPressed(ImGuiKey_UpArrow))
+            m_topLine -= 1;
+        if (ImGui::IsKeyPressed(ImGuiKey_DownArrow))
+            m_topLine += 1;
+        if (ImGui::IsKeyPressed(ImGuiKey_PageUp))
+            m_topLine -= visibleLines;
+        if (ImGui::IsKeyPressed(ImGuiKey_PageDown))
+            m_topLine += visibleLines;
+        if (io.KeyCtrl && ImGui::IsKeyPressed(ImGuiKey_Home))
+            m_topLine = 0;
+        if (io.KeyCtrl && ImGui::IsKeyPressed(ImGuiKey_End))
+            m_topLine = (int64_t)lineCount;
+    }
+
+    ImS64 scroll = std::max<int64_t>(0, std::min(m_topLine, (int64_t)lineCount - visibleLines));
+    ImRect scrollbar(ImVec2(windowPos.x + windowSize.x - scrollbarWidth, windowPos.y), ImVec2(windowPos.x + windowSize.x, windowPos.y + windowSize.y));
+    ImGui::ScrollbarEx(scrollbar, ImGui::GetID("##lines"), ImGuiAxis_Y, &scroll, visibleLines, (ImS64)lineCount + visibleLines - 1);
+    m_topLine = scroll;
+
+    // Gutter wide enough for the largest line number
+    char number[32];
+    snprintf(number, sizeof(number), " %llu ", (unsigned long long)lineCount);
+    const float gutter = ImGui::CalcTextSize(number).x + ImGui::GetFontSize();
+
+    ImDrawList* drawList = ImGui::GetWindowDrawList();
+    const ImVec2 origin = ImGui::GetCursorScreenPos();
+    const uint64_t matchEnd = m_matchOffset == kNoMatch ? kNoMatch : m_matchOffset + m_matchLength;
+    const char* data = m_file.Data();
+    const char* fileEnd = data + m_file.Size();
+    float longest = 0.0f;
+
+    const char* lineStart = data + LineStart((uint64_t)m_topLine);
+    for (int64_t row = 0; row < visibleLines && m_topLine + row < (int64_t)lineCount && lineStart <= fileEnd; ++row)
+    {
+        const ImVec2 pos(origin.x, origin.y + row * lineHeight);
+        const char* lineEnd = lineStart < fileEnd ? LineEnd(lineStart) : fileEnd;
+
+        // Cut very long lines off at a character boundary, and leave out the '\r' of CRLF files
+        const char* drawEnd = lineEnd;
+        if (drawEnd - lineStart > (ptrdiff_t)kMaxDrawnLineBytes)
+        {
+            drawEnd = lineStart + kMaxDrawnLineBytes;
+            while (drawEnd > lineStart && (*drawEnd & 0xC0) == 0x80)
+                --drawEnd;
+        }
+        else if (drawEnd > lineStart && drawEnd[-1] == '\r')
+            --drawEnd;
+
+        snprintf(number, sizeof(number), "%llu", (unsigned long long)(m_topLine + row + 1));
+        float numberWidth = ImGui::CalcTextSize(number).x;
+        drawList->AddText(ImVec2(pos.x + gutter - numberWidth - ImGui::GetFontSize() * 0.5f, pos.y),
+                          m_palette[(int)TextEditor::PaletteIndex::LineNumber], number);
+
+        DrawLine(drawList, ImVec2(pos.x + gutter, pos.y), lineStart, drawEnd, m_matchOffset, matchEnd);
+        longest = std::max(longest, ImGui::GetFont()->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX, -1.0f, lineStart, drawEnd).x);
+
+        lineStart = lineEnd + 1;
+    }
+
+    // Only the width is scrolled by ImGui
+    ImGui::Dummy(ImVec2(gutter + longest + scrollbarWidth, 0.0f));
+    ImGui::EndChild();
+    ImGui::PopID();
+}
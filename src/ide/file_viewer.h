@@ -0,0 +1,101 @@
+#pragma once
+
+#include "TextEditor.h"
+#include "mapped_file.h"
+#include "imgui.h"
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Read-only view of a file too large to load into a TextEditor. The file stays memory-mapped
+// and a background thread indexes its lines; lines can be viewed and searched while the rest
+// of the file is still being indexed. Only the visible lines are ever read from the mapping,
+// and they are highlighted as they are drawn. The index and search threads read the file
+// itself, so they do not fault if another program truncates it; the view maps it again.
+class FileViewer
+{
+public:
+    FileViewer() = default;
+    ~FileViewer();
+
+    FileViewer(const FileViewer&) = delete;
+    FileViewer& operator=(const FileViewer&) = delete;
+
+    bool Open(const std::filesystem::path& path);
+    void Close();
+    bool IsOpen() const { return m_file.IsOpen(); }
+
+    size_t Size() const { return m_file.Size(); }
+    // Contents of the file, read from the file rather than the mapping
+    std::string GetText() const;
+
+    // Lines indexed so far; grows until IsIndexing() turns false
+    uint64_t GetLineCount() const;
+    bool IsIndexing() const { return m_indexedBytes.load() < m_file.Size(); }
+    float GetIndexProgress() const;
+
+    // Zero-based line. Lines that are not indexed yet are scrolled to once they are.
+    void GoToLine(uint64_t line);
+    // Searches for text on a background thread, starting after the current match (or at the
+    // top line) and wrapping around at the end of the file
+    void Find(const std::string& text);
+    bool IsSearching() const { return m_searching.load(); }
+
+    void SetLanguageDefinition(const TextEditor::LanguageDefinition& language) { m_language = language; }
+    void SetPalette(const TextEditor::Palette& palette) { m_palette = palette; }
+
+    void Render(const char* title, const ImVec2& size = ImVec2(), bool border = false);
+
+private:
+    // Every kLineSample-th line start is kept: enough to reach any line with a short memchr
+    // walk, at 1/kLineSample of the memory of a full index
+    static const uint64_t kLineSample = 64;
+    static const size_t kMaxDrawnLineBytes = 4096;  // longer lines are cut off when drawn
+    static const uint64_t kNoMatch = ~0ull;
+
+    // Maps the file again once it has shrunk, before the pages past its new end are touched
+    void ReopenIfShrunk();
+    void IndexThread();
+    void SearchThread(std::string text, uint64_t from);
+    void StopSearch();
+
+    uint64_t LineStart(uint64_t line) const;
+    uint64_t LineOfOffset(uint64_t offset) const;
+    const char* LineEnd(const char* lineStart) const;
+    void DrawLine(ImDrawList* drawList, ImVec2 pos, const char* begin, const char* end, uint64_t matchBegin, uint64_t matchEnd);
+
+    std::filesystem::path m_path;
+    MappedFile m_file;
+    TextEditor::LanguageDefinition m_language = TextEditor::LanguageDefinition::Python();
+    TextEditor::Palette m_palette = TextEditor::GetDarkPalette();
+
+    // Line index, filled in by m_indexThread
+    std::thread m_indexThread;
+    mutable std::mutex m_indexMutex;
+    std::vector<uint64_t> m_lineSamples;    // guarded by m_indexMutex
+    uint64_t m_lineCount = 0;               // guarded by m_indexMutex
+    std::atomic<uint64_t> m_indexedBytes{ 0 };
+    std::atomic<bool> m_quit{ false };
+
+    // Search, run on m_searchThread
+    std::thread m_searchThread;
+    std::atomic<bool> m_searching{ false };
+    std::atomic<bool> m_searchCancel{ false };
+    std::atomic<uint64_t> m_searchResult{ kNoMatch };
+    std::string m_findText;
+    char m_findBuffer[256] = {};
+    char m_lineBuffer[32] = {};
+    uint64_t m_matchOffset = kNoMatch;
+    uint64_t m_matchLength = 0;
+    bool m_noMatch = false;
+
+    // View
+    int64_t m_topLine = 0;
+    int64_t m_pendingLine = -1;             // requested line, not indexed yet
+    uint64_t m_pendingMatch = kNoMatch;     // match whose line is not indexed yet
+    TextEditor::Tokens m_tokens;            // tokens of the line being drawn, reused across lines
+};
@@ -0,0 +1,214 @@
+#include "file_watcher.h"
+
+#ifdef __linux__
+    #include <poll.h>
+    #include <sys/eventfd.h>
+    #include <sys/inotify.h>
+    #include <unistd.h>
+    #include <cerrno>
+#endif
+
+namespace fs = std::filesystem;
+
+fs::path FileWatcher::Normalize(const fs::path& path)
+{
+    std::error_code ec;
+    auto absolute = fs::absolute(path, ec);
+    return (ec ? path : absolute).lexically_normal();
+}
+
+FileWatcher::FileWatcher()
+{
+#ifdef __linux__
+    m_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    m_wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_inotify < 0 || m_wake < 0)
+        return;
+#endif
+    m_thread = std::thread(&FileWatcher::WorkerThread, this);
+}
+
+FileWatcher::~FileWatcher()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_condition.notify_one();
+#ifdef __linux__
+    if (m_wake >= 0)
+    {
+        uint64_t one = 1;
+        (void)!write(m_wake, &one, sizeof(one));
+    }
+#endif
+    if (m_thread.joinable())
+        m_thread.join();
+#ifdef __linux__
+    if (m_inotify >= 0)
+        close(m_inotify);
+    if (m_wake >= 0)
+        close(m_wake);
+#endif
+}
+
+void FileWatcher::Watch(const fs::path& path)
+{
+    auto file = Normalize(path);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto& watched = m_files[file];
+    if (watched.count++ > 0)
+        return;
+
+#ifdef __linux__
+    // The directory is watched rather than the file, whose watch would not survive the file
+    // being replaced
+    auto directory = file.parent_path();
+    auto& watchedDirectory = m_directories[directory];
+    if (watchedDirectory.count++ == 0 && m_inotify >= 0)
+    {
+        watchedDirectory.descriptor = inotify_add_watch(m_inotify, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR);
+        if (watchedDirectory.descriptor >= 0)
+            m_descriptors[watchedDirectory.descriptor] = directory;
+    }
+#else
+    std::error_code ec;
+    watched.size = fs::file_size(file, ec);
+    watched.time = fs::last_write_time(file, ec);
+#endif
+}
+
+void FileWatcher::Unwatch(const fs::path& path)
+{
+    auto file = Normalize(path);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_files.find(file);
+    if (it == m_files.end() || --it->second.count > 0)
+        return;
+    m_files.erase(it);
+    m_changes.erase(file);
+
+#ifdef __linux__
+    auto directory = m_directories.find(file.parent_path());
+    if (directory != m_directories.end() && --directory->second.count == 0)
+    {
+        if (directory->second.descriptor >= 0)
+        {
+            inotify_rm_watch(m_inotify, directory->second.descriptor);
+            m_descriptors.erase(directory->second.descriptor);
+        }
+        m_directories.erase(directory);
+    }
+#endif
+}
+
+bool FileWatcher::TakeChanges(std::vector<fs::path>& paths)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_changes.empty())
+        return false;
+
+    paths.assign(m_changes.begin(), m_changes.end());
+    m_changes.clear();
+    return true;
+}
+
+#ifdef __linux__
+
+void FileWatcher::WorkerThread()
+{
+    alignas(inotify_event) char buffer[16 * 1024];
+    pollfd fds[2] = { { m_inotify, POLLIN, 0 }, { m_wake, POLLIN, 0 } };
+    for (;;)
+    {
+        if (poll(fds, 2, -1) < 0 && errno != EINTR)
+            return;
+        if (fds[1].revents != 0)
+            return;
+
+        for (;;)
+        {
+            auto length = read(m_inotify, buffer, sizeof(buffer));
+            if (length <= 0)
+                break;
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (char* pos = buffer; pos < buffer + length; )
+            {
+                auto event = reinterpret_cast<inotify_event*>(pos);
+                pos += sizeof(inotify_event) + event->len;
+
+                auto directory = m_descriptors.find(event->wd);
+                if (directory == m_descriptors.end())
+                    continue;
+                if (event->mask & IN_IGNORED)
+                {
+                    // The directory is gone: watching it again takes a new watch
+                    m_directories.erase(directory->second);
+                    m_descriptors.erase(directory);
+                    continue;
+                }
+                if (event->len == 0)
+                    continue;
+
+                auto file = directory->second / event->name;
+                if (m_files.count(file) != 0)
+                    m_changes.insert(std::move(file));
+            }
+        }
+    }
+}
+
+#else
+
+void FileWatcher::WorkerThread()
+{
+    std::vector<fs::path> files;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;)
+    {
+        if (m_condition.wait_for(lock, kPollInterval, [this] { return m_quit; }))
+            return;
+
+        files.clear();
+        for (auto& [file, watched] : m_files)
+            files.push_back(file);
+        lock.unlock();
+
+        // Stat outside the lock, which Watch() and Unwatch() need meanwhile
+        struct Stamp
+        {
+            uintmax_t size;
+            fs::file_time_type time;
+            bool ok;
+        };
+        std::vector<Stamp> stamps;
+        stamps.reserve(files.size());
+        for (auto& file : files)
+        {
+            std::error_code sizeError, timeError;
+            Stamp stamp;
+            stamp.size = fs::file_size(file, sizeError);
+            stamp.time = fs::last_write_time(file, timeError);
+            stamp.ok = !sizeError && !timeError;
+            stamps.push_back(stamp);
+        }
+
+        lock.lock();
+        for (size_t i = 0; i < files.size(); ++i)
+        {
+            auto it = m_files.find(files[i]);
+            if (it == m_files.end() || !stamps[i].ok)
+                continue;
+            auto& watched = it->second;
+            if (watched.size != stamps[i].size || watched.time != stamps[i].time)
+            {
+                watched.size = stamps[i].size;
+                watched.time = stamps[i].time;
+                m_changes.insert(files[i]);
+            }
+        }
+    }
+}
+
+#endif
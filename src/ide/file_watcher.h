@@ -0,0 +1,68 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+// Notices files being written by other programs, on a background thread. On Linux it watches
+// the directories of the files with inotify, which also sees a file replaced by renaming
+// another one over it; elsewhere it compares their size and modification time every
+// kPollInterval.
+class FileWatcher
+{
+public:
+    static constexpr std::chrono::milliseconds kPollInterval{ 1000 };
+
+    FileWatcher();
+    ~FileWatcher();
+
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+
+    // Watches are counted: a path watched twice is watched until it is unwatched twice
+    void Watch(const std::filesystem::path& path);
+    void Unwatch(const std::filesystem::path& path);
+
+    // The watched files written since the last call, as absolute paths
+    bool TakeChanges(std::vector<std::filesystem::path>& paths);
+
+    static std::filesystem::path Normalize(const std::filesystem::path& path);
+
+private:
+    struct WatchedFile
+    {
+        int count = 0;
+        // Polling only: what the file looked like when last checked
+        uintmax_t size = 0;
+        std::filesystem::file_time_type time;
+    };
+
+    void WorkerThread();
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::map<std::filesystem::path, WatchedFile> m_files;
+    std::set<std::filesystem::path> m_changes;
+    bool m_quit = false;
+
+#ifdef __linux__
+    // inotify watches one per directory, counted by the files watched in it
+    struct WatchedDirectory
+    {
+        int descriptor = -1;
+        int count = 0;
+    };
+
+    int m_inotify = -1;
+    int m_wake = -1;                    // eventfd that wakes the thread up to quit
+    std::map<std::filesystem::path, WatchedDirectory> m_directories;
+    std::map<int, std::filesystem::path> m_descriptors;
+#endif
+};
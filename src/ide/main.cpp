@@ -307,6 +307,7 @@ int main(int, char**)
 
     // Our state
     bool show_console_window = false;
+    bool show_outline_window = false;
 #ifdef ENABLE_DEBUGGER
     bool show_variables_window = false;
     bool show_callstack_window = false;
@@ -323,6 +324,13 @@ int main(int, char**)
 
     // Init editor
     Editor editor;
+
+    // Journal unsaved edits, and bring back those of a run that crashed
+    if (char* prefPath = SDL_GetPrefPath("pocketpy", "ide"))
+    {
+        editor.StartJournal(fs::path(prefPath) / "journal");
+        SDL_free(prefPath);
+    }
     
     // Load test.py if exists
     if (fs::exists("test.py"))
@@ -330,18 +338,49 @@ int main(int, char**)
         editor.LoadFile("test.py");
     }
 
+    // Asked for when closing an untitled document with edits to save
+    editor.SetSaveAsDialog([]() -> std::filesystem::path {
+        auto saveFileName = tinyfd_saveFileDialog(
+            "Save file as",
+            "untitled.py",
+            0,
+            nullptr,
+            nullptr);
+        return saveFileName != nullptr ? saveFileName : "";
+    });
+
+    // Saves finish in the background, report them once they are on disk
+    editor.SetSaveCallback([&](const std::filesystem::path& path, bool ok) {
+        if (ok)
+        {
+            console.AddLog("File saved: %s\n", path.string().c_str());
+        }
+        else
+        {
+            console.AddLog("[error] Failed to save file: %s\n", path.string().c_str());
+            show_console_window = true;
+        }
+    });
+
 #ifdef ENABLE_DEBUGGER
     // Setup breakpoint callback - sync editor breakpoints with debugger
-    editor.SetBreakpointCallback([&](int line, bool added) {
+    // Only the changes are applied, breakpoints moved by edits follow their line quietly
+    editor.SetBreakpointCallback([&](const TextEditor::BreakpointChange& change) {
         auto currentFile = editor.GetCurrentFile();
         std::string filename = currentFile.empty() ? "<string>" : currentFile.string();
         
-        if (added) {
-            debugger.AddBreakpoint(filename, line);
-            console.AddLog("Breakpoint added: %s:%d\n", filename.c_str(), line);
-        } else {
-            debugger.RemoveBreakpoint(filename, line);
-            console.AddLog("Breakpoint removed: %s:%d\n", filename.c_str(), line);
+        switch (change.mType) {
+        case TextEditor::BreakpointChange::Type::Added:
+            debugger.AddBreakpoint(filename, change.mLine);
+            console.AddLog("Breakpoint added: %s:%d\n", filename.c_str(), change.mLine);
+            break;
+        case TextEditor::BreakpointChange::Type::Removed:
+            debugger.RemoveBreakpoint(filename, change.mLine);
+            console.AddLog("Breakpoint removed: %s:%d\n", filename.c_str(), change.mLine);
+            break;
+        case TextEditor::BreakpointChange::Type::Moved:
+            debugger.MoveBreakpoint(filename, change.mOldLine, change.mLine);
+            break;
         }
     });
     
@@ -381,7 +420,7 @@ int main(int, char**)
     };
     
     // Helper function to run script via pkpy process with output capture
-    auto runScriptViaProcess = [&](const std::string& code, const std::string& filename) {
+    auto runScriptViaProcess = [&](const std::string& filename) {
         // Determine script path
         std::string scriptPath;
         bool isRealFile = !filename.empty() && 
@@ -391,11 +430,8 @@ int main(int, char**)
         
         if (isRealFile) {
             scriptPath = filename;
-            // Write current content to file (handle unsaved changes)
-            std::ofstream outFile(scriptPath);
-            if (outFile) {
-                outFile << code;
-                outFile.close();
+            // Write current content to file (handle unsaved changes); skipped if it is already there
+            if (editor.WriteFile(scriptPath).get()) {
                 console.AddLog("[info] Using file: %s\n", scriptPath.c_str());
             } else {
                 console.AddLog("[error] Failed to write to file: %s\n", scriptPath.c_str());
@@ -404,10 +440,7 @@ int main(int, char**)
         } else {
             // Create temporary file
             scriptPath = (fs::temp_directory_path() / "minipythonide_run.py").string();
-            std::ofstream outFile(scriptPath);
-            if (outFile) {
-                outFile << code;
-                outFile.close();
+            if (editor.WriteFile(scriptPath).get()) {
                 console.AddLog("[info] Using temporary file: %s\n", scriptPath.c_str());
             } else {
                 console.AddLog("[error] Failed to create temporary file\n");
@@ -479,12 +512,33 @@ int main(int, char**)
         show_console_window = true;
     };
     
+#ifdef ENABLE_DEBUGGER
+    // Lets the debugger write the editor buffer to the script it launches
+    auto writeScript = [&](const std::string& path) {
+        return editor.WriteFile(path).get();
+    };
+#endif
+    
     // Init pocket.py
     py_initialize();
     
     // Initial setup for VM 0
     setupPythonVM();
 
+    // Complete the names of the builtins, and the members of the test module after "test."
+    auto moduleNames = [](const char* path) {
+        std::vector<std::string> names;
+        py_applydict(py_getmodule(path), [](py_Name name, py_Ref, void* ctx) {
+            auto str = py_name2str(name);
+            if (str[0] != '_')
+                static_cast<std::vector<std::string>*>(ctx)->push_back(str);
+            return true;
+        }, &names);
+        return names;
+    };
+    editor.SetCompletionWords(moduleNames("builtins"));
+    editor.SetCompletionMembers("test", moduleNames("test"));
+
 
     // Main loop
     bool done = false;
@@ -522,6 +576,11 @@ int main(int, char**)
         {
             if (ImGui::BeginMenu("File"))
             {
+                if (ImGui::MenuItem("New", "Ctrl+N"))
+                {
+                    editor.NewDocument();
+                }
+                
                 if (ImGui::MenuItem("Open", "Ctrl+O"))
                 {
                     auto openFileName = tinyfd_openFileDialog(
@@ -559,6 +618,11 @@ int main(int, char**)
                     }
                 }
                 
+                if (ImGui::MenuItem("Close", "Ctrl+W"))
+                {
+                    editor.CloseDocument(editor.GetActiveDocument());
+                }
+                
                 ImGui::Separator();
                 if (ImGui::MenuItem("Exit"))
                 {
@@ -588,6 +652,20 @@ int main(int, char**)
                 
                 if (ImGui::MenuItem("Select All", "Ctrl-A"))
                     textEditor.SelectAll();
+
+                ImGui::Separator();
+
+                if (ImGui::MenuItem("Find/Replace", "Ctrl-F", nullptr, !editor.IsViewing()))
+                    editor.ShowFindPanel();
+                if (ImGui::MenuItem("Find Next", "F3", nullptr, !editor.IsViewing()))
+                    editor.FindNext();
+                if (ImGui::MenuItem("Find Previous", "Shift-F3", nullptr, !editor.IsViewing()))
+                    editor.FindNext(true);
+
+                ImGui::Separator();
+
+                if (ImGui::MenuItem("Go to Definition", "F12", nullptr, !editor.IsViewing()))
+                    editor.GoToDefinition();
                     
                 ImGui::EndMenu();
             }
@@ -598,6 +676,13 @@ int main(int, char**)
                 bool showWhitespace = textEditor.IsShowingWhitespaces();
                 if (ImGui::MenuItem("Show Whitespace", nullptr, &showWhitespace))
                     textEditor.SetShowWhitespaces(showWhitespace);
+                bool showMinimap = textEditor.IsShowingMinimap();
+                if (ImGui::MenuItem("Show Minimap", nullptr, &showMinimap))
+                    textEditor.SetShowMinimap(showMinimap);
+                bool wordWrap = textEditor.IsWordWrapping();
+                if (ImGui::MenuItem("Word Wrap", nullptr, &wordWrap))
+                    textEditor.SetWordWrap(wordWrap);
+                ImGui::MenuItem("Show Outline", nullptr, &show_outline_window);
                     
                 ImGui::Separator();
                 
@@ -623,12 +708,11 @@ int main(int, char**)
 #endif
                 if (ImGui::MenuItem("Run Script", "F5", false, canRun))
                 {
-                    std::string code = editor.GetText();
                     auto currentFile = editor.GetCurrentFile();
                     std::string filename = currentFile.empty() ? "<editor>" : currentFile.string();
                     
                     // Run script via pkpy process with output capture
-                    runScriptViaProcess(code, filename);
+                    runScriptViaProcess(filename);
                 }
                 
                 ImGui::Separator();
@@ -645,8 +729,7 @@ int main(int, char**)
                     show_callstack_window = true;
                     show_console_window = true;
                     
-                    // Get code and filename
-                    std::string code = editor.GetText();
+                    // Get filename
                     std::string filename = editor.GetCurrentFile().empty() ? 
                         "<editor>" : editor.GetCurrentFile().string();
                     
@@ -656,7 +739,7 @@ int main(int, char**)
                         console.AddLog("%s", msg.c_str());
                     };
                     
-                    debugger.Start(code, filename, logCallback);
+                    debugger.Start(filename, writeScript, logCallback);
                 }
                 
                 if (ImGui::MenuItem("Stop Debugging", nullptr, false, debugger.IsDebugging()))
@@ -708,8 +791,7 @@ int main(int, char**)
             show_callstack_window = true;
             show_console_window = true;
             
-            // Get code and filename
-            std::string code = editor.GetText();
+            // Get filename
             std::string filename = editor.GetCurrentFile().empty() ? 
                 "<editor>" : editor.GetCurrentFile().string();
             
@@ -718,7 +800,7 @@ int main(int, char**)
                 console.AddLog("%s", msg.c_str());
             };
             
-            debugger.Start(code, filename, logCallback);
+            debugger.Start(filename, writeScript, logCallback);
         }
         
         // F5 - Continue (when debugging) or Run Script via pkpy process (when not debugging)
@@ -730,12 +812,11 @@ int main(int, char**)
             }
             else if (!debugger.IsDebugging())
             {
-                std::string code = editor.GetText();
                 auto currentFile = editor.GetCurrentFile();
                 std::string filename = currentFile.empty() ? "<editor>" : currentFile.string();
                 
                 // Run script via pkpy process with output capture
-                runScriptViaProcess(code, filename);
+                runScriptViaProcess(filename);
             }
         }
         
@@ -764,12 +845,11 @@ int main(int, char**)
         // F5 - Run Script (when debugger not enabled)
         if (ImGui::IsKeyPressed(ImGuiKey_F5))
         {
-            std::string code = editor.GetText();
             auto currentFile = editor.GetCurrentFile();
             std::string filename = currentFile.empty() ? "<editor>" : currentFile.string();
             
             // Run script via pkpy process with output capture
-            runScriptViaProcess(code, filename);
+            runScriptViaProcess(filename);
         }
 #endif
         
@@ -791,13 +871,30 @@ int main(int, char**)
                 }
             }
             
+            // Ctrl+N - New File
+            if (ImGui::IsKeyPressed(ImGuiKey_N))
+            {
+                editor.NewDocument();
+            }
+            
+            // Ctrl+W - Close File
+            if (ImGui::IsKeyPressed(ImGuiKey_W))
+            {
+                editor.CloseDocument(editor.GetActiveDocument());
+            }
+            
+            // Ctrl+F - Find/Replace (the large file viewer has its own find bar)
+            if (ImGui::IsKeyPressed(ImGuiKey_F) && !editor.IsViewing())
+            {
+                editor.ShowFindPanel();
+            }
+            
             // Ctrl+S - Save File
             if (ImGui::IsKeyPressed(ImGuiKey_S))
             {
                 if (!editor.GetCurrentFile().empty())
                 {
                     editor.SaveFile(editor.GetCurrentFile());
-                    console.AddLog("File saved: %s\n", editor.GetCurrentFile().string().c_str());
                 }
                 else
                 {
@@ -810,12 +907,23 @@ int main(int, char**)
                     if (saveFileName != nullptr)
                     {
                         editor.SaveFile(saveFileName);
-                        console.AddLog("File saved: %s\n", saveFileName);
                     }
                 }
             }
         }
 
+        // F3 / Shift+F3 - Find Next / Previous
+        if (ImGui::IsKeyPressed(ImGuiKey_F3) && !editor.IsViewing())
+        {
+            editor.FindNext(ImGui::GetIO().KeyShift);
+        }
+
+        // F12 - Go to Definition
+        if (ImGui::IsKeyPressed(ImGuiKey_F12))
+        {
+            editor.GoToDefinition();
+        }
+
         // Editor Window
         ImGui::Begin("Code Editor", nullptr, ImGuiWindowFlags_HorizontalScrollbar | ImGuiWindowFlags_MenuBar);
         
@@ -823,11 +931,21 @@ int main(int, char**)
         {
             auto& textEditor = editor.GetTextEditor();
             auto cursorPos = textEditor.GetCursorPosition();
-            ImGui::Text("Ln %d, Col %d | %d lines | %s", 
-                cursorPos.mLine + 1, 
-                cursorPos.mColumn + 1, 
-                textEditor.GetTotalLines(),
-                textEditor.IsOverwrite() ? "Ovr" : "Ins");
+            if (editor.IsViewing())
+            {
+                auto& viewer = editor.GetFileViewer();
+                ImGui::Text("%llu lines%s | Read-only",
+                    (unsigned long long)viewer.GetLineCount(),
+                    viewer.IsIndexing() ? "..." : "");
+            }
+            else
+            {
+                ImGui::Text("Ln %d, Col %d | %d lines | %s", 
+                    cursorPos.mLine + 1, 
+                    cursorPos.mColumn + 1, 
+                    textEditor.GetTotalLines(),
+                    textEditor.IsOverwrite() ? "Ovr" : "Ins");
+            }
                 
             if (!editor.GetCurrentFile().empty())
             {
@@ -855,6 +973,16 @@ int main(int, char**)
             console.Draw("Python Console", &show_console_window);
         }
 
+        // Outline Window
+        if (show_outline_window)
+        {
+            if (ImGui::Begin("Outline", &show_outline_window))
+            {
+                editor.RenderOutline();
+            }
+            ImGui::End();
+        }
+
 #ifdef ENABLE_DEBUGGER
 
         // Update tree version for JSON viewer
@@ -1187,6 +1315,7 @@ int main(int, char**)
     // Kill all remaining pkpy processes before exit
     CleanupAllProcesses();
     
+    editor.StopSyntaxCheck();
     py_finalize();
 
     SDL_WaitForGPUIdle(gpu_device);
@@ -0,0 +1,191 @@
+#include "mapped_file.h"
+#include <algorithm>
+
+#ifdef _WIN32
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#else
+    #include <cerrno>
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::Open(const std::filesystem::path& path)
+{
+    Close();
+
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size))
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    // CreateFileMapping rejects empty files
+    if (size.QuadPart == 0)
+    {
+        m_file = file;
+        m_open = true;
+        return true;
+    }
+
+    HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr)
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (view == nullptr)
+    {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    m_file = file;
+    m_mapping = mapping;
+    m_data = static_cast<const char*>(view);
+    m_size = static_cast<size_t>(size.QuadPart);
+    m_open = true;
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (m_data)
+        UnmapViewOfFile(m_data);
+    if (m_mapping)
+        CloseHandle(m_mapping);
+    if (m_file)
+        CloseHandle(m_file);
+
+    m_data = nullptr;
+    m_mapping = nullptr;
+    m_file = nullptr;
+    m_size = 0;
+    m_open = false;
+}
+
+uint64_t MappedFile::CurrentSize() const
+{
+    LARGE_INTEGER size;
+    if (m_file == nullptr || !GetFileSizeEx(m_file, &size))
+        return 0;
+    return static_cast<uint64_t>(size.QuadPart);
+}
+
+size_t MappedFile::Read(uint64_t offset, char* buffer, size_t size) const
+{
+    size_t total = 0;
+    while (m_file != nullptr && total < size)
+    {
+        OVERLAPPED overlapped = {};
+        overlapped.Offset = static_cast<DWORD>(offset + total);
+        overlapped.OffsetHigh = static_cast<DWORD>((offset + total) >> 32);
+        DWORD read = 0;
+        DWORD chunk = static_cast<DWORD>(std::min<size_t>(size - total, 1u << 30));
+        if (!ReadFile(m_file, buffer + total, chunk, &read, &overlapped) || read == 0)
+            break;
+        total += read;
+    }
+    return total;
+}
+
+#else
+
+bool MappedFile::Open(const std::filesystem::path& path)
+{
+    Close();
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        close(fd);
+        return false;
+    }
+
+    // mmap rejects empty files
+    if (st.st_size == 0)
+    {
+        m_fd = fd;
+        m_open = true;
+        return true;
+    }
+
+    // The descriptor is kept for CurrentSize() and Read()
+    void* view = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    if (view == MAP_FAILED)
+    {
+        close(fd);
+        return false;
+    }
+
+    // The file is read front to back exactly once
+    madvise(view, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+
+    m_fd = fd;
+    m_data = static_cast<const char*>(view);
+    m_size = static_cast<size_t>(st.st_size);
+    m_open = true;
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (m_data)
+        munmap(const_cast<char*>(m_data), m_size);
+    if (m_fd >= 0)
+        close(m_fd);
+
+    m_data = nullptr;
+    m_fd = -1;
+    m_size = 0;
+    m_open = false;
+}
+
+uint64_t MappedFile::CurrentSize() const
+{
+    struct stat st;
+    if (m_fd < 0 || fstat(m_fd, &st) != 0)
+        return 0;
+    return static_cast<uint64_t>(st.st_size);
+}
+
+size_t MappedFile::Read(uint64_t offset, char* buffer, size_t size) const
+{
+    size_t total = 0;
+    while (m_fd >= 0 && total < size)
+    {
+        ssize_t read = pread(m_fd, buffer + total, size - total, static_cast<off_t>(offset + total));
+        if (read < 0 && errno == EINTR)
+            continue;
+        if (read <= 0)
+            break;
+        total += static_cast<size_t>(read);
+    }
+    return total;
+}
+
+#endif
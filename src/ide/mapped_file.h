@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+// Read-only memory mapping of a whole file. The contents are paged in by the OS on
+// first access instead of being copied through a stream buffer.
+//
+// The mapping keeps the size the file had when it was opened. If another program truncates
+// the file, touching the pages past its new end raises SIGBUS on POSIX systems (Windows
+// refuses to truncate a mapped file). Readers that keep a file mapped compare CurrentSize()
+// with Size() before touching the mapping, and long scans go through Read() instead.
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    explicit MappedFile(const std::filesystem::path& path) { Open(path); }
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Returns false if the file cannot be opened or mapped. An empty file opens
+    // successfully with Data() == nullptr and Size() == 0.
+    bool Open(const std::filesystem::path& path);
+    void Close();
+
+    bool IsOpen() const { return m_open; }
+    const char* Data() const { return m_data; }
+    size_t Size() const { return m_size; }
+
+    // Size of the file now, which is below Size() if the file has been truncated since it was
+    // opened
+    uint64_t CurrentSize() const;
+    // Copies up to size bytes at offset from the file itself rather than the mapping. Returns
+    // the number of bytes read, fewer than size at the end of the file.
+    size_t Read(uint64_t offset, char* buffer, size_t size) const;
+
+private:
+    const char* m_data = nullptr;
+    size_t m_size = 0;
+    bool m_open = false;
+#ifdef _WIN32
+    void* m_file = nullptr;
+    void* m_mapping = nullptr;
+#else
+    int m_fd = -1;
+#endif
+};
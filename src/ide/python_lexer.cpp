@@ -0,0 +1,343 @@
+#include "python_lexer.h"
+#include "pocketpy.h"
+
+#include <cstdio>
+
+namespace
+{
+
+// State between lines
+const int kStateString = 1;         // within a triple-quoted string
+const int kStateDoubleQuote = 2;    // delimited by '"' rather than '\''
+const int kStateRaw = 4;
+const int kStateFString = 8;
+
+const int kMaxFStringDepth = 16;
+
+using TokenKind = PythonLexer::TokenKind;
+
+// Bytes of the UTF-8 sequence starting with c, 0 if it cannot start one (as c11__u8_header())
+int Utf8Length(unsigned char c)
+{
+    if ((c & 0x80) == 0)
+        return 1;
+    if ((c & 0xE0) == 0xC0)
+        return 2;
+    if ((c & 0xF0) == 0xE0)
+        return 3;
+    if ((c & 0xF8) == 0xF0)
+        return 4;
+    if ((c & 0xFC) == 0xF8)
+        return 5;
+    if ((c & 0xFE) == 0xFC)
+        return 6;
+    return 0;
+}
+
+class Scanner
+{
+public:
+    Scanner(const char* begin, const char* end, PythonLexer::Callback callback, void* context)
+        : m_begin(begin), m_current(begin), m_end(end), m_callback(callback), m_context(context)
+    {
+    }
+
+    int Run(int state)
+    {
+        if (state & kStateString)
+            m_state = ScanString(m_begin, (state & kStateDoubleQuote) ? '"' : '\'', state);
+        ScanCode(false);
+        return m_state;
+    }
+
+private:
+    void Emit(TokenKind kind, const char* from, const char* to)
+    {
+        if (m_callback != nullptr && to > from)
+            m_callback(m_context, kind, (int)(from - m_begin), (int)(to - m_begin));
+    }
+
+    bool Match(char c)
+    {
+        if (m_current == m_end || *m_current != c)
+            return false;
+        ++m_current;
+        return true;
+    }
+
+    // Same escapes as _eat_string(); m_current is past the backslash
+    bool ScanEscape()
+    {
+        if (m_current == m_end || *m_current == '\n')
+            return false;
+        switch (*m_current++)
+        {
+        case '"':
+        case '\'':
+        case '\\':
+        case 'n':
+        case 'r':
+        case 't':
+        case 'a':
+        case 'b':
+        case 'f':
+        case 'v':
+        case '0':
+            return true;
+        case 'x':
+        {
+            char hex[3] = { '\0', '\0', '\0' };
+            for (int i = 0; i < 2 && m_current < m_end && *m_current != '\n'; ++i)
+                hex[i] = *m_current++;
+            int code;
+            return sscanf(hex, "%x", &code) == 1 && code <= 0xFF;
+        }
+        default:
+            return false;
+        }
+    }
+
+    // Scans a string literal from its opening quote, which has just been consumed, or, if start
+    // is the beginning of the text, the rest of a triple-quoted string described by flags.
+    // Returns the state at the end of the text.
+    int ScanString(const char* start, char quote, int flags)
+    {
+        bool quote3 = (flags & kStateString) != 0;
+        if (!quote3 && m_end - m_current >= 2 && m_current[0] == quote && m_current[1] == quote)
+        {
+            m_current += 2;
+            quote3 = true;
+        }
+        const char* part = start;   // start of the string text not reported yet
+        while (m_current < m_end)
+        {
+            const char* at = m_current;
+            char c = *m_current++;
+            if (c == quote)
+            {
+                if (quote3)
+                {
+                    if (m_end - m_current < 2 || m_current[0] != quote || m_current[1] != quote)
+                        continue;
+                    m_current += 2;
+                }
+                Emit(TokenKind::String, part, m_current);
+                return 0;
+            }
+            if (c == '\n')
+            {
+                if (quote3)
+                    continue;
+                // Unterminated; the compiler rejects it, but while it is typed it reads better as a string
+                --m_current;
+                break;
+            }
+            if (c == '\\' && !(flags & kStateRaw))
+            {
+                if (!ScanEscape())
+                {
+                    Emit(TokenKind::String, part, at);
+                    Emit(TokenKind::Error, at, m_current > at + 1 ? m_current : at + 1);
+                    part = m_current;
+                }
+                continue;
+            }
+            if (flags & kStateFString)
+            {
+                if (c == '{' && !Match('{') && m_depth < kMaxFStringDepth)
+                {
+                    Emit(TokenKind::String, part, at);
+                    Emit(TokenKind::Operator, at, m_current);
+                    ++m_depth;
+                    ScanCode(true);
+                    --m_depth;
+                    part = m_current;
+                }
+                else if (c == '}' && !Match('}'))
+                {
+                    Emit(TokenKind::String, part, at);
+                    Emit(TokenKind::Error, at, m_current);
+                    part = m_current;
+                }
+            }
+        }
+        Emit(TokenKind::String, part, m_current);
+        if (quote3 && m_current == m_end)
+            return kStateString | (flags & ~kStateString) | (quote == '"' ? kStateDoubleQuote : 0);
+        return 0;
+    }
+
+    // Same as eat_number(), checked only if reported
+    void ScanNumber(const char* start)
+    {
+        bool valid = false;
+        m_current = start + py_lexnumber(start, m_end, m_callback != nullptr ? &valid : nullptr);
+        Emit(valid ? TokenKind::Number : TokenKind::Error, start, m_current);
+    }
+
+    // Same as eat_name(), looked up among the keywords only if reported
+    void ScanName(const char* start)
+    {
+        bool keyword = false;
+        int length = py_lexname(start, m_end, m_callback != nullptr ? &keyword : nullptr);
+        if (length == 0)
+        {
+            // Invalid character: skip all of it
+            int bytes = Utf8Length((unsigned char)*start);
+            m_current = start + (bytes > 0 && bytes <= m_end - start ? bytes : 1);
+            Emit(TokenKind::Error, start, m_current);
+            return;
+        }
+        m_current = start + length;
+        Emit(keyword ? TokenKind::Keyword : TokenKind::Name, start, m_current);
+    }
+
+    // Same as eat_fstring_spec(); start is the ':' or '!'
+    bool ScanFStringSpec(const char* start)
+    {
+        while (m_current < m_end && *m_current != '\n')
+        {
+            if (*m_current == '}')
+            {
+                Emit(TokenKind::String, start, m_current);
+                Emit(TokenKind::Operator, m_current, m_current + 1);
+                ++m_current;
+                return true;
+            }
+            ++m_current;
+        }
+        Emit(TokenKind::Error, start, m_current);
+        return false;
+    }
+
+    // Same as lex_one_token(), called until the end of the text, or with fstring, until the
+    // '}' closing an f-string expression (which returns true) or the end of the line
+    bool ScanCode(bool fstring)
+    {
+        while (m_current < m_end)
+        {
+            const char* start = m_current;
+            char c = *m_current++;
+            switch (c)
+            {
+            case '\n':
+                if (fstring)
+                {
+                    --m_current;
+                    return false;
+                }
+                break;
+            case ' ':
+            case '\t':
+            case '\r':  // SourceData drops '\r'
+                break;
+            case '#':
+                while (m_current < m_end && *m_current != '\n')
+                    ++m_current;
+                Emit(TokenKind::Comment, start, m_current);
+                break;
+            case '\'':
+            case '"':
+            {
+                int state = ScanString(start, c, c == '"' ? kStateDoubleQuote : 0);
+                if (!fstring)
+                    m_state = state;
+                break;
+            }
+            case '}':
+                Emit(TokenKind::Operator, start, m_current);
+                if (fstring)
+                    return true;
+                break;
+            case ':':
+                // BUG (as in the compiler): f"{stack[2:]}"
+                if (fstring)
+                    return ScanFStringSpec(start);
+                Emit(TokenKind::Operator, start, m_current);
+                break;
+            case '!':
+            {
+                if (fstring && Match('r'))
+                    return ScanFStringSpec(start);
+                bool valid = Match('=');
+                Emit(valid ? TokenKind::Operator : TokenKind::Error, start, m_current);
+                break;
+            }
+            case '\\':
+            {
+                // Line continuation character
+                bool eol = m_current == m_end || *m_current == '\n';
+                Emit(eol ? TokenKind::Operator : TokenKind::Error, start, m_current);
+                break;
+            }
+            case '.':
+                if (m_current < m_end && *m_current >= '0' && *m_current <= '9')
+                    ScanNumber(start);
+                else
+                {
+                    if (Match('.'))
+                        Match('.');
+                    Emit(TokenKind::Operator, start, m_current);
+                }
+                break;
+            case '~':
+            case '{':
+            case ',':
+            case ';':
+            case '(':
+            case ')':
+            case '[':
+            case ']':
+            case '@':
+            case '%':
+            case '&':
+            case '|':
+            case '^':
+            case '=':
+            case '+':
+            case '>':
+            case '<':
+            case '-':
+            case '*':
+            case '/':
+                Emit(TokenKind::Operator, start, m_current);
+                break;
+            default:
+                if ((c == 'f' || c == 'r' || c == 'b') && m_current < m_end && (*m_current == '\'' || *m_current == '"'))
+                {
+                    char quote = *m_current++;
+                    int flags = quote == '"' ? kStateDoubleQuote : 0;
+                    if (c == 'f')
+                        flags |= kStateFString;
+                    if (c == 'r')
+                        flags |= kStateRaw;
+                    int state = ScanString(start, quote, flags);
+                    if (!fstring)
+                        m_state = state;
+                }
+                else if (c >= '0' && c <= '9')
+                    ScanNumber(start);
+                else
+                    ScanName(start);
+                break;
+            }
+        }
+        return false;
+    }
+
+    const char* m_begin;
+    const char* m_current;
+    const char* m_end;
+    PythonLexer::Callback m_callback;
+    void* m_context;
+    int m_depth = 0;    // f-string expressions being scanned
+    int m_state = 0;    // returned by Lex()
+};
+
+} // namespace
+
+int PythonLexer::Lex(const char* begin, const char* end, int state, Callback callback, void* context)
+{
+    Scanner scanner(begin, end, callback, context);
+    return scanner.Run(state);
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+// Classifies the tokens of Python source by the rules of pocketpy's lexer (Lexer__process in
+// 3rd_party/pocketpy), for highlighting. Unlike the compiler's lexer it builds no tokens and
+// allocates nothing, reports errors as tokens and goes on, and lexes a line at a time: the only
+// state carried from one line to the next is the kind of triple-quoted string open at its end.
+// Keywords and number literals are checked by pocketpy itself (py_lexname, py_lexnumber).
+class PythonLexer
+{
+public:
+    enum class TokenKind
+    {
+        Name,
+        Keyword,
+        Number,     // int, float and imaginary literals
+        String,     // str and bytes literals, and the text and format specs of f-strings
+        Operator,   // operators and delimiters, including the braces of f-string expressions
+        Comment,
+        Error,      // text the compiler rejects, e.g. `1x`, `$` or an invalid escape in a string
+    };
+
+    // Called for each token, with its byte range relative to the start of the text
+    using Callback = void (*)(void* context, TokenKind kind, int begin, int end);
+
+    // Lexes [begin, end), usually a single line. state is the value returned for the text before
+    // it, 0 at the start of a source. Returns the state at end, which is 0 unless it is within a
+    // triple-quoted string and otherwise below 256. callback may be null to only compute the
+    // state.
+    static int Lex(const char* begin, const char* end, int state, Callback callback, void* context);
+};
@@ -0,0 +1,125 @@
+#include "syntax_checker.h"
+#include "pocketpy.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+SyntaxChecker::~SyntaxChecker()
+{
+    Stop();
+}
+
+void SyntaxChecker::Check(uint64_t document, uint64_t generation, std::string source)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_quit)
+            return;
+        if (!m_thread.joinable())
+            m_thread = std::thread(&SyntaxChecker::WorkerThread, this);
+
+        m_request.document = document;
+        m_request.generation = generation;
+        m_request.source = std::move(source);
+        m_pending = true;
+        m_hasResult = false;
+        ++m_serial;
+    }
+    m_condition.notify_one();
+}
+
+void SyntaxChecker::Cancel()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pending = false;
+    m_hasResult = false;
+    ++m_serial;
+}
+
+void SyntaxChecker::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_condition.notify_one();
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+bool SyntaxChecker::TakeResult(Result& result)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_hasResult)
+        return false;
+
+    result = std::move(m_result);
+    m_hasResult = false;
+    return true;
+}
+
+void SyntaxChecker::WorkerThread()
+{
+    // The VM is current on this thread only: scripts keep running in the main thread's VM
+    py_switchvm(kVmIndex);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;)
+    {
+        m_condition.wait(lock, [this] { return m_quit || m_pending; });
+        if (m_quit)
+            return;
+
+        Request request = std::move(m_request);
+        m_pending = false;
+        uint64_t serial = m_serial;
+        lock.unlock();
+
+        Result result = Compile(request);
+
+        lock.lock();
+        if (serial == m_serial)
+        {
+            m_result = std::move(result);
+            m_hasResult = true;
+        }
+    }
+}
+
+SyntaxChecker::Result SyntaxChecker::Compile(const Request& request)
+{
+    Result result;
+    result.document = request.document;
+    result.generation = request.generation;
+
+    py_StackRef p0 = py_peek(0);
+    if (py_compile(request.source.c_str(), "<editor>", EXEC_MODE, false))
+        return result;
+
+    // The traceback names the line, and its last line holds the message:
+    //     File "<editor>", line 2
+    //       y = (
+    //   SyntaxError: expected an expression, got @eof
+    result.ok = false;
+    char* formatted = py_formatexc();
+    py_clearexc(p0);
+    if (formatted == nullptr)
+        return result;
+
+    std::string text = formatted;
+    py_free(formatted);
+
+    auto lineAt = text.rfind(", line ");
+    if (lineAt != std::string::npos)
+        result.line = atoi(text.c_str() + lineAt + 7);
+    result.line = std::max(result.line, 1);     // errors at the end of the text may report line 0
+
+    auto end = text.find_last_not_of('\n');
+    if (end != std::string::npos)
+    {
+        auto begin = text.rfind('\n', end);
+        begin = begin == std::string::npos ? 0 : begin + 1;
+        result.message = text.substr(begin, end + 1 - begin);
+    }
+    return result;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Compiles Python source with py_compile on a background thread, in a pkpy VM of its own, to
+// find its first syntax error. Only the latest request counts: a newer request replaces one
+// that has not started yet, and the result of one compiled meanwhile is dropped.
+class SyntaxChecker
+{
+public:
+    // py_switchvm() index of the VM the checks run in; nothing else may use it
+    static const int kVmIndex = 15;
+
+    struct Result
+    {
+        uint64_t document = 0;
+        uint64_t generation = 0;
+        bool ok = true;
+        int line = 0;           // 1-based line of the error
+        std::string message;
+    };
+
+    SyntaxChecker() = default;
+    ~SyntaxChecker();
+
+    SyntaxChecker(const SyntaxChecker&) = delete;
+    SyntaxChecker& operator=(const SyntaxChecker&) = delete;
+
+    // The thread starts with the first request, which must come after py_initialize()
+    void Check(uint64_t document, uint64_t generation, std::string source);
+    // Drops the pending request and the result of the one being compiled
+    void Cancel();
+    // Waits for the compile in progress; later requests are ignored. Must come before
+    // py_finalize().
+    void Stop();
+
+    // The result of the latest request, once, when it is done
+    bool TakeResult(Result& result);
+
+private:
+    struct Request
+    {
+        uint64_t document = 0;
+        uint64_t generation = 0;
+        std::string source;
+    };
+
+    void WorkerThread();
+    static Result Compile(const Request& request);
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    Request m_request;              // pending if m_pending
+    bool m_pending = false;
+    uint64_t m_serial = 0;          // of the latest request or cancellation
+    Result m_result;                // available if m_hasResult
+    bool m_hasResult = false;
+    bool m_quit = false;
+};
@@ -0,0 +1,193 @@
+// Error markers (on 1-based lines) stay on the line they were set for as lines are inserted,
+// removed and joined above, below and around them. ImGui runs headless so that keys can be
+// pressed in the editor.
+
+#include "TextEditor.h"
+#include "imgui.h"
+#include <cstdio>
+#include <functional>
+#include <string>
+
+namespace
+{
+
+int g_failures = 0;
+
+#define CHECK(condition)                                                        \
+    do                                                                          \
+    {                                                                           \
+        if (!(condition))                                                       \
+        {                                                                       \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            ++g_failures;                                                       \
+        }                                                                       \
+    } while (0)
+
+void Frame(TextEditor& editor)
+{
+    ImGui::NewFrame();
+    ImGui::SetNextWindowPos(ImVec2(0, 0));
+    ImGui::SetNextWindowSize(ImGui::GetIO().DisplaySize);
+    ImGui::Begin("test", nullptr, ImGuiWindowFlags_NoDecoration);
+    editor.Render("##editor");
+    ImGui::End();
+    ImGui::Render();
+
+    // Stand-in for a renderer: textures are taken as uploaded
+    for (ImTextureData* texture : ImGui::GetPlatformIO().Textures)
+    {
+        if (texture->Status == ImTextureStatus_WantCreate)
+        {
+            texture->SetTexID((ImTextureID)1);
+            texture->SetStatus(ImTextureStatus_OK);
+        }
+        else if (texture->Status == ImTextureStatus_WantUpdates)
+            texture->SetStatus(ImTextureStatus_OK);
+        else if (texture->Status == ImTextureStatus_WantDestroy)
+        {
+            texture->SetTexID(ImTextureID_Invalid);
+            texture->SetStatus(ImTextureStatus_Destroyed);
+        }
+    }
+}
+
+// Lines "line 0" to "line 9", markers on 1-based lines 3 and 6, and the editor focused
+void Setup(TextEditor& editor)
+{
+    std::string text;
+    for (int i = 0; i < 10; ++i)
+        text += "line " + std::to_string(i) + (i < 9 ? "\n" : "");
+    editor.SetText(text);
+    editor.SetErrorMarkers({ { 3, "three" }, { 6, "six" } });
+
+    ImGuiIO& io = ImGui::GetIO();
+    io.AddMousePosEvent(400.0f, 200.0f);
+    Frame(editor);
+    io.AddMouseButtonEvent(0, true);
+    Frame(editor);
+    io.AddMouseButtonEvent(0, false);
+    Frame(editor);
+}
+
+void PressKey(TextEditor& editor, ImGuiKey key)
+{
+    ImGuiIO& io = ImGui::GetIO();
+    io.AddKeyEvent(key, true);
+    Frame(editor);
+    io.AddKeyEvent(key, false);
+    Frame(editor);
+}
+
+bool HasMarkers(const TextEditor& editor, const TextEditor::ErrorMarkers& expected)
+{
+    auto& markers = editor.GetErrorMarkers();
+    if (markers == expected)
+        return true;
+    printf("  markers:");
+    for (auto& [line, message] : markers)
+        printf(" %d (%s)", line, message.c_str());
+    printf("\n");
+    return false;
+}
+
+// Enter at the end of a marked line leaves the marker there; above it, the marker moves down
+void TestEnter()
+{
+    TextEditor editor;
+    Setup(editor);
+    editor.SetCursorPosition(TextEditor::Coordinates(2, 6));
+    PressKey(editor, ImGuiKey_Enter);
+    CHECK(HasMarkers(editor, { { 3, "three" }, { 7, "six" } }));
+
+    editor.SetCursorPosition(TextEditor::Coordinates(1, 6));
+    PressKey(editor, ImGuiKey_Enter);
+    CHECK(HasMarkers(editor, { { 4, "three" }, { 8, "six" } }));
+}
+
+// Several lines inserted at once, above and below the markers
+void TestInsertLines()
+{
+    TextEditor editor;
+    Setup(editor);
+    editor.SetCursorPosition(TextEditor::Coordinates(0, 0));
+    editor.InsertText("a\nb\nc\n");
+    CHECK(HasMarkers(editor, { { 6, "three" }, { 9, "six" } }));
+
+    editor.SetCursorPosition(TextEditor::Coordinates(7, 0));
+    editor.InsertText("d\ne\n");
+    CHECK(HasMarkers(editor, { { 6, "three" }, { 11, "six" } }));
+}
+
+// A range of lines deleted: the markers below move up by as many lines, and the marker of a
+// line that is gone goes with it
+void TestDeleteRange()
+{
+    TextEditor editor;
+    Setup(editor);
+    editor.SetSelection(TextEditor::Coordinates(0, 0), TextEditor::Coordinates(2, 0));
+    editor.Delete();
+    CHECK(HasMarkers(editor, { { 1, "three" }, { 4, "six" } }));
+
+    editor.SetText("");
+    Setup(editor);
+    editor.SetSelection(TextEditor::Coordinates(1, 0), TextEditor::Coordinates(3, 0));
+    editor.Delete();
+    CHECK(HasMarkers(editor, { { 4, "six" } }));
+
+    // Up to the start of a marked line, which stays
+    editor.SetText("");
+    Setup(editor);
+    editor.SetSelection(TextEditor::Coordinates(3, 0), TextEditor::Coordinates(5, 0));
+    editor.Delete();
+    CHECK(HasMarkers(editor, { { 3, "three" }, { 4, "six" } }));
+}
+
+// Backspace at the start of a line joins it to the line above
+void TestBackspaceJoin()
+{
+    // Below a marked line: that marker stays, the ones further down move up
+    TextEditor editor;
+    Setup(editor);
+    editor.SetCursorPosition(TextEditor::Coordinates(3, 0));
+    PressKey(editor, ImGuiKey_Backspace);
+    CHECK(editor.GetTotalLines() == 9);
+    CHECK(HasMarkers(editor, { { 3, "three" }, { 5, "six" } }));
+
+    // The marked line itself: its marker goes with its text
+    editor.SetCursorPosition(TextEditor::Coordinates(2, 0));
+    PressKey(editor, ImGuiKey_Backspace);
+    CHECK(editor.GetTotalLines() == 8);
+    CHECK(HasMarkers(editor, { { 2, "three" }, { 4, "six" } }));
+
+    // And undone, lines come back below the joined line
+    editor.Undo();
+    CHECK(editor.GetTotalLines() == 9);
+    CHECK(HasMarkers(editor, { { 2, "three" }, { 5, "six" } }));
+}
+
+} // namespace
+
+int main()
+{
+    ImGui::CreateContext();
+    ImGuiIO& io = ImGui::GetIO();
+    io.DisplaySize = ImVec2(1280, 720);
+    io.DeltaTime = 1.0f / 60.0f;
+    io.IniFilename = nullptr;
+    io.Fonts->AddFontDefault();
+    io.BackendFlags |= ImGuiBackendFlags_RendererHasTextures;
+
+    TestEnter();
+    TestInsertLines();
+    TestDeleteRange();
+    TestBackspaceJoin();
+    ImGui::DestroyContext();
+
+    if (g_failures > 0)
+    {
+        printf("%d checks failed\n", g_failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
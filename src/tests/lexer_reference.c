@@ -0,0 +1,77 @@
+// pocketpy is compiled into this file, for the test to reach its lexer
+#include "pocketpy.c"
+#include "lexer_reference.h"
+
+static void push(ReferenceToken* tokens, int capacity, int* count, enum ReferenceKind kind, int begin, int end) {
+    if(*count < capacity) {
+        ReferenceToken token = {kind, begin, end};
+        tokens[*count] = token;
+    }
+    (*count)++;
+}
+
+int reference_lex(const char* source, ReferenceToken* tokens, int capacity, char* error, int error_size) {
+    SourceData_ src = SourceData__rcnew(source, "<test>", EXEC_MODE, false);
+    Token* lexed;
+    int length;
+    Error* err = Lexer__process(src, &lexed, &length);
+    if(err) {
+        snprintf(error, error_size, "line %d: %s", err->lineno, err->msg);
+        PK_DECREF(err->src);
+        PK_FREE(err);
+        PK_DECREF(src);
+        return -1;
+    }
+
+    const char* data = src->source->data;
+    int count = 0;
+    for(int i = 0; i < length; i++) {
+        Token* token = &lexed[i];
+        int begin = (int)(token->start - data);
+        int end = begin + token->length;
+        switch(token->type) {
+            case TK_ID: push(tokens, capacity, &count, REFERENCE_NAME, begin, end); break;
+            case TK_NUM:
+            case TK_IMAG: push(tokens, capacity, &count, REFERENCE_NUMBER, begin, end); break;
+            case TK_STR:
+            case TK_BYTES:
+            case TK_FSTR_BEGIN: push(tokens, capacity, &count, REFERENCE_STRING, begin, end); break;
+            case TK_IS_NOT:
+            case TK_NOT_IN:
+            case TK_YIELD_FROM: {
+                // Two keywords merged into the token of the first
+                push(tokens, capacity, &count, REFERENCE_KEYWORD, begin, end);
+                const char* p = token->start + token->length;
+                while(*p == ' ' || *p == '\t')
+                    p++;
+                const char* second = p;
+                while(isalnum((unsigned char)*p) || *p == '_')
+                    p++;
+                push(tokens, capacity, &count, REFERENCE_KEYWORD, (int)(second - data), (int)(p - data));
+                break;
+            }
+            case TK_EOF:
+            case TK_EOL:
+            case TK_SOF:
+            case TK_INDENT:
+            case TK_DEDENT:
+            case TK_FSTR_CPNT:
+            case TK_FSTR_SPEC:
+            case TK_FSTR_END: break;
+            default:
+                push(tokens,
+                     capacity,
+                     &count,
+                     token->type >= TK_FALSE ? REFERENCE_KEYWORD : REFERENCE_OPERATOR,
+                     begin,
+                     end);
+                break;
+        }
+    }
+    for(int i = 0; i < length; i++) {
+        if(lexed[i].value.index == TokenValue_STR) c11_string__delete(lexed[i].value._str);
+    }
+    PK_FREE(lexed);
+    PK_DECREF(src);
+    return count;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Tokens of pocketpy's own lexer (Lexer__process), for lexer_test.cpp to compare the editor's
+// highlighting lexer with. Only what the highlighter classifies is kept: no indents, line ends
+// or f-string parts besides their prefix.
+enum ReferenceKind {
+    REFERENCE_NAME,
+    REFERENCE_KEYWORD,
+    REFERENCE_NUMBER,
+    REFERENCE_STRING,
+    REFERENCE_OPERATOR,
+};
+
+typedef struct ReferenceToken {
+    enum ReferenceKind kind;
+    int begin;  // byte offsets into the source
+    int end;
+} ReferenceToken;
+
+// Returns the number of tokens, at most capacity of them written, or -1 with the lexer's message
+// in error if the source does not lex. The source must not hold '\r' or a BOM, which the
+// compiler drops before lexing.
+int reference_lex(const char* source, ReferenceToken* tokens, int capacity, char* error, int error_size);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,197 @@
+// Compares the tokens of the editor's highlighting lexer (PythonLexer) with those of pocketpy's
+// own lexer on sample sources, lexed a line at a time as the editor does: every token the
+// compiler reads must be classified the same, and the highlighter must flag an error exactly
+// where the compiler rejects the source.
+
+#include "lexer_reference.h"
+#include "python_lexer.h"
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+int g_failures = 0;
+
+#define CHECK(condition, ...)                                                   \
+    do                                                                          \
+    {                                                                           \
+        if (!(condition))                                                       \
+        {                                                                       \
+            printf("%s:%d: check failed: %s: ", __FILE__, __LINE__, #condition); \
+            printf(__VA_ARGS__);                                                \
+            printf("\n");                                                       \
+            ++g_failures;                                                       \
+        }                                                                       \
+    } while (0)
+
+const char* const kSources[] = {
+    "import math\nfrom os import path as p\n\nx = 1\ny = x + 2 * 3 - 4 / 5 // 6 % 7 ** 8\n",
+    "def f(a, b=3, *args, **kwargs) -> int:\n    return a if a > b else b\n",
+    "class A(object):\n    @property\n    def x(self):\n        pass\n",
+    "a = [1, 2, 3][0:2]\nb = {'k': (1,)}\nc = a[-1]; d = ~b\n",
+    "x += 1; x -= 1; x *= 2; x /= 2; x //= 2; x %= 2\nx &= 1; x |= 1; x ^= 1; x <<= 1; x >>= 1\n",
+    "if a == b and c != d or e <= f >= g < h > i:\n    pass\nelif not a:\n    pass\n",
+    "n = 0x1F + 0o17 + 0b101 + 10 + 1.5 + .5 + 1e5 + 1e-3 + 2.5e+2 + 3j + 1.5j\n",
+    "s = 'single' + \"double\" + r'raw\\d' + b'bytes' + '\\x41\\n\\t\\\\'\n",
+    "t = '''triple\nspanning 'lines'\n  \"\"\" inside\n''' + \"\"\"and\n\"\"\"\n",
+    "u = f'{x} and {y!r} and {z:>10} and {{braces}} and {f\"{w}\"}'\n",
+    "for i in range(10):\n    while i:\n        break\n    continue\n",
+    "try:\n    raise ValueError('x')\nexcept Exception as e:\n    del e\nfinally:\n    pass\n",
+    "with open('f') as f:\n    data = f.read()  # comment\n# whole line\n",
+    "def g():\n    yield from range(3)\n    yield 1\n    global x\n    assert x is not None\n",
+    "ok = a not in b and a is b and a in b and lambda: 0\n",
+    "match = 1\nmatch x:\n    case 1:\n        pass\n",
+    "result = foo(a,\n             b) \\\n    + 1\n",
+    "名字 = 1\nprint(名字)\n",
+    "True, False, None, ..., a.b\n",
+};
+
+// Sources the compiler rejects, each with one error the highlighter flags
+const char* const kErrorSources[] = {
+    "a = $\n",
+    "s = '\\q'\n",
+    "n = 12abc\n",
+    "n = 99999999999999999999999\n",
+    "x = 1 \\ y\n",
+    "x = f'}'\n",
+    "x = a ! b\n",
+    "s = '\\xg1'\n",
+};
+
+// Class of every byte of source as the highlighter sees it, -1 where it reports no token
+std::vector<int> Classify(const std::string& source, bool& error)
+{
+    struct Context
+    {
+        std::vector<int>* classes;
+        int offset;
+        bool error;
+    };
+    std::vector<int> classes(source.size(), -1);
+    Context context{ &classes, 0, false };
+    auto callback = [](void* data, PythonLexer::TokenKind kind, int begin, int end)
+    {
+        auto& context = *static_cast<Context*>(data);
+        if (kind == PythonLexer::TokenKind::Error)
+            context.error = true;
+        for (int i = begin; i < end; ++i)
+            (*context.classes)[context.offset + i] = (int)kind;
+    };
+
+    int state = 0;
+    for (size_t lineStart = 0; lineStart <= source.size(); )
+    {
+        auto lineEnd = source.find('\n', lineStart);
+        if (lineEnd == std::string::npos)
+            lineEnd = source.size();
+        context.offset = (int)lineStart;
+        state = PythonLexer::Lex(source.data() + lineStart, source.data() + lineEnd, state, callback, &context);
+        lineStart = lineEnd + 1;
+    }
+    error = context.error;
+    return classes;
+}
+
+PythonLexer::TokenKind Expected(ReferenceKind kind)
+{
+    switch (kind)
+    {
+    case REFERENCE_NAME: return PythonLexer::TokenKind::Name;
+    case REFERENCE_KEYWORD: return PythonLexer::TokenKind::Keyword;
+    case REFERENCE_NUMBER: return PythonLexer::TokenKind::Number;
+    case REFERENCE_STRING: return PythonLexer::TokenKind::String;
+    case REFERENCE_OPERATOR: return PythonLexer::TokenKind::Operator;
+    }
+    return PythonLexer::TokenKind::Error;
+}
+
+void CompareTokens(const std::string& name, const std::string& source)
+{
+    std::vector<ReferenceToken> tokens(source.size() + 16);
+    char message[600];
+    auto count = reference_lex(source.c_str(), tokens.data(), (int)tokens.size(), message, sizeof(message));
+    CHECK(count >= 0, "%s does not lex: %s", name.c_str(), message);
+    if (count < 0)
+        return;
+    tokens.resize(count);
+
+    bool error;
+    auto classes = Classify(source, error);
+    CHECK(!error, "%s: the highlighter flags an error", name.c_str());
+    for (auto& token : tokens)
+    {
+        auto expected = (int)Expected(token.kind);
+        for (int i = token.begin; i < token.end; ++i)
+        {
+            // Lines are lexed without their line break, which is part of multiline strings
+            if (source[i] == '\n')
+                continue;
+            CHECK(classes[i] == expected, "%s: byte %d of '%.*s' is %d instead of %d",
+                name.c_str(), i - token.begin, token.end - token.begin, source.c_str() + token.begin, classes[i], expected);
+            if (classes[i] != expected)
+                break;
+        }
+    }
+}
+
+void TestSamples()
+{
+    int index = 0;
+    for (auto source : kSources)
+        CompareTokens("sample " + std::to_string(index++), source);
+}
+
+void TestErrors()
+{
+    for (auto source : kErrorSources)
+    {
+        char message[600];
+        ReferenceToken token;
+        CHECK(reference_lex(source, &token, 1, message, sizeof(message)) < 0, "the compiler accepts %s", source);
+        bool error;
+        Classify(source, error);
+        CHECK(error, "the highlighter accepts %s", source);
+    }
+}
+
+// The scripts that come with the IDE
+void TestScripts()
+{
+#ifdef SOURCE_DIR
+    for (auto& entry : std::filesystem::directory_iterator(SOURCE_DIR))
+    {
+        auto path = entry.path();
+        if (path.extension() != ".py")
+            continue;
+        std::ifstream file(path, std::ios::binary);
+        std::stringstream text;
+        text << file.rdbuf();
+        auto source = text.str();
+        source.erase(std::remove(source.begin(), source.end(), '\r'), source.end());
+        CompareTokens(path.filename().string(), source);
+    }
+#endif
+}
+
+} // namespace
+
+int main()
+{
+    TestSamples();
+    TestErrors();
+    TestScripts();
+
+    if (g_failures > 0)
+    {
+        printf("%d checks failed\n", g_failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,140 @@
+// Memory accounting of TextEditor: the bytes held per character of text, and the undo history
+// kept within its budget by dropping its oldest steps.
+
+#include "TextEditor.h"
+#include "imgui.h"
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+int g_failures = 0;
+
+#define CHECK(condition)                                                        \
+    do                                                                          \
+    {                                                                           \
+        if (!(condition))                                                       \
+        {                                                                       \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            ++g_failures;                                                       \
+        }                                                                       \
+    } while (0)
+
+std::string Edit(int index)
+{
+    return "edit " + std::to_string(index) + " " + std::string(200, 'x') + "\n";
+}
+
+// Pasted rather than inserted with InsertText, which leaves no undo step
+void Paste(TextEditor& editor, const std::string& text)
+{
+    ImGui::SetClipboardText(text.c_str());
+    editor.Paste();
+}
+
+// Text and attributes take a byte per character each, on top of a fixed cost per line
+size_t TextMemory(int lines, int length, size_t& characters)
+{
+    std::string text;
+    for (int i = 0; i < lines; ++i)
+    {
+        auto line = "value_" + std::to_string(i) + " = compute(value, " + std::to_string(i * 7) + ")";
+        line.resize(length, ' ');
+        text += line + "\n";
+    }
+    characters = text.size();
+
+    TextEditor editor;
+    editor.SetText(text);
+    return editor.GetMemoryUsage();
+}
+
+void TestTextMemory()
+{
+    const int lines = 20000;
+    size_t shortCharacters, longCharacters;
+    auto shortBytes = TextMemory(lines, 40, shortCharacters);
+    auto longBytes = TextMemory(lines, 200, longCharacters);
+    auto perCharacter = (double)(longBytes - shortBytes) / (longCharacters - shortCharacters);
+    auto perLine = ((double)shortBytes - perCharacter * shortCharacters) / lines;
+    printf("text: %.2f bytes per character, %.0f per line\n", perCharacter, perLine);
+    CHECK(perCharacter >= 2.0);
+    CHECK(perCharacter < 2.5);
+}
+
+// Edits past the budget drop the oldest steps; undoing every step left goes back to the text
+// as it was after the steps that were dropped
+void TestUndoBudget()
+{
+    const size_t budget = 64 * 1024;
+    const int edits = 2000;
+
+    TextEditor editor;
+    editor.SetUndoMemoryBudget(budget);
+    editor.SetText("");
+
+    std::vector<std::string> texts{ editor.GetText() };
+    for (int i = 0; i < edits; ++i)
+    {
+        Paste(editor, Edit(i));
+        texts.push_back(editor.GetText());
+        CHECK(editor.GetUndoMemoryUsage() <= budget);
+    }
+
+    auto kept = editor.GetUndoRecordCount();
+    printf("undo: %d of %d steps kept in %zu of %zu bytes\n", kept, edits, editor.GetUndoMemoryUsage(), budget);
+    CHECK(kept > 1);
+    CHECK(kept < edits);
+
+    editor.Undo(kept);
+    CHECK(!editor.CanUndo());
+    CHECK(editor.GetText() == texts[edits - kept]);
+
+    // Redoing every step still held brings the newest text back
+    editor.Redo(kept);
+    CHECK(editor.GetText() == texts[edits]);
+
+    // A smaller budget drops more of the oldest steps right away
+    editor.SetUndoMemoryBudget(budget / 4);
+    CHECK(editor.GetUndoMemoryUsage() <= budget / 4);
+    auto fewer = editor.GetUndoRecordCount();
+    CHECK(fewer < kept);
+    editor.Undo(fewer);
+    CHECK(!editor.CanUndo());
+    CHECK(editor.GetText() == texts[edits - fewer]);
+}
+
+// The most recent step is kept even if it alone is over the budget
+void TestUndoLargeStep()
+{
+    TextEditor editor;
+    editor.SetUndoMemoryBudget(1024);
+    editor.SetText("");
+    Paste(editor, Edit(0));
+    auto before = editor.GetText();
+    Paste(editor, std::string(8192, 'y'));
+    CHECK(editor.GetUndoRecordCount() == 1);
+    editor.Undo();
+    CHECK(editor.GetText() == before);
+}
+
+} // namespace
+
+int main()
+{
+    ImGui::CreateContext();
+    TestTextMemory();
+    TestUndoBudget();
+    TestUndoLargeStep();
+    ImGui::DestroyContext();
+
+    if (g_failures > 0)
+    {
+        printf("%d checks failed\n", g_failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}